@@ -58,7 +58,7 @@ AtlasMeshPositionCostAndGradientCalculator
   
   
   bool allocateNewMemory = true;
-  if ( m_ThreadSpecificPositionGradients.size() == this->GetNumberOfThreads() )
+  if ( m_ThreadSpecificPositionGradients.size() == this->GetNumberOfAccumulators() )
     {
     if ( m_ThreadSpecificPositionGradients[0]->Size() == mesh->GetPoints()->Size() )
       {
@@ -76,7 +76,7 @@ AtlasMeshPositionCostAndGradientCalculator
       
     // For each thread, create an empty gradient and cost so that
     // different threads never interfere with one another
-    for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+    for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
       {
       // Initialize cost to zero for this thread
       m_ThreadSpecificMinLogLikelihoodTimesPriors.push_back( 0.0 );  
@@ -96,7 +96,7 @@ AtlasMeshPositionCostAndGradientCalculator
   else
     {
     // Simply zero out existing memory  
-    for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+    for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
       {
       m_ThreadSpecificMinLogLikelihoodTimesPriors[ threadNumber ] = 0.0;
         
@@ -124,9 +124,9 @@ AtlasMeshPositionCostAndGradientCalculator
 #if KVL_ENABLE_TIME_PROBE  
   clock.Reset();
   clock.Start();
-  m_ThreadSpecificDataTermRasterizationTimers = std::vector< itk::TimeProbe >( this->GetNumberOfThreads() );
-  m_ThreadSpecificPriorTermRasterizationTimers = std::vector< itk::TimeProbe >( this->GetNumberOfThreads() );
-  m_ThreadSpecificOtherRasterizationTimers = std::vector< itk::TimeProbe >( this->GetNumberOfThreads() );
+  m_ThreadSpecificDataTermRasterizationTimers = std::vector< itk::TimeProbe >( this->GetNumberOfAccumulators() );
+  m_ThreadSpecificPriorTermRasterizationTimers = std::vector< itk::TimeProbe >( this->GetNumberOfAccumulators() );
+  m_ThreadSpecificOtherRasterizationTimers = std::vector< itk::TimeProbe >( this->GetNumberOfAccumulators() );
 #endif  
   Superclass::Rasterize( mesh );
 #if KVL_ENABLE_TIME_PROBE  
@@ -135,7 +135,7 @@ AtlasMeshPositionCostAndGradientCalculator
   double  dataTermRasterizationTime = 0.0;
   double  priorTermRasterizationTime = 0.0;
   double  otherRasterizationTime = 0.0;
-  for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+  for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
     {
     dataTermRasterizationTime += m_ThreadSpecificDataTermRasterizationTimers[ threadNumber ].GetTotal();
     priorTermRasterizationTime += m_ThreadSpecificPriorTermRasterizationTimers[ threadNumber ].GetTotal();
@@ -183,7 +183,7 @@ AtlasMeshPositionCostAndGradientCalculator
     
   // Collect MinLogLikelihoodTimesPrior across all threads
   ThreadAccumDataType totalThreadMinLogLikelihoodTimesPrior = 0;
-  for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+  for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
     {
     const double typedValue = double(m_ThreadSpecificMinLogLikelihoodTimesPriors[ threadNumber ]);
     if ( std::isnan( typedValue ) || std::isinf( typedValue ) )
@@ -200,7 +200,7 @@ AtlasMeshPositionCostAndGradientCalculator
   m_MinLogLikelihoodTimesPrior = totalThreadMinLogLikelihoodTimesPrior;
 
   // Accumulate PositionGradient across all threads
-  for ( int threadNumber = 1; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+  for ( int threadNumber = 1; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
     {
     AtlasPositionGradientThreadAccumContainerType::ConstIterator threadIt = m_ThreadSpecificPositionGradients[ threadNumber ]->Begin();
     AtlasPositionGradientThreadAccumContainerType::Iterator firstThreadIt = m_ThreadSpecificPositionGradients[ 0 ]->Begin();
@@ -8,8 +8,12 @@ static std::mutex rasterizorMutex;
 static itk::SimpleFastMutexLock rasterizorMutex;
 #endif
 
+#include <stdlib.h>
 
 
+static bool  globalDefaultDynamicScheduling = ( getenv( "KVL_DYNAMIC_RASTERIZATION" ) && 
+                                                atoi( getenv( "KVL_DYNAMIC_RASTERIZATION" ) ) != 0 );
+
 
 namespace kvl
 {
@@ -25,6 +29,32 @@ AtlasMeshRasterizor
 #else  
   m_NumberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
 #endif  
+  m_DynamicScheduling = globalDefaultDynamicScheduling;
+  m_NumberOfChunksPerThread = 4;
+}
+
+
+
+//
+//
+//
+void
+AtlasMeshRasterizor
+::SetGlobalDefaultDynamicScheduling( bool dynamicScheduling )
+{
+  globalDefaultDynamicScheduling = dynamicScheduling;
+}
+
+
+
+//
+//
+//
+bool
+AtlasMeshRasterizor
+::GetGlobalDefaultDynamicScheduling()
+{
+  return globalDefaultDynamicScheduling;
 }
 
 
@@ -51,6 +81,21 @@ AtlasMeshRasterizor
       }
     }
 
+  // In dynamic mode, cut the work into chunks and give each thread a contiguous run of them
+  str.m_Abort = false;
+  if ( m_DynamicScheduling )
+    {
+    this->SplitIntoChunks( mesh, str, this->GetNumberOfAccumulators() );
+    const int  numberOfChunks = str.m_ChunkStarts.size() - 1;
+    str.m_ChunkQueues = std::vector< std::atomic< uint64_t > >( this->GetNumberOfThreads() );
+    for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+      {
+      const uint64_t  head = static_cast< uint64_t >( threadNumber ) * numberOfChunks / this->GetNumberOfThreads();
+      const uint64_t  tail = static_cast< uint64_t >( threadNumber + 1 ) * numberOfChunks / this->GetNumberOfThreads();
+      str.m_ChunkQueues[ threadNumber ] = head | ( tail << 32 );
+      }
+    }
+
   // Set up the multithreader
 #if ITK_VERSION_MAJOR >= 5
   itk::MultiThreaderBase::Pointer  threader = itk::MultiThreaderBase::New();
@@ -97,6 +142,35 @@ AtlasMeshRasterizor
 #endif  
 
   
+  if ( !str->m_ChunkStarts.empty() )
+    {
+    // Dynamic scheduling. The chunk number, not the thread number, selects the
+    // accumulator, so the sums don't depend on which thread ran which chunk
+    int  chunkNumber;
+    while ( !str->m_Abort && ( ( chunkNumber = GetNextChunk( str, threadNumber ) ) >= 0 ) )
+      {
+      for ( int tetrahedronNumber = str->m_ChunkStarts[ chunkNumber ];
+            tetrahedronNumber < str->m_ChunkStarts[ chunkNumber + 1 ];
+            tetrahedronNumber++ )
+        {
+        if ( !str->m_Rasterizor->RasterizeTetrahedron( str->m_Mesh, 
+                                                       str->m_TetrahedronIds[ tetrahedronNumber ],
+                                                       chunkNumber ) )
+          {
+          // Something wrong with this tetrahedron; make all threads stop ASAP
+          str->m_Abort = true;
+          break;
+          }
+        }
+      }
+      
+#if ITK_VERSION_MAJOR >= 5
+    return itk::ITK_THREAD_RETURN_DEFAULT_VALUE;
+#else  
+    return ITK_THREAD_RETURN_VALUE;
+#endif  
+    }
+  
 #if 1  
   // Compute up-front which tetrahedra this thread should be responsible for. This isn't a 
   // particularly good way of load-balancing, but it does allow us to get the exact same
@@ -207,5 +281,91 @@ AtlasMeshRasterizor
 
 
 
+//
+//
+//
+void
+AtlasMeshRasterizor
+::SplitIntoChunks( const AtlasMesh* mesh, ThreadStruct& str, int numberOfChunks )
+{
+  // Estimate the cost of each tetrahedron by the number of voxels in its bounding box, 
+  // plus a fixed amount for setting it up
+  const int  numberOfTetrahedra = str.m_TetrahedronIds.size();
+  std::vector< double >  cumulativeCosts( numberOfTetrahedra + 1, 0.0 );
+  for ( int tetrahedronNumber = 0; tetrahedronNumber < numberOfTetrahedra; tetrahedronNumber++ )
+    {
+    const AtlasMesh::CellType*  cell = mesh->GetCells()->ElementAt( str.m_TetrahedronIds[ tetrahedronNumber ] );
+    AtlasMesh::CellType::PointIdConstIterator  pit = cell->PointIdsBegin();
+    AtlasMesh::PointType  lower = mesh->GetPoints()->ElementAt( *pit );
+    AtlasMesh::PointType  upper = lower;
+    for ( ++pit; pit != cell->PointIdsEnd(); ++pit )
+      {
+      const AtlasMesh::PointType&  p = mesh->GetPoints()->ElementAt( *pit );
+      for ( int i = 0; i < 3; i++ )
+        {
+        lower[ i ] = std::min( lower[ i ], p[ i ] );
+        upper[ i ] = std::max( upper[ i ], p[ i ] );
+        }
+      }
+    const double  boundingBoxVolume = ( upper[ 0 ] - lower[ 0 ] + 1 ) * 
+                                      ( upper[ 1 ] - lower[ 1 ] + 1 ) * 
+                                      ( upper[ 2 ] - lower[ 2 ] + 1 );
+    cumulativeCosts[ tetrahedronNumber + 1 ] = cumulativeCosts[ tetrahedronNumber ] + boundingBoxVolume + 8.0;
+    }
+
+  // Cut the list, in its original order, where the cumulative cost crosses each multiple
+  // of the average chunk cost. This only depends on the mesh, never on the timing
+  str.m_ChunkStarts.assign( numberOfChunks + 1, numberOfTetrahedra );
+  str.m_ChunkStarts[ 0 ] = 0;
+  int  tetrahedronNumber = 0;
+  for ( int chunkNumber = 1; chunkNumber < numberOfChunks; chunkNumber++ )
+    {
+    const double  target = cumulativeCosts[ numberOfTetrahedra ] * chunkNumber / numberOfChunks;
+    while ( ( tetrahedronNumber < numberOfTetrahedra ) && ( cumulativeCosts[ tetrahedronNumber ] < target ) )
+      {
+      tetrahedronNumber++;
+      }
+    str.m_ChunkStarts[ chunkNumber ] = tetrahedronNumber;
+    }
+}
+
+
+
+//
+//
+//
+int
+AtlasMeshRasterizor
+::GetNextChunk( ThreadStruct* str, int threadNumber )
+{
+  // Take from the front of our own queue, then steal from the back of the others'.
+  // Queues only ever shrink, so once a full pass finds nothing we are done
+  const int  numberOfQueues = str->m_ChunkQueues.size();
+  for ( int i = 0; i < numberOfQueues; i++ )
+    {
+    const bool  own = ( i == 0 );
+    std::atomic< uint64_t >&  queue = str->m_ChunkQueues[ ( threadNumber + i ) % numberOfQueues ];
+    uint64_t  current = queue.load();
+    while ( true )
+      {
+      const uint64_t  head = current & 0xffffffff;
+      const uint64_t  tail = current >> 32;
+      if ( head >= tail )
+        {
+        break;
+        }
+      const uint64_t  next = own ? ( ( head + 1 ) | ( tail << 32 ) ) : ( head | ( ( tail - 1 ) << 32 ) );
+      if ( queue.compare_exchange_weak( current, next ) )
+        {
+        return own ? head : tail - 1;
+        }
+      }
+    }
+
+  return -1;
+}
+
+
+
 } // end namespace kvl
 
@@ -3,6 +3,10 @@
 
 #include "kvlAtlasMesh.h"
 
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+
 
 /*
   If defined, this enables complete reproducibility across
@@ -55,11 +59,52 @@ public:
     return m_NumberOfThreads;
     }
 
+  /** In dynamic mode the tetrahedra are cut into chunks of roughly equal
+   * cost (estimated from their bounding-box volume), and threads that run
+   * out of chunks steal them from the others. Results stay reproducible
+   * because every chunk accumulates into its own slot, whichever thread
+   * runs it, and subclasses combine the slots in a fixed order. The price
+   * is GetNumberOfAccumulators() slots instead of one per thread. */
+  void SetDynamicScheduling( bool dynamicScheduling )
+    {
+    m_DynamicScheduling = dynamicScheduling;
+    }
+
+  /** */
+  bool GetDynamicScheduling() const
+    {
+    return m_DynamicScheduling;
+    }
+
+  /** */
+  void SetNumberOfChunksPerThread( int numberOfChunksPerThread )
+    {
+    m_NumberOfChunksPerThread = std::max( numberOfChunksPerThread, 1 );
+    }
+
+  /** */
+  int GetNumberOfChunksPerThread() const
+    {
+    return m_NumberOfChunksPerThread;
+    }
+
+  /** Number of thread-specific accumulators subclasses must provide; the
+   * last argument of RasterizeTetrahedron() is always smaller than this */
+  int GetNumberOfAccumulators() const
+    {
+    return m_DynamicScheduling ? m_NumberOfThreads * m_NumberOfChunksPerThread : m_NumberOfThreads;
+    }
+
+  /** Default for new rasterizors; initially on if the environment variable
+   * KVL_DYNAMIC_RASTERIZATION is set to a non-zero value */
+  static void SetGlobalDefaultDynamicScheduling( bool dynamicScheduling );
+  static bool GetGlobalDefaultDynamicScheduling();
+
 protected:
   AtlasMeshRasterizor();
   virtual ~AtlasMeshRasterizor() {};
 
-  /** */
+  /** threadNumber is really the accumulator to add to, in [ 0, GetNumberOfAccumulators() ) */
   //
   virtual bool RasterizeTetrahedron( const AtlasMesh* mesh, 
                                      AtlasMesh::CellIdentifier tetrahedronId,
@@ -81,8 +126,18 @@ protected:
     AtlasMesh::ConstPointer  m_Mesh;
     std::vector< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
     //std::set< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
+
+    // Dynamic scheduling only: chunk c is m_TetrahedronIds[ m_ChunkStarts[c] ... m_ChunkStarts[c+1] ),
+    // and thread t's queue holds the chunks [ head, tail ) packed in m_ChunkQueues[t]
+    std::vector< int >  m_ChunkStarts;
+    std::vector< std::atomic< uint64_t > >  m_ChunkQueues;
+    std::atomic< bool >  m_Abort;
     };
 
+  /** */
+  static void SplitIntoChunks( const AtlasMesh* mesh, ThreadStruct& str, int numberOfChunks );
+  static int  GetNextChunk( ThreadStruct* str, int threadNumber );
+
                                      
 
 private:
@@ -90,6 +145,8 @@ private:
   void operator=(const Self&); //purposely not implemented
   
   int  m_NumberOfThreads;
+  bool  m_DynamicScheduling;
+  int  m_NumberOfChunksPerThread;
   
 };
 
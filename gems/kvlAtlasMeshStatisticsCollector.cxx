@@ -49,7 +49,7 @@ AtlasMeshStatisticsCollector
   const int  numberOfClasses = mesh->GetPointData()->Begin().Value().m_Alphas.Size();
   AtlasAlphasType  zeroEntry( numberOfClasses );
   zeroEntry.Fill( 0.0f );
-  for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+  for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
     {
     // Initialize cost to zero for this thread
     m_ThreadSpecificMinLogLikelihoods.push_back( 0.0 );  
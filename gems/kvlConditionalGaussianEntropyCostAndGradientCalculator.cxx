@@ -74,7 +74,7 @@ ConditionalGaussianEntropyCostAndGradientCalculator
   const bool  memoryAlreadyAllocated = ( m_ThreadSpecificNs.size() > 0 );
   //std::cout << "memoryAlreadyAllocated: " << memoryAlreadyAllocated << std::endl;
     
-  for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+  for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
     {
     if ( !m_OnlyDeformationPrior )
       {
@@ -226,7 +226,7 @@ ConditionalGaussianEntropyCostAndGradientCalculator
     {
 
     // Accumulate prior cost over threads
-    for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+    for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
       {
       // Cost
       const double typedPriorCost = double(m_ThreadSpecificPriorCosts[ threadNumber ]);
@@ -240,7 +240,7 @@ ConditionalGaussianEntropyCostAndGradientCalculator
       } // End loop over threads
 
     // Accumulate prior gradients over threads
-    for ( int threadNumber = 1; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+    for ( int threadNumber = 1; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
       {
       // Gradient
       AtlasPositionGradientThreadAccumContainerType::ConstIterator threadIt =  m_ThreadSpecificPriorGradients[ threadNumber ]->Begin();
@@ -282,7 +282,7 @@ ConditionalGaussianEntropyCostAndGradientCalculator
       ThreadAccumDataType tN = 1e-15;
       ThreadAccumDataType tL = 0.0;
       ThreadAccumDataType tQ = 0.0;
-      for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+      for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
         {
         //
         tN += ( m_ThreadSpecificNs[ threadNumber ] )[ classNumber ];
@@ -333,7 +333,7 @@ ConditionalGaussianEntropyCostAndGradientCalculator
       ThreadAccumDataType tN = 1e-15;
       ThreadAccumDataType tL = 0.0;
       ThreadAccumDataType tQ = 0.0;
-      for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+      for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
         {
         //
         tN += ( m_ThreadSpecificNs[ threadNumber ] )[ classNumber ];
@@ -374,7 +374,7 @@ ConditionalGaussianEntropyCostAndGradientCalculator
       // Accumulate the gradients over all threads
       // TODO: Make a template function that does thread accumulation
       // to avoid this ugliness.
-      for ( int threadNumber = 1; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+      for ( int threadNumber = 1; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
         {
         AtlasPositionGradientThreadAccumContainerType::ConstIterator  NGradientIt = ( m_ThreadSpecificNGradients[ threadNumber ] )[ classNumber ]->Begin();
         AtlasPositionGradientThreadAccumContainerType::ConstIterator  LGradientIt = ( m_ThreadSpecificLGradients[ threadNumber ] )[ classNumber ]->Begin();
@@ -226,7 +226,7 @@ Histogrammer
 
   // For each thread, create an empty histogram and cost so that
   // different threads never interfere with one another
-  for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
+  for ( int threadNumber = 0; threadNumber < this->GetNumberOfAccumulators(); threadNumber++ )
     {
     // Initialize cost to zero for this thread
     m_ThreadSpecificMinLogLikelihoods.push_back( 0.0 );  
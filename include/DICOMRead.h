@@ -63,6 +63,7 @@ typedef unsigned short int BOOL;
 #ifdef _DICOMRead_SRC
 char *SDCMStatusFile = 0;
 char *SDCMListFile = 0;
+char *SDCMIndexFile = 0; // index kept by ScanSiemensDCMDir()
 int  UseDICOMRead2 = 1; // use new dicom reader by default
 int  UseDCM2NIIX = 1; // changed to 1 on 4/06/2023
 const char *DCM2NIIX_outdir = NULL;
@@ -81,6 +82,7 @@ int AutoSliceResElTag = 0; // automatically determine which tag to use based on
 #else
 extern char *SDCMStatusFile;
 extern char *SDCMListFile;
+extern char *SDCMIndexFile;
 extern int  UseDICOMRead2;
 extern int  UseDCM2NIIX;
 extern const char *DCM2NIIX_outdir;
@@ -29,3 +29,18 @@ void MRISrigidBodyAlignGlobal_findMinSSE(
     float               max_radians,
     double              ext_sse,
     int                 nangles);
+
+// Correlates the spherical harmonic expansions, up to degree bandwidth, of the subject's field and
+// the template over all of SO(3), takes the best rotation whose angles are within max_radians, and
+// refines it with the grid search above over a small window around it.
+// Same inputs and outputs as MRISrigidBodyAlignGlobal_findMinSSE.
+//
+void MRISrigidBodyAlignGlobal_findMinSSE_SO3(
+    double* mina, double* new_minb, double* new_ming, double* new_sse,  // outputs
+    MRI_SURFACE*        mris,
+    INTEGRATION_PARMS*  parms,
+    float               min_radians,
+    float               max_radians,
+    double              ext_sse,
+    int                 nangles,
+    int                 bandwidth);
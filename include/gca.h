@@ -222,6 +222,7 @@ typedef struct
   int          total_training ;
   int          max_label ;
   COLOR_TABLE  *ct ;
+  struct GCA_PACKED *packed ;   // non-NULL if nodes/priors live in packed blocks (see gcapacked.h)
 }
 GAUSSIAN_CLASSIFIER_ARRAY, GCA ;
 
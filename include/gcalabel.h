@@ -0,0 +1,36 @@
+/**
+ * @brief vectorized, multithreaded MAP labeling with a GCA
+ *
+ * Fast paths for GCAlabel() and GCAlabelProbabilities().  The per-class
+ * inverse covariances and log-determinants are computed once per call,
+ * the candidate labels of a whole row of voxels are evaluated as one
+ * SIMD-friendly batch, and rows are distributed over threads.  The
+ * arithmetic is done in the same order and precision as the reference
+ * (per-voxel) code, so the output is bit-identical to it.
+ *
+ * Set FS_GCA_LABEL_REFERENCE in the environment to force the original
+ * serial code instead (e.g. to compare the two).
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef GCALABEL_H
+#define GCALABEL_H
+
+#include "gca.h"
+
+int  GCAlabelUseReference(void) ;
+MRI  *GCAlabelVectorized(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
+MRI  *GCAlabelProbabilitiesVectorized(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
+
+#endif
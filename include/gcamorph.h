@@ -134,6 +134,30 @@ typedef struct
 }
 GCA_MORPH_NODE, GMN ;
 
+/* structure-of-arrays copies of the node fields read by the neighborhood
+   terms (smoothness, jacobian). A node is ~200 bytes, so visiting the 26
+   neighbors of every node through nodes[x][y][z] drags whole nodes through
+   the cache for a few doubles each. The planes are filled from the nodes by
+   GCAMloadSoa() and stay current across calls: the integration step
+   (gcamApplyGradient, gcamUndoGradient, gcamComputeMetricProperties) writes
+   through to them, and everything else that moves nodes or changes their
+   areas or validity calls GCAMinvalidateSoa(). Code that writes those node
+   fields directly must call it too; the GCAMregister* entry points do so
+   on entry. */
+typedef struct GCAM_SOA
+{
+  int     width, height, depth ;
+  int     valid ;   // planes match the nodes, see GCAMinvalidateSoa()
+  double  *x, *y, *z ;
+  double  *origx, *origy, *origz ;
+  float   *area, *area1, *area2 ;
+  float   *orig_area, *orig_area1, *orig_area2 ;
+  char    *invalid ;
+}
+GCAM_SOA ;
+
+#define GCAM_SOA_INDEX(soa, x, y, z) ((((size_t)(x) * (soa)->height) + (y)) * (soa)->depth + (z))
+
 struct GCA_MORPH
 {
   int  width, height ,depth ;
@@ -153,6 +177,7 @@ struct GCA_MORPH
   MATRIX   *m_affine ;         // affine transform to initialize with
   double   det ;               // determinant of affine transform
   void    *vgcam_ms ; // Not saved.
+  GCAM_SOA *soa ;     // Not saved. hot node fields, see GCAMloadSoa()
 };
 
 typedef GCA_MORPH GCAM;
@@ -318,6 +343,9 @@ GCA_MORPH *GCAMreadAndInvert(const char *gcamfname);
 GCA_MORPH *GCAMreadAndInvertNonTal(const char *gcamfname);
 int       GCAMfree(GCA_MORPH **pgcam) ;
 int       GCAMfreeContents(GCA_MORPH *gcam) ;
+GCAM_SOA  *GCAMloadSoa(GCA_MORPH *gcam) ;
+int       GCAMinvalidateSoa(GCA_MORPH *gcam) ;
+int       GCAMfreeSoa(GCA_MORPH *gcam) ;
 
 MRI       *GCAMmorphFromAtlas(MRI *mri_src, GCA_MORPH *gcam, MRI *mri_dst, int sample_type) ;
 int GCAMmorphPlistFromAtlas(int N, float *points_in, GCA_MORPH *gcam, float *points_out) ;
@@ -614,7 +642,6 @@ double MRIlabelMorphSSE(MRI *mri_source, MRI *mri_atlas, MRI *mri_morph) ;
 			       double *pdz );
 
   int gcamJacobianTerm( GCA_MORPH *gcam, 
-			const MRI *mri, 
 			double l_jacobian, 
 			double ratio_thresh );
 
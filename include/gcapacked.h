@@ -0,0 +1,119 @@
+/**
+ * @brief flat, structure-of-arrays storage for GCA atlases
+ *
+ * A packed GCA keeps every node, GC1D and prior in a handful of contiguous
+ * arrays indexed by node (or prior) offset, instead of the millions of small
+ * allocations made by GCAread().  The on-disk form (.gcap) is laid out so it
+ * can be mmap'd directly: pages are mapped copy-on-write, so processes that
+ * only read the atlas share one physical copy of it.
+ *
+ * The usual GCA_NODE/GCA_PRIOR/GC1D structures are still built on load, but
+ * all of their arrays point into the packed blocks, so existing callers work
+ * unchanged. New code can index the blocks directly with the inline helpers
+ * below.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef GCAPACKED_H
+#define GCAPACKED_H
+
+#include <stdint.h>
+
+#include "gca.h"
+
+#define GCA_PACKED_MAGIC      "GCAPACK1"
+#define GCA_PACKED_VERSION    2
+#define GCA_PACKED_ALIGN      64   // every block starts on a cache line
+
+typedef struct GCA_PACKED
+{
+  int      ninputs ;
+  int      ncovars ;          // ninputs*(ninputs+1)/2 (upper triangle)
+  int      gibbs ;            // 0 if the atlas has no MRF (GCA_NO_MRF)
+  int64_t  nnodes ;           // node_width*node_height*node_depth
+  int64_t  npriors ;          // prior_width*prior_height*prior_depth
+  int64_t  ngcs ;             // total # of GC1Ds over all nodes
+  int64_t  ngibbs ;           // total # of gibbs (nbr label, prior) pairs
+  int64_t  nprior_labels ;    // total # of (label, prior) pairs
+
+  /* nodes - node n owns GC1Ds [node_offsets[n], node_offsets[n+1]) */
+  int64_t        *node_offsets ;        // nnodes+1
+  int            *node_total_training ; // nnodes
+
+  /* GC1Ds, indexed by g in [0, ngcs) */
+  unsigned short *gc_labels ;           // ngcs
+  float          *means ;               // ngcs*ninputs
+  float          *covars ;              // ngcs*ncovars
+  int            *gc_ntraining ;        // ngcs
+
+  /* gibbs priors - direction d of GC1D g owns
+     [gibbs_offsets[g*GIBBS_NEIGHBORS+d], gibbs_offsets[g*GIBBS_NEIGHBORS+d+1]) */
+  short          *gibbs_nlabels ;       // ngcs*GIBBS_NEIGHBORS
+  int64_t        *gibbs_offsets ;       // ngcs*GIBBS_NEIGHBORS+1
+  unsigned short *gibbs_labels ;        // ngibbs
+  float          *gibbs_priors ;        // ngibbs
+
+  /* priors - prior p owns [prior_offsets[p], prior_offsets[p+1]) */
+  int64_t        *prior_offsets ;       // npriors+1
+  int            *prior_total_training ;// npriors
+  unsigned short *prior_labels ;        // nprior_labels
+  float          *prior_priors ;        // nprior_labels
+
+  /* GCA_NODE/GCA_PRIOR/GC1D views into the blocks above */
+  GCA_NODE       *node_arena ;
+  GCA_NODE      **node_rows ;
+  GCA_PRIOR      *prior_arena ;
+  GCA_PRIOR     **prior_rows ;
+  GC1D           *gc_arena ;
+  unsigned short **gibbs_label_ptrs ;
+  float          **gibbs_prior_ptrs ;
+
+  void    *map ;              // start of the mapping, NULL if not mapped
+  size_t   map_size ;
+}
+GCA_PACKED ;
+
+int  GCApackedIsFile(const char *fname) ;
+GCA  *GCApackedRead(const char *fname) ;
+int  GCApackedWrite(GCA *gca, const char *fname) ;
+int  GCApackedFree(GCA *gca) ;
+int  GCApackedReleaseGibbs(GCA *gca) ;
+
+/* direct accessors for code that wants to skip the GCA_NODE views */
+static inline int64_t GCApackedNodeIndex(const GCA *gca, int xn, int yn, int zn)
+{
+  return (((int64_t)xn * gca->node_height) + yn) * gca->node_depth + zn ;
+}
+static inline int64_t GCApackedPriorIndex(const GCA *gca, int xp, int yp, int zp)
+{
+  return (((int64_t)xp * gca->prior_height) + yp) * gca->prior_depth + zp ;
+}
+static inline int GCApackedNodeNlabels(const GCA_PACKED *gcap, int64_t node)
+{
+  return (int)(gcap->node_offsets[node + 1] - gcap->node_offsets[node]) ;
+}
+static inline const float *GCApackedMeans(const GCA_PACKED *gcap, int64_t gc)
+{
+  return gcap->means + gc * gcap->ninputs ;
+}
+static inline const float *GCApackedCovars(const GCA_PACKED *gcap, int64_t gc)
+{
+  return gcap->covars + gc * gcap->ncovars ;
+}
+static inline int GCApackedPriorNlabels(const GCA_PACKED *gcap, int64_t prior)
+{
+  return (int)(gcap->prior_offsets[prior + 1] - gcap->prior_offsets[prior]) ;
+}
+
+#endif
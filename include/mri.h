@@ -549,6 +549,8 @@ public:
   bool owndata = true;          // indicates ownership of the chunked buffer data
   BUFTYPE ***slices = nullptr;  // fallback non-contiguous storage for 3D-indexed image data
   void *chunk = nullptr;        // default contiguous storage for image data
+  void *chunk_map = nullptr;    // file mapping that chunk points into (see mghReadEx), if any
+  size_t chunk_map_size = 0;    // size of the file mapping
 };
 
 
@@ -1618,6 +1620,7 @@ void mriio_set_gdf_crop_flag(int new_gdf_crop_flag);
 int MRIgetVolumeName(const char *string, char *name_only);
 MRI *MRIread(const char *fname, std::vector<MRI*> *mriVector=NULL);
 MRI *MRIreadEx(const char *fname, int nthframe);
+MRI *MRIreadFrameSlab(const char *fname, int start_frame, int end_frame, int start_slice, int end_slice);
 MRI *MRIreadType(const char *fname, int type);
 MRI *MRIreadInfo(const char *fname);
 MRI *MRIreadHeader(const char *fname, int type);
@@ -1745,6 +1748,7 @@ MATRIX *GetSurfaceRASToVoxelMatrix(VOL_GEOM *mri);
 
 // functions read/write MRI_MGH_FILE
 MRI *mghRead(const char *fname, int read_volume=TRUE, int frame=-1);
+MRI *mghReadEx(const char *fname, int read_volume, int start_frame, int end_frame, int start_slice, int end_slice);
 int mghWrite(MRI *mri, const char *fname, int frame=-1);
 
 /* Zero-padding for 3d analyze (ie, spm) format */
@@ -0,0 +1,76 @@
+/**
+ * @brief one-pass segmentation statistics engine behind mri_segstats
+ *
+ * MRIsegStats(), MRIsegStatsRobust(), MRIsegFrameAvg() and MRIsegCount()
+ * scan the whole segmentation for every id they are asked about, which makes
+ * a run over all the labels of an aparc+aseg O(nsegids x nvoxels x nframes).
+ * An MRI_SEGINDEX is built with a single pass over the segmentation: it
+ * groups the voxels of each id, in the column/row/slice order the reference
+ * loops visit them.  The statistics of an id are then computed from its own
+ * voxels only, so a run over all the ids visits each voxel once, and the ids
+ * can be handled by different threads without any reduction.
+ * MRIsegIndexPVVolumes() does the same for the partial-volume corrected
+ * volumes of MRIvoxelsInLabelWithPartialVolumeEffects(), visiting each
+ * border voxel once for all the labels it borders.
+ *
+ * Since each id still sees its voxels in the same order, the sums, minima,
+ * maxima and sorted lists are exactly those of the reference functions.
+ *
+ * Set FS_MRI_SEGSTATS_REFERENCE in the environment to always use the
+ * original functions (e.g. to compare the two).
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRISEGSTATS_H
+#define MRISEGSTATS_H
+
+#include "mri.h"
+
+typedef struct
+{
+  int width, height, depth ;  // of the segmentation
+  int nsegs ;                 // number of distinct ids indexed
+  int *segids ;               // the ids, in increasing order
+  int *offset ;               // voxels of segids[k] are voxels[offset[k]] ... voxels[offset[k+1]-1]
+  int *voxels ;               // s + depth*(r + height*c), in increasing order within each id
+} MRI_SEGINDEX ;
+
+int  MRIsegStatsUseReference(void) ;
+
+/* indexes the voxels of seg (frame 0) whose id is one of the nsegids
+   segids.  Returns NULL if the volume is too large to be indexed. */
+MRI_SEGINDEX *MRIsegIndexAlloc(MRI *seg, const int *segids, int nsegids) ;
+int  MRIsegIndexFree(MRI_SEGINDEX **psi) ;
+
+/* position k of segid in si->segids, -1 if it was not indexed */
+int  MRIsegIndexFind(const MRI_SEGINDEX *si, int segid) ;
+
+/* same results as MRIsegCount(seg, segid, 0), MRIsegStats(),
+   MRIsegStatsRobust() and MRIsegFrameAvg() for the segmentation
+   the index was built from */
+int  MRIsegIndexCount(const MRI_SEGINDEX *si, int segid) ;
+int  MRIsegIndexStats(const MRI_SEGINDEX *si, int segid, MRI *mri, int frame,
+                      float *min, float *max, float *range, float *mean, float *std) ;
+int  MRIsegIndexStatsRobust(const MRI_SEGINDEX *si, int segid, MRI *mri, int frame,
+                            float *min, float *max, float *range, float *mean, float *std,
+                            float Pct) ;
+int  MRIsegIndexFrameAvg(const MRI_SEGINDEX *si, int segid, MRI *mri, double *favg) ;
+
+/* vols[k] = MRIvoxelsInLabelWithPartialVolumeEffects(seg, mri_vals,
+   si->segids[k], NULL, NULL) for all the indexed ids.  Returns
+   ERROR_UNSUPPORTED (vols untouched) when seg has labels that function
+   can not handle, in which case the caller must call it instead. */
+int  MRIsegIndexPVVolumes(const MRI_SEGINDEX *si, MRI *seg, MRI *mri_vals, float *vols) ;
+
+#endif
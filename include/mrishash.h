@@ -120,6 +120,23 @@ void MHT_maybeParallel_end();
 int  MHTwhich(MRIS_HASH_TABLE const * mht);
 void MHTfree(MRIS_HASH_TABLE**mht);
 
+// Lock-free, read-only snapshot
+//
+// MHTfreeze compacts the table into an immutable snapshot: a sorted list of the occupied buckets,
+// one flat (CSR) array of their face or vertex numbers, and an open-addressing index over the buckets.
+// While frozen, every query reads only the snapshot and takes no locks, so queries can be run from any
+// number of threads without MHT_maybeParallel_{begin,end}().
+//
+// Adds and removes still update the underlying table, but queries only see them after MHTrefreeze,
+// which rebuilds just the buckets that were touched.  MHTrefreezeVertices does the same for a vertex
+// table after the given vertices have moved.  Neither may run while other threads are querying.
+//
+void MHTfreeze          (MRIS_HASH_TABLE *mht);
+void MHTrefreeze        (MRIS_HASH_TABLE *mht);
+void MHTrefreezeVertices(MRIS_HASH_TABLE *mht, int const *vnos, int nvnos);
+void MHTthaw            (MRIS_HASH_TABLE *mht);
+int  MHTisFrozen        (MRIS_HASH_TABLE const *mht);
+
 // Support multiple representations
 //
 #define MHT_VIRTUAL                 
@@ -45,6 +45,7 @@ typedef struct MRIS_HASH_BUCKET
     int              const max_bins ;
     int                    nused ;
     int                    size, ysize, zsize ;
+    bool                   frozen ;     // part of an immutable snapshot, never locked
 } MHBT ;
 
 
@@ -833,6 +833,7 @@ int          MRISrigidBodyAlignGlobal(MRI_SURFACE *mris,
                                       float min_degrees,
                                       float max_degrees,
                                       int nangles) ;
+int          MRISsetRigidBodyAlignSO3(int bandwidth) ;
 MRI_SURFACE  *MRISunfoldOnSphere(MRI_SURFACE *mris,
                                  INTEGRATION_PARMS *parms,
                                  int max_passes);
@@ -1619,11 +1620,24 @@ int   MRISnormalize(MRI_SURFACE *mris, int dof, int which) ;
 int  MRIScopyMRI(MRIS *Surf, MRI *Src, int Frame, const char *Field);
 MRI *MRIcopyMRIS(MRI *mri, MRIS *surf, int Frame, const char *Field);
 
+// One step of the nearest-neighbour smoothing done by MRISsmoothMRIFast(),
+// as a CSR matrix; see MRISsmoothOpAlloc()
+typedef struct
+{
+  int nvertices ;
+  int nnz ;
+  int *rowptr ;   // nvertices+1, row vno is col[rowptr[vno]..rowptr[vno+1]-1]
+  int *col ;      // vno itself first, then its unripped, in-mask neighbours
+} MRIS_SMOOTH_OP ;
+
 MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI *Targ);
 MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask,  MRI *Targ);
 MRI *MRISsmoothMRIFastD(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask,  MRI *Targ);
 int MRISsmoothMRIFastCheck(int nSmoothSteps);
 int MRISsmoothMRIFastFrame(MRIS *Surf, MRI *Src, int frame, int nSmoothSteps, MRI *IncMask);
+MRIS_SMOOTH_OP *MRISsmoothOpAlloc(MRIS *Surf, MRI *IncMask);
+void MRISsmoothOpFree(MRIS_SMOOTH_OP **pop);
+MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *Src, int nSmoothSteps, MRI *Targ);
 
 
 int  MRISclearFlags(MRI_SURFACE *mris, int flags) ;
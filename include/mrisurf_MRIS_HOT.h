@@ -0,0 +1,91 @@
+#pragma once
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include "mrisurf_aaa.h"
+
+// The hot part of the vertices for the gradient terms of MRISpositionSurface
+//
+// A VERTEX is several hundred bytes, and the averaging of the gradient and the
+// spring terms only read the position, the normal, the gradient and three flags
+// of a vertex and of its neighbors, so each neighbor they visit costs them a few
+// cache lines of which they use a few bytes.  MRIS_HOT keeps just these
+// properties, one array per property, loaded once per iteration.
+//
+// The MRISHOT_ terms do the same float operations in the same order as the mris
+// versions, so they give the same gradient.  MRISpositionSurface copies the
+// gradient back to the MRIS before any term that only has an MRIS version.
+// Set FS_MRIS_HOT_REFERENCE to use the MRIS versions throughout.
+//
+#define SEP
+#define ELTX(C,T,N) ELT(C,T,N)
+
+#define ELT(C,T,N) C T * v_##N;
+
+  // In
+  #define MRIS_HOT__LIST_V_IN             \
+    ELT(const,  float,  x       ) SEP     \
+    ELT(const,  float,  y       ) SEP     \
+    ELT(const,  float,  z       ) SEP     \
+    ELT(const,  float,  nx      ) SEP     \
+    ELT(const,  float,  ny      ) SEP     \
+    ELT(const,  float,  nz      ) SEP     \
+    ELT(const,  char,   border  ) SEP     \
+    ELT(const,  char,   neg     ) SEP     \
+    ELT(const,  char,   ripflag )
+
+  // In out
+  #define MRIS_HOT__LIST_V_IN_OUT         \
+    ELT(,       float,  dx      ) SEP     \
+    ELT(,       float,  dy      ) SEP     \
+    ELT(,       float,  dz      )
+
+  // Scratch, copied back to the MRIS after averaging, as mrisAverageSignedGradients leaves them
+  #define MRIS_HOT__LIST_V_TMP            \
+    ELT(,       float,  tdx     ) SEP     \
+    ELT(,       float,  tdy     ) SEP     \
+    ELT(,       float,  tdz     )
+
+#undef ELT
+#undef ELTX
+#undef SEP
+
+struct MRIS_HOT {
+  MRIS*                         underlyingMRIS    ;   // for the few properties read from the MRIS itself
+  int                           nvertices         ;
+  VERTEX_TOPOLOGY const *       vertices_topology ;   // pointer copied from MRIS
+  bool                          averaged          ;   // the v_td{xyz} must be copied back
+
+#define SEP
+#define ELTX(C,T,N) ELT(C,T,N)
+#define ELT(C,T,N) T * v_##N;
+  MRIS_HOT__LIST_V_IN
+  MRIS_HOT__LIST_V_IN_OUT
+  MRIS_HOT__LIST_V_TMP
+#undef ELT
+#undef ELTX
+#undef SEP
+};
+
+bool MRISHOT_useReference();
+
+void MRISHOT_ctr(MRIS_HOT* hot);
+void MRISHOT_dtr(MRIS_HOT* hot);
+
+void MRISHOT_load          (MRIS_HOT* hot, MRIS* mris);        // positions, normals, flags and gradient
+void MRISHOT_unloadGradient(MRIS* mris,    MRIS_HOT* hot);     // the dx,dy,dz (and tdx,tdy,tdz) of the vertices
+
+int  MRISHOT_averageSignedGradients   (MRIS_HOT* hot, int num_avgs);
+int  MRISHOT_computeSpringTerm        (MRIS_HOT* hot, double l_spring);
+void MRISHOT_computeNormalSpringTerm  (MRIS_HOT* hot, double l_spring);
+void MRISHOT_computeTangentialSpringTerm(MRIS_HOT* hot, double l_spring);
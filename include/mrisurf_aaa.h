@@ -257,6 +257,12 @@ typedef struct MRIS MRIS,MRI_SURFACE;       // Prefer using MRIS
 typedef struct MRIS_MP MRIS_MP;
 
 
+// MRIS_HOT holds just the vertex properties read by the averaging and spring terms of 
+// MRISpositionSurface, one array per property.  It is defined in mrisurf_MRIS_HOT.h
+//
+typedef struct MRIS_HOT MRIS_HOT;
+
+
 // MRISPV is a much more efficient supplier of MetricProperties data than MRIS
 // and hold all the data.  It is not yet fully implemented.
 //
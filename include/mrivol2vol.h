@@ -0,0 +1,51 @@
+/**
+ * @brief resampling engine behind MRIvol2Vol
+ *
+ * Nearest-neighbor and trilinear resampling of one volume into another
+ * through a vox2vox matrix, specialized at compile time for the source voxel
+ * type, the interpolation and the rounding function MRIvol2Vol() uses.  The
+ * target is walked along its rows, which are contiguous in memory, so both
+ * the reads and the writes are mostly sequential.  Source coordinates come
+ * from per-axis tables of the matrix products, computed once, and are
+ * evaluated a block of voxels at a time so the compiler can vectorize them.
+ * All the frames of a voxel are sampled with the same weights before moving
+ * on to the next voxel.
+ *
+ * The results are identical to those of the per-voxel reference loop in
+ * mri2.cpp: the coordinates are summed in the same order, in the same
+ * precision, and the interpolation and the conversion to the target type
+ * are done exactly as MRIsampleSeqVolume() and MRIsetVoxVal() do them.
+ * Other interpolations and voxel types are left to the reference loop.
+ *
+ * Set FS_MRI_VOL2VOL_REFERENCE in the environment to always use the
+ * original loop (e.g. to compare the two).
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRIVOL2VOL_H
+#define MRIVOL2VOL_H
+
+#include "matrix.h"
+#include "mri.h"
+
+int  MRIvol2VolUseReference(void) ;
+
+/* samples src into targ through the target-to-source vox2vox Vt2s.
+   use_nint2 selects nint2() rather than nint() for rounding the source
+   coordinates, as MRIvol2Vol() does for single-slice sources.  Returns
+   NO_ERROR, or ERROR_UNSUPPORTED (with targ untouched) when the caller
+   must run the reference loop. */
+int  MRIvol2VolSample(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, int use_nint2) ;
+
+#endif
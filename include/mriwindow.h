@@ -0,0 +1,58 @@
+/**
+ * @brief sliding-window engine behind the mrifilter window filters
+ *
+ * Fast paths for MRImean(), MRImeanInMask(), MRImedian(), MRIorder(),
+ * MRIstd() and MRIstdInMask().  Window sums of integer-valued volumes are
+ * built from separable running sums, so each voxel costs O(1) whatever the
+ * window size; medians and other order statistics of integer-valued volumes
+ * are tracked in a histogram that is updated one window column at a time
+ * (Huang's algorithm, in 3D).  Float volumes use a partial selection for
+ * order statistics.  All of them run over threads.
+ *
+ * Every path gives exactly the values the reference (per-voxel) loops in
+ * mrifilter.cpp give.  Where that can not be guaranteed - float sums, whose
+ * rounding depends on the summation order, windows whose integer sums would
+ * not be exact in a float, NaNs - the functions return NULL and the caller
+ * runs the reference loop.  The standard deviations are taken around the
+ * caller's mean volume, so they keep the reference summation order and are
+ * only threaded.
+ *
+ * Set FS_MRI_WINDOW_REFERENCE in the environment to always use the original
+ * loops (e.g. to compare the two).
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRIWINDOW_H
+#define MRIWINDOW_H
+
+#include "mri.h"
+
+int  MRIwindowUseReference(void) ;
+
+/* mean over a (2*whalf+1)^3 window clipped to the volume, all frames */
+MRI  *MRIwindowMean(MRI *mri_src, MRI *mri_dst, int whalf) ;
+/* same, counting only voxels with a nonzero mask, frame 0, written in the mask */
+MRI  *MRIwindowMeanInMask(MRI *mri_src, MRI *mri_dst, MRI *mri_mask, int whalf) ;
+
+/* order'th smallest value in a (2*xhalf+1)x(2*yhalf+1)x(2*zhalf+1) window
+   whose coordinates are clamped to the volume, for voxels in box (NULL for
+   the whole volume) and frames [frame0, frame0+nframes) */
+MRI  *MRIwindowOrder(MRI *mri_src, MRI *mri_dst, int xhalf, int yhalf, int zhalf,
+                     int order, int frame0, int nframes, MRI_REGION *box) ;
+
+/* std around mri_mean over a (2*whalf+1)^3 window clipped to the volume
+   (and to the mask when mri_mask is not NULL), frame 0 */
+MRI  *MRIwindowStd(MRI *mri_src, MRI *mri_dst, MRI *mri_mean, MRI *mri_mask, int whalf) ;
+
+#endif
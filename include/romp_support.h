@@ -158,6 +158,44 @@ void ROMP_pflb_end(
     ROMP_pflb_stack_struct  * pflb_stack);
 
 
+// The always-compiled loop profiler
+//
+// When ROMP_SUPPORT_ENABLED is not defined the annotations still cost almost nothing,
+// but setting FS_ROMP_PROFILE in the environment turns them into a profiler:
+//
+//      FS_ROMP_PROFILE=<dir>           write <dir>/<prog>.<host>.<pid>.romp.json and .csv at exit
+//      FS_ROMP_PROFILE=stderr          write the csv to stderr at exit
+//      FS_ROMP_PROFILE_FORMAT=json|csv only write one of the two files
+//
+// Every ROMP_PF_begin/end (and ROMP_SCOPE_begin/end) entered from serial code is a site.
+// For each site it records the number of calls, how many went parallel, total/min/max wall time,
+// and - when the body has ROMP_PFLB_begin/end - the iterations done and the time at which each
+// thread finished its share, for every thread.  Imbalance is the fraction of thread time spent
+// waiting for the slowest thread.  Annotated loops inside a parallel region are not sites,
+// their bodies are charged to the enclosing one.
+//
+// With the variable unset each annotation is one load and a not-taken branch.
+//
+extern int romp_prof_enabled;              // set once, before main, from FS_ROMP_PROFILE
+extern int volatile romp_prof_active;      // a profiled site is running, so time the loop bodies
+
+typedef struct ROMP_prof_stack_struct {
+    struct ROMP_prof_site* site;
+    struct ROMP_prof_site* outer;
+    long                   start_ns;
+    long                   outer_start_ns;
+} ROMP_prof_stack_struct;
+
+void ROMP_prof_begin(ROMP_pf_static_struct * pf_static, ROMP_prof_stack_struct * prof_stack);
+void ROMP_prof_end  (ROMP_prof_stack_struct * prof_stack);
+void ROMP_prof_lb   (int body_begin);
+
+// Write what the profiler has collected so far, whether or not FS_ROMP_PROFILE is set
+//
+void ROMP_prof_write_csv (FILE* file);
+void ROMP_prof_write_json(FILE* file);
+
+
 // The conditionalized macros that either do or don't add the variables and calls based on the above
 //
 #if !defined(ROMP_SUPPORT_ENABLED)
@@ -171,15 +209,26 @@ void ROMP_pflb_end(
 	// end of macro
 
     #define ROMP_PF_begin \
-	{
+	{ \
+	static ROMP_pf_static_struct ROMP_pf_static = { 0L, __BASE_FILE__, __func__, __LINE__ }; \
+	ROMP_prof_stack_struct ROMP_prof_stack; \
+	ROMP_prof_stack.site = 0; \
+	if (romp_prof_enabled) ROMP_prof_begin(&ROMP_pf_static, &ROMP_prof_stack);
 
     #define ROMP_PF_end \
+	if (ROMP_prof_stack.site) ROMP_prof_end(&ROMP_prof_stack); \
 	}
 
-    #define ROMP_PFLB_begin
-    #define ROMP_PFLB_end
+    #define ROMP_PFLB_begin \
+	if (romp_prof_active) ROMP_prof_lb(1); \
+	// end of macro
+
+    #define ROMP_PFLB_end \
+	if (romp_prof_active) ROMP_prof_lb(0); \
+	// end of macro
+
     #define ROMP_PFLB_continue \
-	{ continue; }
+	{ ROMP_PFLB_end continue; }
 	
 #else
 
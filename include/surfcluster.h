@@ -87,4 +87,23 @@ int sclustGrowByDist(MRIS *surf, int seedvtxno, double dthresh,
 		     int shape, int vtxno, int *vtxlist);
 int sclustSaveAsPointSet(char *fname, SCS *scslist, int NClusters, MRIS *surf);
 
+/* Cluster tree: the largest clusters at many thresholds from a single
+   sort of the vertex values, with no state kept in the surface (see
+   sclustTreeMaxClusters()) */
+typedef struct
+{
+  int nvertices;
+  int *nbrstart;  // neighbors of vertex k are nbrs[nbrstart[k]] ... nbrs[nbrstart[k+1]-1]
+  int *nbrs;
+  float *area;    // vertex area, as used by SurfClusterSummary()
+}
+SURFCLUSTERTREE;
+
+int sclustUseReference(void);
+SURFCLUSTERTREE *sclustTreeAlloc(MRI_SURFACE *Surf);
+int sclustTreeFree(SURFCLUSTERTREE **psct);
+int sclustTreeMaxClusters(const SURFCLUSTERTREE *sct, const float *val, int thsign,
+                          const double *thmin, int nthresh, int *nClusters,
+                          double *MaxArea, int *MaxCount, float *MaxWeightVtx);
+
 #endif
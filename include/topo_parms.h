@@ -53,6 +53,8 @@ typedef struct
   int intersect; /* do final surface self-intersect ? */
   int optimal_mapping; /* type of mapping */
   float fitness; /* fitness of the retessellated patch */
+  unsigned long long random_state; /* private random stream for the grouped
+                                      search (0 = use randomNumber()) */
 
   /* intensity information */
   float white_mean,white_sigma,white_mean_ll;
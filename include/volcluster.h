@@ -71,6 +71,34 @@ int clustGrowOneVoxel(VOLCLUSTER *vc, int col0, int row0, int slc0,
 
 int clustMaxMember(VOLCLUSTER *vc, MRI *vol, int frame, int thsign);
 
+/* Connected-component engine behind clustGetClusters(): all the
+   clusters are labeled at once with a (multithreaded) union-find
+   instead of being grown one voxel at a time. The clusters, their
+   order and the order of their members are the same as with
+   clustGrow(). Set FS_VOLCLUSTER_REFERENCE to use clustGrow(). */
+int clustUseReference(void);
+int clustConnectedComponents(const unsigned char *hit, int width, int height, int depth,
+                             int connectivity, int *label, int *nmembers, int *seed);
+VOLCLUSTER **clustGrowAll(MRI *HitMap, int AllowDiag, int *nclusters);
+
+/* Cluster sizes, maxima and centroids without the member lists */
+typedef struct
+{
+  int nclusters;
+  int maxnmembers;   // size of the largest cluster
+  int *nmembers;
+  int *maxcol, *maxrow, *maxslc;
+  float *maxval;
+  float *ccol, *crow, *cslc; // centroid
+}
+VOLCLUSTERSUMMARY;
+
+VOLCLUSTERSUMMARY *clustGetClusterSummary(MRI *vol, int frame,
+                                          float threshmin, float threshmax,
+                                          int threshsign, MRI *binmask,
+                                          int AllowDiag);
+int clustFreeClusterSummary(VOLCLUSTERSUMMARY **pvcs);
+
 
 VOLCLUSTER **clustPruneBySize(VOLCLUSTER **vclist, int nlist,
                               float voxsize, float sizethresh,
@@ -226,9 +226,11 @@ int main(int argc, char **argv)
     printf("\n");
     printf("Building hash of lh white\n");
     lhwhite_hash = MHTcreateVertexTable_Resolution(lhwhite, CURRENT_VERTICES,hashres);
+    MHTfreeze(lhwhite_hash);  // only queried from here on, lock-free
     printf("\n");
     printf("Building hash of lh pial\n");
     lhpial_hash = MHTcreateVertexTable_Resolution(lhpial, CURRENT_VERTICES,hashres);
+    MHTfreeze(lhpial_hash);
   }
 
   if(DoRH){
@@ -290,9 +292,11 @@ int main(int argc, char **argv)
     printf("\n");
     printf("Building hash of rh white\n");
     rhwhite_hash = MHTcreateVertexTable_Resolution(rhwhite, CURRENT_VERTICES,hashres);
+    MHTfreeze(rhwhite_hash);
     printf("\n");
     printf("Building hash of rh pial\n");
     rhpial_hash = MHTcreateVertexTable_Resolution(rhpial, CURRENT_VERTICES,hashres);
+    MHTfreeze(rhpial_hash);
   }
 
   if(UseNewRibbon){
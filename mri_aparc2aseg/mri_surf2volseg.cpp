@@ -949,7 +949,9 @@ int Surf2VolSeg::LoadData(void){
     lhpial  = MRISread(lhpialpath.c_str());
     if(lhpial==NULL) exit(1);
     lhwhite_hash = MHTcreateVertexTable_Resolution(lhwhite, CURRENT_VERTICES,hashres);
+    MHTfreeze(lhwhite_hash);  // only queried from here on, lock-free
     lhpial_hash = MHTcreateVertexTable_Resolution(lhpial, CURRENT_VERTICES,hashres);
+    MHTfreeze(lhpial_hash);
     printf("Loading %s\n",lhcortexlabelpath.c_str());
     LABEL *cortexlabel = LabelRead(NULL, &(lhcortexlabelpath.c_str()[0]));
     if(cortexlabel==NULL) exit(1);
@@ -990,7 +992,9 @@ int Surf2VolSeg::LoadData(void){
     rhpial  = MRISread(rhpialpath.c_str());
     if(rhpial==NULL) exit(1);
     rhwhite_hash = MHTcreateVertexTable_Resolution(rhwhite, CURRENT_VERTICES,hashres);
+    MHTfreeze(rhwhite_hash);
     rhpial_hash = MHTcreateVertexTable_Resolution(rhpial, CURRENT_VERTICES,hashres);
+    MHTfreeze(rhpial_hash);
     printf("Loading %s\n",rhcortexlabelpath.c_str());
     LABEL *cortexlabel = LabelRead(NULL, &(rhcortexlabelpath.c_str()[0]));
     if(cortexlabel==NULL) exit(1);
@@ -0,0 +1,555 @@
+/**
+ * @brief linear registration to a gca atlas
+ *
+ * Parallel, pruned 9-parameter grid search (see emregistersearch.h)
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "macros.h"
+#include "diag.h"
+#include "error.h"
+#include "numerics.h"
+#include "romp_support.h"
+#include "timer.h"
+#include "utils.h"
+
+#include "emregistersearch.h"
+
+// every EMREG_COARSE_STRIDE-th sample is used to order the candidates
+#define EMREG_COARSE_STRIDE  8
+// how often (in samples) a candidate is checked against the best one
+#define EMREG_PRUNE_BLOCK    64
+// more candidates than this are scored in grid order, without a coarse pass
+#define EMREG_MAX_ORDERED    (1 << 24)
+
+int emregSearchUseReference(void)
+{
+  static int use_reference = -1 ;
+  if (use_reference < 0)
+    use_reference = (getenv("FS_EMREG_SEARCH_REFERENCE") != NULL) ;
+  return(use_reference) ;
+}
+
+/*-----------------------------------------------------------------
+  packs what GCAcomputeLogSampleProbability() uses of each sample,
+  with the covariance terms computed once.
+  -----------------------------------------------------------------*/
+EMREG_SAMPLES *emregPackSamples(GCA_SAMPLE *gcas, int nsamples, int ninputs, double clamp)
+{
+  EMREG_SAMPLES *es ;
+  MATRIX        *m_cov = NULL, *m_cov_inv = NULL ;
+  int           i, n, m, k ;
+  double        det, ub ;
+
+  es = (EMREG_SAMPLES *)calloc(1, sizeof(EMREG_SAMPLES)) ;
+  es->nsamples = nsamples ;
+  es->ninputs = ninputs ;
+  es->clamp = clamp ;
+  es->xp = (float *)calloc(nsamples, sizeof(float)) ;
+  es->yp = (float *)calloc(nsamples, sizeof(float)) ;
+  es->zp = (float *)calloc(nsamples, sizeof(float)) ;
+  es->log_det = (double *)calloc(nsamples, sizeof(double)) ;
+  es->log_prior = (double *)calloc(nsamples, sizeof(double)) ;
+  es->means = (float *)calloc(nsamples*ninputs, sizeof(float)) ;
+  es->icovars = (float *)calloc(nsamples*ninputs*ninputs, sizeof(float)) ;
+  es->bound = (double *)calloc(nsamples+1, sizeof(double)) ;
+  if (!es->xp || !es->yp || !es->zp || !es->log_det || !es->log_prior ||
+      !es->means || !es->icovars || !es->bound)
+    ErrorExit(ERROR_NOMEMORY, "emregPackSamples: could not allocate %d samples", nsamples) ;
+
+  if (ninputs > 1)
+    m_cov = MatrixAlloc(ninputs, ninputs, MATRIX_REAL) ;
+
+  for (i = 0 ; i < nsamples ; i++)
+  {
+    es->xp[i] = gcas[i].xp ;
+    es->yp[i] = gcas[i].yp ;
+    es->zp[i] = gcas[i].zp ;
+    es->log_prior[i] = gcas_getPriorLog(gcas[i]) ;
+    for (n = 0 ; n < ninputs ; n++)
+      es->means[i*ninputs+n] = gcas[i].means[n] ;
+
+    if (ninputs == 1)
+    {
+      det = gcas[i].covars[0] ;
+      es->icovars[i] = gcas[i].covars[0] ;  // divided by, as in GCAsampleMahDist()
+    }
+    else
+    {
+      // only the upper triangle is filled, as in load_sample_covariance_matrix()
+      for (k = n = 0 ; n < ninputs ; n++)
+        for (m = n ; m < ninputs ; m++, k++)
+          *MATRIX_RELT(m_cov, n+1, m+1) = gcas[i].covars[k] ;
+      det = MatrixDeterminant(m_cov) ;
+      m_cov_inv = MatrixInverse(m_cov, m_cov_inv) ;
+      if (!m_cov_inv)
+        ErrorExit(ERROR_BADPARM, "singular covariance matrix!");
+      for (n = 0 ; n < ninputs ; n++)
+        for (m = 0 ; m < ninputs ; m++)
+          es->icovars[(i*ninputs+n)*ninputs+m] = *MATRIX_RELT(m_cov_inv, n+1, m+1) ;
+    }
+    es->log_det[i] = -log(sqrt(det)) ;
+  }
+
+  // the Mahalanobis term only lowers log_p, and clamping raises it to -clamp
+  for (i = nsamples-1 ; i >= 0 ; i--)
+  {
+    ub = es->log_det[i] + es->log_prior[i] ;
+    if (ub < -clamp)
+      ub = -clamp ;
+    es->bound[i] = es->bound[i+1] + ub ;
+  }
+
+  if (m_cov)
+    MatrixFree(&m_cov) ;
+  if (m_cov_inv)
+    MatrixFree(&m_cov_inv) ;
+  return(es) ;
+}
+
+int emregFreeSamples(EMREG_SAMPLES **pes)
+{
+  EMREG_SAMPLES *es = *pes ;
+
+  if (es == NULL)
+    return(NO_ERROR) ;
+  free(es->xp) ;
+  free(es->yp) ;
+  free(es->zp) ;
+  free(es->log_det) ;
+  free(es->log_prior) ;
+  free(es->means) ;
+  free(es->icovars) ;
+  free(es->bound) ;
+  free(es) ;
+  *pes = NULL ;
+  return(NO_ERROR) ;
+}
+
+/*-----------------------------------------------------------------
+  sums log_p over every stride-th sample, the way
+  GCAcomputeLogSampleProbability() computes it for a linear
+  transform whose prior-to-source voxel matrix is m_p2s. Gives up
+  (and returns 0) as soon as the total is sure to end below
+  prune_total, otherwise returns 1 with the total in *ptotal.
+  -----------------------------------------------------------------*/
+static int emregSumLogP(const EMREG_SAMPLES *es, MRI *mri, const MATRIX *m_p2s,
+                        int stride, double prune_total, double *ptotal)
+{
+  float  m11, m12, m13, m14, m21, m22, m23, m24, m31, m32, m33, m34, xf, yf, zf, v, dsq ;
+  float  vals[MAX_GCA_INPUTS], d[MAX_GCA_INPUTS], t[MAX_GCA_INPUTS] ;
+  int    i, n, m, x, y, z, ninputs ;
+  double total, log_p ;
+  const float *means, *icov ;
+
+  m11 = *MATRIX_RELT(m_p2s, 1, 1) ; m12 = *MATRIX_RELT(m_p2s, 1, 2) ;
+  m13 = *MATRIX_RELT(m_p2s, 1, 3) ; m14 = *MATRIX_RELT(m_p2s, 1, 4) ;
+  m21 = *MATRIX_RELT(m_p2s, 2, 1) ; m22 = *MATRIX_RELT(m_p2s, 2, 2) ;
+  m23 = *MATRIX_RELT(m_p2s, 2, 3) ; m24 = *MATRIX_RELT(m_p2s, 2, 4) ;
+  m31 = *MATRIX_RELT(m_p2s, 3, 1) ; m32 = *MATRIX_RELT(m_p2s, 3, 2) ;
+  m33 = *MATRIX_RELT(m_p2s, 3, 3) ; m34 = *MATRIX_RELT(m_p2s, 3, 4) ;
+
+  ninputs = es->ninputs ;
+  total = 0.0 ;
+  for (i = 0 ; i < es->nsamples ; i += stride)
+  {
+    if (stride == 1 && (i % EMREG_PRUNE_BLOCK) == 0 && total + es->bound[i] < prune_total)
+      return(0) ;
+
+    // same order of operations as MatrixMultiply()
+    xf = 0.0f ; xf += m11*es->xp[i] ; xf += m12*es->yp[i] ; xf += m13*es->zp[i] ; xf += m14*1.0f ;
+    yf = 0.0f ; yf += m21*es->xp[i] ; yf += m22*es->yp[i] ; yf += m23*es->zp[i] ; yf += m24*1.0f ;
+    zf = 0.0f ; zf += m31*es->xp[i] ; zf += m32*es->yp[i] ; zf += m33*es->zp[i] ; zf += m34*1.0f ;
+    x = nint(xf) ;
+    y = nint(yf) ;
+    z = nint(zf) ;
+    if (x < 0 || x >= mri->width || y < 0 || y >= mri->height || z < 0 || z >= mri->depth)
+    {
+      total += -1000000 ;  // outside the volume
+      continue ;
+    }
+
+    means = &es->means[i*ninputs] ;
+    if (ninputs == 1)
+    {
+      load_vals(mri, x, y, z, vals, 1) ;
+      v = vals[0] - means[0] ;
+      dsq = v * v / es->icovars[i] ;
+    }
+    else
+    {
+      // as GCAsampleMahDist() does it with MATRIX/VECTOR arithmetic
+      MRIsampleVolumeFrame_xyzInt_nRange_floats(mri, x, y, z, 0, ninputs, vals) ;
+      icov = &es->icovars[i*ninputs*ninputs] ;
+      for (n = 0 ; n < ninputs ; n++)
+        d[n] = means[n] - vals[n] ;
+      for (n = 0 ; n < ninputs ; n++)
+      {
+        t[n] = 0.0f ;
+        for (m = 0 ; m < ninputs ; m++)
+          t[n] += icov[n*ninputs+m] * d[m] ;
+      }
+      dsq = 0.0f ;
+      for (n = 0 ; n < ninputs ; n++)
+        dsq += d[n] * t[n] ;
+    }
+    log_p = es->log_det[i] - .5 * dsq ;
+    log_p += es->log_prior[i] ;
+    if (log_p < -es->clamp)
+      log_p = -es->clamp ;
+    total += log_p ;
+  }
+
+  *ptotal = total ;
+  return(1) ;
+}
+
+// the part of GCAgetPriorToSourceVoxelMatrix() that does not depend on m_L
+static MATRIX *emregPriorToVoxel(GCA *gca)
+{
+  return(MatrixMultiply(gca->mri_tal__->r_to_i__, gca->prior_i_to_r__, NULL)) ;
+}
+
+/*-----------------------------------------------------------------
+  m_p2s = inverse(m_L) * m_prior2voxel, computed into m_inv and m_p2s
+  with the same arithmetic as TransformInvert() followed by
+  GCAgetPriorToSourceVoxelMatrix(), but without allocating anything.
+  -----------------------------------------------------------------*/
+static MATRIX *emregPriorToSource(const MATRIX *m_prior2voxel, MATRIX *m_L, MATRIX *m_inv, MATRIX *m_p2s)
+{
+  int r, c ;
+
+  // what MatrixInverse() does, minus the copy of m_L
+  if (OpenLUMatrixInverse(m_L, m_inv) != NO_ERROR)
+    ErrorExit(ERROR_BADPARM, "emregSearchLinearXform: xform noninvertible") ;
+  for (r = 1 ; r <= 4 ; r++)
+    for (c = 1 ; c <= 4 ; c++)
+      if (!std::isfinite(*MATRIX_RELT(m_inv, r, c)))
+        ErrorExit(ERROR_BADPARM, "emregSearchLinearXform: xform noninvertible") ;
+  return(MatrixMultiply(m_inv, m_prior2voxel, m_p2s)) ;
+}
+
+double emregLogSampleProbability(GCA *gca, const EMREG_SAMPLES *es, MRI *mri, MATRIX *m_L)
+{
+  MATRIX *m_prior2voxel, *m_inv, *m_p2s ;
+  double total ;
+
+  m_prior2voxel = emregPriorToVoxel(gca) ;
+  m_inv = MatrixAlloc(4, 4, MATRIX_REAL) ;
+  m_p2s = MatrixAlloc(4, 4, MATRIX_REAL) ;
+  emregPriorToSource(m_prior2voxel, m_L, m_inv, m_p2s) ;
+  emregSumLogP(es, mri, m_p2s, 1, -HUGE_VAL, &total) ;
+  MatrixFree(&m_prior2voxel) ;
+  MatrixFree(&m_inv) ;
+  MatrixFree(&m_p2s) ;
+  return((float)total / es->nsamples) ;
+}
+
+/*-----------------------------------------------------------------
+  grid values of one parameter, with the same floating point
+  accumulation as the loops of find_optimal_linear_xform()
+  -----------------------------------------------------------------*/
+static int emregGridValues(const EMREG_RANGE *r, double **pvals)
+{
+  double v, *vals ;
+  int    n ;
+
+  n = 0 ;
+  for (v = r->min ; v <= r->max ; v += r->delta)
+    n++ ;
+  vals = (double *)calloc(n+1, sizeof(double)) ;
+  n = 0 ;
+  for (v = r->min ; v <= r->max ; v += r->delta)
+    vals[n++] = v ;
+  *pvals = vals ;
+  return(n) ;
+}
+
+// per-thread matrices, reused from one candidate to the next
+typedef struct
+{
+  MATRIX *m_scale, *m_x_rot, *m_y_rot, *m_z_rot, *m_rot, *m_tmp, *m_tmp2, *m_tmp3, *m_trans, *m_L_tmp ;
+  MATRIX *m_inv, *m_p2s ;
+} EMREG_WORK ;
+
+typedef struct
+{
+  int    nscale, nangle, ntrans ;
+  double *scales, *angles, *transs ;
+  MATRIX *m_L, *m_origin, *m_origin_inv, *m_prior2voxel ;
+} EMREG_GRID ;
+
+typedef struct
+{
+  float score ;
+  int   index ;
+} EMREG_CANDIDATE ;
+
+// decreasing score, then grid order
+static int emregCompareCandidates(const void *a, const void *b)
+{
+  const EMREG_CANDIDATE *ca = (const EMREG_CANDIDATE *)a, *cb = (const EMREG_CANDIDATE *)b ;
+  if (ca->score > cb->score) return(-1) ;
+  if (ca->score < cb->score) return(+1) ;
+  return(ca->index < cb->index ? -1 : ca->index > cb->index) ;
+}
+
+/*-----------------------------------------------------------------
+  m_tmp3 = scale * rotation * m_L for the outer (scale, angle) index,
+  composed exactly as in find_optimal_linear_xform()
+  -----------------------------------------------------------------*/
+static void emregOuterXform(const EMREG_GRID *g, EMREG_WORK *w, long outer)
+{
+  int iaz = outer % g->nangle ; outer /= g->nangle ;
+  int iay = outer % g->nangle ; outer /= g->nangle ;
+  int iax = outer % g->nangle ; outer /= g->nangle ;
+  int isz = outer % g->nscale ; outer /= g->nscale ;
+  int isy = outer % g->nscale ; outer /= g->nscale ;
+  int isx = outer ;
+
+  MatrixIdentity(4, w->m_scale) ;
+  *MATRIX_RELT(w->m_scale, 1, 1) = g->scales[isx] ;
+  *MATRIX_RELT(w->m_scale, 2, 2) = g->scales[isy] ;
+  *MATRIX_RELT(w->m_scale, 3, 3) = g->scales[isz] ;
+  w->m_tmp = MatrixMultiply(w->m_scale, g->m_origin_inv, w->m_tmp) ;
+  MatrixMultiply(g->m_origin, w->m_tmp, w->m_scale) ;
+
+  w->m_x_rot = MatrixReallocRotation(4, g->angles[iax], X_ROTATION, w->m_x_rot) ;
+  w->m_y_rot = MatrixReallocRotation(4, g->angles[iay], Y_ROTATION, w->m_y_rot) ;
+  w->m_tmp = MatrixMultiply(w->m_y_rot, w->m_x_rot, w->m_tmp) ;
+  w->m_z_rot = MatrixReallocRotation(4, g->angles[iaz], Z_ROTATION, w->m_z_rot) ;
+  w->m_rot = MatrixMultiply(w->m_z_rot, w->m_tmp, w->m_rot) ;
+  w->m_tmp2 = MatrixMultiply(w->m_rot, g->m_origin_inv, w->m_tmp2) ;
+  MatrixMultiply(g->m_origin, w->m_tmp2, w->m_rot) ;
+
+  w->m_tmp2 = MatrixMultiply(w->m_scale, w->m_rot, w->m_tmp2) ;
+  w->m_tmp3 = MatrixMultiply(w->m_tmp2, g->m_L, w->m_tmp3) ;
+}
+
+// m_L_tmp = translation * m_tmp3 for the inner (translation) index
+static void emregInnerXform(const EMREG_GRID *g, EMREG_WORK *w, int inner)
+{
+  int itz = inner % g->ntrans ; inner /= g->ntrans ;
+  int ity = inner % g->ntrans ; inner /= g->ntrans ;
+  int itx = inner ;
+
+  *MATRIX_RELT(w->m_trans, 1, 4) = g->transs[itx] ;
+  *MATRIX_RELT(w->m_trans, 2, 4) = g->transs[ity] ;
+  *MATRIX_RELT(w->m_trans, 3, 4) = g->transs[itz] ;
+  w->m_L_tmp = MatrixMultiply(w->m_trans, w->m_tmp3, w->m_L_tmp) ;
+}
+
+static int emregThreadNum(void)
+{
+#ifdef HAVE_OPENMP
+  return(omp_get_thread_num()) ;
+#else
+  return(0) ;
+#endif
+}
+
+int emregSearchLinearXform(GCA *gca, const EMREG_SAMPLES *es, MRI *mri,
+                           MATRIX *m_L, MATRIX *m_origin, MATRIX *m_origin_inv,
+                           const EMREG_RANGE *scale, const EMREG_RANGE *angle,
+                           const EMREG_RANGE *trans, double *pmax_log_p,
+                           double *max_scale, double *max_rot, double *max_trans)
+{
+  EMREG_GRID      g ;
+  EMREG_WORK      work[_MAX_FS_THREADS] ;
+  EMREG_CANDIDATE *cands = NULL ;
+  long            ncands, nouter, k ;
+  int             ninner, nthreads, tid, nfull, best_index, improved ;
+  double          start_log_p, best_log_p, prune_log_p ;
+
+  Timer timer ;
+
+  g.nscale = emregGridValues(scale, &g.scales) ;
+  g.nangle = emregGridValues(angle, &g.angles) ;
+  g.ntrans = emregGridValues(trans, &g.transs) ;
+  g.m_L = m_L ;
+  g.m_origin = m_origin ;
+  g.m_origin_inv = m_origin_inv ;
+  g.m_prior2voxel = emregPriorToVoxel(gca) ;
+  nouter = (long)g.nscale*g.nscale*g.nscale*g.nangle*g.nangle*g.nangle ;
+  ninner = g.ntrans*g.ntrans*g.ntrans ;
+  ncands = nouter*ninner ;
+
+  nthreads = 1 ;
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads() ;
+#endif
+  for (tid = 0 ; tid < nthreads ; tid++)
+  {
+    work[tid].m_scale = MatrixIdentity(4, NULL) ;
+    work[tid].m_x_rot = MatrixIdentity(4, NULL) ;
+    work[tid].m_y_rot = MatrixIdentity(4, NULL) ;
+    work[tid].m_z_rot = MatrixIdentity(4, NULL) ;
+    work[tid].m_trans = MatrixIdentity(4, NULL) ;
+    work[tid].m_rot = work[tid].m_tmp = work[tid].m_tmp2 = work[tid].m_tmp3 = work[tid].m_L_tmp = NULL ;
+    work[tid].m_inv = MatrixAlloc(4, 4, MATRIX_REAL) ;
+    work[tid].m_p2s = MatrixAlloc(4, 4, MATRIX_REAL) ;
+  }
+
+  // coarse pass: order the candidates by their score on a subset of the samples
+  if (ncands <= EMREG_MAX_ORDERED)
+  {
+    long outer ;
+
+    cands = (EMREG_CANDIDATE *)calloc(ncands, sizeof(EMREG_CANDIDATE)) ;
+    if (cands == NULL)
+      ErrorExit(ERROR_NOMEMORY, "emregSearchLinearXform: could not allocate %ld candidates", ncands) ;
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+    for (outer = 0 ; outer < nouter ; outer++)
+    {
+      ROMP_PFLB_begin
+      EMREG_WORK *w = &work[emregThreadNum()] ;
+      double     total = 0 ;
+      int        inner ;
+
+      emregOuterXform(&g, w, outer) ;
+      for (inner = 0 ; inner < ninner ; inner++)
+      {
+        emregInnerXform(&g, w, inner) ;
+        emregPriorToSource(g.m_prior2voxel, w->m_L_tmp, w->m_inv, w->m_p2s) ;
+        emregSumLogP(es, mri, w->m_p2s, EMREG_COARSE_STRIDE, -HUGE_VAL, &total) ;
+        cands[outer*ninner+inner].score = total ;
+        cands[outer*ninner+inner].index = outer*ninner+inner ;
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    qsort(cands, ncands, sizeof(EMREG_CANDIDATE), emregCompareCandidates) ;
+  }
+
+  // full pass, most promising candidates first. A candidate only needs
+  // to be scored in full if it can still beat the best one so far.
+  start_log_p = *pmax_log_p ;
+  prune_log_p = start_log_p ;
+  best_log_p = start_log_p ;
+  best_index = -1 ;
+  nfull = 0 ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 16) reduction(+ : nfull)
+#endif
+  for (k = 0 ; k < ncands ; k++)
+  {
+    ROMP_PFLB_begin
+    EMREG_WORK *w = &work[emregThreadNum()] ;
+    double     total, log_p, prune, prune_total ;
+    long       index ;
+
+    index = cands ? cands[k].index : k ;
+    emregOuterXform(&g, w, index / ninner) ;
+    emregInnerXform(&g, w, index % ninner) ;
+    emregPriorToSource(g.m_prior2voxel, w->m_L_tmp, w->m_inv, w->m_p2s) ;
+
+#ifdef HAVE_OPENMP
+    #pragma omp atomic read
+#endif
+    prune = prune_log_p ;
+    // a margin well above float rounding, so that only candidates that
+    // are sure to score less than the best one are given up on
+    prune_total = prune * es->nsamples ;
+    prune_total -= 1e-5 * fabs(prune_total) + 1e-3 ;
+
+    if (emregSumLogP(es, mri, w->m_p2s, 1, prune_total, &total))
+    {
+      nfull++ ;
+      log_p = (float)total / es->nsamples ;
+      if (log_p > start_log_p)
+      {
+#ifdef HAVE_OPENMP
+        #pragma omp critical(emreg_best)
+#endif
+        {
+          // ties go to the first candidate in grid order, as in the reference
+          if (log_p > best_log_p || (log_p == best_log_p && index < best_index))
+          {
+            best_log_p = log_p ;
+            best_index = index ;
+          }
+          if (log_p > prune_log_p)
+          {
+#ifdef HAVE_OPENMP
+            #pragma omp atomic write
+#endif
+            prune_log_p = log_p ;
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  {
+    double seconds = timer.milliseconds() / 1000.0 ;
+    if (seconds <= 0)
+      seconds = 0.001 ;
+    printf("  %ld candidate transforms (%d scored in full) in %2.1f sec, %2.0f candidates/sec\n",
+           ncands, nfull, seconds, ncands / seconds) ;
+    fflush(stdout) ;
+  }
+
+  improved = (best_index >= 0) ;
+  if (improved)
+  {
+    long index = best_index ;
+    int itz = index % g.ntrans ; index /= g.ntrans ;
+    int ity = index % g.ntrans ; index /= g.ntrans ;
+    int itx = index % g.ntrans ; index /= g.ntrans ;
+    int iaz = index % g.nangle ; index /= g.nangle ;
+    int iay = index % g.nangle ; index /= g.nangle ;
+    int iax = index % g.nangle ; index /= g.nangle ;
+    int isz = index % g.nscale ; index /= g.nscale ;
+    int isy = index % g.nscale ; index /= g.nscale ;
+    int isx = index ;
+
+    *pmax_log_p = best_log_p ;
+    max_scale[0] = g.scales[isx] ; max_scale[1] = g.scales[isy] ; max_scale[2] = g.scales[isz] ;
+    max_rot[0] = g.angles[iax] ;   max_rot[1] = g.angles[iay] ;   max_rot[2] = g.angles[iaz] ;
+    max_trans[0] = g.transs[itx] ; max_trans[1] = g.transs[ity] ; max_trans[2] = g.transs[itz] ;
+  }
+
+  for (tid = 0 ; tid < nthreads ; tid++)
+  {
+    MatrixFree(&work[tid].m_scale) ;
+    MatrixFree(&work[tid].m_x_rot) ;
+    MatrixFree(&work[tid].m_y_rot) ;
+    MatrixFree(&work[tid].m_z_rot) ;
+    MatrixFree(&work[tid].m_trans) ;
+    if (work[tid].m_rot) MatrixFree(&work[tid].m_rot) ;
+    if (work[tid].m_tmp) MatrixFree(&work[tid].m_tmp) ;
+    if (work[tid].m_tmp2) MatrixFree(&work[tid].m_tmp2) ;
+    if (work[tid].m_tmp3) MatrixFree(&work[tid].m_tmp3) ;
+    if (work[tid].m_L_tmp) MatrixFree(&work[tid].m_L_tmp) ;
+    MatrixFree(&work[tid].m_inv) ;
+    MatrixFree(&work[tid].m_p2s) ;
+  }
+  MatrixFree(&g.m_prior2voxel) ;
+  free(cands) ;
+  free(g.scales) ;
+  free(g.angles) ;
+  free(g.transs) ;
+  return(improved) ;
+}
@@ -0,0 +1,91 @@
+/**
+ * @brief linear registration to a gca atlas
+ *
+ * Parallel, pruned version of the 9-parameter grid search of
+ * find_optimal_linear_xform().
+ *
+ * The reference search composes the scale, rotation and translation of
+ * every grid point with MatrixMultiply() and scores it with
+ * GCAcomputeLogSampleProbability(), which goes back to the GCA_SAMPLE
+ * array, allocates vectors and recomputes the covariance terms of every
+ * sample for every candidate.  Here the samples are packed once into
+ * flat arrays (prior coordinates, means, inverse covariances and the
+ * constant part of their log density), and the grid is searched in two
+ * passes, both multithreaded over the candidates:
+ *
+ *   - a coarse pass scores every candidate on a subset of the samples,
+ *     only to decide in which order to score them in full;
+ *   - the full pass then goes through the candidates from the most to
+ *     the least promising.  The log density of a sample can not exceed
+ *     the constant part of it (nor be below -clamp inside the volume),
+ *     so once a candidate has fallen so far behind the best one scored
+ *     so far that the remaining samples can not make up for it, the
+ *     rest of its samples are skipped.
+ *
+ * Only candidates that can not beat the best one are skipped, each
+ * candidate that is scored in full gets exactly the value the reference
+ * computes with a single thread, and ties are broken in grid order as
+ * the reference does, so the search finds the same transform.
+ *
+ * Set FS_EMREG_SEARCH_REFERENCE in the environment to use the reference
+ * search (e.g. to compare the two).
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef EM_REGISTER_SEARCH_H
+#define EM_REGISTER_SEARCH_H
+
+#include "mri.h"
+#include "gca.h"
+#include "matrix.h"
+
+typedef struct
+{
+  int    nsamples ;
+  int    ninputs ;
+  float  *xp, *yp, *zp ;  // prior coordinates
+  double *log_det ;       // -log(sqrt(det(covariance)))
+  double *log_prior ;
+  float  *means ;         // ninputs per sample
+  float  *icovars ;       // covars[0] (1 input) or inverse covariance (ninputs x ninputs)
+  double *bound ;         // bound[i] >= sum of log_p over samples i ... nsamples-1
+  double clamp ;
+} EMREG_SAMPLES ;
+
+typedef struct
+{
+  float  min, max ;       // as passed to find_optimal_linear_xform()
+  double delta ;
+} EMREG_RANGE ;
+
+int  emregSearchUseReference(void) ;
+
+EMREG_SAMPLES *emregPackSamples(GCA_SAMPLE *gcas, int nsamples, int ninputs, double clamp) ;
+int  emregFreeSamples(EMREG_SAMPLES **pes) ;
+
+/* same value as local_GCAcomputeLogSampleProbability(gca, gcas, mri,
+   m_L, nsamples, 0, clamp) run with one thread */
+double emregLogSampleProbability(GCA *gca, const EMREG_SAMPLES *es, MRI *mri, MATRIX *m_L) ;
+
+/* one pass of the nested scale/rotation/translation loops of
+   find_optimal_linear_xform(). If a candidate scores more than
+   *pmax_log_p, *pmax_log_p and the scales, angles and translations
+   of the first best candidate are updated and 1 is returned. */
+int  emregSearchLinearXform(GCA *gca, const EMREG_SAMPLES *es, MRI *mri,
+                            MATRIX *m_L, MATRIX *m_origin, MATRIX *m_origin_inv,
+                            const EMREG_RANGE *scale, const EMREG_RANGE *angle,
+                            const EMREG_RANGE *trans, double *pmax_log_p,
+                            double *max_scale, double *max_rot, double *max_trans) ;
+
+#endif
@@ -46,6 +46,7 @@
 
 #include "emregisterutils.h"
 #include "findtranslation.h"
+#include "emregistersearch.h"
 #include "fsinit.h"
 
 #define DEFAULT_MIN_SCALES 3
@@ -2216,6 +2217,173 @@ get_option(int argc, char *argv[])
 
 
 
+/*/////////////////////////////////////////////////////////////
+  one pass of the nested scale/rotation/translation loops, scoring
+  every candidate with local_GCAcomputeLogSampleProbability(). Used
+  where emregSearchLinearXform() can not be (see emregistersearch.h),
+  with the same arguments and return value.
+*/
+static int
+search_linear_xform_grid
+(GCA *gca, GCA_SAMPLE *gcas, MRI *mri, int nsamples,
+ MATRIX *m_L, MATRIX *m_origin, MATRIX *m_origin_inv,
+ const EMREG_RANGE *scale, const EMREG_RANGE *angle, const EMREG_RANGE *trans,
+ double *pmax_log_p, double *max_scales, double *max_rots, double *max_transs)
+{
+  MATRIX   *m_rot, *m_x_rot, *m_y_rot, *m_z_rot, *m_tmp, *m_L_tmp,
+           *m_tmp2, *m_scale, *m_trans, *m_tmp3 ;
+  float  min_scale = scale->min, max_scale = scale->max ;
+  float  min_angle = angle->min, max_angle = angle->max ;
+  float  min_trans = trans->min, max_trans = trans->max ;
+  double delta_scale = scale->delta, delta_rot = angle->delta, delta_trans = trans->delta ;
+  double x_max_scale, y_max_scale, z_max_scale ;
+  double x_max_rot, y_max_rot, z_max_rot ;
+  double x_max_trans, y_max_trans, z_max_trans ;
+  double x_scale, y_scale, z_scale ;
+  double x_angle, y_angle, z_angle ;
+  double x_trans, y_trans, z_trans ;
+  double log_p, max_log_p ;
+  int    improved ;
+
+  m_scale = MatrixIdentity(4, NULL) ;
+  m_trans = MatrixIdentity(4, NULL) ;
+  m_L_tmp = m_x_rot = m_y_rot = m_z_rot = m_rot = m_tmp = m_tmp2 = m_tmp3 = NULL ;
+  x_max_scale = y_max_scale = z_max_scale = 1.0 ;
+  x_max_rot = y_max_rot = z_max_rot = 0.0 ;
+  x_max_trans = y_max_trans = z_max_trans = 0.0 ;
+  max_log_p = *pmax_log_p ;
+
+  // scale /////////////////////////////////////////////////////////////
+  for (x_scale = min_scale ; x_scale <= max_scale ; x_scale += delta_scale)
+  {
+    /*      printf("x_scale = %2.3f\n", x_scale) ;*/
+    *MATRIX_RELT(m_scale, 1, 1) = x_scale ;
+    for (y_scale = min_scale ;
+         y_scale <= max_scale ;
+         y_scale += delta_scale)
+    {
+      *MATRIX_RELT(m_scale, 2, 2) = y_scale ;
+      for (z_scale= min_scale ;
+           z_scale <= max_scale;
+           z_scale += delta_scale)
+      {
+        *MATRIX_RELT(m_scale, 3, 3) = z_scale ;
+
+        /* reset translation values */
+        *MATRIX_RELT(m_scale, 1, 4) =
+          *MATRIX_RELT(m_scale, 2, 4) =
+            *MATRIX_RELT(m_scale, 3, 4) = 0.0f ;
+        m_tmp = MatrixMultiply(m_scale, m_origin_inv, m_tmp) ;
+        MatrixMultiply(m_origin, m_tmp, m_scale) ;
+
+        // angle //////////////////////////////
+        for (x_angle = min_angle ;
+             x_angle <= max_angle ;
+             x_angle += delta_rot)
+        {
+          m_x_rot = MatrixReallocRotation
+                    (4, x_angle, X_ROTATION, m_x_rot) ;
+          for (y_angle = min_angle ;
+               y_angle <= max_angle ;
+               y_angle += delta_rot)
+          {
+            m_y_rot = MatrixReallocRotation
+                      (4, y_angle, Y_ROTATION, m_y_rot);
+            m_tmp = MatrixMultiply(m_y_rot, m_x_rot, m_tmp) ;
+            for (z_angle= min_angle;
+                 z_angle <= max_angle;
+                 z_angle += delta_rot)
+            {
+              m_z_rot = MatrixReallocRotation
+                        (4, z_angle,Z_ROTATION,m_z_rot);
+              m_rot = MatrixMultiply(m_z_rot, m_tmp, m_rot) ;
+              m_tmp2 = MatrixMultiply
+                       (m_rot, m_origin_inv, m_tmp2) ;
+              MatrixMultiply(m_origin, m_tmp2, m_rot) ;
+
+              m_tmp2 = MatrixMultiply(m_scale, m_rot, m_tmp2) ;
+              m_tmp3 = MatrixMultiply(m_tmp2, m_L, m_tmp3) ;
+
+              // translation //////////
+              for (x_trans = min_trans ;
+                   x_trans <= max_trans ;
+                   x_trans += delta_trans)
+              {
+                *MATRIX_RELT(m_trans, 1, 4) = x_trans ;
+                for (y_trans = min_trans ;
+                     y_trans <= max_trans ;
+                     y_trans += delta_trans)
+                {
+                  *MATRIX_RELT(m_trans, 2, 4) = y_trans ;
+                  for (z_trans= min_trans ;
+                       z_trans <= max_trans ;
+                       z_trans += delta_trans)
+                  {
+                    *MATRIX_RELT(m_trans, 3, 4) =
+                      z_trans ;
+
+                    m_L_tmp = MatrixMultiply
+                              (m_trans, m_tmp3, m_L_tmp) ;
+
+                    log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L_tmp, nsamples, exvivo, Gclamp);
+                    if (log_p > max_log_p)
+                    {
+                      if (exvivo)
+                        printf("current estimates G=%d, W=%d, F=%d\n",
+                               (int)G_gm_mean, (int)G_wm_mean, (int)G_fluid_mean) ;
+                      max_log_p = log_p ;
+                      x_max_scale = x_scale ;
+                      y_max_scale = y_scale ;
+                      z_max_scale = z_scale ;
+                      x_max_rot = x_angle ;
+                      y_max_rot = y_angle ;
+                      z_max_rot = z_angle ;
+                      x_max_trans = x_trans ;
+                      y_max_trans = y_trans ;
+                      z_max_trans = z_trans ;
+                    }
+#if 0
+                    printf( "%s: log_p = %f\n", __FUNCTION__, log_p );
+                    printf( "%s: Translation (%4.2f, %4.2f, %4.2f)\n",
+                            __FUNCTION__, x_trans, y_trans, z_trans );
+                    printf( "%s: Rotation (%4.2f, %4.2f, %4.2f)\n",
+                            __FUNCTION__, x_angle, y_angle, z_angle );
+                    printf( "%s: Scale (%4.2f, %4.2f, %4.2f)\n",
+                            __FUNCTION__, x_scale, y_scale, z_scale );
+                    exit( 0 );
+#endif
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  improved = (max_log_p > *pmax_log_p) ;
+  if (improved)
+  {
+    *pmax_log_p = max_log_p ;
+    max_scales[0] = x_max_scale ; max_scales[1] = y_max_scale ; max_scales[2] = z_max_scale ;
+    max_rots[0] = x_max_rot ;     max_rots[1] = y_max_rot ;     max_rots[2] = z_max_rot ;
+    max_transs[0] = x_max_trans ; max_transs[1] = y_max_trans ; max_transs[2] = z_max_trans ;
+  }
+
+  MatrixFree(&m_scale) ;
+  MatrixFree(&m_trans) ;
+  if (m_x_rot) MatrixFree(&m_x_rot) ;
+  if (m_y_rot) MatrixFree(&m_y_rot) ;
+  if (m_z_rot) MatrixFree(&m_z_rot) ;
+  if (m_rot) MatrixFree(&m_rot) ;
+  if (m_tmp) MatrixFree(&m_tmp) ;
+  if (m_tmp2) MatrixFree(&m_tmp2) ;
+  if (m_tmp3) MatrixFree(&m_tmp3) ;
+  if (m_L_tmp) MatrixFree(&m_L_tmp) ;
+  return(improved) ;
+}
+
 /*/////////////////////////////////////////////////////////////
   search 9-dimensional parameter space
 */
@@ -2240,11 +2408,8 @@ find_optimal_linear_xform
   double delta_scale, delta_trans;
   double max_log_p, mean_angle;
   double mean_scale, x_max_trans, y_max_trans, z_max_trans, mean_trans ;
-  double x_trans, y_trans, z_trans;
-  double x_scale, y_scale, z_scale;
-  double x_angle, y_angle, z_angle;
-  double log_p;
   int i;
+  EMREG_SAMPLES *es ;
 
   if (rigid)
   {
@@ -2261,7 +2426,16 @@ find_optimal_linear_xform
                               = x_max_rot = y_max_rot = z_max_rot = 0.0 ;
   x_max_scale = y_max_scale = z_max_scale = 1.0f ;
   m_scale = MatrixIdentity(4, NULL) ;
-  max_log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L, nsamples, exvivo, Gclamp) ;
+
+  // the pruned parallel search scores candidates with the plain log
+  // likelihood only (see emregistersearch.h)
+  es = NULL ;
+  if (!exvivo && !robust && !use_variance && !emregSearchUseReference())
+    es = emregPackSamples(gcas, nsamples, gca->ninputs, Gclamp) ;
+  if (es)
+    max_log_p = emregLogSampleProbability(gca, es, mri, m_L) ;
+  else
+    max_log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L, nsamples, exvivo, Gclamp) ;
 
   // Loop a set number of times to polish transform
 
@@ -2294,112 +2468,32 @@ find_optimal_linear_xform
       fflush(stdout) ;
     }
 
-    // scale /////////////////////////////////////////////////////////////
-    for (x_scale = min_scale ; x_scale <= max_scale ; x_scale += delta_scale)
     {
-      /*      printf("x_scale = %2.3f\n", x_scale) ;*/
-      *MATRIX_RELT(m_scale, 1, 1) = x_scale ;
-      for (y_scale = min_scale ;
-           y_scale <= max_scale ;
-           y_scale += delta_scale)
+      EMREG_RANGE scale_range = { min_scale, max_scale, delta_scale } ;
+      EMREG_RANGE angle_range = { min_angle, max_angle, delta_rot } ;
+      EMREG_RANGE trans_range = { min_trans, max_trans, delta_trans } ;
+      double max_scales[3], max_rots[3], max_transs[3] ;
+      int    improved ;
+
+      if (es)
+        improved = emregSearchLinearXform(gca, es, mri, m_L, m_origin, m_origin_inv,
+                                          &scale_range, &angle_range, &trans_range,
+                                          &max_log_p, max_scales, max_rots, max_transs) ;
+      else
+        improved = search_linear_xform_grid(gca, gcas, mri, nsamples, m_L, m_origin, m_origin_inv,
+                                            &scale_range, &angle_range, &trans_range,
+                                            &max_log_p, max_scales, max_rots, max_transs) ;
+      if (improved)
       {
-        *MATRIX_RELT(m_scale, 2, 2) = y_scale ;
-        for (z_scale= min_scale ;
-             z_scale <= max_scale;
-             z_scale += delta_scale)
-        {
-          *MATRIX_RELT(m_scale, 3, 3) = z_scale ;
-
-          /* reset translation values */
-          *MATRIX_RELT(m_scale, 1, 4) =
-            *MATRIX_RELT(m_scale, 2, 4) =
-              *MATRIX_RELT(m_scale, 3, 4) = 0.0f ;
-          m_tmp = MatrixMultiply(m_scale, m_origin_inv, m_tmp) ;
-          MatrixMultiply(m_origin, m_tmp, m_scale) ;
-
-          // angle //////////////////////////////
-          for (x_angle = min_angle ;
-               x_angle <= max_angle ;
-               x_angle += delta_rot)
-          {
-            m_x_rot = MatrixReallocRotation
-                      (4, x_angle, X_ROTATION, m_x_rot) ;
-            for (y_angle = min_angle ;
-                 y_angle <= max_angle ;
-                 y_angle += delta_rot)
-            {
-              m_y_rot = MatrixReallocRotation
-                        (4, y_angle, Y_ROTATION, m_y_rot);
-              m_tmp = MatrixMultiply(m_y_rot, m_x_rot, m_tmp) ;
-              for (z_angle= min_angle;
-                   z_angle <= max_angle;
-                   z_angle += delta_rot)
-              {
-                m_z_rot = MatrixReallocRotation
-                          (4, z_angle,Z_ROTATION,m_z_rot);
-                m_rot = MatrixMultiply(m_z_rot, m_tmp, m_rot) ;
-                m_tmp2 = MatrixMultiply
-                         (m_rot, m_origin_inv, m_tmp2) ;
-                MatrixMultiply(m_origin, m_tmp2, m_rot) ;
-
-                m_tmp2 = MatrixMultiply(m_scale, m_rot, m_tmp2) ;
-                m_tmp3 = MatrixMultiply(m_tmp2, m_L, m_tmp3) ;
-
-                // translation //////////
-                for (x_trans = min_trans ;
-                     x_trans <= max_trans ;
-                     x_trans += delta_trans)
-                {
-                  *MATRIX_RELT(m_trans, 1, 4) = x_trans ;
-                  for (y_trans = min_trans ;
-                       y_trans <= max_trans ;
-                       y_trans += delta_trans)
-                  {
-                    *MATRIX_RELT(m_trans, 2, 4) = y_trans ;
-                    for (z_trans= min_trans ;
-                         z_trans <= max_trans ;
-                         z_trans += delta_trans)
-                    {
-                      *MATRIX_RELT(m_trans, 3, 4) =
-                        z_trans ;
-
-                      m_L_tmp = MatrixMultiply
-                                (m_trans, m_tmp3, m_L_tmp) ;
-
-                      log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L_tmp, nsamples, exvivo, Gclamp);
-                      if (log_p > max_log_p)
-                      {
-                        if (exvivo)
-                          printf("current estimates G=%d, W=%d, F=%d\n",
-                                 (int)G_gm_mean, (int)G_wm_mean, (int)G_fluid_mean) ;
-                        max_log_p = log_p ;
-                        x_max_scale = x_scale ;
-                        y_max_scale = y_scale ;
-                        z_max_scale = z_scale ;
-                        x_max_rot = x_angle ;
-                        y_max_rot = y_angle ;
-                        z_max_rot = z_angle ;
-                        x_max_trans = x_trans ;
-                        y_max_trans = y_trans ;
-                        z_max_trans = z_trans ;
-                      }
-#if 0
-                      printf( "%s: log_p = %f\n", __FUNCTION__, log_p );
-                      printf( "%s: Translation (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_trans, y_trans, z_trans );
-                      printf( "%s: Rotation (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_angle, y_angle, z_angle );
-                      printf( "%s: Scale (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_scale, y_scale, z_scale );
-                      exit( 0 );
-#endif
-                    }
-                  }
-                }
-              }
-            }
-          }
-        }
+        x_max_scale = max_scales[0] ;
+        y_max_scale = max_scales[1] ;
+        z_max_scale = max_scales[2] ;
+        x_max_rot = max_rots[0] ;
+        y_max_rot = max_rots[1] ;
+        z_max_rot = max_rots[2] ;
+        x_max_trans = max_transs[0] ;
+        y_max_trans = max_transs[1] ;
+        z_max_trans = max_transs[2] ;
       }
     }
 
@@ -2477,6 +2571,7 @@ find_optimal_linear_xform
   MatrixFree(&m_tmp2) ;
   MatrixFree(&m_trans) ;
   MatrixFree(&m_tmp3) ;
+  emregFreeSamples(&es) ;
 
   return(max_log_p) ;
 }
@@ -8,3 +8,10 @@ fi
 
 test_command mri_em_register -uns 3 -mask brainmask.mgz nu.mgz ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca talairach.lta
 compare_lta talairach.lta talairach.ref.lta
+
+# the pruned parallel search must find the same transform as the reference grid search
+FSTEST_NO_DATA_RESET=1
+export FS_EMREG_SEARCH_REFERENCE=1
+test_command mri_em_register -uns 3 -mask brainmask.mgz nu.mgz ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca talairach.reference.lta
+unset FS_EMREG_SEARCH_REFERENCE
+compare_lta talairach.lta talairach.reference.lta
@@ -83,6 +83,8 @@ USAGE: ./mri_glmfit
 
    --sim nulltype nsim thresh csdbasename : simulation perm, mc-full, mc-z
    --sim-sign signstring : abs, pos, or neg. Default is abs.
+   --sim-threads nthreads : run simulation iterations in parallel
+   --sim-merge outcsd csd1 csd2 ... : merge CSDs from separate sims and exit
    --uniform min max : use uniform distribution instead of gaussian
 
    --pca : perform pca/svd analysis on residual
@@ -497,6 +499,23 @@ only have one row.
 For mc-full, synthesize input as a uniform distribution between min
 and max. 
 
+--sim-threads nthreads
+
+Run the simulation iterations on nthreads threads. Each iteration
+draws its random numbers from its own stream, seeded from --seed and
+the iteration number, so the CSD does not depend on the number of
+threads (but it will differ from a single-threaded run with the same
+seed). The CSD files are rewritten after every batch of iterations
+rather than after every iteration. --diag-cluster, --simcontrastdir
+and --frame-mask always run single-threaded.
+
+--sim-merge outcsd csd1 csd2 ...
+
+Merge the CSD files from simulations run as separate processes (eg,
+on different nodes of a cluster) into one CSD file. The inputs must
+have been created with different seeds but otherwise the same
+parameters.
+
 ENDHELP --------------------------------------------------------------
 
 */
@@ -552,6 +571,7 @@ double round(double x);
 #include "image.h"
 #include "stats.h"
 #include "evschutils.h"
+#include "romp_support.h"
 
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag);
 int RandPermMatrixAndPVR(MATRIX *X, MRI **pvrs, int npvrs);
@@ -564,6 +584,9 @@ static void print_help(void) ;
 static void print_version(void) ;
 static void dump_options(FILE *fp);
 static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel);
+static int SimWriteCSD(CSD *csd, int n, int msecFitTime);
+static int SimCanRunParallel(void);
+static int SimRunParallel(void);
 
 int main(int argc, char *argv[]) ;
 
@@ -663,6 +686,7 @@ double csize;
 MRI *fwhmmap = NULL;
 
 VOLCLUSTER **VolClustList;
+VOLCLUSTERSUMMARY *VolClustSummary;
 
 int DiagCluster=0;
 
@@ -738,6 +762,7 @@ float ThreshList[4] = {1.3,  2.0,  2.3,  3.0};
 int  nSignList = 3, nthSign;
 int SignList[3] = {-1,0,1};
 CSD *csdList[5][3][20];
+int SimThreads = 1;
 
 MATRIX *RTM_Cr, *RTM_intCr, *RTM_TimeSec, *RTM_TimeMin;
 int DoMRTM1=0;
@@ -780,7 +805,6 @@ int main(int argc, char **argv) {
   MATRIX *Ct, *CCt;
   FILE *fp;
   double Ccond, dtmp, threshadj, eff;
-  const char *tmpstr2=NULL;
 
   setenv("FS_MRIMASK_ALLOW_DIFF_GEOM","0",1);
   eresfwhm = -1;
@@ -1754,7 +1778,8 @@ int main(int argc, char **argv) {
 
     printf("\n\nStarting simulation sim over %d trials\n",nsim);
     mytimer.reset() ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
+    if (SimThreads > 1 && SimCanRunParallel()) SimRunParallel();
+    else for (nthsim=0; nthsim < nsim; nthsim++) {
       msecFitTime = mytimer.milliseconds();
       if(debug) printf("%d/%d t=%g ---------------------------------\n",
              nthsim+1,nsim,msecFitTime/(1000*60.0));
@@ -1900,11 +1925,21 @@ int main(int argc, char **argv) {
 	    else {
 	      // volume clustering -------------
 	      if (debug) printf("Clustering on volume\n");
-	      VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
-					      mriglm->mask, &nClusters, NULL);
-	      csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
-	      if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
-	      clustFreeClusterList(&VolClustList,nClusters);
+	      if (Gdiag_no > 0 || clustUseReference()) {
+		VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
+						mriglm->mask, &nClusters, NULL);
+		csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
+		if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
+		clustFreeClusterList(&VolClustList,nClusters);
+	      }
+	      else {
+		// only the cluster sizes are needed, not the member lists
+		VolClustSummary = clustGetClusterSummary(sig, 0, threshadj,-1,csd->threshsign,
+							 mriglm->mask, 0);
+		nClusters = VolClustSummary->nclusters;
+		csize = voxelsize*VolClustSummary->maxnmembers;
+		clustFreeClusterSummary(&VolClustSummary);
+	      }
 	    }
 	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
 			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
@@ -1912,44 +1947,12 @@ int main(int argc, char **argv) {
 	    // Re-write the full CSD file each time. Should not take that
 	    // long and assures output can be used immediately regardless
 	    // of whether the job terminated properly or not
-	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
-	    if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
-	      if(round(csd->threshsign) ==  0) tmpstr2 = "abs"; 
-	      if(round(csd->threshsign) == +1) tmpstr2 = "pos"; 
-	      if(round(csd->threshsign) == -1) tmpstr2 = "neg"; 
-	      //sprintf(tmpstr,"%s-%s.th%04d.%s.csd",simbase,mriglm->glm->Cname[n],
-	      //      (int)round(csd->thresh*100),tmpstr2);
-	      sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
-		      (int)round(csd->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
-	    }
-	    else
-	      sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
-	    if(debug) printf("csd %s \n",tmpstr);
-	    fflush(stdout);
-	    fp = fopen(tmpstr,"w");
-	    if (fp == NULL) {
-	      printf("ERROR: opening %s\n",tmpstr);
-	      exit(1);
-	    }
-	    fprintf(fp,"# ClusterSimulationData 2\n");
-	    fprintf(fp,"# mri_glmfit simulation sim\n");
-	    fprintf(fp,"# hostname %s\n",uts.nodename);
-	    fprintf(fp,"# machine  %s\n",uts.machine);
-	    fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
-	    fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
-	    if (mriglm->mask) fprintf(fp,"# masking 1\n");
-	    else             fprintf(fp,"# masking 0\n");
-	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
-	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
-	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
 	    csd->nreps = nthsim+1;
 	    csd->nClusters[nthsim] = nClusters;
 	    csd->MaxClusterSize[nthsim] = csize;
 	    csd->MaxSig[nthsim] = sigmax;
 	    csd->MaxStat[nthsim] = Fmax;
-	    CSDprint(fp, csd);
-	    fclose(fp);
-	    if(debug) CSDprint(stdout, csd);
+	    SimWriteCSD(csd, n, msecFitTime);
 
 	    if(DiagCluster) {
 	      sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
@@ -2668,6 +2671,26 @@ static int parse_commandline(int argc, char **argv) {
       DoPCC = 0;
       nargsused = 4;
     } 
+    else if (!strcasecmp(option, "--sim-threads")) {
+      if (nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&SimThreads);
+      if (SimThreads < 1) SimThreads = 1;
+      nargsused = 1;
+    } 
+    else if (!strcasecmp(option, "--sim-merge")) {
+      // Merge CSDs from separate sim runs into one, then exit
+      CSD *csdmerged = NULL;
+      int nthcsd;
+      if (nargc < 3) CMDargNErr(option,3);
+      for (nthcsd = 1; CMDnthIsArg(nargc, pargv, nthcsd); nthcsd++) {
+        printf("Merging %s\n",pargv[nthcsd]);
+        csdmerged = CSDreadMerge(pargv[nthcsd],csdmerged);
+        if (csdmerged == NULL) exit(1);
+      }
+      printf("Writing %d repetitions to %s\n",csdmerged->nreps,pargv[0]);
+      if (CSDwrite(pargv[0],csdmerged)) exit(1);
+      exit(0);
+    } 
     else if(!strcasecmp(option, "--sim-thresh-loop")) DoSimThreshLoop = 1;
     else if(!strcasecmp(option, "--sim-thresh-loop-pos")){
       DoSimThreshLoop = 1;
@@ -3203,6 +3226,8 @@ printf("   --kurtosis : compute kurtosis and p-value for kurtosis\n");
 printf("\n");
 printf("   --sim nulltype nsim thresh csdbasename : simulation perm, mc-full, mc-z\n");
 printf("   --sim-sign signstring : abs, pos, or neg. Default is abs.\n");
+printf("   --sim-threads nthreads : run simulation iterations in parallel\n");
+printf("   --sim-merge outcsd csd1 csd2 ... : merge CSDs from separate sims and exit\n");
 printf("   --uniform min max : use uniform distribution instead of gaussian\n");
 printf("   --permute-input : good for testing (not related to sim)\n");
 printf("\n");
@@ -3628,6 +3653,23 @@ printf("--uniform min max\n");
 printf("\n");
 printf("For mc-full, synthesize input as a uniform distribution between min\n");
 printf("and max. \n");
+printf("\n");
+printf("--sim-threads nthreads\n");
+printf("\n");
+printf("Run the simulation iterations on nthreads threads. Each iteration\n");
+printf("draws its random numbers from its own stream, seeded from --seed and\n");
+printf("the iteration number, so the CSD does not depend on the number of\n");
+printf("threads (but it will differ from a single-threaded run with the same\n");
+printf("seed). The CSD files are rewritten after every batch of iterations\n");
+printf("rather than after every iteration. --diag-cluster, --simcontrastdir\n");
+printf("and --frame-mask always run single-threaded.\n");
+printf("\n");
+printf("--sim-merge outcsd csd1 csd2 ...\n");
+printf("\n");
+printf("Merge the CSD files from simulations run as separate processes (eg,\n");
+printf("on different nodes of a cluster) into one CSD file. The inputs must\n");
+printf("have been created with different seeds but otherwise the same\n");
+printf("parameters.\n");
 printf("\n");
   exit(1) ;
 }
@@ -4392,7 +4434,432 @@ MRI *MRIclip(MRI *invol, double thresh, int ClipType, MRI *mask, MRI *outvol)
 }
 
 
+/*--------------------------------------------------------------------*/
+/*!
+  \fn static int SimWriteCSD(CSD *csd, int n, int msecFitTime)
+  \brief Writes the full CSD file for contrast n (the first csd->nreps
+  repetitions).
+*/
+static int SimWriteCSD(CSD *csd, int n, int msecFitTime)
+{
+  char fname[2000];
+  const char *signstr=NULL;
+  FILE *fp;
+
+  strcpy(csd->contrast,mriglm->glm->Cname[n]);
+  if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
+    if(round(csd->threshsign) ==  0) signstr = "abs"; 
+    if(round(csd->threshsign) == +1) signstr = "pos"; 
+    if(round(csd->threshsign) == -1) signstr = "neg"; 
+    sprintf(fname,"%s.th%02d.%s.j001-%s.csd",simbase,
+	    (int)round(csd->thresh*10),signstr,mriglm->glm->Cname[n]);
+  }
+  else
+    sprintf(fname,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
+  if(debug) printf("csd %s \n",fname);
+  fflush(stdout);
+  fp = fopen(fname,"w");
+  if (fp == NULL) {
+    printf("ERROR: opening %s\n",fname);
+    exit(1);
+  }
+  fprintf(fp,"# ClusterSimulationData 2\n");
+  fprintf(fp,"# mri_glmfit simulation sim\n");
+  fprintf(fp,"# hostname %s\n",uts.nodename);
+  fprintf(fp,"# machine  %s\n",uts.machine);
+  fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
+  fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
+  if (mriglm->mask) fprintf(fp,"# masking 1\n");
+  else             fprintf(fp,"# masking 0\n");
+  fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
+  fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
+  fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+  CSDprint(fp, csd);
+  fclose(fp);
+  if(debug) CSDprint(stdout, csd);
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  Parallel simulation. Each thread gets its own copy of everything the
+  simulation writes to (the GLM and its outputs, the permuted design
+  and PVRs, the synthesized data, the surface used for smoothing and
+  clustering). The inputs (y, mask, weights) are shared read-only.
+  --------------------------------------------------------------------*/
+typedef struct {
+  MRIGLM *mriglm;
+  MRIS *surf;
+  MRI *z, *zabs, *p, *sig, *ar1, *fwhmmap;
+} SIM_THREAD;
+
+/*!
+  \fn static int SimCanRunParallel(void)
+  \brief Returns 1 if the simulation options can be run with SimRunParallel().
+  Variance smoothing, per-voxel regressors, weights, and fixed-effects
+  variance all send the test through GLMtest()/GLMtestFFx(), which keep
+  their scratch matrices in static variables, so they have to stay serial.
+*/
+static int SimCanRunParallel(void)
+{
+  if(DiagCluster || simcontrastdir || mriglm->FrameMask){
+    printf("INFO: this simulation cannot run multithreaded, using 1 thread\n");
+    return(0);
+  }
+  if(VarFWHM > 0 || mriglm->npvr > 0 || mriglm->pervoxflag ||
+     mriglm->w != NULL || mriglm->yffxvar != NULL){
+    printf("INFO: var smoothing, pvrs, weights, and ffx cannot run multithreaded, using 1 thread\n");
+    return(0);
+  }
+  return(1);
+}
+
+/*!
+  \fn static unsigned long SimIterSeed(long seed, int nthsim)
+  \brief Seed of the random number stream for iteration nthsim. This is
+  a hash (splitmix64) of the global seed and the iteration number, so
+  each iteration gets its own stream regardless of which thread runs it.
+*/
+static unsigned long SimIterSeed(long seed, int nthsim)
+{
+  unsigned long long x;
+  x = ((unsigned long long)seed << 32) ^ (unsigned long long)(nthsim+1);
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = (x ^ (x >> 31)) & 0xFFFFFFFFULL;
+  if(x == 0) x = 1; // 0 means "seed from the time of day"
+  return((unsigned long)x);
+}
+
+/*!
+  \fn static MRIS *SimCloneSurf(MRIS *src)
+  \brief MRISclone() plus the group area fields used by the cluster area
+*/
+static MRIS *SimCloneSurf(MRIS *src)
+{
+  MRIS *dst;
+  int vtxno;
+  dst = MRISclone(src);
+  dst->group_avg_surface_area = src->group_avg_surface_area;
+  dst->group_avg_vtxarea_loaded = src->group_avg_vtxarea_loaded;
+  for(vtxno=0; vtxno < src->nvertices; vtxno++)
+    dst->vertices[vtxno].group_avg_area = src->vertices[vtxno].group_avg_area;
+  return(dst);
+}
 
+/*!
+  \fn static int SimThreadAlloc(SIM_THREAD *st)
+  \brief Sets up the per-thread data for SimRunIteration().
+*/
+static int SimThreadAlloc(SIM_THREAD *st)
+{
+  MRIGLM *tglm;
+  GLMMAT *glm = mriglm->glm;
+  int n;
 
+  memset(st,0,sizeof(SIM_THREAD));
+  // Shallow copy shares the inputs, then replace everything that gets written
+  tglm = (MRIGLM *) calloc(sizeof(MRIGLM),1);
+  *tglm = *mriglm;
+  tglm->cond = tglm->beta = tglm->yhat = tglm->eres = tglm->rvar = NULL;
+  for(n=0; n < 100; n++){
+    tglm->gamma[n] = tglm->gammaVar[n] = tglm->F[n] = tglm->p[n] = NULL;
+    tglm->sig[n] = tglm->z[n] = tglm->pcc[n] = tglm->ypmf[n] = NULL;
+  }
+  tglm->Xg = MatrixCopy(mriglm->Xg,NULL);
+  if(!strcmp(csd->simtype,"perm"))
+    for(n=0; n < mriglm->npvr; n++) tglm->pvr[n] = MRIcopy(mriglm->pvr[n],NULL);
+  if(!strcmp(csd->simtype,"mc-full")) tglm->y = MRIcopy(mriglm->y,NULL);
+
+  tglm->glm = GLMalloc();
+  tglm->glm->ncontrasts = glm->ncontrasts;
+  for(n=0; n < glm->ncontrasts; n++){
+    tglm->glm->C[n] = MatrixCopy(glm->C[n],NULL);
+    tglm->glm->Cname[n] = glm->Cname[n];
+    tglm->glm->UseGamma0[n] = glm->UseGamma0[n];
+    if(glm->gamma0[n]) tglm->glm->gamma0[n] = MatrixCopy(glm->gamma0[n],NULL);
+    tglm->glm->ypmfflag[n] = glm->ypmfflag[n];
+  }
+  tglm->glm->DoPCC = glm->DoPCC;
+  tglm->glm->ReScaleX = glm->ReScaleX;
+  tglm->glm->AllowZeroDOF = glm->AllowZeroDOF;
+  tglm->glm->dof = glm->dof;
+  st->mriglm = tglm;
+
+  if(surf) st->surf = SimCloneSurf(surf);
+  if(!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")){
+    st->z    = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+    st->zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+  }
+  return(0);
+}
 
+/*!
+  \fn static int SimThreadFree(SIM_THREAD *st)
+  \brief Frees what SimThreadAlloc() and SimRunIteration() allocated.
+  The inputs shared with mriglm are left alone.
+*/
+static int SimThreadFree(SIM_THREAD *st)
+{
+  MRIGLM *tglm = st->mriglm;
+  int n;
 
+  if(tglm){
+    if(tglm->cond) MRIfree(&tglm->cond);
+    if(tglm->beta) MRIfree(&tglm->beta);
+    if(tglm->yhat) MRIfree(&tglm->yhat);
+    if(tglm->eres) MRIfree(&tglm->eres);
+    if(tglm->rvar) MRIfree(&tglm->rvar);
+    for(n=0; n < 100; n++){
+      if(tglm->gamma[n])    MRIfree(&tglm->gamma[n]);
+      if(tglm->gammaVar[n]) MRIfree(&tglm->gammaVar[n]);
+      if(tglm->F[n])        MRIfree(&tglm->F[n]);
+      if(tglm->p[n])        MRIfree(&tglm->p[n]);
+      if(tglm->sig[n])      MRIfree(&tglm->sig[n]);
+      if(tglm->z[n])        MRIfree(&tglm->z[n]);
+      if(tglm->pcc[n])      MRIfree(&tglm->pcc[n]);
+      if(tglm->ypmf[n])     MRIfree(&tglm->ypmf[n]);
+    }
+    MatrixFree(&tglm->Xg);
+    if(!strcmp(csd->simtype,"perm"))
+      for(n=0; n < mriglm->npvr; n++) MRIfree(&tglm->pvr[n]);
+    if(!strcmp(csd->simtype,"mc-full")) MRIfree(&tglm->y);
+    // the contrast names belong to mriglm->glm
+    for(n=0; n < tglm->glm->ncontrasts; n++) tglm->glm->Cname[n] = NULL;
+    GLMfree(&tglm->glm);
+    free(tglm);
+  }
+  if(st->surf)    MRISfree(&st->surf);
+  if(st->z)       MRIfree(&st->z);
+  if(st->zabs)    MRIfree(&st->zabs);
+  if(st->p)       MRIfree(&st->p);
+  if(st->sig)     MRIfree(&st->sig);
+  if(st->ar1)     MRIfree(&st->ar1);
+  if(st->fwhmmap) MRIfree(&st->fwhmmap);
+  memset(st,0,sizeof(SIM_THREAD));
+  return(0);
+}
+
+/*!
+  \fn static int SimRunIteration(SIM_THREAD *st, int nthsim)
+  \brief Runs simulation iteration nthsim using the thread data in st and
+  stores the result in slot nthsim of each CSD in csdList. This follows
+  the serial loop in main() except for where the random numbers come from.
+*/
+static int SimRunIteration(SIM_THREAD *st, int nthsim)
+{
+  MRIGLM *tglm = st->mriglm;
+  RFS *rng;
+  CSD *tcsd;
+  SURFCLUSTERSUM *scs;
+  VOLCLUSTER **vcl;
+  int n, f, nthThresh, nthSign, nclust, cmax, rmax, smax;
+  int *order;
+  double threshadj, sigmax, Fmax, csize;
+
+  // Random number stream for this iteration
+  rng = RFspecInit(SimIterSeed(SynthSeed,nthsim),NULL);
+  if(!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")){
+    rng->name = strcpyalloc(rfs->name);
+    rng->params[0] = rfs->params[0];
+    rng->params[1] = rfs->params[1];
+  }
+  else if(!strcmp(csd->simtype,"mc-full") && !UseUniform){
+    rng->name = strcpyalloc("gaussian");
+    rng->params[0] = 0;
+    rng->params[1] = 1;
+  }
+  else {
+    rng->name = strcpyalloc("uniform");
+    rng->params[0] = UseUniform ? UniformMin : 0;
+    rng->params[1] = UseUniform ? UniformMax : 1;
+  }
+
+  if (!strcmp(csd->simtype,"mc-full")) {
+    RFsynth(tglm->y,rng,NULL);
+    if(logflag) MRIlog(tglm->y,tglm->mask,-1,1,tglm->y);
+    if(FWHM > 0) SmoothSurfOrVol(st->surf, tglm->y, tglm->mask, SmoothLevel);
+  }
+  if (!strcmp(csd->simtype,"perm")) {
+    if (!OneSamplePerm) {
+      // Fisher-Yates shuffle of the original rows (one-based for MatrixReorderRows)
+      order = (int *) calloc(mriglm->Xg->rows,sizeof(int));
+      for(f=0; f < mriglm->Xg->rows; f++) order[f] = f+1;
+      for(f=mriglm->Xg->rows-1; f > 0; f--){
+	int k = (int)(RFdrawVal(rng)*(f+1));
+	int tmp;
+	if(k > f) k = f;
+	tmp = order[f]; order[f] = order[k]; order[k] = tmp;
+      }
+      MatrixReorderRows(mriglm->Xg, order, tglm->Xg);
+      for(n=0; n < mriglm->npvr; n++){
+	int c,r,s;
+	for(c=0; c < mriglm->pvr[n]->width; c++){
+	  for(r=0; r < mriglm->pvr[n]->height; r++){
+	    for(s=0; s < mriglm->pvr[n]->depth; s++){
+	      for(f=0; f < mriglm->Xg->rows; f++)
+		MRIsetVoxVal(tglm->pvr[n],c,r,s,f,MRIgetVoxVal(mriglm->pvr[n],c,r,s,order[f]-1));
+	    }
+	  }
+	}
+      }
+      free(order);
+    }
+    else {
+      for (f=0; f < mriglm->y->nframes; f++) {
+	if (RFdrawVal(rng) > 0.5) tglm->Xg->rptr[f+1][1] = +1;
+	else                      tglm->Xg->rptr[f+1][1] = -1;
+      }
+    }
+  }
+
+  if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+    if (VarFWHM > 0) {
+      MRIglmFit(tglm);
+      SmoothSurfOrVol(st->surf, tglm->rvar, tglm->mask, VarSmoothLevel);
+      MRIglmTest(tglm);
+    }
+    else {
+      MRIglmFitAndTest(tglm);
+      if(!strcmp(csd->simtype,"perm") && PermNonStatCor) {
+	if(st->ar1)     MRIfree(&st->ar1);
+	if(st->fwhmmap) MRIfree(&st->fwhmmap);
+	st->ar1 = MRISar1(st->surf, tglm->eres, tglm->mask, NULL);
+	st->fwhmmap = MRISfwhmFromAR1Map(st->surf, tglm->mask, st->ar1);
+      }
+    }
+  }
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < tglm->glm->ncontrasts; n++) {
+	tcsd = csdList[nthThresh][nthSign][n];
+	if(tcsd->threshsign == 0) threshadj = tcsd->thresh;
+	else threshadj = tcsd->thresh - log10(2.0); // one-sided test
+
+	if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+	  st->sig = MRIlog10(tglm->p[n],NULL,st->sig,1);
+	  if(tcsd->threshsign != 0) MRIsetSign(st->sig,tglm->gamma[n],0);
+	  sigmax = MRIframeMax(st->sig,0,tglm->mask,tcsd->threshsign,&cmax,&rmax,&smax);
+	  Fmax = MRIgetVoxVal(tglm->F[n],cmax,rmax,smax,0);
+	  if(tcsd->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
+	}
+	else {
+	  if(nthThresh == 0 && nthSign == 0) {
+	    RFsynth(st->z,rng,tglm->mask);
+	    if (SmoothLevel > 0) {
+	      SmoothSurfOrVol(st->surf, st->z, tglm->mask, SmoothLevel);
+	      RFrescale(st->z,rng,tglm->mask,st->z);
+	    }
+	  }
+	  st->zabs = MRIabs(st->z,st->zabs);
+	  st->p = RFstat2P(st->zabs,rng,tglm->mask,0,st->p);
+	  MRIscalarMul(st->p,st->p,2);
+	  st->sig = MRIlog10(st->p,NULL,st->sig,1);
+	  if(tcsd->threshsign != 0) MRIsetSign(st->sig,st->z,0);
+	  sigmax = MRIframeMax(st->sig,0,tglm->mask,tcsd->threshsign,&cmax,&rmax,&smax);
+	  Fmax = MRIgetVoxVal(st->z,cmax,rmax,smax,0);
+	  if(tcsd->threshsign == 0) Fmax = fabs(Fmax);
+	}
+	if(tglm->mask) MRImask(st->sig,tglm->mask,st->sig,0.0,0.0);
+
+	if(st->surf) {
+	  MRIScopyMRI(st->surf, st->sig, 0, "val");
+	  scs = sclustMapSurfClusters(st->surf,threshadj,-1,tcsd->threshsign,
+				      0,&nclust,NULL,st->fwhmmap);
+	  csize = sclustMaxClusterArea(scs, nclust);
+	  free(scs);
+	}
+	else {
+	  if (clustUseReference()) {
+	    vcl = clustGetClusters(st->sig, 0, threshadj,-1,tcsd->threshsign,0,
+				   tglm->mask, &nclust, NULL);
+	    csize = voxelsize*clustMaxClusterCount(vcl,nclust);
+	    clustFreeClusterList(&vcl,nclust);
+	  }
+	  else {
+	    VOLCLUSTERSUMMARY *vcs;
+	    vcs = clustGetClusterSummary(st->sig, 0, threshadj,-1,tcsd->threshsign,
+					 tglm->mask, 0);
+	    nclust = vcs->nclusters;
+	    csize = voxelsize*vcs->maxnmembers;
+	    clustFreeClusterSummary(&vcs);
+	  }
+	}
+	if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
+			 tglm->glm->Cname[n],nthsim,nclust,csize,sigmax,Fmax);
+
+	// Each iteration owns its own slot, so no locking is needed
+	tcsd->nClusters[nthsim] = nclust;
+	tcsd->MaxClusterSize[nthsim] = csize;
+	tcsd->MaxSig[nthsim] = sigmax;
+	tcsd->MaxStat[nthsim] = Fmax;
+      }
+    }
+  }
+  RFspecFree(&rng);
+  return(0);
+}
+
+/*!
+  \fn static int SimRunParallel(void)
+  \brief Runs all nsim simulation iterations on SimThreads threads.
+  Iterations are run in batches; after each batch, the CSD files are
+  rewritten with all the iterations done so far so that they can be used
+  even if the job does not finish.
+*/
+static int SimRunParallel(void)
+{
+  SIM_THREAD *st;
+  int nthThresh, nthSign, n, nthreads, batch, start, stop;
+  int msecFitTime;
+
+  nthreads = SimThreads;
+#ifndef HAVE_OPENMP
+  nthreads = 1;
+#endif
+  printf("Running simulation with %d threads\n",nthreads);
+
+  // The sign does not change across iterations, so set it up front
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csdList[nthThresh][nthSign][n]->threshsign = SignList[nthSign];
+	if(mriglm->glm->C[n]->rows > 1) csdList[nthThresh][nthSign][n]->threshsign = 0;
+      }
+    }
+  }
+
+  st = (SIM_THREAD *) calloc(nthreads,sizeof(SIM_THREAD));
+  for(n=0; n < nthreads; n++) SimThreadAlloc(&st[n]);
+
+  batch = 4*nthreads;
+  for(start = 0; start < nsim; start += batch){
+    stop = MIN(start+batch,nsim);
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) num_threads(nthreads) schedule(dynamic,1)
+#endif
+    for(int nthsim = start; nthsim < stop; nthsim++){
+      ROMP_PFLB_begin
+      SimRunIteration(&st[omp_get_thread_num()], nthsim);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    msecFitTime = mytimer.milliseconds();
+    if(debug) printf("%d/%d t=%g ---------------------------------\n",
+		     stop,nsim,msecFitTime/(1000*60.0));
+    for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+      for(nthSign = 0; nthSign < nSignList; nthSign++){
+	for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	  csdList[nthThresh][nthSign][n]->nreps = stop;
+	  SimWriteCSD(csdList[nthThresh][nthSign][n], n, msecFitTime);
+	}
+      }
+    }
+  }
+  for(n=0; n < nthreads; n++) SimThreadFree(&st[n]);
+  free(st);
+  return(0);
+}
@@ -167,6 +167,10 @@ int main(int argc, char *argv[]) {
   int csizen;
   int nClusters, cmax,rmax,smax;
   SURFCLUSTERSUM *SurfClustList;
+  SURFCLUSTERTREE *sct = NULL;
+  double threshadjList[100], csizeList[100];
+  int nClustersList[100], csizenList[100];
+  float cweightvtxList[100];
   Timer mytimer;
   LABEL *clabel;
   FILE *fp, *fpLog=NULL;
@@ -392,6 +396,9 @@ int main(int argc, char *argv[]) {
     ppZ[k] = &(MRIFseq_vox(z,k,0,0,0));
   }
 
+  // All the thresholds of a sign are clustered in one pass
+  if(!sclustUseReference()) sct = sclustTreeAlloc(surf);
+
   // Start the simulation loop
   printf("\n\nStarting Simulation over %d Repetitions\n",nRepetitions);
   if(fpLog) fprintf(fpLog,"\n\nStarting Simulation over %d Repetitions\n",nRepetitions);
@@ -452,28 +459,49 @@ int main(int argc, char *argv[]) {
 	  for(k=0; k < nmaskout; k++) MRIsetVoxVal(sig, maskoutvtxno[k],0,0,0, 0.0);
 	}
 
-	// Copy sig to vertexval
-	//MRIScopyMRI(surf, sig, 0, "val"); // MRIScopyMRI() is a little slow
-	ppVal = ppVal0;
-	ppSig = ppSig0;
-	for(k=0; k < surf->nvertices; k++) *(*ppVal++) = *(*ppSig++);
+	if(sct){
+	  // Cluster sig at all the thresholds at once
+	  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+	    csd = csdList[nthFWHM][nthThresh][nthSign];
+	    if(csd->threshsign == 0) threshadjList[nthThresh] = csd->thresh;
+	    else threshadjList[nthThresh] = csd->thresh - log10(2.0); // one-sided test
+	  }
+	  sclustTreeMaxClusters(sct, &MRIFseq_vox(sig,0,0,0,0), csd->threshsign,
+				threshadjList, nThreshList, nClustersList,
+				csizeList, csizenList, cweightvtxList);
+	}
+	else {
+	  // Copy sig to vertexval
+	  //MRIScopyMRI(surf, sig, 0, "val"); // MRIScopyMRI() is a little slow
+	  ppVal = ppVal0;
+	  ppSig = ppSig0;
+	  for(k=0; k < surf->nvertices; k++) *(*ppVal++) = *(*ppSig++);
+	}
 
 	for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
 	  csd = csdList[nthFWHM][nthThresh][nthSign];
 
-	  // Surface clustering
-	  // Set the threshold
-	  if(csd->threshsign == 0) threshadj = csd->thresh;
-	  else threshadj = csd->thresh - log10(2.0); // one-sided test
-	  // Compute clusters
-	  SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						0,&nClusters,NULL,NULL);
-	  // Actual area of cluster with max area
-	  csize  = sclustMaxClusterArea(SurfClustList, nClusters);
-	  // Number of vertices of cluster with max number of vertices. 
-	  // Note: this may be a different cluster from above!
-	  csizen = sclustMaxClusterCount(SurfClustList, nClusters);
-	  cweightvtx = sclustMaxClusterWeightVtx(SurfClustList, nClusters, csd->threshsign);
+	  if(sct){
+	    nClusters  = nClustersList[nthThresh];
+	    csize      = csizeList[nthThresh];
+	    csizen     = csizenList[nthThresh];
+	    cweightvtx = cweightvtxList[nthThresh];
+	  }
+	  else {
+	    // Surface clustering
+	    // Set the threshold
+	    if(csd->threshsign == 0) threshadj = csd->thresh;
+	    else threshadj = csd->thresh - log10(2.0); // one-sided test
+	    // Compute clusters
+	    SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
+						  0,&nClusters,NULL,NULL);
+	    // Actual area of cluster with max area
+	    csize  = sclustMaxClusterArea(SurfClustList, nClusters);
+	    // Number of vertices of cluster with max number of vertices. 
+	    // Note: this may be a different cluster from above!
+	    csizen = sclustMaxClusterCount(SurfClustList, nClusters);
+	    cweightvtx = sclustMaxClusterWeightVtx(SurfClustList, nClusters, csd->threshsign);
+	  }
 	  // Area of this cluster based on average vertex area. This just scales
 	  // the number of vertices.
 	  csizeavg = csizen * avgvtxarea;
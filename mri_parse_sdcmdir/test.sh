@@ -3,3 +3,17 @@ source "$(dirname $0)/../test.sh"
 
 test_command mri_parse_sdcmdir --sortbyrun --d . --o dicomdir.sumfile
 compare_file dicomdir.sumfile dicomdir.ref.sumfile
+
+# the DICOM index must give the same summary as the fresh scan above,
+# both when it is first written and when the files are read from it
+if [ "$FSTEST_REGENERATE" != true ]; then
+   FSTEST_NO_DATA_RESET=1
+   test_command mkdir -p index
+   test_command "mri_parse_sdcmdir --sortbyrun --d . --index index/sdcmindex --o dicomdir.index1.sumfile 2>&1 | tee index1.log"
+   test_command "mri_parse_sdcmdir --sortbyrun --d . --index index/sdcmindex --o dicomdir.index2.sumfile 2>&1 | tee index2.log"
+   test_command grep -q \"INFO: 0 files from DICOM index\" index1.log
+   test_command grep -q \"files from DICOM index\" index2.log
+   EXPECT_FAILURE=1 test_command grep -q \"INFO: 0 files from DICOM index\" index2.log
+   compare_file dicomdir.index1.sumfile dicomdir.sumfile
+   compare_file dicomdir.index2.sumfile dicomdir.sumfile
+fi
@@ -364,6 +364,7 @@ void MultiRegistration::initRegistration(RegRobust & R)
   R.setCost(Registration::ROB);
   R.setSaturation(sat);
   R.setDoublePrec(doubleprec);
+  R.setStreamAb(streamab);
   //R.setDebug(debug);
 
   if (subsamplesize > 0)
@@ -67,7 +67,7 @@ public:
           affine(false), trans(NULL), subsamplesize(-1), minsize(-1), maxsize(-1),
           debug(0), verbose(1),initorient(false), inittransform(true), initscaling(false),
           highit(-1), mri_source(NULL), mri_target(NULL), iscaleinit(1.0),
-          iscalefinal(1.0), doubleprec(false), symmetry(true),
+          iscalefinal(1.0), doubleprec(false), streamab(false), symmetry(true),
           sampletype(SAMPLE_TRILINEAR), resample(false), costfun(ROB), converged(false)
   {
   }
@@ -238,6 +238,12 @@ public:
     doubleprec = b;
   }
 
+  //! Specify if A'WA and A'Wb are accumulated instead of storing A (less memory)
+  void setStreamAb(bool b)
+  {
+    streamab = b;
+  }
+
   // void setWLimit( double d)      {wlimit = d;};
   //! Specify whether registration is symmetric or at target space
   void setSymmetry(bool b)
@@ -426,6 +432,7 @@ protected:
   double iscaleinit;
   double iscalefinal;
   bool doubleprec;
+  bool streamab;
 //  double wlimit;
   bool symmetry;
   int sampletype;
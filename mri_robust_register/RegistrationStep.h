@@ -51,7 +51,7 @@ public:
       sat(R.sat), iscale(R.iscale), transonly(R.transonly), rigid(R.rigid), isoscale(
           R.isoscale), trans(R.trans), costfun(R.costfun), rtype(1), subsamplesize(
           R.subsamplesize), debug(R.debug), verbose(R.verbose), floatsvd(false), iscalefinal(
-          R.iscalefinal), mri_weights(NULL), mri_indexing(NULL)
+          R.iscalefinal), streamab(R.streamab), mri_weights(NULL), mri_indexing(NULL)
   {
   }
 
@@ -102,6 +102,12 @@ public:
   }
   // only makes sense for T=double;
 
+  //! Accumulate A'WA and A'Wb on the fly instead of storing A (saves most of the memory)
+  void setStreamAb(bool s)
+  {
+    streamab = s;
+  }
+
   // only public because of resampling testing in Registration.cpp
   // should be made protected at some point.
   void constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T> &A, vnl_vector<T> &b);
@@ -115,6 +121,17 @@ protected:
 
   vnl_matrix<T> constructR(const vnl_vector<T> & p);
 
+  //! What is needed to regenerate one row of A and b
+  struct AbRow
+  {
+    float fx, fy, fz, ft, b;
+    unsigned int x, y, z;
+  };
+  void constructAbRows(MRI *mriS, MRI *mriT, vnl_matrix<T> *A, vnl_vector<T> *b,
+      std::vector<AbRow> *rows);
+  vnl_vector<T> computeDenseEstimate(MRI * mriS, MRI* mriT, vnl_vector<T>& w);
+  vnl_vector<T> computeStreamedEstimate(MRI * mriS, MRI* mriT, vnl_vector<T>& w);
+
 private:
 // in:
 
@@ -131,6 +148,7 @@ private:
   int verbose;
   bool floatsvd; // should be removed
   double iscalefinal; // from the last step, used in constructAB
+  bool streamab;
 
 // out:
 
@@ -163,80 +181,14 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
     exit(1);
   }
 
-  vnl_matrix<T> A;
-  vnl_vector<T> b;
-
-  if (rigid && rtype == 2)
-  {
-    if (verbose > 1)
-      std::cout << "rigid and rtype 2 !" << std::endl;
-    assert(rtype !=2);
-
-    // compute non rigid A
-    rigid = false;
-    constructAb(mriS, mriT, A, b);
-    rigid = true;
-    // now restrict A  (= A R(lastp) )
-    vnl_matrix<T> R;
-    if (pvec.size() > 0)
-      R = constructR(pvec); // construct from last param estimate
-    else // construct from identity:
-    {
-      int l = 6;
-      if (!rigid)
-        l = 12;
-      if (iscale)
-        l++;
-      vnl_vector<T> tempp(l, 0.0);
-      R = constructR(tempp);
-      //MatrixPrintFmt(stdout,"% 2.8f",R);exit(1);
-    }
-    A = A * R.transpose();
-  }
+  vnl_vector<T> w;
+  if (streamab && !(rigid && rtype == 2))
+    pvec = computeStreamedEstimate(mriS, mriT, w); // never stores A
   else
-  {
-    //std::cout << "Rtype  " << rtype << std::endl;
-
-    constructAb(mriS, mriT, A, b);
-  }
-
-  if (verbose > 1)
-    std::cout << "   - checking A and b for nan ..." << std::flush;
-  if (!A.is_finite() || !b.is_finite())
-  {
-    std::cerr << " A or b constain NAN or infinity values!!" << std::endl;
-    exit(1);
-  }
-
-  if (verbose > 1)
-    std::cout << "  DONE" << std::endl;
+    pvec = computeDenseEstimate(mriS, mriT, w);
 
-  Regression<T> R(A, b);
-  R.setVerbose(verbose);
-  R.setFloatSvd(floatsvd);
   if (costfun == Registration::ROB)
   {
-    vnl_vector<T> w;
-    if (verbose > 1)
-      std::cout << "   - compute robust estimate ( sat " << sat << " )..."
-          << std::flush;
-    if (sat < 0)
-      pvec = R.getRobustEstW(w);
-    else
-      pvec = R.getRobustEstW(w, sat);
-
-    A.clear();
-    b.clear();
-
-    if (verbose > 1)
-      std::cout << "  DONE" << std::endl;
-
-//    std::cout << " pvec  : "<< std::endl;
-//    std::cout.precision(16);
-//    for (unsigned int iii=0;iii<pvec.size(); iii++)
-//      std::cout << pvec[iii] << std::endl;;
-//    std::cout.precision(8);
-
     // transform weights vector back to 3d (mri real)
     if (mri_weights
         && (mri_weights->width != mriS->width
@@ -326,22 +278,11 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
   }
   else
   {
-    if (verbose > 1)
-      std::cout << "   - compute least squares estimate ..." << std::flush;
-    pvec = R.getLSEst();
-
-    A.clear();
-    b.clear();
-    if (verbose > 1)
-      std::cout << "  DONE" << std::endl;
     // no weights in this case
     if (mri_weights)
       MRIfree(&mri_weights);
   }
 
-//  zeroweights = R.getLastZeroWeightPercent();
-  zeroweights = R.getLastWeightPercent(); // does not need pointers A and B to be valid
-
 //  R.plotPartialSat(name);
 
 //   if (mriS->depth ==1 || mriT->depth ==1)
@@ -361,6 +302,157 @@ std::pair<vnl_matrix_fixed<double, 4, 4>, double> RegistrationStep<T>::computeRe
   return Md;
 }
 
+/** Robust (or least squares) estimate of the parameters from the full
+ matrix A and vector b (see constructAb). Returns sqrt weights in w.
+ */
+template<class T>
+vnl_vector<T> RegistrationStep<T>::computeDenseEstimate(MRI * mriS, MRI* mriT,
+    vnl_vector<T>& w)
+{
+  vnl_vector<T> p;
+  vnl_matrix<T> A;
+  vnl_vector<T> b;
+
+  if (rigid && rtype == 2)
+  {
+    if (verbose > 1)
+      std::cout << "rigid and rtype 2 !" << std::endl;
+    assert(rtype !=2);
+
+    // compute non rigid A
+    rigid = false;
+    constructAb(mriS, mriT, A, b);
+    rigid = true;
+    // now restrict A  (= A R(lastp) )
+    vnl_matrix<T> R;
+    if (pvec.size() > 0)
+      R = constructR(pvec); // construct from last param estimate
+    else // construct from identity:
+    {
+      int l = 6;
+      if (!rigid)
+        l = 12;
+      if (iscale)
+        l++;
+      vnl_vector<T> tempp(l, 0.0);
+      R = constructR(tempp);
+      //MatrixPrintFmt(stdout,"% 2.8f",R);exit(1);
+    }
+    A = A * R.transpose();
+  }
+  else
+  {
+    //std::cout << "Rtype  " << rtype << std::endl;
+
+    constructAb(mriS, mriT, A, b);
+  }
+
+  if (verbose > 1)
+    std::cout << "   - checking A and b for nan ..." << std::flush;
+  if (!A.is_finite() || !b.is_finite())
+  {
+    std::cerr << " A or b constain NAN or infinity values!!" << std::endl;
+    exit(1);
+  }
+
+  if (verbose > 1)
+    std::cout << "  DONE" << std::endl;
+
+  Regression<T> R(A, b);
+  R.setVerbose(verbose);
+  R.setFloatSvd(floatsvd);
+  if (costfun == Registration::ROB)
+  {
+    if (verbose > 1)
+      std::cout << "   - compute robust estimate ( sat " << sat << " )..."
+          << std::flush;
+    if (sat < 0)
+      p = R.getRobustEstW(w);
+    else
+      p = R.getRobustEstW(w, sat);
+
+    A.clear();
+    b.clear();
+
+    if (verbose > 1)
+      std::cout << "  DONE" << std::endl;
+
+//    std::cout << " pvec  : "<< std::endl;
+//    std::cout.precision(16);
+//    for (unsigned int iii=0;iii<pvec.size(); iii++)
+//      std::cout << pvec[iii] << std::endl;;
+//    std::cout.precision(8);
+  }
+  else
+  {
+    if (verbose > 1)
+      std::cout << "   - compute least squares estimate ..." << std::flush;
+    p = R.getLSEst();
+
+    A.clear();
+    b.clear();
+    if (verbose > 1)
+      std::cout << "  DONE" << std::endl;
+  }
+
+//  zeroweights = R.getLastZeroWeightPercent();
+  zeroweights = R.getLastWeightPercent(); // does not need pointers A and B to be valid
+
+  return p;
+}
+
+/** Same as computeDenseEstimate, but A is never stored: only the
+ derivatives needed to regenerate each row are kept, and the
+ regression accumulates A'WA and A'Wb in parallel blocks.
+ */
+template<class T>
+vnl_vector<T> RegistrationStep<T>::computeStreamedEstimate(MRI * mriS, MRI* mriT,
+    vnl_vector<T>& w)
+{
+  std::vector<AbRow> rows;
+  constructAbRows(mriS, mriT, NULL, NULL, &rows);
+
+  const Transformation * tr = trans;
+  const int dof = trans->getDOF();
+  const bool isc = iscale;
+  int pnum = dof;
+  if (iscale)
+    pnum++;
+  auto rowfun = [&rows, tr, dof, isc](long i, double * a) -> double
+  {
+    const AbRow & row = rows[i];
+    tr->fillGradient(row.x, row.fx, row.y, row.fy, row.z, row.fz, a);
+    if (isc)
+      a[dof] = row.ft;
+    return row.b;
+  };
+
+  Regression<T> R;
+  R.setVerbose(verbose);
+  vnl_vector<T> p;
+  if (costfun == Registration::ROB)
+  {
+    if (verbose > 1)
+      std::cout << "   - compute robust estimate, streamed ( sat " << sat << " )..."
+          << std::flush;
+    if (sat < 0)
+      p = R.getRobustEstWStream(rows.size(), pnum, rowfun, w);
+    else
+      p = R.getRobustEstWStream(rows.size(), pnum, rowfun, w, sat);
+  }
+  else
+  {
+    if (verbose > 1)
+      std::cout << "   - compute least squares estimate, streamed ..." << std::flush;
+    p = R.getLSEstStream(rows.size(), pnum, rowfun);
+  }
+  if (verbose > 1)
+    std::cout << "  DONE" << std::endl;
+
+  zeroweights = R.getLastWeightPercent();
+  return p;
+}
+
 /** Constructs matrix A and vector b for robust regression
    (see Reuter et. al, Neuroimage 2010)
  */
@@ -368,6 +460,17 @@ template<class T>
 void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
     vnl_vector<T>&b)
 {
+  constructAbRows(mriS, mriT, &A, &b, NULL);
+}
+
+/** Either fills A and b (rows == NULL), or only stores the per row
+   derivatives and b entry in rows, from which a row of A can be
+   regenerated with trans->fillGradient (see computeStreamedEstimate).
+ */
+template<class T>
+void RegistrationStep<T>::constructAbRows(MRI *mriS, MRI *mriT,
+    vnl_matrix<T> *A, vnl_vector<T> *b, std::vector<AbRow> *rows)
+{
 
   if (verbose > 1)
     std::cout << "   - constructAb: " << std::endl;
@@ -631,38 +734,53 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
   if (iscale)
     pnum++;
   //cout << " pnum: " << pnum << "  counti: " << counti<<  endl;
-  double amu = ((double) counti * (pnum + 1)) * sizeof(T) / (1024.0 * 1024.0); // +1 =  rowpointer vector
-  double bmu = (double) counti * sizeof(T) / (1024.0 * 1024.0);
-  if (verbose > 1)
-    std::cout << "     -- allocating " << amu + bmu << "Mb mem for A and b ... "
-        << std::flush;
-  bool OK = A.set_size(counti, pnum);
-  OK = OK && b.set_size(counti);
-  if (!OK)
-  {
-    std::cout << std::endl;
-    ErrorExit(ERROR_NO_MEMORY,
-        "Registration::constructAB could not allocate memory for A and b");
-  }
-  if (verbose > 1)
-    std::cout << " done! " << std::endl;
-  double maxmu = 5 * amu + 7 * bmu;
-  string fstr = "";
-  if (floatsvd)
+  if (rows)
   {
-    maxmu = amu + 3 * bmu + 2 * (amu + bmu);
-    fstr = "-float";
+    // streamed: rows only, A'WA and A'Wb are accumulated later
+    double rmu = ((double) counti * sizeof(AbRow)) / (1024.0 * 1024.0);
+    if (verbose > 1)
+      std::cout << "     -- allocating " << rmu << "Mb mem for rows of A and b ... "
+          << std::flush;
+    rows->resize(counti);
+    if (verbose > 1)
+      std::cout << " done! " << std::endl;
   }
-  if (verbose > 1)
-    std::cout << "         (MAX usage in SVD" << fstr << " will be > " << maxmu
-        << "Mb mem + 6 MRI) " << std::endl;
-  if (maxmu > 3800)
+  else
   {
-    std::cout << "     -- WARNING: mem usage large: " << maxmu
-        << "Mb mem + 6 MRI" << std::endl;
-    //string fsvd;
-    //if (doubleprec) fsvd = "remove --doubleprec and/or ";
-    std::cout << "          Maybe use --subsample <int> " << std::endl;
+    double amu = ((double) counti * (pnum + 1)) * sizeof(T) / (1024.0 * 1024.0); // +1 =  rowpointer vector
+    double bmu = (double) counti * sizeof(T) / (1024.0 * 1024.0);
+    if (verbose > 1)
+      std::cout << "     -- allocating " << amu + bmu << "Mb mem for A and b ... "
+          << std::flush;
+    bool OK = A->set_size(counti, pnum);
+    OK = OK && b->set_size(counti);
+    if (!OK)
+    {
+      std::cout << std::endl;
+      ErrorExit(ERROR_NO_MEMORY,
+          "Registration::constructAB could not allocate memory for A and b");
+    }
+    if (verbose > 1)
+      std::cout << " done! " << std::endl;
+    double maxmu = 5 * amu + 7 * bmu;
+    string fstr = "";
+    if (floatsvd)
+    {
+      maxmu = amu + 3 * bmu + 2 * (amu + bmu);
+      fstr = "-float";
+    }
+    if (verbose > 1)
+      std::cout << "         (MAX usage in SVD" << fstr << " will be > " << maxmu
+          << "Mb mem + 6 MRI) " << std::endl;
+    if (maxmu > 3800)
+    {
+      std::cout << "     -- WARNING: mem usage large: " << maxmu
+          << "Mb mem + 6 MRI" << std::endl;
+      //string fsvd;
+      //if (doubleprec) fsvd = "remove --doubleprec and/or ";
+      std::cout << "          Maybe use --subsample <int> " << std::endl;
+      std::cout << "          or --stream to avoid storing A " << std::endl;
+    }
   }
 
 //        char ch;
@@ -752,12 +870,28 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
           //cout << "x: " << x << " y: " << y << " z: " << z << " count: "<< count << std::endl;
           //cout << " " << count << " mrifx: " << MRIFvox(mri_fx, x, y, z) << " mrifx int: " << (int)MRIvox(mri_fx,x,y,z) <<endl;
 
+          if (rows)
+          {
+            // keep what is needed to regenerate this row of A
+            AbRow & row = (*rows)[count];
+            row.fx = fxval;
+            row.fy = fyval;
+            row.fz = fzval;
+            row.ft = ftval;
+            row.b  = MRIFseq_vox(SmT, x, y, z, f);
+            row.x  = x;
+            row.y  = y;
+            row.z  = z;
+            count++;
+            continue;
+          }
+
           // new: now use transformation model to get the gradient vector
           vnl_vector < double > grad = trans->getGradient(x,fxval,y,fyval,z,fzval);
           int dof = grad.size();
           for (int pno = 0; pno < dof; pno++)
           {
-            A[count][pno] = grad[pno];
+            (*A)[count][pno] = grad[pno];
           }
 
 //         if (transonly)
@@ -880,10 +1014,10 @@ void RegistrationStep<T>::constructAb(MRI *mriS, MRI *mriT, vnl_matrix<T>& A,
           // intensity model: R(s,IS,IT) = exp(-0.5 s) IT - exp(0.5 s) IS
           //                  R'  = -0.5 ( exp(-0.5 s) IT + exp(0.5 s) IS)
           //   ft = 0.5 ( exp(-0.5s) IT + exp(0.5s) IS)  (average of intensity adjusted images)
-          if (iscale) A[count][dof] = ftval;
+          if (iscale) (*A)[count][dof] = ftval;
 
           // A p = b = IS - IT
-          b[count] = MRIFseq_vox(SmT, x, y, z, f);
+          (*b)[count] = MRIFseq_vox(SmT, x, y, z, f);
 
           count++;// start with 0 above
 
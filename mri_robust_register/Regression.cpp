@@ -29,6 +29,7 @@
 #include <limits>
 #include <vector>
 #include <fstream>
+#include <algorithm>
 #include "RobustGaussian.h"
 
 #define export // obsolete feature 'export template' used in these headers 
@@ -570,6 +571,270 @@ vnl_vector<T> Regression<T>::getLSEst()
   return p;
 }
 
+// rows are streamed in blocks of this size, the partial sums of the blocks are
+// added in block order, so the result does not depend on the number of threads
+#define REGRESSION_STREAM_BLOCK 65536
+
+/** One pass over the rows: computes sqrt weights from the residuals r / sigma
+ (Tukey, as getSqrtTukeyDiaWeights) into w and accumulates
+ \f$ A^T W A \f$ and \f$ A^T W b\f$. Without r, or with sigma 0, all weights are 1.
+ */
+template<class T>
+template<class RowFun>
+void Regression<T>::accumulateWeightedNormals(long n, int pnum,
+    const RowFun& rowfun, const vnl_vector<T>* r, double sigma, double sat,
+    vnl_vector<T>* w, vnl_matrix<double>& AtWA, vnl_vector<double>& AtWb)
+{
+  const long nblocks = (n + REGRESSION_STREAM_BLOCK - 1) / REGRESSION_STREAM_BLOCK;
+  const int psize = pnum * pnum + pnum;
+  std::vector<double> partial(nblocks * psize, 0.0);
+
+  long block;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for (block = 0; block < nblocks; block++)
+  {
+    double * ata = &partial[block * psize];
+    double * atb = ata + pnum * pnum;
+    std::vector<double> a(pnum);
+    long end = std::min(n, (block + 1) * (long) REGRESSION_STREAM_BLOCK);
+    for (long i = block * REGRESSION_STREAM_BLOCK; i < end; i++)
+    {
+      double wi = 1.0;
+      if (r && sigma > 0.0)
+      {
+        double t1 = (*r)[i] / (sigma * sat);
+        wi = (fabs(t1) >= 1.0) ? 0.0 : 1.0 - t1 * t1;
+      }
+      if (w)
+        (*w)[i] = (T) wi;
+      if (wi == 0.0)
+        continue;
+
+      double bi = rowfun(i, &a[0]);
+      double ww = (double) ((T) wi) * (double) ((T) wi);
+      for (int j = 0; j < pnum; j++)
+      {
+        double wa = ww * a[j];
+        for (int k = j; k < pnum; k++)
+          ata[j * pnum + k] += wa * a[k];
+        atb[j] += wa * bi;
+      }
+    }
+  }
+
+  AtWA.set_size(pnum, pnum);
+  AtWA.fill(0.0);
+  AtWb.set_size(pnum);
+  AtWb.fill(0.0);
+  for (block = 0; block < nblocks; block++)
+  {
+    const double * ata = &partial[block * psize];
+    const double * atb = ata + pnum * pnum;
+    for (int j = 0; j < pnum; j++)
+    {
+      for (int k = j; k < pnum; k++)
+        AtWA(j, k) += ata[j * pnum + k];
+      AtWb[j] += atb[j];
+    }
+  }
+  for (int j = 0; j < pnum; j++)
+    for (int k = 0; k < j; k++)
+      AtWA(j, k) = AtWA(k, j);
+}
+
+/** One pass over the rows: r = b - A p, returns
+ \f$ \sum w_i^2 r_i^2 / \sum w_i^2 \f$ (w are sqrt weights, all 1 if w is NULL)
+ */
+template<class T>
+template<class RowFun>
+double Regression<T>::computeStreamResiduals(long n, int pnum,
+    const RowFun& rowfun, const vnl_vector<T>& p, const vnl_vector<T>* w,
+    vnl_vector<T>& r)
+{
+  const long nblocks = (n + REGRESSION_STREAM_BLOCK - 1) / REGRESSION_STREAM_BLOCK;
+  std::vector<double> partial(2 * nblocks, 0.0);
+
+  long block;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for (block = 0; block < nblocks; block++)
+  {
+    std::vector<double> a(pnum);
+    double sw = 0.0, swr = 0.0;
+    long end = std::min(n, (block + 1) * (long) REGRESSION_STREAM_BLOCK);
+    for (long i = block * REGRESSION_STREAM_BLOCK; i < end; i++)
+    {
+      double ri = rowfun(i, &a[0]);
+      for (int j = 0; j < pnum; j++)
+        ri -= a[j] * p[j];
+      r[i] = (T) ri;
+      double ww = w ? (double) (*w)[i] * (double) (*w)[i] : 1.0;
+      sw += ww;
+      swr += ww * ri * ri;
+    }
+    partial[2 * block] = sw;
+    partial[2 * block + 1] = swr;
+  }
+
+  double sw = 0.0, swr = 0.0;
+  for (block = 0; block < nblocks; block++)
+  {
+    sw += partial[2 * block];
+    swr += partial[2 * block + 1];
+  }
+  return swr / sw;
+}
+
+template<class T>
+vnl_vector<T> Regression<T>::solveNormals(vnl_matrix<double>& AtWA,
+    const vnl_vector<double>& AtWb)
+{
+  if (!AtWA.is_finite() || !AtWb.is_finite())
+  {
+    std::cerr << " A or b constain NAN or infinity values!!" << std::endl;
+    exit(1);
+  }
+  vnl_qr<double> QR(AtWA);
+  vnl_vector<double> pd = QR.solve(AtWb);
+  vnl_vector<T> p(pd.size());
+  for (unsigned int i = 0; i < pd.size(); i++)
+    p[i] = (T) pd[i];
+  return p;
+}
+
+/** Same iteratively reweighted least squares as getRobustEstWAB, but the rows
+ of A and b are generated on the fly by rowfun, so A is never stored.
+ Each iteration takes two passes: weights fused with accumulating the normal
+ equations, then residuals fused with the error. Memory is a few vectors of
+ length n instead of the n x pnum matrix A (and its weighted copy).
+ */
+template<class T>
+template<class RowFun>
+vnl_vector<T> Regression<T>::getRobustEstWStream(long n, int pnum,
+    const RowFun& rowfun, vnl_vector<T>& wfinal, double sat, double sig)
+{
+  if (verbose > 1)
+    cout << "  Regression<T>::getRobustEstWStream( "<<sat<<" , "<<sig<<" )  n: " << n << endl;
+
+  // constants
+  int MAXIT = 20;
+  double EPS = 2e-12;
+
+  std::vector<T> err(MAXIT + 1);
+  err[0] = numeric_limits<T>::infinity();
+  err[1] = 1e20;
+  double sigma;
+
+  // init residuals (based on zero p, so r := b )
+  vnl_vector<T> r(n);
+  vnl_vector<T> p(pnum, 0.0), lastp(pnum, 0.0);
+  vnl_vector<T> w(n), lastw(n);
+  computeStreamResiduals(n, pnum, rowfun, p, NULL, r);
+
+  vnl_matrix<double> AtWA;
+  vnl_vector<double> AtWb;
+  int count = 0;
+  int incr = 0;
+  do
+  {
+    count++;
+
+    if (count > 1)
+    {
+      lastp.swap(p);
+      lastw.swap(w);
+    }
+
+    sigma = getSigmaMAD(r);
+    if (sigma < EPS) // e.g. if images are identical
+    {
+      cout << "  Sigma too small: " << sigma << " (identical images?)" << endl;
+      sigma = 0.0;
+    }
+
+    // weights and weighted normal equations in one pass, then solve
+    accumulateWeightedNormals(n, pnum, rowfun, &r, sigma, sat, &w, AtWA, AtWb);
+    p = solveNormals(AtWA, AtWb);
+
+    // new residuals and total error err = sum (w r^2) / sum (w)
+    err[count] = computeStreamResiduals(n, pnum, rowfun, p, &w, r);
+    if (err[count - 1] <= err[count])
+      incr++;
+  } while (incr < 1 && count < MAXIT && err[count] > EPS);
+
+  r.clear();
+
+  vnl_vector<T> pfinal;
+  if (err[count] > err[count - 1])
+  {
+    // take previous values (since actual values made the error to increase)
+    pfinal = lastp;
+    wfinal = lastw;
+    if (verbose > 1)
+      cout << "     Step: " << count - 2 << " ERR: " << err[count - 1] << endl;
+    lasterror = err[count - 1];
+  }
+  else
+  {
+    pfinal = p;
+    wfinal = w;
+    if (verbose > 1)
+      cout << "     Step: " << count - 1 << " ERR: " << err[count] << endl;
+    lasterror = err[count];
+  }
+  lastw.clear();
+  w.clear();
+
+  // compute statistics on weights (as getRobustEstWAB):
+  std::vector<double> a(pnum);
+  double dd = 0.0;
+  double ddcount = 0;
+  int zcount = 0;
+  for (long i = 0; i < n; i++)
+  {
+    if (fabs(rowfun(i, &a[0])) > 0.00001)
+    {
+      T val = wfinal[i];
+      dd += val;
+      ddcount++;
+      if (val < 0.1)
+        zcount++;
+    }
+  }
+  dd /= ddcount;
+  if (verbose > 1)
+    cout << "          weights average: " << dd << "  zero: "
+        << (double) zcount / ddcount << flush;
+  lastweight = dd;
+  lastzero = (double) zcount / ddcount;
+
+  return pfinal;
+}
+
+/** Least squares via the normal equations, rows generated by rowfun (see getRobustEstWStream)
+ */
+template<class T>
+template<class RowFun>
+vnl_vector<T> Regression<T>::getLSEstStream(long n, int pnum, const RowFun& rowfun)
+{
+  lastweight = -1;
+  lastzero = -1;
+
+  vnl_matrix<double> AtWA;
+  vnl_vector<double> AtWb;
+  accumulateWeightedNormals(n, pnum, rowfun, NULL, 0.0, SATr, NULL, AtWA, AtWb);
+  vnl_vector<T> p = solveNormals(AtWA, AtWb);
+
+  // compute error:
+  vnl_vector<T> r(n);
+  lasterror = computeStreamResiduals(n, pnum, rowfun, p, NULL, r) * n;
+
+  return p;
+}
+
 template<class T>
 void getTukeyBiweight(const vnl_vector<T>& r, vnl_vector<T>& w, double sat)
 {
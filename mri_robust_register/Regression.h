@@ -56,6 +56,11 @@ public:
       A(NULL), b(&bp), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
   {}
 
+  //! Constructor for the streaming solvers below (no A or b is stored)
+  Regression() :
+      A(NULL), b(NULL), lasterror(-1), lastweight(-1), lastzero(-1), verbose(1), floatsvd(false)
+  {}
+
   //! Robust solver
   vnl_vector<T> getRobustEst(double sat = SATr, double sig=1.4826);
   //! Robust solver (returning also the sqrtweights)
@@ -68,6 +73,15 @@ public:
   //! Weighted least squares in float (only for the T=double version)
   vnl_vector<T> getWeightedLSEstFloat(const vnl_vector<T> & sqrtweights);
 
+  //! Robust solver that never stores A: row i of A (pnum entries) is written to a
+  //! by rowfun(i, a), which returns b_i. A'WA and A'Wb are accumulated instead.
+  template<class RowFun>
+  vnl_vector<T> getRobustEstWStream(long n, int pnum, const RowFun& rowfun,
+      vnl_vector<T>&w, double sat=SATr, double sig=1.4826);
+  //! Least squares, streaming version of getLSEst
+  template<class RowFun>
+  vnl_vector<T> getLSEstStream(long n, int pnum, const RowFun& rowfun);
+
   double getLastError()
   {
     return lasterror;
@@ -106,6 +120,15 @@ protected:
   vnl_vector<T> getRobustEstWAB(vnl_vector<T>&w, double sat = SATr, double sig = 1.4826);
   double getRobustEstWB(vnl_vector<T>&w, double sat = SATr, double sig = 1.4826);
 
+  template<class RowFun>
+  void accumulateWeightedNormals(long n, int pnum, const RowFun& rowfun,
+      const vnl_vector<T>* r, double sigma, double sat, vnl_vector<T>* w,
+      vnl_matrix<double>& AtWA, vnl_vector<double>& AtWb);
+  template<class RowFun>
+  double computeStreamResiduals(long n, int pnum, const RowFun& rowfun,
+      const vnl_vector<T>& p, const vnl_vector<T>* w, vnl_vector<T>& r);
+  vnl_vector<T> solveNormals(vnl_matrix<double>& AtWA, const vnl_vector<double>& AtWb);
+
   T getSigmaMAD(const vnl_vector<T>& r, T d = 1.4826);
   T VectorMedian(const vnl_vector<T>& v);
 
@@ -59,6 +59,15 @@ public:
   virtual vnl_vector<double> getGradient(const unsigned int& x, const float& fx,
       const unsigned int& y, const float& fy, const unsigned int& z,
       const float& fz) const =0;
+  //! Same as getGradient, but writes the getDOF() entries to g instead of allocating
+  virtual void fillGradient(const unsigned int& x, const float& fx,
+      const unsigned int& y, const float& fy, const unsigned int& z,
+      const float& fz, double* g) const
+  {
+    vnl_vector<double> ret = getGradient(x, fx, y, fy, z, fz);
+    for (unsigned int i = 0; i < ret.size(); i++)
+      g[i] = ret[i];
+  }
 
   //! Set the parameters from double std vector
   void setParameters(const std::vector<double> &p)
@@ -802,6 +811,24 @@ public:
     return ret;
   }
 
+  inline virtual void fillGradient(const unsigned int& x,
+      const float& fx, const unsigned int& y, const float& fy,
+      const unsigned int& z, const float& fz, double* ret) const
+  {
+    ret[0] = fx * x;
+    ret[1] = fx * y;
+    ret[2] = fx * z;
+    ret[3] = fx;
+    ret[4] = fy * x;
+    ret[5] = fy * y;
+    ret[6] = fy * z;
+    ret[7] = fy;
+    ret[8] = fz * x;
+    ret[9] = fz * y;
+    ret[10] = fz * z;
+    ret[11] = fz;
+  }
+
 };
 
 /** \class Transform3dAffine2
@@ -1220,6 +1247,18 @@ public:
     return ret;
   }
 
+  inline virtual void fillGradient(const unsigned int& x,
+      const float& fx, const unsigned int& y, const float& fy,
+      const unsigned int& z, const float& fz, double* ret) const
+  {
+    ret[0] = fx;
+    ret[1] = fy;
+    ret[2] = fz;
+    ret[3] = (fz * y - fy * z);
+    ret[4] = (fx * z - fz * x);
+    ret[5] = (fy * x - fx * y);
+  }
+
 };
 
 /** \class Transform3dRigid2
@@ -1379,6 +1418,15 @@ public:
     return ret;
   }
 
+  inline virtual void fillGradient(const unsigned int& x,
+      const float& fx, const unsigned int& y, const float& fy,
+      const unsigned int& z, const float& fz, double* ret) const
+  {
+    ret[0] = fx;
+    ret[1] = fy;
+    ret[2] = fz;
+  }
+
 };
 
 /** \class TransformIdentity
@@ -120,6 +120,7 @@ struct Parameters
   double pairepsit;
   float  resthresh;
   double frobnormthresh;
+  bool streamab;
 };
 
 // Initializations:
@@ -127,7 +128,7 @@ static struct Parameters P =
 { vector<string>(0), vector<string>(0), "", vector<string>(0), vector<string>(0), vector<string>(
     0), vector<string>(0), false, false, false, false, false, false, false, false, false,
     5, -1.0, SAT, vector<string>(0), 0, 1, -1, false, false, SSAMPLE, false, false, "", false,
-    true, vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01, 0.01, 0.0001};
+    true, vector<string>(0), vector<string>(0), SAMPLE_CUBIC_BSPLINE, -1, 0 , false, 5, 0.01, 0.01, 0.0001, false};
 
 static void printUsage(void);
 static bool parseCommandLine(int argc, char *argv[], Parameters & P);
@@ -217,6 +218,7 @@ int main(int argc, char *argv[])
     MR.setKeepType(!P.floattype);
     MR.setAverage(P.average);
     MR.setDoublePrec(P.doubleprec);
+    MR.setStreamAb(P.streamab);
     MR.setSubsamplesize(P.subsamplesize);
     MR.setHighit(P.highit);
     if (P.nweights.size() > 0)
@@ -676,6 +678,14 @@ static int parseNextCommand(int argc, char *argv[], Parameters & P)
         << "--doubleprec: Will perform algorithm with double precision (higher mem usage)!"
         << endl;
   }
+  else if (!strcmp(option, "STREAM"))
+  {
+    P.streamab = true;
+    nargs = 0;
+    cout
+        << "--stream: Will accumulate normal equations instead of storing A (lower mem usage)!"
+        << endl;
+  }
   else if (!strcmp(option, "WEIGHTS"))
   {
     nargs = 0;
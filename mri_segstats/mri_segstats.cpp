@@ -66,6 +66,7 @@
 #include "diag.h"
 #include "mri.h"
 #include "mri2.h"
+#include "mrisegstats.h"
 #include "version.h"
 #include "cma.h"
 #include "gca.h"
@@ -203,6 +204,8 @@ int main(int argc, char **argv)
   float min, max, range, mean, std, snr;
   FILE *fp;
   double  **favg, *favgmn;
+  MRI_SEGINDEX *segindex = NULL;
+  float *pvvols = NULL;
   char tmpstr[1000];
   double atlas_icv=0;
   int ntotalsegid=0;
@@ -816,6 +819,25 @@ int main(int argc, char **argv)
   printf("Computing statistics for each segmentation\n");
   fflush(stdout);
 
+  // Index the voxels of each segmentation once, rather than rescanning
+  // the whole volume for each one
+  if (!dontrun && !MRIsegStatsUseReference())
+  {
+    int *ids = (int *) calloc(sizeof(int),nsegid);
+    for (n=0; n < nsegid; n++) ids[n] = StatSumTable[n].id;
+    segindex = MRIsegIndexAlloc(seg, ids, nsegid);
+    free(ids);
+    if (segindex != NULL && pvvol != NULL && !mris)
+    {
+      pvvols = (float *) calloc(sizeof(float),segindex->nsegs);
+      if (MRIsegIndexPVVolumes(segindex, seg, pvvol, pvvols) != NO_ERROR)
+      {
+        free(pvvols);
+        pvvols = NULL;
+      }
+    }
+  }
+
   DoContinue=0;nx=0;skip=0;n0=0;vol=0;nhits=0;c=0;min=0.0;max=0.0;range=0.0;mean=0.0;std=0.0;snr=0.0;
 
   ROMP_PF_begin
@@ -858,15 +880,25 @@ int main(int argc, char **argv)
     {
       if (!mris)
       {
-        if (pvvol == NULL)
+        if (segindex)
+        {
+          nhits = MRIsegIndexCount(segindex, StatSumTable[n].id);
+        }
+        else
         {
           nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+        }
+        if (pvvol == NULL)
+        {
           vol = nhits*voxelvolume;
         }
+        else if (pvvols)
+        {
+          vol = pvvols[MRIsegIndexFind(segindex, StatSumTable[n].id)];
+        }
         else
         {
           vol = MRIvoxelsInLabelWithPartialVolumeEffects(seg, pvvol, StatSumTable[n].id, NULL, NULL);
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
 //          nhits = nint(vol/voxelvolume);
         }
       }  // if (!mris)
@@ -903,7 +935,13 @@ int main(int argc, char **argv)
     {
       if (nhits > 0)
       {
-        if(UseRobust == 0)
+        if(segindex && UseRobust == 0)
+          MRIsegIndexStats(segindex, StatSumTable[n].id, invol, frame,
+            &min, &max, &range, &mean, &std);
+        else if(segindex)
+          MRIsegIndexStatsRobust(segindex, StatSumTable[n].id, invol, frame,
+            &min, &max, &range, &mean, &std, RobustPct);
+        else if(UseRobust == 0)
           MRIsegStats(seg, StatSumTable[n].id, invol, frame,
             &min, &max, &range, &mean, &std);
         else
@@ -1425,7 +1463,8 @@ int main(int argc, char **argv)
 	if (n%20 == 19) printf("\n");
 	fflush(stdout);
       }
-      nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
+      if(segindex) nvox = MRIsegIndexFrameAvg(segindex, StatSumTable[n].id, invol, favg[n]);
+      else         nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
       favgmn[n] = 0.0;
       for(f=0; f < invol->nframes; f++) {
 	if(DoFrameSum) favg[n][f] *= nvox; // Undo spatial average
@@ -60,6 +60,7 @@
 #include "proto.h"
 #include "stats.h"
 #include "timer.h"
+#include "romp_support.h"
 #include "const.h"
 #include "mrishash.h"
 #include "icosahedron.h"
@@ -77,6 +78,7 @@
 #include "transform.h"
 #include "talairachex.h"
 #include "mri_circulars.h"
+#include "watershedflood.h"
 #include "timer.h"
 
 
@@ -139,7 +141,8 @@ BasinCell;
 
 typedef struct Bound
 {
-  unsigned char x,y,z,val;
+  int x,y,z;
+  unsigned char val;
   struct Bound *next;
 }
 Bound;
@@ -351,6 +354,7 @@ int CopyOnly = 0;
 char *rusage_file=NULL;
 double xthresh=0;
 int xthreshset=0;
+static int conform_min = 0 ;
 
 #ifndef __OPTIMIZE__
 // this routine is slow and should be used only for diagnostics
@@ -380,19 +384,17 @@ void FindMainWmComponent(MRI_variables *MRI_var);
 int CharSorting(MRI_variables *MRI_var);
 int sqroot(int r);
 int Analyze(STRIP_PARMS *parms,MRI_variables *MRI_var);
+static int FloodBasins(STRIP_PARMS *parms,MRI_variables *MRI_var);
 Cell* FindBasin(Cell *cell);
 int Lookat(int,int,int,unsigned char,int*,Cell**,int*,Cell* adtab[27],
            STRIP_PARMS *parms,MRI_variables *MRI_var);
 int Test(Coord crd,STRIP_PARMS *parms,MRI_variables *MRI_var);
 Cell* TypeVoxel(Cell *cell);
 int PostAnalyze(STRIP_PARMS *parms,MRI_variables *MRI_var);
-int Merge(unsigned char i,unsigned char j,unsigned char k,
-          int val,int *n,MRI_variables *MRI_var);
+int Merge(int i,int j,int k,int val,int *n,MRI_variables *MRI_var);
 int AddVoxel(MRI_variables *MRI_var);
-int AroundCell(unsigned char i,unsigned char j,unsigned char k,
-               MRI_variables *MRI_var);
-int MergeRoutine(unsigned char,unsigned char,unsigned char,int,int*,
-                 MRI_variables *MRI_var);
+int AroundCell(int i,int j,int k,MRI_variables *MRI_var);
+int MergeRoutine(int,int,int,int,int*,MRI_variables *MRI_var);
 int FreeMem(MRI_variables *MRI_var);
 int Save(MRI_variables *MRI_var);
 #if 0
@@ -752,6 +754,12 @@ get_option(int argc, char *argv[],STRIP_PARMS *parms)
     xthreshset=1;
     nargs=1;
   }
+  else if (!strcmp(option, "conform_min"))
+  {
+    conform_min = 1 ;
+    nargs = 0 ;
+    fprintf(stdout,"Mode:          conform to the smallest voxel size\n") ;
+  }
   else if (!strcmp(option, "keep"))
   {
     parms->KeepEdits = 1;
@@ -1158,8 +1166,29 @@ int main(int argc, char *argv[])
     MATRIX *m_conform, *m_tmp ;
     MRI *mri_tmp ;
 
-    printf("conforming input...\n") ;
-    mri_tmp = MRIconform(mri_with_skull) ;
+    if (conform_min)
+    {
+      int   conform_width ;
+      float conform_size ;
+      MRI   *mri_templ, *mri_uchar ;
+
+      /* high resolution input: keep its resolution
+         instead of resampling to 256^3 1mm voxels */
+      conform_size = MRIfindMinSize(mri_with_skull, &conform_width) ;
+      printf("conforming input to %d^3 voxels of %g mm...\n",
+             conform_width, conform_size) ;
+      mri_templ = MRIconformedTemplate(mri_with_skull, conform_width,
+                                       conform_size, 0) ;
+      mri_uchar = MRIchangeType(mri_with_skull, MRI_UCHAR, 0.0, 0.999, FALSE) ;
+      mri_tmp = MRIresample(mri_uchar, mri_templ, SAMPLE_TRILINEAR) ;
+      MRIfree(&mri_uchar) ;
+      MRIfree(&mri_templ) ;
+    }
+    else
+    {
+      printf("conforming input...\n") ;
+      mri_tmp = MRIconform(mri_with_skull) ;
+    }
     if (parms->transform)
     {
       LTA *lta = (LTA *) (parms->transform->xform);
@@ -1880,7 +1909,11 @@ int Watershed(STRIP_PARMS *parms,MRI_variables *MRI_var)
   fprintf(stdout,"\n      preflooding height equal to %d percent",
           parms->hpf) ;
 
-  CharSorting(MRI_var);
+  /* FloodBasins() sorts the voxels itself */
+  if (wshedUseReference())
+  {
+    CharSorting(MRI_var);
+  }
   fprintf(stdout,"\ndone.");
 
   fprintf(stdout,"\nAnalyze...\n");
@@ -3442,37 +3475,44 @@ int Analyze(STRIP_PARMS *parms,MRI_variables *MRI_var)
   MRI_var->basinnumber=0;
   MRI_var->basinsize=0;
 
-  n=MRI_var->sqrdim[MRI_var->Imax]; // the sqrt of the population at Imax
-  for (u=0; u<n; u++)
+  if (!wshedUseReference())
   {
-    free(MRI_var->Table[MRI_var->Imax][u]);
+    FloodBasins(parms,MRI_var);
   }
-  free(MRI_var->Table[MRI_var->Imax]);
-
-  for (pos=MRI_var->Imax-1; pos>0; pos--)
+  else
   {
-    l=0;
-    d=MRI_var->tabdim[pos];  // the population at pos
-    n=MRI_var->sqrdim[pos];  // the sqrt of the d
-    while (l<d)
-    {
-      ld=ldiv(l,n);
-      u=ld.quot;
-      v=ld.rem;
-      Test(MRI_var->Table[pos][u][v],parms,MRI_var);
-      l++;
-    }
+    n=MRI_var->sqrdim[MRI_var->Imax]; // the sqrt of the population at Imax
     for (u=0; u<n; u++)
     {
-      free(MRI_var->Table[pos][u]);
+      free(MRI_var->Table[MRI_var->Imax][u]);
     }
-    free(MRI_var->Table[pos]);
+    free(MRI_var->Table[MRI_var->Imax]);
 
-    if (Gdiag & DIAG_SHOW)
+    for (pos=MRI_var->Imax-1; pos>0; pos--)
     {
-      fprintf(stdout,"\n      %3d%%... %8ld basins; main size = %8ld ",
-              (MRI_var->Imax-pos)*100/(MRI_var->Imax-1),
-              MRI_var->basinnumber,MRI_var->basinsize);
+      l=0;
+      d=MRI_var->tabdim[pos];  // the population at pos
+      n=MRI_var->sqrdim[pos];  // the sqrt of the d
+      while (l<d)
+      {
+        ld=ldiv(l,n);
+        u=ld.quot;
+        v=ld.rem;
+        Test(MRI_var->Table[pos][u][v],parms,MRI_var);
+        l++;
+      }
+      for (u=0; u<n; u++)
+      {
+        free(MRI_var->Table[pos][u]);
+      }
+      free(MRI_var->Table[pos]);
+
+      if (Gdiag & DIAG_SHOW)
+      {
+        fprintf(stdout,"\n      %3d%%... %8ld basins; main size = %8ld ",
+                (MRI_var->Imax-pos)*100/(MRI_var->Imax-1),
+                MRI_var->basinnumber,MRI_var->basinsize);
+      }
     }
   }
 
@@ -3512,6 +3552,132 @@ int Analyze(STRIP_PARMS *parms,MRI_variables *MRI_var)
   return 0;
 }
 
+/*-----------------------------------------------------
+  Floods the volume as the Test() loop of Analyze() does,
+  with the engine of watershedflood.cpp, and writes the
+  basins back into the Cell table for PostAnalyze():
+  each basin has its BasinCell in its root voxel and every
+  other voxel of the basin points to the root (type 1).
+  ------------------------------------------------------*/
+static int FloodBasins(STRIP_PARMS *parms,MRI_variables *MRI_var)
+{
+  WSHED_FLOOD *wf;
+  Cell *gcell;
+  int ig,jg,kg,k,pos,bad=0;
+
+  wf=wshedAlloc(MRI_var->width,MRI_var->height,MRI_var->depth);
+  if (!wf)
+    ErrorExit(ERROR_BADPARM,
+              "%s: %dx%dx%d volume too large for the watershed, "
+              "set FS_WATERSHED_REFERENCE", Progname,
+              MRI_var->width,MRI_var->height,MRI_var->depth);
+
+  /*the global minimum and the voxels Pre_CharSorting() attached to it*/
+  ig=MRI_var->i_global_min;
+  jg=MRI_var->j_global_min;
+  kg=MRI_var->k_global_min;
+  gcell=&MRI_var->Basin[kg][jg][ig];
+  wshedAddBasin(wf,ig,jg,kg,((BasinCell*)gcell->next)->depth,
+                ((BasinCell*)gcell->next)->size,
+                ((BasinCell*)gcell->next)->ambiguous,1);
+  free(gcell->next);
+  gcell->next=NULL;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+:bad)
+#endif
+  for (k=0; k<MRI_var->depth; k++)
+  {
+    ROMP_PFLB_begin
+    int i,j;
+    Cell *cell;
+
+    for (j=0; j<MRI_var->height; j++)
+      for (i=0; i<MRI_var->width; i++)
+      {
+        cell=&MRI_var->Basin[k][j][i];
+        if (cell->type==1 && cell->next==gcell)
+          wshedJoin(wf,i,j,k,ig,jg,kg);
+        else if (cell->type && cell!=gcell)
+          bad++;
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  if (bad)
+    ErrorExit(ERROR_BADPARM,
+              "%s: %d voxels of unexpected type before the flooding",
+              Progname,bad);
+
+  wshedSortVoxels(wf,MRI_var->mri_src,MRI_var->Imax,
+                  (unsigned char)parms->hpf,parms->watershed_analyze,
+                  MRI_var->WM_MIN,MRI_var->WM_MAX,MRI_var->WM_VARIANCE);
+
+  for (pos=MRI_var->Imax-1; pos>0; pos--)
+  {
+    wshedFloodLevel(wf,pos,MRI_var->tabdim[pos]);
+
+    if (Gdiag & DIAG_SHOW)
+    {
+      fprintf(stdout,"\n      %3d%%... %8ld basins; main size = %8ld ",
+              (MRI_var->Imax-pos)*100/(MRI_var->Imax-1),
+              wf->basinnumber,wf->basinsize);
+    }
+  }
+
+  MRI_var->basinnumber=wf->basinnumber;
+  MRI_var->basinsize=wf->basinsize;
+  for (pos=0; pos<256; pos++)
+  {
+    MRI_var->gmnumber[pos]+=wf->gmnumber[pos];
+  }
+
+  /*back to the Cell table*/
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (k=0; k<MRI_var->depth; k++)
+  {
+    ROMP_PFLB_begin
+    int i,j,v,r,b;
+    Cell *cell;
+
+    for (j=0; j<MRI_var->height; j++)
+      for (i=0; i<MRI_var->width; i++)
+      {
+        v=i+MRI_var->width*(j+MRI_var->height*k);
+        r=wshedRoot(wf,v);
+        if (r<0)
+        {
+          continue;
+        }
+        cell=&MRI_var->Basin[k][j][i];
+        if (r==v)
+        {
+          b=WSHED_BASIN(wf->parent[v]);
+          cell->type=wf->bmain[b] ? 3 : 2;
+          cell->next=(BasinCell*)CreateBasinCell(wf->bdepth[b],wf->bsize[b],
+                                                 wf->bambiguous[b]);
+        }
+        else
+        {
+          cell->type=1;
+          cell->next=(Cell*)&MRI_var->Basin
+                     [r/(MRI_var->width*MRI_var->height)]
+                     [(r/MRI_var->width)%MRI_var->height]
+                     [r%MRI_var->width];
+        }
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  wshedFree(&wf);
+  return 0;
+}
+
 /*looking at a voxel, finds the corresponding basin*/
 Cell* FindBasin(Cell *cell)
 {
@@ -3737,8 +3903,7 @@ Cell* TypeVoxel(Cell *cell)
 
 
 /*Looks if the voxel is a border from the segmented brain*/
-int AroundCell( unsigned char i,unsigned char j,unsigned char k,
-                MRI_variables *MRI_var )
+int AroundCell( int i,int j,int k,MRI_variables *MRI_var )
 {
   int val=0,n=0;
 
@@ -3784,12 +3949,19 @@ int AroundCell( unsigned char i,unsigned char j,unsigned char k,
 
 
 /*Merge voxels which intensity is near the intensity of border voxels*/
-int MergeRoutine( unsigned char i,unsigned char j,unsigned char k,
-                  int val,int *n,MRI_variables *MRI_var )
+int MergeRoutine( int i,int j,int k,int val,int *n,MRI_variables *MRI_var )
 {
   int cond=15*val;
   Bound *buff;
-  Cell cell=MRI_var->Basin[k][j][i];
+  Cell cell;
+
+  /* the borders can be reached after a few AddVoxel():
+     wrap around the volume as the former unsigned char
+     coordinates did in 256^3 volumes */
+  i=(i+MRI_var->width)%MRI_var->width;
+  j=(j+MRI_var->height)%MRI_var->height;
+  k=(k+MRI_var->depth)%MRI_var->depth;
+  cell=MRI_var->Basin[k][j][i];
 
   if (cell.type<2)
     if (abs(MRIvox(MRI_var->mri_src,i,j,k)-val)*100<cond)
@@ -3817,8 +3989,7 @@ int MergeRoutine( unsigned char i,unsigned char j,unsigned char k,
 }
 
 
-int Merge( unsigned char i,unsigned char j,unsigned char k,
-           int val,int *n,MRI_variables *MRI_var )
+int Merge( int i,int j,int k,int val,int *n,MRI_variables *MRI_var )
 {
 
   MergeRoutine(i-1,j,k,val,n,MRI_var);
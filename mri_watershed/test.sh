@@ -21,3 +21,21 @@ else
    compare_vol brainmask.mgz brainmask.ref.mgz
 fi
 
+
+# -conform_min strips a 0.7mm input at 0.7mm. Its mask must agree with the
+# 1mm reference mask, up to the voxels along the brain boundary (the count
+# threshold is about 5% of the mask)
+if [ "$FSTEST_REGENERATE" != true ]; then
+   FSTEST_NO_DATA_RESET=1 && init_testdata
+   mri_convert=$(find_path $FSTEST_CWD mri_convert/mri_convert)
+   lta_convert=$(find_path $FSTEST_CWD lta_convert/lta_convert)
+   mri_binarize=$(find_path $FSTEST_CWD mri_binarize/mri_binarize)
+   mri_diff=$(find_path $FSTEST_CWD mri_diff/mri_diff)
+   test_command $mri_convert -vs 0.7 0.7 0.7 T1.mgz T1.0.7.mgz
+   test_command $lta_convert --inlta talairach_with_skull.lta --src T1.0.7.mgz --ltavox2vox --outlta talairach_with_skull.0.7.lta
+   test_command mri_watershed -conform_min -T1 -brain_atlas ${FREESURFER_HOME}/average/RB_all_withskull_2016-05-10.vc700.gca talairach_with_skull.0.7.lta T1.0.7.mgz brainmask.0.7.mgz
+   test_command $mri_convert -rl brainmask.ref.mgz -rt nearest brainmask.0.7.mgz brainmask.0.7.1mm.mgz
+   test_command $mri_binarize --i brainmask.0.7.1mm.mgz --min 1 --o mask.0.7.mgz
+   test_command $mri_binarize --i brainmask.ref.mgz --min 1 --o mask.ref.mgz
+   test_command $mri_diff --count-thresh 75000 mask.0.7.mgz mask.ref.mgz
+fi
@@ -0,0 +1,338 @@
+/**
+ * @brief flooding engine of the mri_watershed watershed step
+ *
+ * see watershedflood.h
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "error.h"
+#include "romp_support.h"
+
+#include "watershedflood.h"
+
+int wshedUseReference(void)
+{
+  static int use_reference = -1 ;
+  if (use_reference < 0)
+    use_reference = (getenv("FS_WATERSHED_REFERENCE") != NULL) ;
+  return(use_reference) ;
+}
+
+WSHED_FLOOD *wshedAlloc(int width, int height, int depth)
+{
+  WSHED_FLOOD *wf ;
+  size_t      nvox, v ;
+
+  nvox = (size_t)width * height * depth ;
+  if (nvox >= (size_t)INT_MAX)
+    return(NULL) ;
+
+  wf = (WSHED_FLOOD *)calloc(1, sizeof(WSHED_FLOOD)) ;
+  if (!wf)
+    ErrorExit(ERROR_NOMEMORY, "wshedAlloc: could not allocate flood") ;
+  wf->width = width ;
+  wf->height = height ;
+  wf->depth = depth ;
+  wf->parent = (int *)malloc(nvox*sizeof(int)) ;
+  if (!wf->parent)
+    ErrorExit(ERROR_NOMEMORY, "wshedAlloc: could not allocate %ld voxels", (long)nvox) ;
+  for (v = 0 ; v < nvox ; v++)
+    wf->parent[v] = WSHED_UNFLOODED ;
+  return(wf) ;
+}
+
+int wshedFree(WSHED_FLOOD **pwf)
+{
+  WSHED_FLOOD *wf = *pwf ;
+
+  if (!wf)
+    return(NO_ERROR) ;
+  free(wf->parent) ;
+  free(wf->bdepth) ;
+  free(wf->bsize) ;
+  free(wf->bambiguous) ;
+  free(wf->bmain) ;
+  free(wf->order) ;
+  free(wf->wm_like) ;
+  free(wf) ;
+  *pwf = NULL ;
+  return(NO_ERROR) ;
+}
+
+static int wshedNewBasin(WSHED_FLOOD *wf, int v, int depth, unsigned long ambiguous, int main_basin)
+{
+  int b ;
+
+  if (wf->nbasins == wf->max_basins)
+  {
+    wf->max_basins = wf->max_basins ? 2*wf->max_basins : 1024 ;
+    wf->bdepth = (unsigned char *)realloc(wf->bdepth, wf->max_basins*sizeof(unsigned char)) ;
+    wf->bsize = (unsigned long *)realloc(wf->bsize, wf->max_basins*sizeof(unsigned long)) ;
+    wf->bambiguous = (unsigned long *)realloc(wf->bambiguous, wf->max_basins*sizeof(unsigned long)) ;
+    wf->bmain = (unsigned char *)realloc(wf->bmain, wf->max_basins*sizeof(unsigned char)) ;
+    if (!wf->bdepth || !wf->bsize || !wf->bambiguous || !wf->bmain)
+      ErrorExit(ERROR_NOMEMORY, "wshedNewBasin: could not allocate %d basins", wf->max_basins) ;
+  }
+  b = wf->nbasins++ ;
+  wf->bdepth[b] = (unsigned char)depth ;
+  wf->bsize[b] = 1 ;
+  wf->bambiguous[b] = ambiguous ;
+  wf->bmain[b] = (unsigned char)main_basin ;
+  wf->parent[v] = WSHED_ROOT(b) ;
+  return(b) ;
+}
+
+int wshedAddBasin(WSHED_FLOOD *wf, int x, int y, int z, int depth,
+                  unsigned long size, unsigned long ambiguous, int main_basin)
+{
+  int b ;
+
+  b = wshedNewBasin(wf, x + wf->width*(y + wf->height*z), depth, ambiguous, main_basin) ;
+  wf->bsize[b] = size ;
+  return(NO_ERROR) ;
+}
+
+int wshedJoin(WSHED_FLOOD *wf, int x, int y, int z, int x0, int y0, int z0)
+{
+  wf->parent[x + wf->width*(y + wf->height*z)] = x0 + wf->width*(y0 + wf->height*z0) ;
+  return(NO_ERROR) ;
+}
+
+int wshedRoot(const WSHED_FLOOD *wf, int v)
+{
+  if (wf->parent[v] == WSHED_UNFLOODED)
+    return(-1) ;
+  while (wf->parent[v] >= 0)
+    v = wf->parent[v] ;
+  return(v) ;
+}
+
+// root of a flooded voxel, halving the path on the way
+static int wshedFind(int *parent, int v)
+{
+  int p ;
+
+  while ((p = parent[v]) >= 0)
+  {
+    if (parent[p] >= 0)
+      parent[v] = parent[p] ;
+    v = p ;
+  }
+  return(v) ;
+}
+
+/*-----------------------------------------------------------------
+  the 3x3x3 test of Test() (watershed_analyze)
+  -----------------------------------------------------------------*/
+static int wshedWmLike(const WSHED_FLOOD *wf, MRI *mri, int i, int j, int k)
+{
+  int a, b, c, tp, mean, var ;
+
+  mean = var = 0 ;
+  for (a = -1 ; a < 2 ; a++)
+    for (b = -1 ; b < 2 ; b++)
+      for (c = -1 ; c < 2 ; c++)
+      {
+        tp = MRIvox(mri, i+a, j+b, k+c) ;
+        mean += tp ;
+        var += SQR(tp) ;
+      }
+  mean /= 27 ;
+  var = var/27 - SQR(mean) ;
+  return(mean >= wf->wm_min && mean <= wf->wm_max && var <= wf->wm_variance) ;
+}
+
+int wshedSortVoxels(WSHED_FLOOD *wf, MRI *mri, int Imax, int hpf,
+                    int analyze, int wm_min, int wm_max, int wm_variance)
+{
+  int  width = wf->width, height = wf->height, depth = wf->depth ;
+  int  nslabs, s, val ;
+  long (*offset)[256], n ;
+
+  wf->Imax = Imax ;
+  wf->hpf = hpf ;
+  wf->analyze = analyze ;
+  wf->wm_min = wm_min ;
+  wf->wm_max = wm_max ;
+  wf->wm_variance = wm_variance ;
+
+  // one slab per slice: count, then give each slab its part of each level
+  nslabs = MAX(depth-4, 0) ;
+  offset = (long (*)[256])calloc(MAX(nslabs, 1), sizeof(*offset)) ;
+  if (!offset)
+    ErrorExit(ERROR_NOMEMORY, "wshedSortVoxels: could not allocate %d slabs", nslabs) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+  for (s = 0 ; s < nslabs ; s++)
+  {
+    ROMP_PFLB_begin
+    int      i, j, k = s+2 ;
+    BUFTYPE  *pb ;
+
+    for (j = 2 ; j < height-2 ; j++)
+    {
+      pb = &MRIvox(mri, 2, j, k) ;
+      for (i = 2 ; i < width-2 ; i++, pb++)
+        offset[s][*pb]++ ;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // levels by decreasing intensity, slabs in scan order within a level
+  n = 0 ;
+  for (val = 255 ; val >= 0 ; val--)
+  {
+    wf->level_start[val+1] = n ;
+    for (s = 0 ; s < nslabs ; s++)
+    {
+      long count = offset[s][val] ;
+      offset[s][val] = n ;
+      if (val > 0 && val < Imax)
+        n += count ;
+    }
+  }
+  wf->level_start[0] = n ;
+
+  free(wf->order) ;
+  free(wf->wm_like) ;
+  wf->order = (int *)malloc(MAX(n, 1)*sizeof(int)) ;
+  wf->wm_like = analyze ? (unsigned char *)malloc(MAX(n, 1)) : NULL ;
+  if (!wf->order || (analyze && !wf->wm_like))
+    ErrorExit(ERROR_NOMEMORY, "wshedSortVoxels: could not allocate %ld voxels", n) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+  for (s = 0 ; s < nslabs ; s++)
+  {
+    ROMP_PFLB_begin
+    int      i, j, k = s+2 ;
+    long     l ;
+    BUFTYPE  *pb ;
+
+    for (j = 2 ; j < height-2 ; j++)
+    {
+      pb = &MRIvox(mri, 2, j, k) ;
+      for (i = 2 ; i < width-2 ; i++, pb++)
+      {
+        if (*pb == 0 || *pb >= Imax)
+          continue ;
+        l = offset[s][*pb]++ ;
+        wf->order[l] = i + width*(j + height*k) ;
+        if (analyze)
+          wf->wm_like[l] = wshedWmLike(wf, mri, i, j, k) ;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(offset) ;
+  return(NO_ERROR) ;
+}
+
+/*-----------------------------------------------------------------
+  Lookat() on a neighbor: keeps the deepest basin around, and the
+  basins close enough in depth to be merged
+  -----------------------------------------------------------------*/
+static void wshedLookat(WSHED_FLOOD *wf, int n, int val, int *dpt, int *admax, int *nb, int adtab[6])
+{
+  int r, d, m ;
+
+  if (wf->parent[n] == WSHED_UNFLOODED)
+    return ;
+
+  r = wshedFind(wf->parent, n) ;
+  d = wf->bdepth[WSHED_BASIN(wf->parent[r])] ;
+  if (d > *dpt)
+  {
+    *admax = r ;
+    *dpt = d ;
+  }
+  if (100*(d-val) < wf->hpf*wf->Imax)
+  {
+    for (m = 0 ; m < *nb ; m++)
+      if (adtab[m] == r)
+        return ;
+    adtab[(*nb)++] = r ;
+  }
+}
+
+int wshedFloodLevel(WSHED_FLOOD *wf, int val, long nvoxels)
+{
+  int  *parent = wf->parent ;
+  long sx = 1, sy = wf->width, sz = (long)wf->width*wf->height, l, end ;
+
+  if (val <= 0 || val >= wf->Imax)
+    return(NO_ERROR) ;
+
+  end = MIN(wf->level_start[val], wf->level_start[val+1]+MAX(nvoxels, 0)) ;
+  for (l = wf->level_start[val+1] ; l < end ; l++)
+  {
+    int  v = wf->order[l], tp, n, nb = 0, dpt = -1, admax = v, adtab[6], b, ba ;
+
+    wshedLookat(wf, v-sz, val, &dpt, &admax, &nb, adtab) ;
+    wshedLookat(wf, v+sz, val, &dpt, &admax, &nb, adtab) ;
+    wshedLookat(wf, v-sy, val, &dpt, &admax, &nb, adtab) ;
+    wshedLookat(wf, v+sy, val, &dpt, &admax, &nb, adtab) ;
+    wshedLookat(wf, v-sx, val, &dpt, &admax, &nb, adtab) ;
+    wshedLookat(wf, v+sx, val, &dpt, &admax, &nb, adtab) ;
+
+    tp = wf->analyze ? wf->wm_like[l] : 0 ;
+
+    /*creates a new basin*/
+    if (dpt == -1)
+    {
+      wshedNewBasin(wf, v, val, tp ? 1 : 0, 0) ;
+      wf->basinnumber++ ;
+      continue ;
+    }
+
+    /*Merging*/
+    ba = WSHED_BASIN(parent[admax]) ;
+    if (wf->bmain[ba] && val <= wf->wm_min && val > 0)
+      wf->gmnumber[val]++ ;
+
+    parent[v] = admax ;
+    wf->bsize[ba]++ ;
+    if (tp && !wf->bmain[ba])
+      wf->bambiguous[ba]++ ;
+
+    for (n = 0 ; n < nb ; n++)
+      if (adtab[n] != admax)
+      {
+        b = WSHED_BASIN(parent[adtab[n]]) ;
+        wf->bsize[ba] += wf->bsize[b] ;
+        if (tp && !wf->bmain[ba])
+          wf->bambiguous[ba] += wf->bambiguous[b] ;
+        parent[adtab[n]] = admax ;
+        wf->basinnumber-- ;
+      }
+
+    if (wf->bsize[ba] > wf->basinsize)
+      wf->basinsize = wf->bsize[ba] ;
+  }
+  return(NO_ERROR) ;
+}
@@ -0,0 +1,101 @@
+/**
+ * @brief flooding engine of the mri_watershed watershed step
+ *
+ * The reference Analyze() visits the voxels in decreasing intensity
+ * order from a table of 2D arrays of 16-bit coordinates (one per grey
+ * level), and each voxel it visits follows chains of Cell pointers to
+ * find the basins of its neighbors, chains that get longer every time
+ * two basins are merged.
+ *
+ * Here the voxels are bucket sorted once into a flat array of 32-bit
+ * voxel indices, slab by slab in parallel (each slab writes its own
+ * part of every bucket, so within a grey level the voxels keep the scan
+ * order of the reference).  The basins form a union-find forest over the
+ * same 32-bit indices (4 bytes per voxel instead of a 16-byte Cell), and
+ * the basin of a voxel is found with path halving.  The 3x3x3 statistics
+ * used by the watershed analysis (-wat) only depend on the input and are
+ * computed in the parallel sorting pass.
+ *
+ * Flooding itself stays serial: the order in which the voxels are merged
+ * decides the basins, and it is the order of the reference, so the
+ * basins, their depths, sizes and ambiguous counts are the same.  The
+ * volume can have any dimensions (fewer than 2^31 voxels).
+ *
+ * Set FS_WATERSHED_REFERENCE in the environment to use the original
+ * Cell-based flooding (e.g. to compare the two).
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef WATERSHED_FLOOD_H
+#define WATERSHED_FLOOD_H
+
+#include "mri.h"
+
+#define WSHED_UNFLOODED   (-1)
+
+// parent[] of the root voxel of basin b
+#define WSHED_ROOT(b)     (-(b)-2)
+#define WSHED_BASIN(p)    (-(p)-2)
+
+typedef struct
+{
+  int           width, height, depth ;
+
+  /* WSHED_UNFLOODED, WSHED_ROOT(b) for the voxel that holds basin b,
+     or the index (x + width*(y + height*z)) of a voxel of the same basin */
+  int           *parent ;
+
+  int           nbasins, max_basins ;
+  unsigned char *bdepth ;       // intensity the basin was created at
+  unsigned long *bsize ;
+  unsigned long *bambiguous ;
+  unsigned char *bmain ;        // main (brain) basin, type 3 in Analyze()
+
+  /* voxels to flood, by decreasing intensity, as set by wshedSortVoxels() */
+  int           Imax, hpf ;
+  int           analyze, wm_min, wm_max, wm_variance ;
+  int           *order ;
+  unsigned char *wm_like ;      // 3x3x3 neighborhood looks like wm (analyze only)
+  long          level_start[257] ;
+
+  unsigned long basinnumber, basinsize ;
+  unsigned long gmnumber[256] ;
+} WSHED_FLOOD ;
+
+int  wshedUseReference(void) ;
+
+/* NULL if the volume has too many voxels for 32-bit indices */
+WSHED_FLOOD *wshedAlloc(int width, int height, int depth) ;
+int  wshedFree(WSHED_FLOOD **pwf) ;
+
+/* seeds the flooding: a basin held by voxel (x,y,z), and voxels
+   that are part of the basin of another voxel */
+int  wshedAddBasin(WSHED_FLOOD *wf, int x, int y, int z, int depth,
+                   unsigned long size, unsigned long ambiguous, int main_basin) ;
+int  wshedJoin(WSHED_FLOOD *wf, int x, int y, int z, int x0, int y0, int z0) ;
+
+/* bucket sorts the voxels of mri (UCHAR) with 0 < intensity < Imax
+   that are at least 2 voxels from the border */
+int  wshedSortVoxels(WSHED_FLOOD *wf, MRI *mri, int Imax, int hpf,
+                     int analyze, int wm_min, int wm_max, int wm_variance) ;
+
+/* does what Test() does to the first nvoxels voxels of intensity val
+   (Analyze() goes by the histogram of the volume), in the same order */
+int  wshedFloodLevel(WSHED_FLOOD *wf, int val, long nvoxels) ;
+
+/* voxel that holds the basin of voxel v (-1 if v was not flooded).
+   Does not modify wf, so it can be called from several threads. */
+int  wshedRoot(const WSHED_FLOOD *wf, int v) ;
+
+#endif
@@ -24,3 +24,12 @@ else
    compare_surf subj3/surf/rh.orig subj3/surf/rh.orig.ref
 fi
 
+# the grouped retessellation must give the same surface whatever the number of threads
+FSTEST_NO_DATA_RESET=1 && init_testdata
+export FS_TOPOLOGY_PARALLEL_DEFECTS=1
+export OMP_NUM_THREADS=1
+test_command mris_fix_topology -mgz -sphere qsphere.nofix -out orig.groups1 -ga -seed 1234 subj1 lh
+export OMP_NUM_THREADS=8
+test_command mris_fix_topology -mgz -sphere qsphere.nofix -out orig.groups8 -ga -seed 1234 subj1 lh
+unset FS_TOPOLOGY_PARALLEL_DEFECTS
+compare_surf subj1/surf/lh.orig.groups8 subj1/surf/lh.orig.groups1
@@ -861,6 +861,13 @@ get_option(int argc, char *argv[])
     fprintf(stderr, "setting # of angles/search per scale to %d\n", nangles) ;
     nargs = 1 ;
   }
+  else if (!stricmp(option, "so3"))
+  {
+    int bandwidth = atoi(argv[2]) ;
+    MRISsetRigidBodyAlignSO3(bandwidth) ;
+    fprintf(stderr, "using spherical harmonics up to degree %d for the initial rotation search\n", bandwidth) ;
+    nargs = 1 ;
+  }
   else if (!stricmp(option, "jacobian"))
   {
     jacobian_fname = argv[2] ;
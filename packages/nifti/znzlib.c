@@ -43,6 +43,186 @@
 #endif
 #include "znzlib.h"
 
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#ifdef HAVE_ZLIB
+
+/* Block-parallel gzip writer. Data written to a compressed file is
+   gathered into blocks of ZNZ_PGZ_BLOCK bytes. When there is one block
+   per thread, the blocks are deflated concurrently, each into its own
+   complete gzip member, and appended to the file in order. A sequence
+   of members is a valid gzip file (RFC 1952), so gunzip and gzread()
+   read it back as a single stream.
+*/
+
+#define ZNZ_PGZ_BLOCK (1 << 20)
+
+struct znz_pgz
+{
+  FILE *fp;
+  int level;
+  int nthreads;
+  unsigned char *buf;  /* nthreads input blocks */
+  size_t nbuf;         /* # of bytes in buf */
+  unsigned char **out; /* one compressed member per block */
+  size_t *nout;
+  size_t out_size;     /* capacity of each out[] */
+  long total;          /* uncompressed bytes written so far */
+  int error;
+};
+
+static int znz_gzip_params_set = 0;
+static int znz_gzip_threads = 1;
+static int znz_gzip_level = Z_DEFAULT_COMPRESSION;
+
+void znzSetGzipParams(int nthreads, int level)
+{
+  znz_gzip_params_set = 1;
+  znz_gzip_threads = nthreads;
+  znz_gzip_level = level;
+}
+
+static void znz_gzip_params(int *nthreads, int *level)
+{
+  char *cp;
+
+  *nthreads = 1;
+  *level = Z_DEFAULT_COMPRESSION;
+  if (znz_gzip_params_set) {
+    *nthreads = znz_gzip_threads;
+    *level = znz_gzip_level;
+  }
+  else {
+    if ((cp = getenv("FS_GZIP_THREADS")) != NULL) *nthreads = atoi(cp);
+    if ((cp = getenv("FS_GZIP_LEVEL")) != NULL) *level = atoi(cp);
+  }
+  if (*level < -1 || *level > 9) *level = Z_DEFAULT_COMPRESSION;
+#ifdef HAVE_OPENMP
+  if (*nthreads <= 0) *nthreads = omp_get_max_threads();
+#else
+  *nthreads = 1;
+#endif
+  if (*nthreads < 1) *nthreads = 1;
+}
+
+static size_t znz_pgz_deflate(unsigned char *in, size_t nin, unsigned char *out, size_t out_size, int level)
+{
+  z_stream strm;
+  size_t nout;
+  int ret;
+
+  memset(&strm, 0, sizeof(strm));
+  /* windowBits + 16 writes a gzip header and trailer */
+  if (deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+  strm.next_in = in;
+  strm.avail_in = (uInt)nin;
+  strm.next_out = out;
+  strm.avail_out = (uInt)out_size;
+  ret = deflate(&strm, Z_FINISH);
+  nout = out_size - strm.avail_out;
+  deflateEnd(&strm);
+  return (ret == Z_STREAM_END) ? nout : 0;
+}
+
+/* compress whatever is buffered and append it to the file */
+static int znz_pgz_flush(struct znz_pgz *pgz)
+{
+  int b, nblocks;
+
+  nblocks = (int)((pgz->nbuf + ZNZ_PGZ_BLOCK - 1) / ZNZ_PGZ_BLOCK);
+  if (nblocks == 0) return pgz->error ? -1 : 0;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for num_threads(pgz->nthreads) schedule(dynamic, 1) if (nblocks > 1)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    size_t off = (size_t)b * ZNZ_PGZ_BLOCK;
+    size_t nin = pgz->nbuf - off < ZNZ_PGZ_BLOCK ? pgz->nbuf - off : ZNZ_PGZ_BLOCK;
+    pgz->nout[b] = znz_pgz_deflate(pgz->buf + off, nin, pgz->out[b], pgz->out_size, pgz->level);
+  }
+
+  for (b = 0; b < nblocks; b++) {
+    if (pgz->nout[b] == 0 || fwrite(pgz->out[b], 1, pgz->nout[b], pgz->fp) != pgz->nout[b]) pgz->error = 1;
+  }
+  pgz->nbuf = 0;
+  return pgz->error ? -1 : 0;
+}
+
+static size_t znz_pgz_write(struct znz_pgz *pgz, const void *buf, size_t nbytes)
+{
+  const unsigned char *cp = (const unsigned char *)buf;
+  size_t capacity = (size_t)pgz->nthreads * ZNZ_PGZ_BLOCK, left = nbytes, n;
+
+  while (left > 0) {
+    n = capacity - pgz->nbuf;
+    if (n > left) n = left;
+    memcpy(pgz->buf + pgz->nbuf, cp, n);
+    pgz->nbuf += n;
+    cp += n;
+    left -= n;
+    if (pgz->nbuf == capacity && znz_pgz_flush(pgz) != 0) return 0;
+  }
+  pgz->total += nbytes;
+  return nbytes;
+}
+
+static int znz_pgz_close(struct znz_pgz *pgz)
+{
+  int b, retval;
+
+  retval = znz_pgz_flush(pgz);
+  if (pgz->total == 0 && !pgz->error) {
+    /* an empty file still needs a gzip header */
+    size_t nout = znz_pgz_deflate(pgz->buf, 0, pgz->out[0], pgz->out_size, pgz->level);
+    if (nout == 0 || fwrite(pgz->out[0], 1, nout, pgz->fp) != nout) retval = -1;
+  }
+  if (fclose(pgz->fp) != 0) retval = -1;
+  for (b = 0; b < pgz->nthreads; b++) free(pgz->out[b]);
+  free(pgz->out);
+  free(pgz->nout);
+  free(pgz->buf);
+  free(pgz);
+  return retval;
+}
+
+static struct znz_pgz *znz_pgz_open(const char *path, const char *mode, int nthreads, int level)
+{
+  struct znz_pgz *pgz;
+  int b;
+
+  pgz = (struct znz_pgz *)calloc(1, sizeof(struct znz_pgz));
+  if (pgz == NULL) return NULL;
+  pgz->nthreads = nthreads;
+  pgz->level = level;
+  pgz->out_size = compressBound(ZNZ_PGZ_BLOCK) + 32; /* + gzip header/trailer */
+  pgz->buf = (unsigned char *)malloc((size_t)nthreads * ZNZ_PGZ_BLOCK);
+  pgz->out = (unsigned char **)calloc(nthreads, sizeof(unsigned char *));
+  pgz->nout = (size_t *)calloc(nthreads, sizeof(size_t));
+  if (pgz->buf && pgz->out && pgz->nout) {
+    for (b = 0; b < nthreads; b++)
+      if ((pgz->out[b] = (unsigned char *)malloc(pgz->out_size)) == NULL) break;
+    if (b == nthreads) pgz->fp = fopen(path, mode[0] == 'a' ? "ab" : "wb");
+  }
+  if (pgz->fp == NULL) {
+    if (pgz->out)
+      for (b = 0; b < nthreads; b++) free(pgz->out[b]);
+    free(pgz->out);
+    free(pgz->nout);
+    free(pgz->buf);
+    free(pgz);
+    return NULL;
+  }
+  return pgz;
+}
+
+#else
+
+void znzSetGzipParams(int nthreads, int level) {}
+
+#endif  // HAVE_ZLIB
+
 /* Note extra argument (use_compression) where
    use_compression==0 is no compression
    use_compression!=0 uses zlib (gzip) compression
@@ -61,9 +241,35 @@ znzFile znzopen(const char *path, const char *mode, int use_compression)
 
 #ifdef HAVE_ZLIB
   file->zfptr = NULL;
+  file->pgz = NULL;
 
   if (use_compression) {
     file->withz = 1;
+    if (mode[0] == 'w' || mode[0] == 'a') {
+      int nthreads, level;
+      char zmode[16];
+      const char *digit = strpbrk(mode, "0123456789");
+
+      /* a level given in the mode (e.g. "wb9") wins over the default */
+      znz_gzip_params(&nthreads, &level);
+      if (digit != NULL) level = *digit - '0';
+      if (nthreads > 1) {
+        if ((file->pgz = znz_pgz_open(path, mode, nthreads, level)) == NULL) {
+          free(file);
+          file = NULL;
+        }
+        return file;
+      }
+      if (digit == NULL && level != Z_DEFAULT_COMPRESSION && strlen(mode) < sizeof(zmode) - 1) {
+        sprintf(zmode, "%s%d", mode, level);
+        mode = zmode;
+      }
+      if ((file->zfptr = gzopen(path, mode)) == NULL) {
+        free(file);
+        file = NULL;
+      }
+      return file;
+    }
     if ((file->zfptr = gzopen(path, mode)) == NULL) {
       free(file);
       file = NULL;
@@ -120,6 +326,9 @@ int Xznzclose(znzFile *file)
     if ((*file)->zfptr != NULL) {
       retval = gzclose((*file)->zfptr);
     }
+    if ((*file)->pgz != NULL) {
+      retval = znz_pgz_close((*file)->pgz);
+    }
 #endif
     if ((*file)->nzfptr != NULL) {
       retval = fclose((*file)->nzfptr);
@@ -137,6 +346,7 @@ size_t znzread(void *buf, size_t size, size_t nmemb, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return 0;
   if (file->zfptr != NULL) return (size_t)(gzread(file->zfptr, buf, ((int)size) * ((int)nmemb)) / size);
 #endif
   return fread(buf, size, nmemb, file->nzfptr);
@@ -148,6 +358,7 @@ size_t znzwrite(void *buf, size_t size, size_t nmemb, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return znz_pgz_write(file->pgz, buf, size * nmemb) / size;
   if (file->zfptr != NULL) return (size_t)(gzwrite(file->zfptr, buf, size * nmemb) / size);
 #endif
   return fwrite(buf, size, nmemb, file->nzfptr);
@@ -159,6 +370,18 @@ long znzseek(znzFile file, long offset, int whence)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) {
+    /* like gzseek() on a file open for writing: only forward, filling with zeros */
+    static const char zeros[1024] = {0};
+    long n;
+    if (whence == SEEK_SET) offset -= file->pgz->total;
+    if (whence == SEEK_END || offset < 0) return -1;
+    for (; offset > 0; offset -= n) {
+      n = offset < (long)sizeof(zeros) ? offset : (long)sizeof(zeros);
+      if (znz_pgz_write(file->pgz, zeros, n) != (size_t)n) return -1;
+    }
+    return file->pgz->total;
+  }
   if (file->zfptr != NULL) return (long)gzseek(file->zfptr, offset, whence);
 #endif
   return fseek(file->nzfptr, offset, whence);
@@ -170,6 +393,7 @@ int znzrewind(znzFile stream)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (stream->pgz != NULL) return -1;
   if (stream->zfptr != NULL) return gzrewind(stream->zfptr);
 #endif
   rewind(stream->nzfptr);
@@ -182,6 +406,7 @@ long znztell(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return file->pgz->total;
   if (file->zfptr != NULL) return (long)gztell(file->zfptr);
 #endif
   return ftell(file->nzfptr);
@@ -193,6 +418,7 @@ int znzputs(char *str, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return (int)znz_pgz_write(file->pgz, str, strlen(str));
   if (file->zfptr != NULL) return gzputs(file->zfptr, str);
 #endif
   return fputs(str, file->nzfptr);
@@ -204,6 +430,7 @@ char *znzgets(char *str, int size, znzFile file)
     return NULL;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return NULL;
   if (file->zfptr != NULL) return gzgets(file->zfptr, str, size);
 #endif
   return fgets(str, size, file->nzfptr);
@@ -215,6 +442,10 @@ int znzflush(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) {
+    if (znz_pgz_flush(file->pgz) != 0) return -1;
+    return fflush(file->pgz->fp);
+  }
   if (file->zfptr != NULL) return gzflush(file->zfptr, Z_SYNC_FLUSH);
 #endif
   return fflush(file->nzfptr);
@@ -226,6 +457,7 @@ int znzeof(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return 0;
   if (file->zfptr != NULL) return gzeof(file->zfptr);
 #endif
   return feof(file->nzfptr);
@@ -237,6 +469,10 @@ int znzputc(int c, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) {
+    unsigned char ch = (unsigned char)c;
+    return znz_pgz_write(file->pgz, &ch, 1) == 1 ? ch : -1;
+  }
   if (file->zfptr != NULL) return gzputc(file->zfptr, c);
 #endif
   return fputc(c, file->nzfptr);
@@ -248,6 +484,7 @@ int znzgetc(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->pgz != NULL) return -1;
   if (file->zfptr != NULL) return gzgetc(file->zfptr);
 #endif
   return fgetc(file->nzfptr);
@@ -266,7 +503,7 @@ int znzprintf(znzFile stream, const char *format, ...)
   }
   va_start(va, format);
 #ifdef HAVE_ZLIB
-  if (stream->zfptr != NULL) {
+  if (stream->zfptr != NULL || stream->pgz != NULL) {
     int size;                        /* local to HAVE_ZLIB block */
     size = strlen(format) + 1000000; /* overkill I hope */
     tmpstr = (char *)calloc(1, size);
@@ -275,7 +512,10 @@ int znzprintf(znzFile stream, const char *format, ...)
       return retval;
     }
     vsprintf(tmpstr, format, va);
-    retval = gzprintf(stream->zfptr, "%s", tmpstr);
+    if (stream->pgz != NULL)
+      retval = (int)znz_pgz_write(stream->pgz, tmpstr, strlen(tmpstr));
+    else
+      retval = gzprintf(stream->zfptr, "%s", tmpstr);
     free(tmpstr);
   }
   else
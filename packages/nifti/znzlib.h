@@ -73,12 +73,15 @@ extern "C"
 #endif
 
 
+  struct znz_pgz;   /* block-parallel gzip writer, see znzSetGzipParams() */
+
   struct znzptr
   {
     int withz;
     FILE* nzfptr;
 #ifdef HAVE_ZLIB
     gzFile zfptr;
+    struct znz_pgz *pgz;
 #endif
   } ;
 
@@ -126,6 +129,12 @@ extern "C"
   int znzprintf(znzFile stream, const char *format, ...);
 #endif
 
+  /* Compressed writes use nthreads threads (0 means all OpenMP threads,
+     1 is plain single-stream gzip) and zlib level (-1 is the zlib
+     default) from then on. Unless set here, they come from the
+     environment variables FS_GZIP_THREADS and FS_GZIP_LEVEL. */
+  void znzSetGzipParams(int nthreads, int level);
+
   /*=================*/
 #ifdef  __cplusplus
 }
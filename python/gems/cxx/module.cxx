@@ -5,6 +5,7 @@
 #include "pyKvlMesh.h"
 #include "pyKvlOptimizer.h"
 #include "pyKvlTransform.h"
+#include "kvlAtlasMeshRasterizor.h"
 
 namespace py = pybind11;
 
@@ -16,6 +17,10 @@ void setGlobalDefaultNumberOfThreads(int maximumNumberOfThreads){
 #endif    
 }
 
+void setGlobalDefaultDynamicRasterization(bool dynamicScheduling){
+    kvl::AtlasMeshRasterizor::SetGlobalDefaultDynamicScheduling( dynamicScheduling );
+}
+
 PYBIND11_MODULE(gemsbindings, m) {
     py::class_<KvlImage>(m, "KvlImage")
             .def(py::init<const std::string &>())
@@ -117,4 +122,5 @@ PYBIND11_MODULE(gemsbindings, m) {
             .def("generatefromsinglemesh", &KvlMeshCollection::GenerateFromSingleMesh, py::return_value_policy::take_ownership)
             ;
      m.def("setGlobalDefaultNumberOfThreads", &setGlobalDefaultNumberOfThreads, "Sets the maximum number of threads for ITK.");
+     m.def("setGlobalDefaultDynamicRasterization", &setGlobalDefaultDynamicRasterization, "Use cost-balanced, work-stealing (but still reproducible) scheduling of mesh rasterization.");
 }
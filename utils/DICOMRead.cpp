@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/timeb.h>
 #include <sys/types.h>
@@ -40,9 +41,11 @@ void *malloc(size_t size);
 #include "dti.h"
 #include "fio.h"
 #include "fsenv.h"
+#include "machine.h"
 #include "macros.h"  // DEGREES
 #include "mosaic.h"
 #include "mri_identify.h"
+#include "romp_support.h"
 
 #include "dcm2niix_fswrapper.h"
 
@@ -60,6 +63,62 @@ static int sliceDirCosPresent;
 static const char *jpegCompressed_UID = "1.2.840.10008.1.2.4";
 static const char *rllEncoded_UID = "1.2.840.10008.1.2.5";
 
+/* Values of the Siemens ASCII header (ASCCONV block) that the Siemens
+   DICOM indexer needs, all read from the file in a single pass by
+   sdcmReadAscii(). The tags before SDCM_ASCII_FIRST_PLAIN are looked
+   up the way SiemensAsciiTagEx() does it (last match in any block),
+   the others the way SiemensAsciiTag() does it (first match in the
+   first block). */
+typedef enum {
+  SDCM_ASCII_lRepetitions = 0,
+  SDCM_ASCII_lSize,
+  SDCM_ASCII_dPhaseFOV,
+  SDCM_ASCII_dReadoutFOV,
+  SDCM_ASCII_dSag,
+  SDCM_ASCII_dCor,
+  SDCM_ASCII_dTra,
+  SDCM_ASCII_lDiffDirections,
+  SDCM_ASCII_alFree8,
+  SDCM_ASCII_NTAGS
+} SDCM_ASCII_TAG;
+#define SDCM_ASCII_FIRST_PLAIN SDCM_ASCII_lDiffDirections
+static const char *sdcmAsciiTagNames[SDCM_ASCII_NTAGS] = {"lRepetitions",
+                                                         "sSliceArray.lSize",
+                                                         "sSliceArray.asSlice[0].dPhaseFOV",
+                                                         "sSliceArray.asSlice[0].dReadoutFOV",
+                                                         "sSliceArray.asSlice[0].sNormal.dSag",
+                                                         "sSliceArray.asSlice[0].sNormal.dCor",
+                                                         "sSliceArray.asSlice[0].sNormal.dTra",
+                                                         "sDiffusion.lDiffDirections",
+                                                         "sWiPMemBlock.alFree[8]"};
+typedef struct
+{
+  char *val[SDCM_ASCII_NTAGS]; /* NULL when the tag is not there */
+} SDCMASCII;
+
+static DCM_ELEMENT *GetElementFromObject(DCM_OBJECT **object, long grpid, long elid);
+static DCM_OBJECT *sdcmOpenObject(const char *fname);
+static int sdcmIsSiemensObj(DCM_OBJECT **object, const char *dcmfile);
+static int sdcmAsciiTagExMode(void);
+static int sdcmReadAscii(const char *dcmfile, SDCMASCII *ascii, int exmode);
+static void sdcmFreeAscii(SDCMASCII *ascii);
+static int dcmGetNRowsObj(DCM_OBJECT **object, const char *dcmfile);
+static int dcmGetNColsObj(DCM_OBJECT **object);
+static int dcmGetVolResObj(DCM_OBJECT **object, float *ColRes, float *RowRes, float *SliceRes);
+static int dcmImageDirCosObj(
+    DCM_OBJECT **object, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz);
+static int dcmImagePositionObj(DCM_OBJECT **object, float *x, float *y, float *z);
+static int sdcmSliceDirCosAscii(const SDCMASCII *ascii, float *Vsx, float *Vsy, float *Vsz);
+static int sdcmIsMosaicObj(DCM_OBJECT **object,
+                           const SDCMASCII *ascii,
+                           const char *dcmfile,
+                           int *pNcols,
+                           int *pNrows,
+                           int *pNslices,
+                           int *pNframes);
+static SDCMFILEINFO *sdcmFileInfoObj(const char *dcmfile, DCM_OBJECT **object, const SDCMASCII *ascii);
+static SDCMFILEINFO **sdcmIndexDir(const char *pname, struct dirent **NameList, int NFiles, int *NSDCMFiles);
+
 //#define _DEBUG
 
 /*-----------------------------------------------------------------
@@ -1199,6 +1258,37 @@ DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
 
   return (element);
 }
+/*---------------------------------------------------------------
+  GetElementFromObject() - same as GetElementFromFile() but gets the
+  element from an object that is already open, so that the file is
+  not parsed again for each element.
+  ---------------------------------------------------------------*/
+static DCM_ELEMENT *GetElementFromObject(DCM_OBJECT **object, long grpid, long elid)
+{
+  CONDITION cond;
+  DCM_ELEMENT *element;
+  DCM_TAG tag;
+  unsigned int rtnLength;
+  void *Ctx = NULL;
+
+  element = (DCM_ELEMENT *)calloc(1, sizeof(DCM_ELEMENT));
+
+  tag = DCM_MAKETAG(grpid, elid);
+  cond = DCM_GetElement(object, tag, element);
+  if (cond != DCM_NORMAL) {
+    free(element);
+    return (NULL);
+  }
+  AllocElementData(element);
+  cond = DCM_GetElementValue(object, element, &rtnLength, &Ctx);
+  if (cond != DCM_NORMAL) {
+    FreeElementData(element);
+    free(element);
+    return (NULL);
+  }
+
+  return (element);
+}
 /*---------------------------------------------------------------
   GetObjectFromFile() - gets an object from a DICOM file. Returns
   a pointer to the object (or NULL upon failure).
@@ -1243,6 +1333,38 @@ DCM_OBJECT *GetObjectFromFile(const char *fname, unsigned long options)
 
   return (object);
 }
+/*---------------------------------------------------------------
+  sdcmOpenObject() - opens fname the way IsDICOM() and
+  GetObjectFromFile() do, but parses it only once and quietly
+  returns NULL when it is not a DICOM file.
+  ---------------------------------------------------------------*/
+static DCM_OBJECT *sdcmOpenObject(const char *fname)
+{
+  static const unsigned long formats[4] = {
+      DCM_PART10FILE, DCM_ORDERLITTLEENDIAN, DCM_ORDERBIGENDIAN, DCM_FORMATCONVERSION};
+  CONDITION cond = DCM_NORMAL;
+  DCM_OBJECT *object = 0;
+  int n;
+
+  if (fio_IsDirectory(fname)) {
+    return (NULL);
+  }
+
+  COND_PopCondition(1);
+  for (n = 0; n < 4; n++) {
+    cond = DCM_OpenFile(fname, formats[n] | DCM_ACCEPTVRMISMATCH, &object);
+    if (cond == DCM_NORMAL) {
+      break;
+    }
+    DCM_CloseObject(&object);
+  }
+  COND_PopCondition(1);
+
+  if (cond != DCM_NORMAL) {
+    return (NULL);
+  }
+  return (object);
+}
 /*-------------------------------------------------------------------
   AllocElementData() - allocates memory for the data portion of
   the element structure. Returns 1 if there's an error (otherwise 0).
@@ -1518,6 +1640,32 @@ int IsSiemensDICOM(const char *dcmfile)
   // printf("Leaving IsSiemensDICOM (%s)\n",dcmfile);
   return (1);
 }
+/*-----------------------------------------------------------------------
+  sdcmIsSiemensObj() - same test as IsSiemensDICOM() on an object that
+  is already open.
+  -----------------------------------------------------------------------*/
+static int sdcmIsSiemensObj(DCM_OBJECT **object, const char *dcmfile)
+{
+  DCM_ELEMENT *e;
+  int IsSiemens;
+
+  e = GetElementFromObject(object, 0x8, 0x70);
+  if (e == NULL) {
+    printf(
+        "WARNING: searching dicom file %s for "
+        "Manufacturer tag 0x8, 0x70\n",
+        dcmfile);
+    printf("WARNING: the result could be a mess.\n");
+    return (0);
+  }
+  /* Siemens appears to add a space onto the end of their
+     Manufacturer string*/
+  IsSiemens = (strcmp(e->d.string, "SIEMENS") == 0 || strcmp(e->d.string, "SIEMENS ") == 0);
+  FreeElementData(e);
+  free(e);
+
+  return (IsSiemens);
+}
 
 /* The original SiemensQsciiTag() is too slow         */
 /* make sure that returned value be freed if non-null */
@@ -1810,6 +1958,177 @@ char *SiemensAsciiTag(const char *dcmfile, const char *TagString, int flag)
 
   return (VariableValue);
 }
+/*-----------------------------------------------------------------
+  sdcmAsciiTagExMode() - whether SiemensAsciiTagEx() does its own
+  lookup (1) or falls back to SiemensAsciiTag() (0).
+  -----------------------------------------------------------------*/
+static int sdcmAsciiTagExMode(void)
+{
+#ifdef Darwin
+  return (0);
+#else
+  return (getenv("USE_SIEMENSASCIITAG") == NULL);
+#endif
+}
+
+/* Checks whether line is "VariableName = VariableValue" for one of the
+   tags [k0,k1) and keeps the value. With last=0, the first value found
+   for a tag is kept (SiemensAsciiTag()), otherwise the last one
+   (SiemensAsciiTagEx()). */
+static void sdcmAsciiMatchLine(const char *line, int k0, int k1, int last, SDCMASCII *ascii)
+{
+  char VariableName[512];
+  char VariableValue[512];
+  int k;
+
+  VariableName[0] = 0;
+  sscanf(line, "%511s", VariableName);
+  if (VariableName[0] == 0) {
+    return;
+  }
+
+  for (k = k0; k < k1; k++) {
+    if (strcmp(VariableName, sdcmAsciiTagNames[k]) != 0) {
+      continue;
+    }
+    if (ascii->val[k] != NULL && !last) {
+      return;
+    }
+    if (sscanf(line, "%*s %*s %511s", VariableValue) == 1) {
+      free(ascii->val[k]);
+      ascii->val[k] = strcpyalloc(VariableValue);
+    }
+    return;
+  }
+}
+
+/* SiemensAsciiTagEx() lookup: the lines are the strings of printable
+   characters of the file, as the unix strings command lists them, and
+   all the ASCCONV blocks are searched. */
+static void sdcmAsciiScanEx(const char *buf, size_t len, int k0, int k1, SDCMASCII *ascii)
+{
+#define SDCM_ISPRINT(c) ((c) == '\t' || ((c) >= 0x20 && (c) < 0x7f))
+  char line[1024];
+  size_t i, j, s, n;
+  int startOfAscii = 0;
+
+  i = 0;
+  while (i < len) {
+    if (!SDCM_ISPRINT((unsigned char)buf[i])) {
+      i++;
+      continue;
+    }
+    for (j = i; j < len && SDCM_ISPRINT((unsigned char)buf[j]); j++)
+      ;
+    if (j - i >= 4) {
+      // SiemensAsciiTagEx() reads the output of strings with fgets()
+      for (s = i; s < j; s += n) {
+        n = MIN(j - s, sizeof(line) - 1);
+        memcpy(line, buf + s, n);
+        line[n] = 0;
+        if (strncmp(line, "### ASCCONV BEGIN", 17) == 0) {
+          startOfAscii = 1;
+        }
+        else if (strncmp(line, "### ASCCONV END ###", 19) == 0) {
+          startOfAscii = 0;
+        }
+        if (startOfAscii) {
+          sdcmAsciiMatchLine(line, k0, k1, 1, ascii);
+        }
+      }
+    }
+    i = j;
+  }
+#undef SDCM_ISPRINT
+}
+
+/* SiemensAsciiTag() lookup: the lines of the file from the first
+   "### ASCCONV BEGIN" to the next "### ASCCONV END ###". */
+static void sdcmAsciiScanFirstBlock(const char *buf, size_t len, int k0, int k1, SDCMASCII *ascii)
+{
+  const char *BeginStr = "### ASCCONV BEGIN";
+  const char *p, *end;
+  char line[4000];
+  size_t n;
+
+  p = (const char *)memmem(buf, len, BeginStr, strlen(BeginStr));
+  if (p == NULL) {
+    return;
+  }
+
+  end = buf + len;
+  while (p < end) {
+    // what fgets() would read: up to the newline, 3999 chars at most
+    n = 0;
+    while (p + n < end && n < sizeof(line) - 1) {
+      if (p[n++] == '\n') {
+        break;
+      }
+    }
+    memcpy(line, p, n);
+    line[n] = 0;
+    p += n;
+
+    if (strncmp(line, "### ASCCONV END ###", 19) == 0) {
+      break;
+    }
+    sdcmAsciiMatchLine(line, k0, k1, 0, ascii);
+  }
+}
+
+/*-----------------------------------------------------------------
+  sdcmReadAscii() - reads dcmfile once and gets the values of all the
+  SDCM_ASCII_TAG tags from its Siemens ASCII header. This gives the
+  same values as SiemensAsciiTagEx() (or SiemensAsciiTag() when exmode
+  is 0) without re-reading the file or running the strings command for
+  each tag. It does not use any global state, so it can be run for
+  several files at once. Returns 1 if the file could not be read.
+  -----------------------------------------------------------------*/
+static int sdcmReadAscii(const char *dcmfile, SDCMASCII *ascii, int exmode)
+{
+  FILE *fp;
+  char *buf;
+  long len;
+  size_t nread;
+
+  memset(ascii, 0, sizeof(SDCMASCII));
+
+  fp = fopen(dcmfile, "r");
+  if (fp == NULL) {
+    return (1);
+  }
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (len <= 0) {
+    fclose(fp);
+    return (1);
+  }
+  buf = (char *)malloc(len);
+  nread = fread(buf, sizeof(char), len, fp);
+  fclose(fp);
+
+  if (exmode) {
+    sdcmAsciiScanEx(buf, nread, 0, SDCM_ASCII_FIRST_PLAIN, ascii);
+    sdcmAsciiScanFirstBlock(buf, nread, SDCM_ASCII_FIRST_PLAIN, SDCM_ASCII_NTAGS, ascii);
+  }
+  else {
+    sdcmAsciiScanFirstBlock(buf, nread, 0, SDCM_ASCII_NTAGS, ascii);
+  }
+  free(buf);
+
+  return (0);
+}
+
+static void sdcmFreeAscii(SDCMASCII *ascii)
+{
+  int k;
+
+  for (k = 0; k < SDCM_ASCII_NTAGS; k++) {
+    free(ascii->val[k]);
+    ascii->val[k] = NULL;
+  }
+}
 /*-----------------------------------------------------------------------
   dcmGetVolRes - Gets the volume resolution (mm) from a DICOM File. The
   column and row resolution is obtained from tag (28,30). This tag is stored
@@ -1819,6 +2138,22 @@ char *SiemensAsciiTag(const char *dcmfile, const char *TagString, int flag)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *SliceRes)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmGetVolResObj(&object, ColRes, RowRes, SliceRes);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (err);
+}
+/* dcmGetVolRes() on an object that is already open */
+static int dcmGetVolResObj(DCM_OBJECT **object, float *ColRes, float *RowRes, float *SliceRes)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -1828,7 +2163,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
 
   /* Load the Pixel Spacing - this is a string of the form:
      ColRes\RowRes   */
-  e = GetElementFromFile(dcmfile, 0x28, 0x30);
+  e = GetElementFromObject(object, 0x28, 0x30);
   if (e == NULL) {
     return (1);
   }
@@ -1868,7 +2203,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
 
   if (AutoSliceResElTag) {
     printf("Automatically determining SliceResElTag\n");
-    e = GetElementFromFile(dcmfile, 0x18, 0x23);
+    e = GetElementFromObject(object, 0x18, 0x23);
     if (e != NULL) {
       if (strcmp(e->d.string, "3D") == 0)
         SliceResElTag1 = 0x50;
@@ -1882,7 +2217,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
   /* By default, the slice resolution is determined from 18,88. If
      that does not exist, then 18,50 is used. For siemens mag res
      angiogram (MRAs), 18,50 must be used first */
-  e = GetElementFromFile(dcmfile, 0x18, SliceResElTag1);
+  e = GetElementFromObject(object, 0x18, SliceResElTag1);
   if (e == NULL)
     tag_not_found = 1;
   else {
@@ -1894,7 +2229,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
     }
   }
   if (tag_not_found) {  // so either no tag or tag was zero
-    e = GetElementFromFile(dcmfile, 0x18, SliceResElTag2);
+    e = GetElementFromObject(object, 0x18, SliceResElTag2);
     if (e == NULL) return (1);  // no tag
     sscanf(e->d.string, "%f", SliceRes);
     FreeElementData(e);
@@ -1936,11 +2271,27 @@ int dcmGetSeriesNo(const char *dcmfile)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetNRows(const char *dcmfile)
+{
+  DCM_OBJECT *object;
+  int NRows;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  NRows = dcmGetNRowsObj(&object, dcmfile);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (NRows);
+}
+/* dcmGetNRows() on an object that is already open */
+static int dcmGetNRowsObj(DCM_OBJECT **object, const char *dcmfile)
 {
   DCM_ELEMENT *e;
   int NRows;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x10);
+  e = GetElementFromObject(object, 0x28, 0x10);
   if (e == NULL) {
     return (-1);
   }
@@ -1964,11 +2315,27 @@ int dcmGetNRows(const char *dcmfile)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetNCols(const char *dcmfile)
+{
+  DCM_OBJECT *object;
+  int NCols;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  NCols = dcmGetNColsObj(&object);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (NCols);
+}
+/* dcmGetNCols() on an object that is already open */
+static int dcmGetNColsObj(DCM_OBJECT **object)
 {
   DCM_ELEMENT *e;
   int NCols;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x11);
+  e = GetElementFromObject(object, 0x28, 0x11);
   if (e == NULL) {
     return (-1);
   }
@@ -1990,6 +2357,23 @@ int dcmGetNCols(const char *dcmfile)
   Author: Douglas N. Greve, 9/10/2001
   -----------------------------------------------------------------------*/
 int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmImageDirCosObj(&object, Vcx, Vcy, Vcz, Vrx, Vry, Vrz);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (err);
+}
+/* dcmImageDirCos() on an object that is already open */
+static int dcmImageDirCosObj(
+    DCM_OBJECT **object, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -1999,7 +2383,7 @@ int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, floa
 
   /* Load the direction cosines - this is a string of the form:
      Vcx\Vcy\Vcz\Vrx\Vry\Vrz */
-  e = GetElementFromFile(dcmfile, 0x20, 0x37);
+  e = GetElementFromObject(object, 0x20, 0x37);
   if (e == NULL) {
     return (1);
   }
@@ -2054,6 +2438,22 @@ int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, floa
   Author: Douglas N. Greve, 9/10/2001
   -----------------------------------------------------------------------*/
 int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmImagePositionObj(&object, x, y, z);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (err);
+}
+/* dcmImagePosition() on an object that is already open */
+static int dcmImagePositionObj(DCM_OBJECT **object, float *x, float *y, float *z)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -2062,7 +2462,7 @@ int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
 
   /* Load the Image Position: this is a string of the form:
      x\y\z  */
-  e = GetElementFromFile(dcmfile, 0x20, 0x32);
+  e = GetElementFromObject(object, 0x20, 0x32);
   if (e == NULL) {
     return (1);
   }
@@ -2109,29 +2509,38 @@ int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
   -----------------------------------------------------------------------*/
 int sdcmSliceDirCos(const char *dcmfile, float *Vsx, float *Vsy, float *Vsz)
 {
-  char *tmpstr;
-  float rms;
+  SDCMASCII ascii;
+  int err;
 
   if (!IsSiemensDICOM(dcmfile)) {
     return (1);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dSag", 0);
+  sdcmReadAscii(dcmfile, &ascii, sdcmAsciiTagExMode());
+  err = sdcmSliceDirCosAscii(&ascii, Vsx, Vsy, Vsz);
+  sdcmFreeAscii(&ascii);
+
+  return (err);
+}
+/* sdcmSliceDirCos() from the ASCII header values of the file */
+static int sdcmSliceDirCosAscii(const SDCMASCII *ascii, float *Vsx, float *Vsy, float *Vsz)
+{
+  char *tmpstr;
+  float rms;
+
+  tmpstr = ascii->val[SDCM_ASCII_dSag];
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsx);
-    free(tmpstr);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dCor", 0);
+  tmpstr = ascii->val[SDCM_ASCII_dCor];
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsy);
-    free(tmpstr);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dTra", 0);
+  tmpstr = ascii->val[SDCM_ASCII_dTra];
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsz);
-    free(tmpstr);
   }
 
   if (*Vsx == 0 && *Vsy == 0 && *Vsz == 0) {
@@ -2169,6 +2578,35 @@ int sdcmSliceDirCos(const char *dcmfile, float *Vsx, float *Vsy, float *Vsz)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, int *pNframes)
+{
+  DCM_OBJECT *object;
+  SDCMASCII ascii;
+  int IsMosaic;
+
+  if (!IsSiemensDICOM(dcmfile)) {
+    return (0);
+  }
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  sdcmReadAscii(dcmfile, &ascii, sdcmAsciiTagExMode());
+  IsMosaic = sdcmIsMosaicObj(&object, &ascii, dcmfile, pNcols, pNrows, pNslices, pNframes);
+  sdcmFreeAscii(&ascii);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (IsMosaic);
+}
+/* sdcmIsMosaic() on an object that is already open */
+static int sdcmIsMosaicObj(DCM_OBJECT **object,
+                           const SDCMASCII *ascii,
+                           const char *dcmfile,
+                           int *pNcols,
+                           int *pNrows,
+                           int *pNslices,
+                           int *pNframes)
 {
   DCM_ELEMENT *e;
   char *PhEncDir;
@@ -2180,10 +2618,6 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
   int err, IsMosaic;
   char *tmpstr;
 
-  if (!IsSiemensDICOM(dcmfile)) {
-    return (0);
-  }
-
   tmpstr = getenv("SDCM_ISMOSAIC_OVERRIDE");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%d", &IsMosaic);
@@ -2195,7 +2629,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
 
   /* Get the phase encode direction: should be COL or ROW */
   /* COL means that each row is a different phase encode (??)*/
-  e = GetElementFromFile(dcmfile, 0x18, 0x1312);
+  e = GetElementFromObject(object, 0x18, 0x1312);
   if (e == NULL) {
     return (0);
   }
@@ -2203,12 +2637,12 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
   FreeElementData(e);
   free(e);
 
-  Nrows = dcmGetNRows(dcmfile);
+  Nrows = dcmGetNRowsObj(object, dcmfile);
   if (Nrows == -1) {
     return (0);
   }
 
-  Ncols = dcmGetNCols(dcmfile);
+  Ncols = dcmGetNColsObj(object);
   if (Ncols == -1) {
     return (0);
   }
@@ -2217,7 +2651,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
    * NumberOfImagesInMosaic field first, which represents the number of slices
    * in the run. Note that mosaics are always square, i.e. filled with empty
    * slices at the end. */
-  e = GetElementFromFile(dcmfile, 0x19, 0x100a);
+  e = GetElementFromObject(object, 0x19, 0x100a);
   NimagesMosaic = 0;
   if (e != NULL) {
     IsMosaic = 1;
@@ -2227,21 +2661,19 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
     NcolsExp = Ncols / NmosaicSideLen;
   }
   else {
-    tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dPhaseFOV", 0);
+    tmpstr = ascii->val[SDCM_ASCII_dPhaseFOV];
     if (tmpstr == NULL) {
       return (0);
     }
     sscanf(tmpstr, "%f", &PhEncFOV);
-    free(tmpstr);
 
-    tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dReadoutFOV", 0);
+    tmpstr = ascii->val[SDCM_ASCII_dReadoutFOV];
     if (tmpstr == NULL) {
       return (0);
     }
     sscanf(tmpstr, "%f", &ReadOutFOV);
-    free(tmpstr);
 
-    err = dcmGetVolRes(dcmfile, &ColRes, &RowRes, &SliceRes);
+    err = dcmGetVolResObj(object, &ColRes, &RowRes, &SliceRes);
     if (err) {
       return (-1);
     }
@@ -2286,12 +2718,11 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
         *pNslices = NimagesMosaic;
       }
       else if (tmpstr == NULL) {
-        tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.lSize", 0);
+        tmpstr = ascii->val[SDCM_ASCII_lSize];
         if (tmpstr == NULL) {
           return (0);
         }
         sscanf(tmpstr, "%d", pNslices);
-        free(tmpstr);
       }
       else {
         sscanf(tmpstr, "%d", pNslices);
@@ -2299,13 +2730,12 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
       }
     }
     if (pNframes != NULL) {
-      tmpstr = SiemensAsciiTagEx(dcmfile, "lRepetitions", 0);
+      tmpstr = ascii->val[SDCM_ASCII_lRepetitions];
       if (tmpstr == NULL) {
         return (0);
       }
       sscanf(tmpstr, "%d", pNframes);
       (*pNframes)++;
-      free(tmpstr);
     }
   }
   free(PhEncDir);
@@ -2316,11 +2746,41 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
   GetSDCMFileInfo() - this fills a SDCMFILEINFO structure for a
   single Siemens DICOM file. Some of the data are filled from
   the DICOM header and some from the Siemens ASCII header. The
-  pixel data are not loaded.
+  pixel data are not loaded. The DICOM header is parsed once, and
+  the whole Siemens ASCII header is read in one pass (rather than
+  re-reading the file for each tag). Returns NULL if the file is not
+  a Siemens DICOM file.
   ----------------------------------------------------------------*/
 SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
 {
-  DCM_OBJECT *object = 0;
+  DCM_OBJECT *object;
+  SDCMFILEINFO *sdcmfi;
+  SDCMASCII ascii;
+
+  object = sdcmOpenObject(dcmfile);
+  if (object == NULL) {
+    return (NULL);
+  }
+
+  sdcmfi = NULL;
+  if (sdcmIsSiemensObj(&object, dcmfile)) {
+    sdcmReadAscii(dcmfile, &ascii, sdcmAsciiTagExMode());
+    sdcmfi = sdcmFileInfoObj(dcmfile, &object, &ascii);
+    sdcmFreeAscii(&ascii);
+  }
+
+  DCM_CloseObject(&object);
+
+  /* Clear the condition stack to prevent overflow */
+  COND_PopCondition(1);
+
+  return (sdcmfi);
+}
+/* GetSDCMFileInfo() on a Siemens DICOM file that is already open, with
+   the values of its ASCII header from sdcmReadAscii(). Each tag is read
+   from the object, so the file is parsed only once. */
+static SDCMFILEINFO *sdcmFileInfoObj(const char *dcmfile, DCM_OBJECT **object, const SDCMASCII *ascii)
+{
   SDCMFILEINFO *sdcmfi;
   CONDITION cond;
   DCM_TAG tag;
@@ -2333,21 +2793,8 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   double xr, xa, xs, yr, ya, ys, zr, za, zs;
   int DoDWI;
 
-  if (!IsSiemensDICOM(dcmfile)) {
-    return (NULL);
-  }
-
   sdcmfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
 
-  fflush(stdout);
-  fflush(stderr);
-  object = GetObjectFromFile(dcmfile, 0);
-  fflush(stdout);
-  fflush(stderr);
-  if (object == NULL) {
-    exit(1);
-  }
-
   l = strlen(dcmfile);
   sdcmfi->FileName = (char *)calloc(l + 1, sizeof(char));
   memmove(sdcmfi->FileName, dcmfile, l);
@@ -2357,40 +2804,40 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   // whether the data has been compressed. See:
   // http://www.psychology.nottingham.ac.uk/staff/cr1/dicom.html
   tag = DCM_MAKETAG(0x2, 0x10);
-  cond = GetString(&object, tag, &sdcmfi->TransferSyntaxUID);
+  cond = GetString(object, tag, &sdcmfi->TransferSyntaxUID);
 
   tag = DCM_MAKETAG(0x10, 0x10);
-  cond = GetString(&object, tag, &sdcmfi->PatientName);
+  cond = GetString(object, tag, &sdcmfi->PatientName);
 
   tag = DCM_MAKETAG(0x8, 0x20);
-  cond = GetString(&object, tag, &sdcmfi->StudyDate);
+  cond = GetString(object, tag, &sdcmfi->StudyDate);
 
   tag = DCM_MAKETAG(0x8, 0x30);
-  cond = GetString(&object, tag, &sdcmfi->StudyTime);
+  cond = GetString(object, tag, &sdcmfi->StudyTime);
 
   tag = DCM_MAKETAG(0x8, 0x31);
-  cond = GetString(&object, tag, &sdcmfi->SeriesTime);
+  cond = GetString(object, tag, &sdcmfi->SeriesTime);
 
   tag = DCM_MAKETAG(0x8, 0x32);
-  cond = GetString(&object, tag, &sdcmfi->AcquisitionTime);
+  cond = GetString(object, tag, &sdcmfi->AcquisitionTime);
 
   tag = DCM_MAKETAG(0x8, 0x1090);
-  cond = GetString(&object, tag, &sdcmfi->ScannerModel);
+  cond = GetString(object, tag, &sdcmfi->ScannerModel);
 
   tag = DCM_MAKETAG(0x18, 0x1020);
-  cond = GetString(&object, tag, &sdcmfi->NumarisVer);
+  cond = GetString(object, tag, &sdcmfi->NumarisVer);
 
   tag = DCM_MAKETAG(0x18, 0x24);
-  cond = GetString(&object, tag, &sdcmfi->PulseSequence);
+  cond = GetString(object, tag, &sdcmfi->PulseSequence);
 
   tag = DCM_MAKETAG(0x18, 0x1030);
-  cond = GetString(&object, tag, &sdcmfi->ProtocolName);
+  cond = GetString(object, tag, &sdcmfi->ProtocolName);
   if (strlen(sdcmfi->ProtocolName) == 0) {
     sdcmfi->ProtocolName = strcpyalloc("PROTOCOL_UNKOWN");
   }
 
   tag = DCM_MAKETAG(0x20, 0x11);
-  cond = GetUSFromString(&object, tag, &ustmp);
+  cond = GetUSFromString(object, tag, &ustmp);
   if (cond != DCM_NORMAL) {
     printf("WARNING: No Series Number (20,11) found in %s\n", sdcmfi->FileName);
     sdcmfi->ErrorFlag = 1;
@@ -2399,7 +2846,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   sdcmfi->RunNo = sdcmfi->SeriesNo - 1;
 
   tag = DCM_MAKETAG(0x20, 0x13);
-  cond = GetUSFromString(&object, tag, &ustmp);
+  cond = GetUSFromString(object, tag, &ustmp);
   if (cond != DCM_NORMAL) {
     printf("WARNING: No Image Number (20,13) found in %s\n", sdcmfi->FileName);
     sdcmfi->ErrorFlag = 1;
@@ -2410,7 +2857,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   sdcmfi->SliceScaleFactor = 1;
   if (getenv("FS_NO_SLICE_SCALE_FACTOR") == NULL) {
     tag = DCM_MAKETAG(0x20, 0x4000);
-    cond = GetString(&object, tag, &strtmp);
+    cond = GetString(object, tag, &strtmp);
     if (cond == DCM_NORMAL) {
       if (strncmp(strtmp, "Scale Factor", 12) == 0) {
         sscanf(strtmp, "%*s %*s %lf", &sdcmfi->SliceScaleFactor);
@@ -2422,7 +2869,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
 
   sdcmfi->RescaleIntercept = 0;
   tag = DCM_MAKETAG(0x28, 0x1052);
-  cond = GetString(&object, tag, &strtmp);
+  cond = GetString(object, tag, &strtmp);
   if(cond == DCM_NORMAL) {
     sscanf(strtmp, "%lf", &sdcmfi->RescaleIntercept);
     free(strtmp);
@@ -2431,7 +2878,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   }
   sdcmfi->RescaleSlope = 1.0;
   tag = DCM_MAKETAG(0x28, 0x1053);
-  cond = GetString(&object, tag, &strtmp);
+  cond = GetString(object, tag, &strtmp);
   if(cond == DCM_NORMAL) {
     sscanf(strtmp, "%lf", &sdcmfi->RescaleSlope);
     free(strtmp);
@@ -2441,14 +2888,14 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   //DCMcheckInterceptSlope(object);
 
   tag = DCM_MAKETAG(0x18, 0x86);
-  cond = GetUSFromString(&object, tag, &ustmp);
+  cond = GetUSFromString(object, tag, &ustmp);
   sdcmfi->EchoNo = (int)ustmp;
 
   tag = DCM_MAKETAG(0x18, 0x1020);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
+  cond = GetDoubleFromString(object, tag, &dtmp);
 
   tag = DCM_MAKETAG(0x18, 0x1314);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
+  cond = GetDoubleFromString(object, tag, &dtmp);
   if (cond == DCM_NORMAL) {
     sdcmfi->FlipAngle = (float)M_PI * dtmp / 180.0;
   }
@@ -2457,23 +2904,26 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   }
 
   tag = DCM_MAKETAG(0x18, 0x81);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
+  cond = GetDoubleFromString(object, tag, &dtmp);
   sdcmfi->EchoTime = (float)dtmp;
 
   tag = DCM_MAKETAG(0x18, 0x87);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
+  cond = GetDoubleFromString(object, tag, &dtmp);
   sdcmfi->FieldStrength = (float)dtmp;
 
   tag = DCM_MAKETAG(0x18, 0x82);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
+  cond = GetDoubleFromString(object, tag, &dtmp);
   if (cond == DCM_NORMAL)
     sdcmfi->InversionTime = (float)dtmp;
   else
     sdcmfi->InversionTime = -1;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x107);
-  if (e)
+  e = GetElementFromObject(object, 0x28, 0x107);
+  if (e) {
     sdcmfi->LargestValue = (float)*(e->d.us);
+    FreeElementData(e);
+    free(e);
+  }
   else
     sdcmfi->LargestValue = 0;
 
@@ -2481,23 +2931,22 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   /* COL means that each row is a different phase encode (??)*/
   // Phase Enc Dir (DNG)
   tag = DCM_MAKETAG(0x18, 0x1312);
-  cond = GetString(&object, tag, &strtmp);
+  cond = GetString(object, tag, &strtmp);
   sdcmfi->PhEncDir = deblank(strtmp);
   free(strtmp);
 
   tag = DCM_MAKETAG(0x18, 0x80);
-  cond = GetDoubleFromString(&object, tag, &dtmp);
+  cond = GetDoubleFromString(object, tag, &dtmp);
   sdcmfi->RepetitionTime = (float)dtmp;
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "lRepetitions", 0);
+  strtmp = ascii->val[SDCM_ASCII_lRepetitions];
   if (strtmp != NULL) {
     // This can cause problems with DTI scans if lRepetitions is actually set
     sscanf(strtmp, "%d", &(sdcmfi->lRepetitions));
-    free(strtmp);
   }
   else {
-    strtmp = SiemensAsciiTag(dcmfile, "sDiffusion.lDiffDirections", 0);
-    strtmp2 = SiemensAsciiTag(dcmfile, "sWiPMemBlock.alFree[8]", 0);
+    strtmp = ascii->val[SDCM_ASCII_lDiffDirections];
+    strtmp2 = ascii->val[SDCM_ASCII_alFree8];
     if (strtmp != NULL && strtmp2 != NULL) {
       sscanf(strtmp, "%d", &nDiffDirections);
       sscanf(strtmp, "%d", &nB0);
@@ -2510,71 +2959,62 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     else {
       sdcmfi->lRepetitions = 0;
     }
-    if (strtmp) {
-      free(strtmp);
-    }
-    if (strtmp2) {
-      free(strtmp2);
-    }
   }
   sdcmfi->NFrames = sdcmfi->lRepetitions + 1;
   /* This is not the last word on NFrames. See sdfiAssignRunNo().*/
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.lSize", 0);
+  strtmp = ascii->val[SDCM_ASCII_lSize];
   if (strtmp != NULL) {
     sscanf(strtmp, "%d", &(sdcmfi->SliceArraylSize));
-    free(strtmp);
   }
   else {
     sdcmfi->SliceArraylSize = 0;
   }
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dPhaseFOV", 0);
+  strtmp = ascii->val[SDCM_ASCII_dPhaseFOV];
   if (strtmp != NULL) {
     sscanf(strtmp, "%f", &(sdcmfi->PhEncFOV));
-    free(strtmp);
   }
   else {
     sdcmfi->PhEncFOV = 0;
   }
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dReadoutFOV", 0);
+  strtmp = ascii->val[SDCM_ASCII_dReadoutFOV];
   if (strtmp != NULL) {
     sscanf(strtmp, "%f", &(sdcmfi->ReadoutFOV));
-    free(strtmp);
   }
   else {
     sdcmfi->ReadoutFOV = 0;
   }
 
-  sdcmfi->NImageRows = dcmGetNRows(dcmfile);
+  sdcmfi->NImageRows = dcmGetNRowsObj(object, dcmfile);
   if (sdcmfi->NImageRows < 0) {
     printf("WARNING: Could not determine number of image rows in %s\n", sdcmfi->FileName);
     sdcmfi->ErrorFlag = 1;
   }
-  sdcmfi->NImageCols = dcmGetNCols(dcmfile);
+  sdcmfi->NImageCols = dcmGetNColsObj(object);
   if (sdcmfi->NImageCols < 0) {
     printf("WARNING: Could not determine number of image cols in %s\n", sdcmfi->FileName);
     sdcmfi->ErrorFlag = 1;
   }
 
-  dcmImagePosition(dcmfile, &(sdcmfi->ImgPos[0]), &(sdcmfi->ImgPos[1]), &(sdcmfi->ImgPos[2]));
+  dcmImagePositionObj(object, &(sdcmfi->ImgPos[0]), &(sdcmfi->ImgPos[1]), &(sdcmfi->ImgPos[2]));
 
-  dcmImageDirCos(dcmfile,
-                 &(sdcmfi->Vc[0]),
-                 &(sdcmfi->Vc[1]),
-                 &(sdcmfi->Vc[2]),
-                 &(sdcmfi->Vr[0]),
-                 &(sdcmfi->Vr[1]),
-                 &(sdcmfi->Vr[2]));
+  dcmImageDirCosObj(object,
+                    &(sdcmfi->Vc[0]),
+                    &(sdcmfi->Vc[1]),
+                    &(sdcmfi->Vc[2]),
+                    &(sdcmfi->Vr[0]),
+                    &(sdcmfi->Vr[1]),
+                    &(sdcmfi->Vr[2]));
 
   /* The following may return 1 (Vs[i] = 0 for all i) when there is no
      ASCII header (anonymization?). This is a show-stopper for mosaics.
      For non-mosaics, it is recoverable because we can sort the files
      and compute the slice dir cos from the image position.*/
-  retval = sdcmSliceDirCos(dcmfile, &(sdcmfi->Vs[0]), &(sdcmfi->Vs[1]), &(sdcmfi->Vs[2]));
+  retval = sdcmSliceDirCosAscii(ascii, &(sdcmfi->Vs[0]), &(sdcmfi->Vs[1]), &(sdcmfi->Vs[2]));
 
-  sdcmfi->IsMosaic = sdcmIsMosaic(dcmfile, NULL, NULL, NULL, NULL);
+  sdcmfi->IsMosaic = sdcmIsMosaicObj(object, ascii, dcmfile, NULL, NULL, NULL, NULL);
 
   /* If could not get sliceDirCos, then we calculate an initial value.
      This might not be used at all. If it is used, then it is only
@@ -2609,10 +3049,11 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     /* Confirm sign by two files later  */
   }
 
-  dcmGetVolRes(dcmfile, &(sdcmfi->VolRes[0]), &(sdcmfi->VolRes[1]), &(sdcmfi->VolRes[2]));
+  dcmGetVolResObj(object, &(sdcmfi->VolRes[0]), &(sdcmfi->VolRes[1]), &(sdcmfi->VolRes[2]));
 
   if (sdcmfi->IsMosaic) {
-    sdcmIsMosaic(dcmfile, &(sdcmfi->VolDim[0]), &(sdcmfi->VolDim[1]), &(sdcmfi->VolDim[2]), &(sdcmfi->NFrames));
+    sdcmIsMosaicObj(
+        object, ascii, dcmfile, &(sdcmfi->VolDim[0]), &(sdcmfi->VolDim[1]), &(sdcmfi->VolDim[2]), &(sdcmfi->NFrames));
   }
   else {
     sdcmfi->VolDim[0] = sdcmfi->NImageCols;
@@ -2629,11 +3070,12 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   if (DoDWI) {
     double bval, xbvec, ybvec, zbvec;
     int err;
-    err = dcmGetDWIParams(object, &bval, &xbvec, &ybvec, &zbvec);
+    err = dcmGetDWIParams(*object, &bval, &xbvec, &ybvec, &zbvec);
     if (err) {
       printf("ERROR: GetSDCMFileInfo(): dcmGetDWIParams() %d\n", err);
       printf("DICOM File: %s\n", dcmfile);
       printf("break %s:%d\n", __FILE__, __LINE__);
+      FreeSDCMFileInfo(&sdcmfi);
       return (NULL);
     }
     if (Gdiag_no > 0)
@@ -2650,14 +3092,6 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     sdcmfi->bvecz = 0;
   }
 
-  // cleanup Ascii storage
-  SiemensAsciiTagEx(dcmfile, (char *)0, 1);
-
-  cond = DCM_CloseObject(&object);
-
-  /* Clear the condition stack to prevent overflow */
-  COND_PopCondition(1);
-
   return (sdcmfi);
 }
 /*----------------------------------------------------------*/
@@ -2955,6 +3389,12 @@ char *sdcmExtractNumarisVer(const char *e_18_1020, int *Maj, int *Min, int *MinM
   are Siemens DICOM Files. It also returns a pointer to an array of
   SDCMFILEINFO structures.
 
+  Each file is parsed once (see sdcmIndexDir()). If SDCMIndexFile is
+  set, or FS_SDCM_INDEX is set in the environment (to 1 for an index
+  named PathName.sdcmindex, next to the directory, or to the name of
+  the index), the info is also kept in an index file, and files that
+  have not changed since the index was written are not read again.
+
   Author: Douglas Greve.
   Date: 09/10/2001
   *------------------------------------------------------------------*/
@@ -2963,10 +3403,7 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   struct dirent **NameList;
   int i, pathlength;
   int NFiles;
-  char tmpstr[1000];
   SDCMFILEINFO **sdcmfi_list;
-  int pct, sumpct;
-  FILE *fp;
 
   char *pname = (char *)calloc(strlen(PathName) + 1, sizeof(char));
   strcpy(pname, PathName);
@@ -2993,24 +3430,439 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   }
   fprintf(stderr, "INFO: Found %d files in %s\n", NFiles, pname);
 
-  /* Count the number of Siemens DICOM Files */
-  fprintf(stderr, "INFO: counting Siemens Files\n");
-  (*NSDCMFiles) = 0;
-  for (i = 0; i < NFiles; i++) {
-    sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      (*NSDCMFiles)++;
+  sdcmfi_list = sdcmIndexDir(pname, NameList, NFiles, NSDCMFiles);
+
+  // free memory
+  while (NFiles--) {
+    free(NameList[NFiles]);
+  }
+  free(NameList);
+
+  free(pname);
+
+  return (sdcmfi_list);
+}
+
+/* A file of a scanned directory, as kept in the index. Files that are
+   not Siemens DICOM files are kept too (with sdfi = NULL) so that they
+   are not parsed again. */
+typedef struct
+{
+  char *name;             /* name of the file in the directory */
+  long long size, mtime;  /* the file is read again if these change */
+  int sliceDirCosPresent; /* as set by sdcmSliceDirCos() for this file */
+  SDCMFILEINFO *sdfi;     /* NULL if not a Siemens DICOM file */
+} SDCMINDEXENTRY;
+
+#define SDCM_INDEX_MAGIC "FSSDCMINDEX"
+#define SDCM_INDEX_VERSION 1
+#define SDCM_INDEX_ENTRY_END 0x5344434d  // "SDCM", after each entry
+
+static int sdcmIndexCompareEntries(const void *a, const void *b)
+{
+  return (strcmp(((const SDCMINDEXENTRY *)a)->name, ((const SDCMINDEXENTRY *)b)->name));
+}
+
+/* Name of the index for directory pname (see ScanSiemensDCMDir()), or
+   NULL if no index is used. */
+static char *sdcmIndexFileName(const char *pname)
+{
+  const char *pc;
+  char *indexfile;
+
+  pc = SDCMIndexFile;
+  if (pc == NULL) {
+    pc = getenv("FS_SDCM_INDEX");
+  }
+  if (pc == NULL || pc[0] == 0 || strcmp(pc, "0") == 0) {
+    return (NULL);
+  }
+
+  // the slice resolution tag then depends on the files already read
+  if (AutoSliceResElTag) {
+    printf("INFO: not using a DICOM index with automatic SliceResElTag\n");
+    return (NULL);
+  }
+
+  if (strcmp(pc, "1") != 0) {
+    return (strcpyalloc(pc));
+  }
+  indexfile = (char *)calloc(strlen(pname) + strlen(".sdcmindex") + 1, sizeof(char));
+  sprintf(indexfile, "%s.sdcmindex", pname);
+  return (indexfile);
+}
+
+/* Everything besides the files themselves that changes what
+   GetSDCMFileInfo() returns. An index made with other settings is
+   not used. */
+static void sdcmIndexSettings(char *settings, int len)
+{
+  static const char *envvars[6] = {"FS_NO_SLICE_SCALE_FACTOR",
+                                   "FS_LOAD_DWI",
+                                   "SDCM_ISMOSAIC_OVERRIDE",
+                                   "NROWS_OVERRIDE",
+                                   "NCOLS_OVERRIDE",
+                                   "NSLICES_OVERRIDE"};
+  const char *pc;
+  int n, k;
+
+  n = snprintf(settings, len, "ascii=%d slicerestags=%lx,%lx", sdcmAsciiTagExMode(), SliceResElTag1, SliceResElTag2);
+  for (k = 0; k < 6 && n < len; k++) {
+    pc = getenv(envvars[k]);
+    n += snprintf(settings + n, len - n, " %s=%s", envvars[k], pc == NULL ? "(unset)" : pc);
+  }
+}
+
+/* Reading and writing of the index, in the byte order of the other
+   FreeSurfer binary files (see fio.h), so that one index can be read
+   on any machine. Past the end of a truncated index the values read
+   as 0 (or NULL), quietly; the entry sentinel then rejects it. */
+static void sdcmIndexIOInt(int *v, FILE *fp, int write)
+{
+  if (write) {
+    fwriteInt(*v, fp);
+  }
+  else if (freadIntEx(v, fp) != 1) {
+    *v = 0;
+  }
+}
+static void sdcmIndexIOFloat(float *v, FILE *fp, int write)
+{
+  if (write) {
+    fwriteFloat(*v, fp);
+  }
+  else if (freadFloatEx(v, fp) != 1) {
+    *v = 0;
+  }
+}
+static void sdcmIndexIODouble(double *v, FILE *fp, int write)
+{
+  if (write) {
+    fwriteDouble(*v, fp);
+  }
+  else if (freadDoubleEx(v, fp) != 1) {
+    *v = 0;
+  }
+}
+static void sdcmIndexIOLong(long long *v, FILE *fp, int write)
+{
+  if (write) {
+    fwriteLong(*v, fp);
+    return;
+  }
+  if (fread(v, sizeof(long long), 1, fp) != 1) {
+    *v = 0;
+    return;
+  }
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  *v = swapLong64(*v);
+#endif
+}
+static void sdcmIndexIOString(char **v, FILE *fp, int write)
+{
+  int len;
+
+  if (write) {
+    len = (*v == NULL) ? -1 : strlen(*v);
+    fwriteInt(len, fp);
+    if (len > 0) {
+      fwrite(*v, sizeof(char), len, fp);
     }
+    return;
   }
 
-  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
+  *v = NULL;
+  if (freadIntEx(&len, fp) != 1 || len < 0 || len > 100000) {
+    return;
+  }
+  *v = (char *)calloc(len + 1, sizeof(char));
+  if (fread(*v, sizeof(char), len, fp) != (size_t)len) {
+    (*v)[0] = 0;
+  }
+}
 
-  if (*NSDCMFiles == 0) {
-    free(pname);
+/* all the fields of sdfi but the file name */
+static void sdcmIndexIOInfo(SDCMFILEINFO *sdfi, FILE *fp, int write)
+{
+  int k;
+
+  sdcmIndexIOString(&sdfi->PatientName, fp, write);
+  sdcmIndexIOString(&sdfi->StudyDate, fp, write);
+  sdcmIndexIOString(&sdfi->StudyTime, fp, write);
+  sdcmIndexIOString(&sdfi->SeriesTime, fp, write);
+  sdcmIndexIOString(&sdfi->AcquisitionTime, fp, write);
+  sdcmIndexIOString(&sdfi->PulseSequence, fp, write);
+  sdcmIndexIOString(&sdfi->ProtocolName, fp, write);
+  sdcmIndexIOString(&sdfi->PhEncDir, fp, write);
+  sdcmIndexIOString(&sdfi->NumarisVer, fp, write);
+  sdcmIndexIOString(&sdfi->ScannerModel, fp, write);
+  sdcmIndexIOString(&sdfi->TransferSyntaxUID, fp, write);
+
+  sdcmIndexIOInt(&sdfi->EchoNo, fp, write);
+  sdcmIndexIOFloat(&sdfi->FlipAngle, fp, write);
+  sdcmIndexIOFloat(&sdfi->EchoTime, fp, write);
+  sdcmIndexIOFloat(&sdfi->RepetitionTime, fp, write);
+  sdcmIndexIOFloat(&sdfi->InversionTime, fp, write);
+  sdcmIndexIOFloat(&sdfi->FieldStrength, fp, write);
+  sdcmIndexIOFloat(&sdfi->PhEncFOV, fp, write);
+  sdcmIndexIOFloat(&sdfi->ReadoutFOV, fp, write);
+
+  sdcmIndexIOInt(&sdfi->SeriesNo, fp, write);
+  sdcmIndexIOInt(&sdfi->ImageNo, fp, write);
+  sdcmIndexIOInt(&sdfi->NImageRows, fp, write);
+  sdcmIndexIOInt(&sdfi->NImageCols, fp, write);
+  sdcmIndexIOInt(&sdfi->lRepetitions, fp, write);
+  sdcmIndexIOInt(&sdfi->SliceArraylSize, fp, write);
+  sdcmIndexIOInt(&sdfi->RunNo, fp, write);
+  sdcmIndexIOInt(&sdfi->IsMosaic, fp, write);
+  sdcmIndexIOInt(&sdfi->NFrames, fp, write);
+  sdcmIndexIOInt(&sdfi->nthDirection, fp, write);
+  sdcmIndexIOInt(&sdfi->UseSliceScaleFactor, fp, write);
+  sdcmIndexIOInt(&sdfi->ErrorFlag, fp, write);
+  for (k = 0; k < 3; k++) {
+    sdcmIndexIOFloat(&sdfi->ImgPos[k], fp, write);
+    sdcmIndexIOFloat(&sdfi->Vc[k], fp, write);
+    sdcmIndexIOFloat(&sdfi->Vr[k], fp, write);
+    sdcmIndexIOFloat(&sdfi->Vs[k], fp, write);
+    sdcmIndexIOInt(&sdfi->VolDim[k], fp, write);
+    sdcmIndexIOFloat(&sdfi->VolRes[k], fp, write);
+    sdcmIndexIOFloat(&sdfi->VolCenter[k], fp, write);
+  }
+  sdcmIndexIOFloat(&sdfi->LargestValue, fp, write);
+
+  sdcmIndexIODouble(&sdfi->bValue, fp, write);
+  sdcmIndexIODouble(&sdfi->SliceScaleFactor, fp, write);
+  sdcmIndexIODouble(&sdfi->bval, fp, write);
+  sdcmIndexIODouble(&sdfi->bvecx, fp, write);
+  sdcmIndexIODouble(&sdfi->bvecy, fp, write);
+  sdcmIndexIODouble(&sdfi->bvecz, fp, write);
+  sdcmIndexIODouble(&sdfi->RescaleIntercept, fp, write);
+  sdcmIndexIODouble(&sdfi->RescaleSlope, fp, write);
+}
+
+static void sdcmIndexFree(SDCMINDEXENTRY *entries, int nentries)
+{
+  int n;
+
+  for (n = 0; n < nentries; n++) {
+    free(entries[n].name);
+    if (entries[n].sdfi != NULL) {
+      FreeSDCMFileInfo(&entries[n].sdfi);
+    }
+  }
+  free(entries);
+}
+
+/* Reads the index of directory pname, sorted by file name. Returns
+   NULL if there is no index yet, or if it can not be used. */
+static SDCMINDEXENTRY *sdcmIndexRead(const char *indexfile, const char *pname, const char *settings, int *nentries)
+{
+  FILE *fp;
+  SDCMINDEXENTRY *entries;
+  char magic[sizeof(SDCM_INDEX_MAGIC)];
+  char *dirname, *indexsettings;
+  int version, issiemens, end, n, ok;
+
+  *nentries = 0;
+  fp = fopen(indexfile, "r");
+  if (fp == NULL) {
     return (NULL);
   }
 
-  sdcmfi_list = (SDCMFILEINFO **)calloc(*NSDCMFiles, sizeof(SDCMFILEINFO *));
+  memset(magic, 0, sizeof(magic));
+  if (fread(magic, sizeof(char), strlen(SDCM_INDEX_MAGIC), fp) != strlen(SDCM_INDEX_MAGIC) ||
+      strcmp(magic, SDCM_INDEX_MAGIC) != 0) {
+    printf("WARNING: %s is not a DICOM index, not using it\n", indexfile);
+    fclose(fp);
+    return (NULL);
+  }
+  sdcmIndexIOInt(&version, fp, 0);
+  sdcmIndexIOString(&dirname, fp, 0);
+  sdcmIndexIOString(&indexsettings, fp, 0);
+  ok = (version == SDCM_INDEX_VERSION && dirname != NULL && indexsettings != NULL && strcmp(dirname, pname) == 0 &&
+        strcmp(indexsettings, settings) == 0);
+  free(dirname);
+  free(indexsettings);
+  if (!ok) {
+    printf("INFO: DICOM index %s is for another directory, version or settings, rebuilding it\n", indexfile);
+    fclose(fp);
+    return (NULL);
+  }
+
+  sdcmIndexIOInt(nentries, fp, 0);
+  if (*nentries < 0 || *nentries > 100000000) {
+    *nentries = 0;
+  }
+  entries = (SDCMINDEXENTRY *)calloc(*nentries + 1, sizeof(SDCMINDEXENTRY));
+  for (n = 0; n < *nentries && ok; n++) {
+    sdcmIndexIOString(&entries[n].name, fp, 0);
+    sdcmIndexIOLong(&entries[n].size, fp, 0);
+    sdcmIndexIOLong(&entries[n].mtime, fp, 0);
+    sdcmIndexIOInt(&entries[n].sliceDirCosPresent, fp, 0);
+    sdcmIndexIOInt(&issiemens, fp, 0);
+    if (issiemens) {
+      entries[n].sdfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
+      sdcmIndexIOInfo(entries[n].sdfi, fp, 0);
+    }
+    sdcmIndexIOInt(&end, fp, 0);
+    ok = (entries[n].name != NULL && end == SDCM_INDEX_ENTRY_END && !ferror(fp) && !feof(fp));
+  }
+  fclose(fp);
+
+  if (!ok) {
+    printf("WARNING: could not read DICOM index %s, rebuilding it\n", indexfile);
+    sdcmIndexFree(entries, n);
+    *nentries = 0;
+    return (NULL);
+  }
+
+  qsort(entries, *nentries, sizeof(SDCMINDEXENTRY), sdcmIndexCompareEntries);
+  return (entries);
+}
+
+/* Writes the index of directory pname, through a temporary file so
+   that a scan running at the same time never sees half an index.
+   Entries with a NULL name are skipped. Returns 1 on error. */
+static int sdcmIndexWrite(
+    const char *indexfile, const char *pname, const char *settings, SDCMINDEXENTRY *entries, int nentries)
+{
+  FILE *fp;
+  char *tmpfile, *pc;
+  int n, nwrite, version, issiemens, end, err;
+
+  tmpfile = (char *)calloc(strlen(indexfile) + 32, sizeof(char));
+  sprintf(tmpfile, "%s.tmp%d", indexfile, (int)getpid());
+  fp = fopen(tmpfile, "w");
+  if (fp == NULL) {
+    free(tmpfile);
+    return (1);
+  }
+
+  nwrite = 0;
+  for (n = 0; n < nentries; n++) {
+    if (entries[n].name != NULL) {
+      nwrite++;
+    }
+  }
+
+  fwrite(SDCM_INDEX_MAGIC, sizeof(char), strlen(SDCM_INDEX_MAGIC), fp);
+  version = SDCM_INDEX_VERSION;
+  sdcmIndexIOInt(&version, fp, 1);
+  pc = (char *)pname;
+  sdcmIndexIOString(&pc, fp, 1);
+  pc = (char *)settings;
+  sdcmIndexIOString(&pc, fp, 1);
+  sdcmIndexIOInt(&nwrite, fp, 1);
+  end = SDCM_INDEX_ENTRY_END;
+  for (n = 0; n < nentries; n++) {
+    if (entries[n].name == NULL) {
+      continue;
+    }
+    sdcmIndexIOString(&entries[n].name, fp, 1);
+    sdcmIndexIOLong(&entries[n].size, fp, 1);
+    sdcmIndexIOLong(&entries[n].mtime, fp, 1);
+    sdcmIndexIOInt(&entries[n].sliceDirCosPresent, fp, 1);
+    issiemens = (entries[n].sdfi != NULL);
+    sdcmIndexIOInt(&issiemens, fp, 1);
+    if (issiemens) {
+      sdcmIndexIOInfo(entries[n].sdfi, fp, 1);
+    }
+    sdcmIndexIOInt(&end, fp, 1);
+  }
+
+  err = ferror(fp);
+  if (fclose(fp) != 0) {
+    err = 1;
+  }
+  if (!err && rename(tmpfile, indexfile) != 0) {
+    err = 1;
+  }
+  if (err) {
+    unlink(tmpfile);
+  }
+  free(tmpfile);
+
+  return (err ? 1 : 0);
+}
+
+/*--------------------------------------------------------------------
+  sdcmIndexDir() - GetSDCMFileInfo() for each of the NFiles files of
+  directory pname, keeping the Siemens DICOM files in the order of
+  NameList. The files are read, and their Siemens ASCII headers
+  parsed, by several threads at once. The DICOM parsing itself is
+  done one file at a time (in order) because the CTN DICOM library
+  keeps its conditions in a global stack; it then reads the file from
+  the cache. Files found unchanged in the index (see
+  ScanSiemensDCMDir()) are not read at all, and the index is updated
+  when anything changed. Returns NULL if no Siemens DICOM files were
+  found or if one could not be read. As each file is only parsed
+  once, the number of Siemens DICOM files is known, and printed, at
+  the end of the scan (there is no separate counting pass before it).
+  *------------------------------------------------------------------*/
+static SDCMFILEINFO **sdcmIndexDir(const char *pname, struct dirent **NameList, int NFiles, int *NSDCMFiles)
+{
+  char *indexfile;
+  char settings[2000];
+  SDCMINDEXENTRY *cache, *entries, **cached;
+  SDCMASCII *ascii;
+  SDCMFILEINFO **sdcmfi_list;
+  DCM_OBJECT *object;
+  char **paths;
+  int ncache, nfromindex, nparsed, exmode, failed;
+  int i, pct, sumpct;
+  FILE *fp;
+
+  cache = NULL;
+  ncache = 0;
+  indexfile = sdcmIndexFileName(pname);
+  if (indexfile != NULL) {
+    sdcmIndexSettings(settings, sizeof(settings));
+    cache = sdcmIndexRead(indexfile, pname, settings, &ncache);
+  }
+  exmode = sdcmAsciiTagExMode();
+
+  entries = (SDCMINDEXENTRY *)calloc(NFiles, sizeof(SDCMINDEXENTRY));
+  cached = (SDCMINDEXENTRY **)calloc(NFiles, sizeof(SDCMINDEXENTRY *));
+  ascii = (SDCMASCII *)calloc(NFiles, sizeof(SDCMASCII));
+  paths = (char **)calloc(NFiles, sizeof(char *));
+  for (i = 0; i < NFiles; i++) {
+    paths[i] = (char *)calloc(strlen(pname) + strlen(NameList[i]->d_name) + 2, sizeof(char));
+    sprintf(paths[i], "%s/%s", pname, NameList[i]->d_name);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (i = 0; i < NFiles; i++) {
+    ROMP_PFLB_begin
+    struct stat st;
+    SDCMINDEXENTRY key, *hit;
+
+    // only regular files (or links to them) can be DICOM files;
+    // entries without a name are left out of the index
+    if (stat(paths[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+      ROMP_PFLB_continue;
+    }
+    entries[i].name = NameList[i]->d_name;
+    entries[i].size = st.st_size;
+    entries[i].mtime = st.st_mtime;
+
+    if (cache != NULL) {
+      key.name = NameList[i]->d_name;
+      hit = (SDCMINDEXENTRY *)bsearch(&key, cache, ncache, sizeof(SDCMINDEXENTRY), sdcmIndexCompareEntries);
+      if (hit != NULL && hit->size == entries[i].size && hit->mtime == entries[i].mtime) {
+        cached[i] = hit;
+        ROMP_PFLB_continue;
+      }
+    }
+
+    sdcmReadAscii(paths[i], &ascii[i], exmode);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  sdcmfi_list = (SDCMFILEINFO **)calloc(NFiles + 1, sizeof(SDCMFILEINFO *));
 
   fprintf(stderr, "INFO: scanning info from Siemens Files\n");
 
@@ -3021,8 +3873,10 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   fprintf(stderr, "%2d ", 0);
   sumpct = 0;
   (*NSDCMFiles) = 0;
-  for (i = 0; i < NFiles; i++) {
-    // fprintf(stderr,"%4d ",i);
+  nfromindex = 0;
+  nparsed = 0;
+  failed = 0;
+  for (i = 0; i < NFiles && !failed; i++) {
     pct = rint(100 * (i + 1) / NFiles) - sumpct;
     if (pct >= 2) {
       sumpct += pct;
@@ -3037,24 +3891,72 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
       }
     }
 
-    sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      sdcmfi_list[*NSDCMFiles] = GetSDCMFileInfo(tmpstr);
-      if (sdcmfi_list[*NSDCMFiles] == NULL) {
-        return (NULL);
+    if (entries[i].name == NULL) {
+      continue;
+    }
+
+    if (cached[i] != NULL) {
+      // the info now belongs to the list
+      entries[i].sliceDirCosPresent = cached[i]->sliceDirCosPresent;
+      entries[i].sdfi = cached[i]->sdfi;
+      cached[i]->sdfi = NULL;
+      if (entries[i].sdfi != NULL) {
+        entries[i].sdfi->FileName = strcpyalloc(paths[i]);
+        sliceDirCosPresent = entries[i].sliceDirCosPresent;
       }
-      (*NSDCMFiles)++;
+      nfromindex++;
+    }
+    else {
+      object = sdcmOpenObject(paths[i]);
+      if (object != NULL) {
+        if (sdcmIsSiemensObj(&object, paths[i])) {
+          entries[i].sdfi = sdcmFileInfoObj(paths[i], &object, &ascii[i]);
+          entries[i].sliceDirCosPresent = sliceDirCosPresent;
+          failed = (entries[i].sdfi == NULL);
+        }
+        DCM_CloseObject(&object);
+        COND_PopCondition(1);
+      }
+      nparsed++;
+    }
+
+    if (entries[i].sdfi != NULL) {
+      sdcmfi_list[(*NSDCMFiles)++] = entries[i].sdfi;
     }
   }
   fprintf(stderr, "\n");
 
-  // free memory
-  while (NFiles--) {
-    free(NameList[NFiles]);
+  if (indexfile != NULL && !failed) {
+    fprintf(stderr, "INFO: %d files from DICOM index %s\n", nfromindex, indexfile);
+    if (nparsed > 0 || nfromindex != ncache) {
+      if (sdcmIndexWrite(indexfile, pname, settings, entries, NFiles)) {
+        printf("WARNING: could not write DICOM index %s\n", indexfile);
+      }
+    }
   }
-  free(NameList);
 
-  free(pname);
+  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
+
+  if (failed || *NSDCMFiles == 0) {
+    for (i = 0; i < *NSDCMFiles; i++) {
+      FreeSDCMFileInfo(&sdcmfi_list[i]);
+    }
+    free(sdcmfi_list);
+    sdcmfi_list = NULL;
+  }
+
+  for (i = 0; i < NFiles; i++) {
+    sdcmFreeAscii(&ascii[i]);
+    free(paths[i]);
+  }
+  free(ascii);
+  free(paths);
+  free(cached);
+  free(entries);
+  if (cache != NULL) {
+    sdcmIndexFree(cache, ncache);
+  }
+  free(indexfile);
 
   return (sdcmfi_list);
 }
@@ -19,6 +19,11 @@
 #include "MRISrigidBodyAlignGlobal.h"
 #include "romp_support.h"
 #include "vertexRotator.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <complex>
+#include <vector>
 
 static float* getFloats(size_t capacity) {
   void* ptr = NULL;
@@ -540,3 +545,311 @@ void MRISrigidBodyAlignGlobal_findMinSSE(
 }
 
 
+// Coarse search over all rotations by spherical harmonic correlation
+//
+// Both fields are sampled on an equiangular (theta, phi) grid and expanded in complex spherical
+// harmonics up to degree L.  For R = Rz(alpha) Ry(beta) Rz(gamma) the correlation of the rotated
+// subject f(R^-1 x) with the template g(x) is
+//
+//      C(alpha, beta, gamma) = Re sum_{m,n} exp(-i m alpha) exp(-i n gamma) sum_l conj(g_lm) f_ln d^l_mn(beta)
+//
+// so for each beta the sum over l gives a (2L+1)x(2L+1) matrix, and all the alpha and gamma
+// samples come from one 2D Fourier transform of it.  At these bandwidths the transform is done
+// directly, one axis at a time, which is cheaper than setting up an FFT.
+//
+typedef std::complex<double> SO3complex;
+
+static int so3Index(int l, int m) { return l*l + l + m; }      // -l <= m <= l
+
+// Orthonormal associated Legendre functions, with the Condon-Shortley phase, for 0 <= m <= l <= L
+//
+static void so3Legendre(double* P, int L, double x, double s)
+{
+  P[0] = sqrt(1.0 / (4.0*M_PI));
+  for (int m = 1; m <= L; m++) {
+    P[so3Index(m,m)] = -sqrt((2.0*m + 1.0) / (2.0*m)) * s * P[so3Index(m-1,m-1)];
+  }
+  for (int m = 0; m < L; m++) {
+    P[so3Index(m+1,m)] = sqrt(2.0*m + 3.0) * x * P[so3Index(m,m)];
+  }
+  for (int m = 0; m <= L; m++) {
+    for (int l = m + 2; l <= L; l++) {
+      double const a = sqrt((4.0*l*l - 1.0) / ((double)l*l - (double)m*m));
+      double const b = sqrt(((l - 1.0)*(l - 1.0) - (double)m*m) / (4.0*(l - 1.0)*(l - 1.0) - 1.0));
+      P[so3Index(l,m)] = a * (x * P[so3Index(l-1,m)] - b * P[so3Index(l-2,m)]);
+    }
+  }
+}
+
+// The coefficients f_lm, -l <= m <= l <= L, of a real field sampled at
+//      theta_j = pi (2j+1) / (2 ns),  phi_k = 2 pi k / ns
+//
+static void so3Expand(SO3complex* coefs, float const* samples, int ns, int L)
+{
+  std::vector<double>     P((L+1)*(L+1));
+  std::vector<SO3complex> F(L+1);
+  std::vector<SO3complex> expTable(ns);
+  for (int k = 0; k < ns; k++) expTable[k] = std::polar(1.0, -2.0*M_PI*k/ns);
+
+  std::fill(coefs, coefs + (L+1)*(L+1), SO3complex(0.0));
+
+  double const cellArea = (M_PI/ns) * (2.0*M_PI/ns);
+  for (int j = 0; j < ns; j++) {
+    double const theta = M_PI*(2*j + 1) / (2.0*ns);
+    float const* row = &samples[j*ns];
+    for (int m = 0; m <= L; m++) {
+      SO3complex sum(0.0);
+      for (int k = 0; k < ns; k++) sum += (double)row[k] * expTable[(m*k) % ns];
+      F[m] = sum;
+    }
+    so3Legendre(P.data(), L, cos(theta), sin(theta));
+    double const w = sin(theta) * cellArea;
+    for (int m = 0; m <= L; m++) {
+      for (int l = m; l <= L; l++) coefs[so3Index(l,m)] += w * P[so3Index(l,m)] * F[m];
+    }
+  }
+
+  // f is real, so f_l,-m = (-1)^m conj(f_lm)
+  //
+  for (int l = 1; l <= L; l++) {
+    for (int m = 1; m <= l; m++) {
+      coefs[so3Index(l,-m)] = (m & 1) ? -std::conj(coefs[so3Index(l,m)]) : std::conj(coefs[so3Index(l,m)]);
+    }
+  }
+}
+
+// Wigner's formula for d^l_mn(beta), given cos(beta/2) and sin(beta/2).
+// Only used at l = max(|m|,|n|), where it has a single term.
+//
+static double so3LogFactorial(int n) { return lgamma(n + 1.0); }
+
+static double so3WignerSeed(int l, int m, int n, double c, double s)
+{
+  int const kLo = std::max(0, n - m);
+  int const kHi = std::min(l + n, l - m);
+  double const norm = 0.5*(so3LogFactorial(l+m) + so3LogFactorial(l-m) + so3LogFactorial(l+n) + so3LogFactorial(l-n));
+  double sum = 0.0;
+  for (int k = kLo; k <= kHi; k++) {
+    double const t = exp(norm
+      - so3LogFactorial(l+n-k) - so3LogFactorial(k) - so3LogFactorial(m-n+k) - so3LogFactorial(l-m-k)
+      + (2*l + n - m - 2*k)*log(c) + (m - n + 2*k)*log(s));
+    sum += ((m - n + k) & 1) ? -t : t;
+  }
+  return sum;
+}
+
+// C[i*N + k] = C(alpha_i, beta, gamma_k), alpha_i = gamma_i = 2 pi i / N
+//
+static void so3CorrelateBeta(double* C, SO3complex const* f, SO3complex const* g, int L, int N, double beta)
+{
+  int const width = 2*L + 1;
+  std::vector<SO3complex> S(width*width), T(width*N), expTable(N);
+  for (int k = 0; k < N; k++) expTable[k] = std::polar(1.0, -2.0*M_PI*k/N);
+
+  double const cb = cos(beta), c = cos(beta/2), s = sin(beta/2);
+
+  // S(m,n) = sum_l conj(g_lm) f_ln d^l_mn(beta), with d from the three term recurrence in l.
+  // The l = 0 term is the same for every rotation, so is left out.
+  //
+  for (int m = -L; m <= L; m++) {
+    for (int n = -L; n <= L; n++) {
+      int const l0 = std::max(std::abs(m), std::abs(n));
+      double dPrev = 0.0, d = so3WignerSeed(l0, m, n, c, s);
+      SO3complex sum(0.0);
+      for (int l = l0; ; l++) {
+        if (l > 0) sum += std::conj(g[so3Index(l,m)]) * f[so3Index(l,n)] * d;
+        if (l == L) break;
+        double dNext;
+        if (l == 0) {
+          dNext = cb * d;                                 // m = n = 0
+        } else {
+          double const l1 = l + 1.0;
+          dNext = l1*(2*l + 1) / sqrt((l1*l1 - m*m) * (l1*l1 - n*n))
+                * ( (cb - (double)(m*n) / (l*l1)) * d
+                  - sqrt(((double)l*l - m*m) * ((double)l*l - n*n)) / (l*(2.0*l + 1)) * dPrev );
+        }
+        dPrev = d;
+        d     = dNext;
+      }
+      S[(m+L)*width + (n+L)] = sum;
+    }
+  }
+
+  // Over n for gamma, then over m for alpha
+  //
+  for (int m = 0; m < width; m++) {
+    for (int k = 0; k < N; k++) {
+      SO3complex sum(0.0);
+      for (int n = -L; n <= L; n++) sum += S[m*width + (n+L)] * expTable[(((n*k) % N) + N) % N];
+      T[m*N + k] = sum;
+    }
+  }
+  for (int i = 0; i < N; i++) {
+    for (int k = 0; k < N; k++) {
+      double sum = 0.0;
+      for (int m = -L; m <= L; m++) sum += (T[(m+L)*N + k] * expTable[(((m*i) % N) + N) % N]).real();
+      C[i*N + k] = sum;
+    }
+  }
+}
+
+// The matrix MRISrotate applies for (alpha, beta, gamma), and back
+//
+static void so3MRISrotateMatrix(double M[3][3], double a, double b, double g)
+{
+  double const sa = sin(a), sb = sin(b), sg = sin(g);
+  double const ca = cos(a), cb = cos(b), cg = cos(g);
+  M[0][0] =  ca*cb; M[0][1] = cg*sa - ca*sb*sg; M[0][2] = -ca*cg*sb - sa*sg;
+  M[1][0] = -cb*sa; M[1][1] = ca*cg + sa*sb*sg; M[1][2] =  cg*sa*sb - ca*sg;
+  M[2][0] =  sb;    M[2][1] = cb*sg;            M[2][2] =  cb*cg;
+}
+
+static void so3MRISrotateAngles(double* a, double* b, double* g, double const M[3][3])
+{
+  *b = asin(std::max(-1.0, std::min(1.0, M[2][0])));
+  *g = atan2(M[2][1], M[2][2]);
+  *a = atan2(-M[1][0], M[0][0]);
+}
+
+// Rz(alpha) Ry(beta) Rz(gamma)
+//
+static void so3EulerMatrix(double M[3][3], double alpha, double beta, double gamma)
+{
+  double const sa = sin(alpha), sb = sin(beta), sg = sin(gamma);
+  double const ca = cos(alpha), cb = cos(beta), cg = cos(gamma);
+  M[0][0] = ca*cb*cg - sa*sg; M[0][1] = -ca*cb*sg - sa*cg; M[0][2] = ca*sb;
+  M[1][0] = sa*cb*cg + ca*sg; M[1][1] = -sa*cb*sg + ca*cg; M[1][2] = sa*sb;
+  M[2][0] = -sb*cg;           M[2][1] = sb*sg;             M[2][2] = cb;
+}
+
+// Finds the rotation, in MRISrotate's angles and within +-max_radians of each, that best
+// correlates the bandwidth-limited fields.  Returns the number of rotations correlated.
+//
+static int so3FindMaxCorrelation(
+  double* mina, double* minb, double* ming, double* max_corr,
+  float const* subject, float const* target, int ns, int L, float max_radians)
+{
+  int const N = 2*(L + 1);
+
+  std::vector<SO3complex> f((L+1)*(L+1)), g((L+1)*(L+1));
+  so3Expand(f.data(), subject, ns, L);
+  so3Expand(g.data(), target,  ns, L);
+
+  std::vector<double> C((size_t)N*N*N);
+
+  ROMP_PF_begin
+  int j;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (j = 0; j < N; j++) {
+    ROMP_PFLB_begin
+    so3CorrelateBeta(&C[(size_t)j*N*N], f.data(), g.data(), L, N, M_PI*(2*j + 1) / (2.0*N));
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  bool found = false;
+  for (int j = 0; j < N; j++) {
+    for (int i = 0; i < N; i++) {
+      for (int k = 0; k < N; k++) {
+        double const corr = C[((size_t)j*N + i)*N + k];
+        if (found && corr <= *max_corr) continue;
+        double M[3][3], a, b, c;
+        so3EulerMatrix(M, 2.0*M_PI*i/N, M_PI*(2*j + 1) / (2.0*N), 2.0*M_PI*k/N);
+        so3MRISrotateAngles(&a, &b, &c, M);
+        if (fabs(a) > max_radians || fabs(b) > max_radians || fabs(c) > max_radians) continue;
+        found = true;
+        *mina = a; *minb = b; *ming = c; *max_corr = corr;
+      }
+    }
+  }
+  if (!found) {
+    *mina = *minb = *ming = 0.0; *max_corr = 0.0;
+  }
+  return N*N*N;
+}
+
+
+void MRISrigidBodyAlignGlobal_findMinSSE_SO3(
+  double* new_mina, double* new_minb, double* new_ming, double* new_sse,  // outputs
+  MRI_SURFACE*       mris,
+  INTEGRATION_PARMS* parms,
+  float              min_radians,
+  float              max_radians,
+  double             ext_sse,
+  int                nangles,
+  int                bandwidth) {
+
+  Timer timer;
+
+  int const L  = bandwidth;
+  int const N  = 2*(L + 1);     // samples of each Euler angle
+  int const ns = 4*(L + 1);     // samples of theta and phi, twice what the bandwidth needs, to limit aliasing
+
+  // Sample the subject's and the template's fields at the same points.
+  // The template is weighted by its inverse variance, as in the sse.
+  //
+  float* const subject = getFloats(ns*ns);
+  float* const target  = getFloats(ns*ns);
+
+  MRI_SP* mrisp_subject = MRIStoParameterization(mris, NULL, parms->mrisp_template->scale, 0);
+  for (int j = 0; j < ns; j++) {
+    double const theta = M_PI*(2*j + 1) / (2.0*ns);
+    for (int k = 0; k < ns; k++) {
+      double const phi = 2.0*M_PI*k/ns;
+      float const x = mris->radius * sin(theta) * cos(phi);
+      float const y = mris->radius * sin(theta) * sin(phi);
+      float const z = mris->radius * cos(theta);
+      double const mean = MRISPfunctionVal(parms->mrisp_template, mris->radius, x, y, z, parms->frame_no);
+      double       var  = MRISPfunctionVal(parms->mrisp_template, mris->radius, x, y, z, parms->frame_no + 1);
+      if (FZERO(var)) var = 16.0;       // DEFAULT_STD squared
+      subject[j*ns + k] = MRISPfunctionVal(mrisp_subject, mris->radius, x, y, z, 0);
+      target [j*ns + k] = mean / var;
+    }
+  }
+  MRISPfree(&mrisp_subject);
+
+  double coarse_a, coarse_b, coarse_g, max_corr;
+  int const nrotations = so3FindMaxCorrelation(&coarse_a, &coarse_b, &coarse_g, &max_corr, subject, target, ns, L, max_radians);
+  free(target);
+  free(subject);
+
+  printf("  SO(3) correlation, bandwidth %d, %d rotations: max @ (%2.2f, %2.2f, %2.2f), elapsed %6.4f min\n",
+    L, nrotations,
+    (float)DEGREES(coarse_a), (float)DEGREES(coarse_b), (float)DEGREES(coarse_g),
+    timer.minutes());
+
+  // Refine with the sse over +- one Euler grid step around it.
+  // The window must hold at least 2*nangles cells of min_radians for the grid search to make progress.
+  //
+  float const refine_radians = std::max(4.0*M_PI/N, 2.0*nangles*min_radians);
+
+  std::vector<float> saved(3*mris->nvertices);
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const * v = &mris->vertices[vno];
+    saved[3*vno+0] = v->x; saved[3*vno+1] = v->y; saved[3*vno+2] = v->z;
+  }
+  MRISrotate(mris, mris, coarse_a, coarse_b, coarse_g);
+
+  double fine_a, fine_b, fine_g;
+  MRISrigidBodyAlignGlobal_findMinSSE(
+    &fine_a, &fine_b, &fine_g, new_sse,
+    mris, parms, min_radians, refine_radians, ext_sse, nangles);
+
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    MRISsetXYZ(mris, vno, saved[3*vno+0], saved[3*vno+1], saved[3*vno+2]);
+  }
+
+  // The refinement was applied after the coarse rotation
+  //
+  double coarse[3][3], fine[3][3], both[3][3];
+  so3MRISrotateMatrix(coarse, coarse_a, coarse_b, coarse_g);
+  so3MRISrotateMatrix(fine,   fine_a,   fine_b,   fine_g);
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      both[r][c] = fine[r][0]*coarse[0][c] + fine[r][1]*coarse[1][c] + fine[r][2]*coarse[2][c];
+    }
+  }
+  so3MRISrotateAngles(new_mina, new_minb, new_ming, both);
+}
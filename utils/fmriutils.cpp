@@ -899,6 +899,8 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   efficient.  So why have MRIglmFit() and MRIglmTest()? So that the
   variance can be smoothed between the two if desired.
   --------------------------------------------------------------------*/
+static int MRIglmFitAndTestBatched(MRIGLM *mriglm);
+
 int MRIglmFitAndTest(MRIGLM *mriglm)
 {
   int c, nc, nr, ns, nf, n;
@@ -975,6 +977,10 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
     }
   }
 
+  // When X is the same at every voxel, fit blocks of voxels at once
+  if (!mriglm->pervoxflag && mriglm->yffxvar == NULL && getenv("FS_GLM_PER_VOXEL") == NULL)
+    return (MRIglmFitAndTestBatched(mriglm));
+
   //--------------------------------------------
   //pctdone = 0;
   //nthvox = 0;
@@ -1065,6 +1071,332 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
   return (0);
 }
 
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestBatched() - same as the voxel loop in
+  MRIglmFitAndTest() for the case where the design matrix is shared by
+  all voxels (no per-voxel regressors, weights, frame mask or ffx). Then
+  inv(X'X), C*inv(X'X)*C' and its inverse, and the pcc matrices are the
+  same everywhere, so the voxels are packed into blocks (the columns of
+  a Y matrix) and beta, yhat, eres, rvar, gamma, F, p, z, sig and pcc
+  are computed for the whole block with dense matrix products. Blocks
+  are independent, so they are spread over threads. Everything is done
+  in double; results match the per-voxel path to within float rounding.
+  Set FS_GLM_PER_VOXEL to use the per-voxel path instead.
+  --------------------------------------------------------------------*/
+#define GLM_BATCH_NVOX 256
+static int MRIglmFitAndTestBatched(MRIGLM *mriglm)
+{
+  GLMMAT *glm = mriglm->glm;
+  int nc, nr, ns, nf, nreg, ncon, n, f, k, j, J, Jmax, c, r, s;
+  long nvox, nblocks, blk, v;
+  long *vox;
+  int nthreads, nscratch;
+  double *scratch;
+  double *Xd, *iXtXd, **Cd, **iCd, **Mpmfd, **RDd, **Xcdd, *sumXcd, *sumXcd2, **g0d, *CiXtXCt11;
+  int *Cinvertible;
+  double Xcond = 0, dof;
+  RFS *rfs;
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  ns = mriglm->y->depth;
+  nf = mriglm->y->nframes;
+  ncon = glm->ncontrasts;
+
+  // The global weights are the same at every voxel, so weight X once
+  if (mriglm->wg != NULL && !mriglm->skipweight) {
+    for (f = 1; f <= nf; f++)
+      for (k = 1; k <= mriglm->Xg->cols; k++) glm->X->rptr[f][k] = mriglm->Xg->rptr[f][k] * mriglm->wg->rptr[f][1];
+    GLMxMatrices(glm);
+  }
+  nreg = glm->X->cols;
+  dof = glm->dof;
+
+  // List the voxels to process, in the order of the per-voxel loop
+  vox = (long *)calloc((size_t)nc * nr * ns, sizeof(long));
+  nvox = 0;
+  for (c = 0; c < nc; c++) {
+    for (r = 0; r < nr; r++) {
+      for (s = 0; s < ns; s++) {
+        if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask, c, r, s, 0) < 0.5) continue;
+        vox[nvox++] = ((long)c * nr + r) * ns + s;
+      }
+    }
+  }
+
+  if (mriglm->condsave) Xcond = MatrixConditionNumber(glm->XtX);
+  if (glm->ill_cond_flag) {
+    if (mriglm->condsave)
+      for (v = 0; v < nvox; v++)
+        MRIsetVoxVal(mriglm->cond, vox[v] / ((long)nr * ns), (vox[v] / ns) % nr, vox[v] % ns, 0, Xcond);
+    mriglm->n_ill_cond = nvox;
+    free(vox);
+    return (0);
+  }
+  mriglm->n_ill_cond = 0;
+
+  // Shared matrices, in double, 0-based row major
+  Xd = (double *)calloc(nf * nreg, sizeof(double));
+  iXtXd = (double *)calloc(nreg * nreg, sizeof(double));
+  for (f = 0; f < nf; f++)
+    for (k = 0; k < nreg; k++) Xd[f * nreg + k] = glm->X->rptr[f + 1][k + 1];
+  for (j = 0; j < nreg; j++)
+    for (k = 0; k < nreg; k++) iXtXd[j * nreg + k] = glm->iXtX->rptr[j + 1][k + 1];
+
+  Cd = (double **)calloc(ncon, sizeof(double *));
+  iCd = (double **)calloc(ncon, sizeof(double *));
+  Mpmfd = (double **)calloc(ncon, sizeof(double *));
+  RDd = (double **)calloc(ncon, sizeof(double *));
+  Xcdd = (double **)calloc(ncon, sizeof(double *));
+  g0d = (double **)calloc(ncon, sizeof(double *));
+  sumXcd = (double *)calloc(ncon, sizeof(double));
+  sumXcd2 = (double *)calloc(ncon, sizeof(double));
+  CiXtXCt11 = (double *)calloc(ncon, sizeof(double));
+  Cinvertible = (int *)calloc(ncon, sizeof(int));
+  Jmax = 1;
+  for (n = 0; n < ncon; n++) {
+    MATRIX *iC;
+    J = glm->C[n]->rows;
+    Jmax = MAX(Jmax, J);
+    Cd[n] = (double *)calloc(J * nreg, sizeof(double));
+    for (j = 0; j < J; j++)
+      for (k = 0; k < nreg; k++) Cd[n][j * nreg + k] = glm->C[n]->rptr[j + 1][k + 1];
+    CiXtXCt11[n] = glm->CiXtXCt[n]->rptr[1][1];
+    iC = MatrixInverse(glm->CiXtXCt[n], NULL);
+    if (iC != NULL) {
+      Cinvertible[n] = 1;
+      iCd[n] = (double *)calloc(J * J, sizeof(double));
+      for (j = 0; j < J; j++)
+        for (k = 0; k < J; k++) iCd[n][j * J + k] = iC->rptr[j + 1][k + 1];
+      MatrixFree(&iC);
+    }
+    if (glm->UseGamma0[n]) {
+      g0d[n] = (double *)calloc(J, sizeof(double));
+      for (j = 0; j < J; j++) g0d[n][j] = glm->gamma0[n]->rptr[j + 1][1];
+    }
+    if (glm->ypmfflag[n]) {
+      Mpmfd[n] = (double *)calloc(nreg * nreg, sizeof(double));
+      for (j = 0; j < nreg; j++)
+        for (k = 0; k < nreg; k++) Mpmfd[n][j * nreg + k] = glm->Mpmf[n]->rptr[j + 1][k + 1];
+    }
+    if (J == 1 && glm->DoPCC && glm->Dt[n] != NULL) {
+      RDd[n] = (double *)calloc(nf * nf, sizeof(double));
+      Xcdd[n] = (double *)calloc(nf, sizeof(double));
+      for (j = 0; j < nf; j++) {
+        for (k = 0; k < nf; k++) RDd[n][j * nf + k] = glm->RD[n]->rptr[j + 1][k + 1];
+        Xcdd[n][j] = glm->Xcd[n]->rptr[j + 1][1];
+      }
+      sumXcd[n] = glm->sumXcd[n]->rptr[1][1];
+      sumXcd2[n] = glm->sumXcd2[n]->rptr[1][1];
+    }
+  }
+
+  rfs = RFspecInit(0, NULL);
+  rfs->name = strcpyalloc("z");
+
+  // Same complaint the per-voxel path gets from MRIfromMatrix(), once rather than at every voxel
+  for (n = 0; n < ncon; n++) {
+    if (Mpmfd[n] && mriglm->ypmf[n]->nframes != nreg) {
+      printf("ERROR: MRIfromMatrix: MRI frames = %d, does not equal\n", mriglm->ypmf[n]->nframes);
+      printf("       matrix dim = %dx%d = %d", nreg, 1, nreg);
+    }
+  }
+
+  // The blocks of each thread, [row][voxel] so the inner loops run over contiguous voxels
+  nthreads = omp_get_max_threads();
+  nscratch = (2 * nf + 2 * nreg + Jmax + MAX(nf, nreg)) * GLM_BATCH_NVOX;
+  scratch = (double *)calloc((size_t)nthreads * nscratch, sizeof(double));
+  if (scratch == NULL) ErrorExit(ERROR_NOMEMORY, "MRIglmFitAndTest: could not allocate %d blocks", nthreads);
+
+  nblocks = (nvox + GLM_BATCH_NVOX - 1) / GLM_BATCH_NVOX;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (blk = 0; blk < nblocks; blk++) {
+    ROMP_PFLB_begin
+    const int B = GLM_BATCH_NVOX;
+    long v0 = blk * GLM_BATCH_NVOX, nb = MIN(GLM_BATCH_NVOX, nvox - v0);
+    int b, f, j, k, n, J, vc[GLM_BATCH_NVOX], vr[GLM_BATCH_NVOX], vs[GLM_BATCH_NVOX];
+    double *Y = &scratch[(size_t)omp_get_thread_num() * nscratch];
+    double *Xty = Y + nf * B;
+    double *beta = Xty + nreg * B;
+    double *yhat = beta + nreg * B;
+    double *gam = yhat + nf * B;
+    double *tmp = gam + Jmax * B;
+    double rvar[GLM_BATCH_NVOX];
+
+    // Xty, beta and yhat are accumulated
+    memset(Xty, 0, (2 * nreg + nf) * B * sizeof(double));
+
+    for (b = 0; b < nb; b++) {
+      long vi = vox[v0 + b];
+      vc[b] = vi / ((long)nr * ns);
+      vr[b] = (vi / ns) % nr;
+      vs[b] = vi % ns;
+      for (f = 0; f < nf; f++) {
+        Y[f * B + b] = MRIgetVoxVal(mriglm->y, vc[b], vr[b], vs[b], f);
+        if (mriglm->wg != NULL && !mriglm->skipweight) Y[f * B + b] *= mriglm->wg->rptr[f + 1][1];
+      }
+    }
+
+    // Xty = X'*Y, beta = inv(X'X)*Xty, yhat = X*beta
+    for (k = 0; k < nreg; k++)
+      for (f = 0; f < nf; f++) {
+        double x = Xd[f * nreg + k];
+        for (b = 0; b < nb; b++) Xty[k * B + b] += x * Y[f * B + b];
+      }
+    for (j = 0; j < nreg; j++)
+      for (k = 0; k < nreg; k++) {
+        double a = iXtXd[j * nreg + k];
+        for (b = 0; b < nb; b++) beta[j * B + b] += a * Xty[k * B + b];
+      }
+    for (f = 0; f < nf; f++)
+      for (k = 0; k < nreg; k++) {
+        double x = Xd[f * nreg + k];
+        for (b = 0; b < nb; b++) yhat[f * B + b] += x * beta[k * B + b];
+      }
+
+    // eres = Y - yhat (kept in Y), rvar = sum(eres.^2)/dof
+    for (b = 0; b < nb; b++) rvar[b] = 0;
+    for (f = 0; f < nf; f++)
+      for (b = 0; b < nb; b++) {
+        double e = Y[f * B + b] - yhat[f * B + b];
+        Y[f * B + b] = e;
+        rvar[b] += e * e;
+      }
+    for (b = 0; b < nb; b++) {
+      rvar[b] /= dof;
+      if (rvar[b] < FLT_MIN) rvar[b] = FLT_MIN;
+    }
+
+    for (b = 0; b < nb; b++) {
+      MRIsetVoxVal(mriglm->rvar, vc[b], vr[b], vs[b], 0, rvar[b]);
+      if (mriglm->condsave) MRIsetVoxVal(mriglm->cond, vc[b], vr[b], vs[b], 0, Xcond);
+      for (k = 0; k < nreg; k++) MRIsetVoxVal(mriglm->beta, vc[b], vr[b], vs[b], k, beta[k * B + b]);
+      for (f = 0; f < nf; f++) MRIsetVoxVal(mriglm->eres, vc[b], vr[b], vs[b], f, Y[f * B + b]);
+      if (mriglm->yhatsave)
+        for (f = 0; f < nf; f++) MRIsetVoxVal(mriglm->yhat, vc[b], vr[b], vs[b], f, yhat[f * B + b]);
+    }
+
+    for (n = 0; n < ncon; n++) {
+      J = glm->C[n]->rows;
+
+      // gamma = C*beta (- gamma0)
+      memset(gam, 0, J * B * sizeof(double));
+      for (j = 0; j < J; j++)
+        for (k = 0; k < nreg; k++) {
+          double a = Cd[n][j * nreg + k];
+          for (b = 0; b < nb; b++) gam[j * B + b] += a * beta[k * B + b];
+        }
+      if (g0d[n])
+        for (j = 0; j < J; j++)
+          for (b = 0; b < nb; b++) gam[j * B + b] -= g0d[n][j];
+
+      // pcc needs RD*yhat for the whole block
+      if (RDd[n]) {
+        memset(tmp, 0, nf * B * sizeof(double));
+        for (j = 0; j < nf; j++)
+          for (k = 0; k < nf; k++) {
+            double a = RDd[n][j * nf + k];
+            for (b = 0; b < nb; b++) tmp[j * B + b] += a * yhat[k * B + b];
+          }
+      }
+
+      for (b = 0; b < nb; b++) {
+        double dtmp, F = 0, p = 1, z = 0, pcc = 0;
+
+        // Error trap for when rvar==0
+        if (rvar[b] < 2 * FLT_MIN)
+          dtmp = 1e10 * J;
+        else
+          dtmp = rvar[b] * J;
+
+        if (Cinvertible[n] && rvar[b] > FLT_MIN) {
+          // F = gamma' * inv(C*inv(X'X)*C') * gamma / dtmp
+          for (j = 0; j < J; j++)
+            for (k = 0; k < J; k++) F += gam[j * B + b] * iCd[n][j * J + k] * gam[k * B + b];
+          F /= dtmp;
+          if (F >= 0) {
+            p = sc_cdf_fdist_Q(F, J, dof);
+            z = RFp2StatVal(rfs, p / 2.0);
+          }
+          else {
+            F = 0;
+            p = 1;
+            z = 0;
+          }
+          if (J == 1 && gam[b] < 0) z *= -1;
+          if (RDd[n]) {
+            double sy = 0, sy2 = 0, xy = 0;
+            for (f = 0; f < nf; f++) {
+              double yd = tmp[f * B + b];
+              sy += yd;
+              sy2 += yd * yd;
+              xy += Xcdd[n][f] * yd;
+            }
+            sy2 += dof * rvar[b];
+            pcc = (xy - sumXcd[n] * sy) / sqrt((sumXcd2[n] - sumXcd[n] * sumXcd[n]) * (sy2 - sy * sy));
+          }
+        }
+
+        for (j = 0; j < J; j++) MRIsetVoxVal(mriglm->gamma[n], vc[b], vr[b], vs[b], j, gam[j * B + b]);
+        if (J == 1) MRIsetVoxVal(mriglm->gammaVar[n], vc[b], vr[b], vs[b], 0, CiXtXCt11[n] * dtmp);
+        MRIsetVoxVal(mriglm->F[n], vc[b], vr[b], vs[b], 0, F);
+        MRIsetVoxVal(mriglm->z[n], vc[b], vr[b], vs[b], 0, z);
+        MRIsetVoxVal(mriglm->p[n], vc[b], vr[b], vs[b], 0, p);
+        if (J == 1 && glm->DoPCC) MRIsetVoxVal(mriglm->pcc[n], vc[b], vr[b], vs[b], 0, pcc);
+        if (p == 0)
+          MRIsetVoxVal(mriglm->sig[n], vc[b], vr[b], vs[b], 0, 10e10);
+        else {
+          double sig = -log10(p);
+          if (J == 1) sig *= SIGN(gam[b]);
+          MRIsetVoxVal(mriglm->sig[n], vc[b], vr[b], vs[b], 0, sig);
+        }
+      }
+
+      // ypmf = Mpmf*beta, left unfilled on a frame/row mismatch like MRIfromMatrix() does
+      if (Mpmfd[n] && mriglm->ypmf[n]->nframes == nreg) {
+        memset(tmp, 0, nreg * B * sizeof(double));
+        for (j = 0; j < nreg; j++)
+          for (k = 0; k < nreg; k++) {
+            double a = Mpmfd[n][j * nreg + k];
+            for (b = 0; b < nb; b++) tmp[j * B + b] += a * beta[k * B + b];
+          }
+        for (b = 0; b < nb; b++)
+          for (k = 0; k < nreg; k++) MRIsetVoxVal(mriglm->ypmf[n], vc[b], vr[b], vs[b], k, tmp[k * B + b]);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(scratch);
+  RFspecFree(&rfs);
+  for (n = 0; n < ncon; n++) {
+    free(Cd[n]);
+    free(iCd[n]);
+    free(Mpmfd[n]);
+    free(RDd[n]);
+    free(Xcdd[n]);
+    free(g0d[n]);
+  }
+  free(Cd);
+  free(iCd);
+  free(Mpmfd);
+  free(RDd);
+  free(Xcdd);
+  free(g0d);
+  free(sumXcd);
+  free(sumXcd2);
+  free(CiXtXCt11);
+  free(Cinvertible);
+  free(Xd);
+  free(iXtXd);
+  free(vox);
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFit() - fits glm (beta and rvar) on a voxel-by-voxel basis.
   Made to be followed by MRIglmTest(). See notes on MRIglmFitandTest()
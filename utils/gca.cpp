@@ -41,6 +41,8 @@
 #include "fio.h"
 #include "flash.h"
 #include "gca.h"
+#include "gcalabel.h"
+#include "gcapacked.h"
 #include "intensity_eig.h"
 #include "macros.h"
 #include "mri.h"
@@ -1609,6 +1611,14 @@ int GCAfree(GCA **pgca)
   gca = *pgca;
   *pgca = NULL;
 
+  if (gca->packed) {
+    // nodes and priors point into the packed blocks, nothing to free per node
+    GCApackedFree(gca);
+    GCAcleanup(gca);
+    free(gca);
+    return (NO_ERROR);
+  }
+
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -2076,6 +2086,9 @@ int GCAwrite(GCA *gca, const char *fname)
   GC1D *gc;
   int gzipped = 0;
 
+  if (strstr(fname, ".gcap")) {
+    return (GCApackedWrite(gca, fname));
+  }
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
@@ -2230,6 +2243,10 @@ GCA *GCAread(const char *fname)
   int gzipped = 0;
   int tempZNZ;
 
+  // packed atlases are recognized by their magic number, whatever the name
+  if (GCApackedIsFile(fname)) {
+    return (GCApackedRead(fname));
+  }
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
@@ -2685,6 +2702,7 @@ static int GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
       unsigned short *old_labels;
       float *old_priors;
 
+      if (gca->packed) ErrorExit(ERROR_UNSUPPORTED, "GCAupdatePrior: cannot add labels to a packed GCA");
       old_max_labels = gcap->max_labels;
       gcap->max_labels += 2;
       old_labels = gcap->labels;
@@ -2833,6 +2851,7 @@ static int GCAupdateNode(GCA *gca, MRI *mri, int xn, int yn, int zn, float *vals
       unsigned short *old_labels;
       GC1D *old_gcs;
 
+      if (gca->packed) ErrorExit(ERROR_UNSUPPORTED, "GCAupdateNode: cannot add labels to a packed GCA");
       old_max_labels = gcan->max_labels;
       gcan->max_labels += 2;
       old_labels = gcan->labels;
@@ -3160,6 +3179,11 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
     MRIcopyHeader(mri_inputs, mri_dst);
   }
 
+  // the batched version gives the same labels - the loop below is the reference
+  if (!use_partial_volume_stuff && !INTERP_PRIOR && !GCAlabelUseReference()) {
+    return (GCAlabelVectorized(mri_inputs, gca, mri_dst, transform));
+  }
+
   /* go through each voxel in the input volume and find the canonical
      voxel (and hence the classifier) to which it maps. Then update the
      classifiers statistics based on this voxel's intensity and label.
@@ -3330,6 +3354,10 @@ MRI *GCAlabelProbabilities(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *t
     MRIcopyHeader(mri_inputs, mri_dst);
   }
 
+  if (!GCAlabelUseReference()) {
+    return (GCAlabelProbabilitiesVectorized(mri_inputs, gca, mri_dst, transform));
+  }
+
   /* go through each voxel in the input volume and find the canonical
      voxel (and hence the classifier) to which it maps. Then update the
      classifiers statistics based on this voxel's intensity and label.
@@ -6005,6 +6033,7 @@ static int GCAupdateNodeGibbsPriors(GCA *gca, MRI *mri, int xn, int yn, int zn,
       unsigned short *old_labels;
       float *old_label_priors;
 
+      if (gca->packed) ErrorExit(ERROR_UNSUPPORTED, "GCAupdateNodeGibbsPriors: cannot add labels to a packed GCA");
       old_labels = gc->labels[i];
       old_label_priors = gc->label_priors[i];
 
@@ -12705,6 +12734,11 @@ int GCAfreeGibbs(GCA *gca)
   if (gca->flags & GCA_NO_MRF) {
     return (NO_ERROR); /* already done */
   }
+  if (gca->packed) {
+    GCApackedReleaseGibbs(gca);
+    gca->flags |= GCA_NO_MRF;
+    return (NO_ERROR);
+  }
 
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
@@ -18465,6 +18499,9 @@ GCA *GCAcompactify(GCA *gca)
   int i, j, k;
   double byteSaved = 0.;
 
+  // packed nodes and priors are already sized to nlabels
+  if (gca->packed) return (gca);
+
   width = gca->prior_width;
   height = gca->prior_height;
   depth = gca->prior_depth;
@@ -21957,6 +21994,8 @@ int GCAinsertLabels(GCA *gca,
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  if (gca->packed) ErrorExit(ERROR_UNSUPPORTED, "GCAinsertLabels: cannot add labels to a packed GCA");
+
   for (l = 0; l < ninsertions; l++) {
     whalf = insert_whalf[l];
     label = insert_labels[l];
@@ -22922,6 +22961,7 @@ void GCAinitLabelsFromMRI(GCA *gca, MRI *mri_labels)
 
   if (gca->width != mri_labels->width || gca->height != mri_labels->height || gca->depth != mri_labels->depth)
     ErrorExit(ERROR_BADPARM, "GCAinitLabelsFromMRI: GCA and MRI must have same dimensions");
+  if (gca->packed) ErrorExit(ERROR_UNSUPPORTED, "GCAinitLabelsFromMRI: cannot reallocate nodes of a packed GCA");
 
   for (x = 0; x < gca->width; x++)
     for (y = 0; y < gca->height; y++)
@@ -0,0 +1,516 @@
+/**
+ * @brief vectorized, multithreaded MAP labeling with a GCA
+ *
+ * Batched evaluation of the class-conditional densities used by GCAlabel()
+ * and GCAlabelProbabilities(). See gcalabel.h.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "error.h"
+#include "gca.h"
+#include "gcalabel.h"
+#include "macros.h"
+#include "matrix.h"
+#include "romp_support.h"
+
+#define BIG_AND_NEGATIVE -10000000.0  // same initial max as GCAlabel() in gca.cpp
+
+/*
+  Everything the inner loops need about the classifiers, flattened so that
+  GC1D g of node n is g = node_offsets[n] + (index of the label in the node).
+  The inverse covariances are computed exactly as GCAmahDist() computes them
+  (MatrixInverse followed by MatrixSVDInverse), and the normalizers as
+  GCAcomputeConditional[Log]Density() do, so every density comes out with
+  the same bits as the per-voxel code.
+*/
+typedef struct
+{
+  int      ninputs ;
+  int64_t  nnodes ;
+  int64_t  ngcs ;
+  int64_t  *node_offsets ;    // nnodes+1
+  float    *means ;           // ngcs*ninputs
+  float    *icovs ;           // ngcs*ninputs*ninputs, row major (covars[0] if ninputs==1)
+  double   *lognorm ;         // -log(sqrt(det))
+  double   *norm ;            // 1/((2pi)^(ninputs/2) sqrt(det))
+  char     *singular ;        // inverse failed - leave it to the reference code
+  int      max_node_labels ;
+  int      max_prior_labels ;
+}
+GCA_LABEL_ENGINE ;
+
+/* per-thread scratch holding all candidate labels of one row of voxels */
+typedef struct
+{
+  int      max_lanes ;
+  int      *first ;           // width: first lane of each voxel
+  int      *nlanes ;          // width: -1 if the voxel is outside the atlas
+  int      *xn, *yn, *zn ;    // width: node of each voxel
+  int64_t  *gc ;              // per lane
+  int      *label ;
+  int      *cand ;            // index of the candidate in the node/prior
+  char     *fallback ;
+  float    *vals ;            // max_lanes*ninputs
+  double   *weight ;          // log(prior) when labeling, prior for probabilities
+  double   *dsq ;
+}
+GCA_LABEL_LANES ;
+
+static GCA_LABEL_ENGINE *gcaLabelEngineAlloc(GCA *gca) ;
+static void gcaLabelEngineFree(GCA_LABEL_ENGINE **pgle) ;
+static int gcaLabelLanesInit(GCA_LABEL_LANES *lanes, int width, int max_lanes, int ninputs) ;
+static void gcaLabelLanesFree(GCA_LABEL_LANES *lanes) ;
+static void gcaLabelMahalanobis(const GCA_LABEL_ENGINE *gle, GCA_LABEL_LANES *lanes, int nlanes) ;
+
+int GCAlabelUseReference(void)
+{
+  static int use_reference = -1 ;
+
+  if (use_reference < 0)
+    use_reference = (getenv("FS_GCA_LABEL_REFERENCE") != NULL) ;
+  return (use_reference) ;
+}
+
+static GCA_LABEL_ENGINE *gcaLabelEngineAlloc(GCA *gca)
+{
+  GCA_LABEL_ENGINE *gle ;
+  int64_t          nnodes, ngcs, node ;
+  int              xn, yn, zn, xp, yp, zp, ninputs ;
+
+  gle = (GCA_LABEL_ENGINE *)calloc(1, sizeof(GCA_LABEL_ENGINE)) ;
+  if (!gle)
+    ErrorExit(ERROR_NOMEMORY, "gcaLabelEngineAlloc: could not allocate engine") ;
+
+  ninputs = gle->ninputs = gca->ninputs ;
+  nnodes = gle->nnodes = (int64_t)gca->node_width * gca->node_height * gca->node_depth ;
+  gle->node_offsets = (int64_t *)calloc(nnodes + 1, sizeof(int64_t)) ;
+  if (!gle->node_offsets)
+    ErrorExit(ERROR_NOMEMORY, "gcaLabelEngineAlloc: could not allocate %lld node offsets", (long long)nnodes) ;
+
+  for (ngcs = 0, node = 0, xn = 0; xn < gca->node_width; xn++)
+    for (yn = 0; yn < gca->node_height; yn++)
+      for (zn = 0; zn < gca->node_depth; zn++, node++)
+      {
+        GCA_NODE *gcan = &gca->nodes[xn][yn][zn] ;
+        gle->node_offsets[node] = ngcs ;
+        ngcs += gcan->nlabels ;
+        if (gcan->nlabels > gle->max_node_labels)
+          gle->max_node_labels = gcan->nlabels ;
+      }
+  gle->node_offsets[nnodes] = gle->ngcs = ngcs ;
+
+  for (xp = 0; xp < gca->prior_width; xp++)
+    for (yp = 0; yp < gca->prior_height; yp++)
+      for (zp = 0; zp < gca->prior_depth; zp++)
+        if (gca->priors[xp][yp][zp].nlabels > gle->max_prior_labels)
+          gle->max_prior_labels = gca->priors[xp][yp][zp].nlabels ;
+
+  // at least one entry, so masked-off lanes can always point at gc 0
+  ngcs = MAX(ngcs, 1) ;
+  gle->means    = (float *)calloc(ngcs * ninputs, sizeof(float)) ;
+  gle->icovs    = (float *)calloc(ngcs * ninputs * ninputs, sizeof(float)) ;
+  gle->lognorm  = (double *)calloc(ngcs, sizeof(double)) ;
+  gle->norm     = (double *)calloc(ngcs, sizeof(double)) ;
+  gle->singular = (char *)calloc(ngcs, sizeof(char)) ;
+  if (!gle->means || !gle->icovs || !gle->lognorm || !gle->norm || !gle->singular)
+    ErrorExit(ERROR_NOMEMORY, "gcaLabelEngineAlloc: could not allocate tables for %lld classifiers", (long long)ngcs) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (xn = 0; xn < gca->node_width; xn++) {
+    ROMP_PFLB_begin
+    int     yn, zn, n, r, c ;
+    MATRIX  *m_cov = NULL, *m_cov_inv = NULL ;
+
+    if (ninputs > 1) {
+      m_cov = MatrixAlloc(ninputs, ninputs, MATRIX_REAL) ;
+      m_cov_inv = MatrixAlloc(ninputs, ninputs, MATRIX_REAL) ;
+    }
+    for (yn = 0; yn < gca->node_height; yn++)
+      for (zn = 0; zn < gca->node_depth; zn++) {
+        GCA_NODE *gcan = &gca->nodes[xn][yn][zn] ;
+        int64_t  node = ((int64_t)xn * gca->node_height + yn) * gca->node_depth + zn ;
+
+        for (n = 0; n < gcan->nlabels; n++) {
+          GC1D    *gc = &gcan->gcs[n] ;
+          int64_t g = gle->node_offsets[node] + n ;
+          double  det ;
+
+          for (r = 0; r < ninputs; r++) gle->means[g * ninputs + r] = gc->means[r] ;
+          det = covariance_determinant(gc, ninputs) ;
+          if (ninputs == 1)
+            gle->icovs[g] = gc->covars[0] ;  // GCAmahDist divides by the variance
+          else {
+            load_covariance_matrix(gc, m_cov, ninputs) ;
+            if (MatrixInverse(m_cov, m_cov_inv) == NULL)
+              gle->singular[g] = 1 ;
+            else {
+              MatrixSVDInverse(m_cov, m_cov_inv) ;
+              for (r = 0; r < ninputs; r++)
+                for (c = 0; c < ninputs; c++)
+                  gle->icovs[(g * ninputs + r) * ninputs + c] = *MATRIX_RELT(m_cov_inv, r + 1, c + 1) ;
+            }
+          }
+          gle->lognorm[g] = -log(sqrt(det)) ;
+          gle->norm[g] = (1.0 / (pow(2 * M_PI, ninputs / 2.0) * sqrt(det))) ;
+        }
+      }
+    if (m_cov) {
+      MatrixFree(&m_cov) ;
+      MatrixFree(&m_cov_inv) ;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (gle) ;
+}
+
+static void gcaLabelEngineFree(GCA_LABEL_ENGINE **pgle)
+{
+  GCA_LABEL_ENGINE *gle = *pgle ;
+
+  *pgle = NULL ;
+  free(gle->node_offsets) ;
+  free(gle->means) ;
+  free(gle->icovs) ;
+  free(gle->lognorm) ;
+  free(gle->norm) ;
+  free(gle->singular) ;
+  free(gle) ;
+}
+
+static int gcaLabelLanesInit(GCA_LABEL_LANES *lanes, int width, int max_lanes, int ninputs)
+{
+  max_lanes = MAX(max_lanes, 1) ;
+  lanes->max_lanes = max_lanes ;
+  lanes->first    = (int *)calloc(width, sizeof(int)) ;
+  lanes->nlanes   = (int *)calloc(width, sizeof(int)) ;
+  lanes->xn       = (int *)calloc(width, sizeof(int)) ;
+  lanes->yn       = (int *)calloc(width, sizeof(int)) ;
+  lanes->zn       = (int *)calloc(width, sizeof(int)) ;
+  lanes->gc       = (int64_t *)calloc(max_lanes, sizeof(int64_t)) ;
+  lanes->label    = (int *)calloc(max_lanes, sizeof(int)) ;
+  lanes->cand     = (int *)calloc(max_lanes, sizeof(int)) ;
+  lanes->fallback = (char *)calloc(max_lanes, sizeof(char)) ;
+  lanes->vals     = (float *)calloc(max_lanes * ninputs, sizeof(float)) ;
+  lanes->weight   = (double *)calloc(max_lanes, sizeof(double)) ;
+  lanes->dsq      = (double *)calloc(max_lanes, sizeof(double)) ;
+  if (!lanes->first || !lanes->nlanes || !lanes->xn || !lanes->yn || !lanes->zn || !lanes->gc || !lanes->label ||
+      !lanes->cand || !lanes->fallback || !lanes->vals || !lanes->weight || !lanes->dsq)
+    ErrorExit(ERROR_NOMEMORY, "gcaLabelLanesInit: could not allocate %d lanes", max_lanes) ;
+  return (NO_ERROR) ;
+}
+
+static void gcaLabelLanesFree(GCA_LABEL_LANES *lanes)
+{
+  free(lanes->first) ;
+  free(lanes->nlanes) ;
+  free(lanes->xn) ;
+  free(lanes->yn) ;
+  free(lanes->zn) ;
+  free(lanes->gc) ;
+  free(lanes->label) ;
+  free(lanes->cand) ;
+  free(lanes->fallback) ;
+  free(lanes->vals) ;
+  free(lanes->weight) ;
+  free(lanes->dsq) ;
+  memset(lanes, 0, sizeof(*lanes)) ;
+}
+
+/*
+  Squared Mahalanobis distance of every lane to its classifier. The
+  operations (float differences, float row sums accumulated in order, float
+  dot product) mirror GCAmahDist()/MatrixMultiply()/VectorDot() one for one;
+  the lanes are independent so the loop vectorizes without reassociation.
+*/
+static void gcaLabelMahalanobis(const GCA_LABEL_ENGINE *gle, GCA_LABEL_LANES *lanes, int nlanes)
+{
+  const int     ninputs = gle->ninputs ;
+  const int64_t *lane_gc = lanes->gc ;
+  const float   *vals = lanes->vals, *means = gle->means, *icovs = gle->icovs ;
+  double        *dsq = lanes->dsq ;
+  int           k ;
+
+  if (ninputs == 1) {
+#ifdef HAVE_OPENMP
+    #pragma omp simd
+#endif
+    for (k = 0; k < nlanes; k++) {
+      int64_t g = lane_gc[k] ;
+      float   v = vals[k] - means[g] ;
+      dsq[k] = v * v / icovs[g] ;
+    }
+    return ;
+  }
+
+#ifdef HAVE_OPENMP
+  #pragma omp simd
+#endif
+  for (k = 0; k < nlanes; k++) {
+    int64_t     g = lane_gc[k] ;
+    const float *mean = means + g * ninputs, *icov = icovs + g * ninputs * ninputs ;
+    float       d[MAX_GCA_INPUTS], w, dot ;
+    int         r, c ;
+
+    for (r = 0; r < ninputs; r++) d[r] = mean[r] - vals[k * ninputs + r] ;
+    for (dot = 0.0f, r = 0; r < ninputs; r++) {
+      for (w = 0.0, c = 0; c < ninputs; c++) w += icov[r * ninputs + c] * d[c] ;
+      dot += d[r] * w ;
+    }
+    dsq[k] = dot ;
+  }
+}
+
+/*!
+  \fn MRI *GCAlabelVectorized(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
+  \brief Maximum a posteriori (no MRF) labeling of mri_inputs, same result as
+  the reference GCAlabel() loop. mri_dst must already be allocated. Voxels
+  that map outside the atlas are left untouched, as in GCAlabel().
+*/
+MRI *GCAlabelVectorized(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
+{
+  GCA_LABEL_ENGINE *gle ;
+  GCA_LABEL_LANES  *thread_lanes ;
+  int              width, height, depth, nrows, row, nthreads, t ;
+
+  gle = gcaLabelEngineAlloc(gca) ;
+  width = mri_inputs->width ;
+  height = mri_inputs->height ;
+  depth = mri_inputs->depth ;
+  nrows = height * depth ;
+  nthreads = omp_get_max_threads() ;
+  thread_lanes = (GCA_LABEL_LANES *)calloc(nthreads, sizeof(GCA_LABEL_LANES)) ;
+  if (!thread_lanes)
+    ErrorExit(ERROR_NOMEMORY, "GCAlabelVectorized: could not allocate %d lane buffers", nthreads) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (row = 0; row < nrows; row++) {
+    ROMP_PFLB_begin
+    GCA_LABEL_LANES *lanes = &thread_lanes[omp_get_thread_num()] ;
+    int             x, y, z, n, k, nl, xp, yp, zp, xn, yn, zn, label ;
+    float           vals[MAX_GCA_INPUTS], max_p, p ;
+
+    y = row % height ;
+    z = row / height ;
+    if (lanes->first == NULL)
+      gcaLabelLanesInit(lanes, width, width * gle->max_prior_labels, gle->ninputs) ;
+
+    // gather every (voxel, candidate label) pair of the row into lanes
+    for (nl = x = 0; x < width; x++) {
+      GCA_PRIOR *gcap ;
+      GCA_NODE  *gcan ;
+      int64_t   base ;
+
+      lanes->first[x] = nl ;
+      lanes->nlanes[x] = -1 ;
+      if (GCAsourceVoxelToPrior(gca, mri_inputs, transform, x, y, z, &xp, &yp, &zp) != NO_ERROR)
+        continue ;
+      GCApriorToNode(gca, xp, yp, zp, &xn, &yn, &zn) ;
+      load_vals(mri_inputs, x, y, z, vals, gca->ninputs) ;
+      lanes->xn[x] = xn ;
+      lanes->yn[x] = yn ;
+      lanes->zn[x] = zn ;
+      gcap = &gca->priors[xp][yp][zp] ;
+      gcan = &gca->nodes[xn][yn][zn] ;
+      base = gle->node_offsets[((int64_t)xn * gca->node_height + yn) * gca->node_depth + zn] ;
+      lanes->nlanes[x] = gcap->nlabels ;
+      for (n = 0; n < gcap->nlabels; n++, nl++) {
+        int m ;
+
+        for (m = 0; m < gcan->nlabels; m++)
+          if (gcan->labels[m] == gcap->labels[n]) break ;
+        lanes->label[nl] = gcap->labels[n] ;
+        lanes->cand[nl] = n ;
+        if (m < gcan->nlabels) {
+          lanes->gc[nl] = base + m ;
+          lanes->fallback[nl] = gle->singular[base + m] ;
+        }
+        else {
+          lanes->gc[nl] = 0 ;
+          lanes->fallback[nl] = 1 ;
+        }
+        lanes->weight[nl] = log(gcap->priors[n]) ;
+        memmove(lanes->vals + nl * gle->ninputs, vals, gle->ninputs * sizeof(float)) ;
+      }
+    }
+
+    gcaLabelMahalanobis(gle, lanes, nl) ;
+
+    // pick the most likely candidate of each voxel, in candidate order
+    for (x = 0; x < width; x++) {
+      if (lanes->nlanes[x] < 0) continue ;
+      if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak() ;
+
+      label = 0 ;
+      max_p = 2 * GIBBS_NEIGHBORS * BIG_AND_NEGATIVE ;
+      for (k = lanes->first[x], n = 0; n < lanes->nlanes[x]; n++, k++) {
+        if (lanes->fallback[k]) {
+          // label not in the node (or singular covariance) - reference path
+          int   skip = 0 ;
+          float *kvals = lanes->vals + k * gle->ninputs ;
+#ifdef HAVE_OPENMP
+          #pragma omp critical(gca_label_fallback)
+#endif
+          {
+            GC1D *gc = GCAfindGC(gca, lanes->xn[x], lanes->yn[x], lanes->zn[x], lanes->label[k]) ;
+            if (gc == NULL)
+              gc = GCAfindClosestValidGC(gca, lanes->xn[x], lanes->yn[x], lanes->zn[x], lanes->label[k], 0) ;
+            if (gc == NULL)
+              skip = 1 ;
+            else {
+              double log_p = GCAcomputeConditionalLogDensity(gc, kvals, gca->ninputs, lanes->label[k]) ;
+              log_p += lanes->weight[k] ;
+              p = log_p ;
+            }
+          }
+          if (skip) continue ;
+        }
+        else {
+          double log_p = gle->lognorm[lanes->gc[k]] - .5 * lanes->dsq[k] ;
+          log_p += lanes->weight[k] ;
+          p = log_p ;
+        }
+        if (p > max_p) {
+          max_p = p ;
+          label = lanes->label[k] ;
+        }
+      }
+      MRIsetVoxVal(mri_dst, x, y, z, 0, label) ;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (t = 0; t < nthreads; t++) gcaLabelLanesFree(&thread_lanes[t]) ;
+  free(thread_lanes) ;
+  gcaLabelEngineFree(&gle) ;
+  return (mri_dst) ;
+}
+
+/*!
+  \fn MRI *GCAlabelProbabilitiesVectorized(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
+  \brief Probability (scaled to 0-255) of the most likely label at each voxel,
+  same result as the reference GCAlabelProbabilities() loop. mri_dst must
+  already be allocated.
+*/
+MRI *GCAlabelProbabilitiesVectorized(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
+{
+  GCA_LABEL_ENGINE *gle ;
+  GCA_LABEL_LANES  *thread_lanes ;
+  int              width, height, depth, nrows, row, nthreads, t ;
+
+  gle = gcaLabelEngineAlloc(gca) ;
+  width = mri_inputs->width ;
+  height = mri_inputs->height ;
+  depth = mri_inputs->depth ;
+  nrows = height * depth ;
+  nthreads = omp_get_max_threads() ;
+  thread_lanes = (GCA_LABEL_LANES *)calloc(nthreads, sizeof(GCA_LABEL_LANES)) ;
+  if (!thread_lanes)
+    ErrorExit(ERROR_NOMEMORY, "GCAlabelProbabilitiesVectorized: could not allocate %d lane buffers", nthreads) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (row = 0; row < nrows; row++) {
+    ROMP_PFLB_begin
+    GCA_LABEL_LANES *lanes = &thread_lanes[omp_get_thread_num()] ;
+    int             x, y, z, n, k, nl, xp, yp, zp, xn, yn, zn ;
+    float           vals[MAX_GCA_INPUTS] ;
+    double          max_p, p, total_p ;
+
+    y = row % height ;
+    z = row / height ;
+    if (lanes->first == NULL)
+      gcaLabelLanesInit(lanes, width, width * gle->max_node_labels, gle->ninputs) ;
+
+    for (nl = x = 0; x < width; x++) {
+      GCA_PRIOR *gcap ;
+      GCA_NODE  *gcan ;
+      int64_t   base ;
+
+      lanes->first[x] = nl ;
+      lanes->nlanes[x] = -1 ;
+      if (GCAsourceVoxelToPrior(gca, mri_inputs, transform, x, y, z, &xp, &yp, &zp) != NO_ERROR)
+        continue ;
+      gcap = &gca->priors[xp][yp][zp] ;
+      if (gcap->nlabels <= 0) continue ;
+      GCApriorToNode(gca, xp, yp, zp, &xn, &yn, &zn) ;
+      load_vals(mri_inputs, x, y, z, vals, gca->ninputs) ;
+      lanes->xn[x] = xn ;
+      lanes->yn[x] = yn ;
+      lanes->zn[x] = zn ;
+      gcan = &gca->nodes[xn][yn][zn] ;
+      base = gle->node_offsets[((int64_t)xn * gca->node_height + yn) * gca->node_depth + zn] ;
+      lanes->nlanes[x] = gcan->nlabels ;
+      for (n = 0; n < gcan->nlabels; n++, nl++) {
+        lanes->gc[nl] = base + n ;
+        lanes->label[nl] = gcan->labels[n] ;
+        lanes->cand[nl] = n ;
+        lanes->fallback[nl] = gle->singular[base + n] ;
+        lanes->weight[nl] = getPrior(gcap, gcan->labels[n]) ;
+        memmove(lanes->vals + nl * gle->ninputs, vals, gle->ninputs * sizeof(float)) ;
+      }
+    }
+
+    gcaLabelMahalanobis(gle, lanes, nl) ;
+
+    for (x = 0; x < width; x++) {
+      if (lanes->nlanes[x] < 0) continue ;
+      if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak() ;
+
+      max_p = 2 * GIBBS_NEIGHBORS * BIG_AND_NEGATIVE ;
+      for (total_p = 0.0, k = lanes->first[x], n = 0; n < lanes->nlanes[x]; n++, k++) {
+        if (lanes->fallback[k]) {
+          GCA_NODE *gcan = &gca->nodes[lanes->xn[x]][lanes->yn[x]][lanes->zn[x]] ;
+#ifdef HAVE_OPENMP
+          #pragma omp critical(gca_label_fallback)
+#endif
+          p = GCAcomputeConditionalDensity(&gcan->gcs[lanes->cand[k]], lanes->vals + k * gle->ninputs,
+                                           gca->ninputs, lanes->label[k]) ;
+        }
+        else
+          p = gle->norm[lanes->gc[k]] * exp(-0.5 * lanes->dsq[k]) ;
+        p *= lanes->weight[k] ;
+        if (p > max_p) max_p = p ;
+        total_p += p ;
+      }
+      max_p = 255.0 * max_p / total_p ;
+      if (max_p > 255) max_p = 255 ;
+      MRIsetVoxVal(mri_dst, x, y, z, 0, (BUFTYPE)max_p) ;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (t = 0; t < nthreads; t++) gcaLabelLanesFree(&thread_lanes[t]) ;
+  free(thread_lanes) ;
+  gcaLabelEngineFree(&gle) ;
+  return (mri_dst) ;
+}
@@ -854,6 +854,7 @@ int GCAMregister(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
   Timer timer,timer2;
   printf("Starting GCAMregister()\n"); fflush(stdout);
 
+  GCAMinvalidateSoa(gcam);
   if (FZERO(parms->min_sigma)) {
     parms->min_sigma = 0.4;
   }
@@ -1477,6 +1478,7 @@ int GCAMinit(GCA_MORPH *gcam, MRI *mri_image, GCA *gca, TRANSFORM *transform, in
   int invalid = 0, x, y, z, width, height, depth, n, max_n, max_label, label, xform_allocated = 0;
   float max_p, ox, oy, oz;
 
+  GCAMinvalidateSoa(gcam);
   if (!mri_image) {
     ErrorExit(ERROR_BADPARM, "GCAMinit() must be called with valid mri_image.\n");
   }
@@ -1756,6 +1758,7 @@ int GCAMfreeContents(GCA_MORPH *gcam)
   GCA_MORPH_NODE *gcamn;
 
   GCAMfreeInverse(gcam);
+  GCAMfreeSoa(gcam);
   for (x = 0; x < gcam->width; x++) {
     for (y = 0; y < gcam->height; y++) {
       for (z = 0; z < gcam->depth; z++) {
@@ -1774,6 +1777,134 @@ int GCAMfreeContents(GCA_MORPH *gcam)
   return (NO_ERROR);
 }
 
+int GCAMfreeSoa(GCA_MORPH *gcam)
+{
+  GCAM_SOA *soa = gcam->soa;
+
+  if (soa == NULL) {
+    return (NO_ERROR);
+  }
+  free(soa->x);
+  free(soa->y);
+  free(soa->z);
+  free(soa->origx);
+  free(soa->origy);
+  free(soa->origz);
+  free(soa->area);
+  free(soa->area1);
+  free(soa->area2);
+  free(soa->orig_area);
+  free(soa->orig_area1);
+  free(soa->orig_area2);
+  free(soa->invalid);
+  free(soa);
+  gcam->soa = NULL;
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int GCAMinvalidateSoa(GCA_MORPH *gcam)
+  \brief Marks the planes of gcam->soa stale, so the next GCAMloadSoa()
+  copies them from the nodes again. Anything that changes the position,
+  area or validity fields of the nodes must call it (gcamApplyGradient,
+  gcamUndoGradient and gcamComputeMetricProperties update the planes
+  themselves instead).
+*/
+int GCAMinvalidateSoa(GCA_MORPH *gcam)
+{
+  if (gcam && gcam->soa) {
+    gcam->soa->valid = 0;
+  }
+  return (NO_ERROR);
+}
+
+/*!
+  \fn GCAM_SOA *GCAMloadSoa(GCA_MORPH *gcam)
+  \brief Returns the contiguous planes of gcam->soa, indexed with
+  GCAM_SOA_INDEX in the same x/y/z order as the nodes. They are allocated on
+  first use (and again if the morph has been resized), and the position,
+  area and validity fields of every node are copied into them only if they
+  have been invalidated since the last call.
+*/
+GCAM_SOA *GCAMloadSoa(GCA_MORPH *gcam)
+{
+  GCAM_SOA *soa = gcam->soa;
+  size_t nnodes;
+  int x;
+
+  if (soa && (soa->width != gcam->width || soa->height != gcam->height || soa->depth != gcam->depth)) {
+    GCAMfreeSoa(gcam);
+    soa = NULL;
+  }
+  if (soa && soa->valid) {
+    return (soa);
+  }
+  nnodes = (size_t)gcam->width * gcam->height * gcam->depth;
+  if (soa == NULL) {
+    soa = (GCAM_SOA *)calloc(1, sizeof(GCAM_SOA));
+    if (!soa) ErrorExit(ERROR_NOMEMORY, "GCAMloadSoa: could not allocate planes");
+    soa->width = gcam->width;
+    soa->height = gcam->height;
+    soa->depth = gcam->depth;
+    soa->x = (double *)malloc(nnodes * sizeof(double));
+    soa->y = (double *)malloc(nnodes * sizeof(double));
+    soa->z = (double *)malloc(nnodes * sizeof(double));
+    soa->origx = (double *)malloc(nnodes * sizeof(double));
+    soa->origy = (double *)malloc(nnodes * sizeof(double));
+    soa->origz = (double *)malloc(nnodes * sizeof(double));
+    soa->area = (float *)malloc(nnodes * sizeof(float));
+    soa->area1 = (float *)malloc(nnodes * sizeof(float));
+    soa->area2 = (float *)malloc(nnodes * sizeof(float));
+    soa->orig_area = (float *)malloc(nnodes * sizeof(float));
+    soa->orig_area1 = (float *)malloc(nnodes * sizeof(float));
+    soa->orig_area2 = (float *)malloc(nnodes * sizeof(float));
+    soa->invalid = (char *)malloc(nnodes * sizeof(char));
+    if (!soa->x || !soa->y || !soa->z || !soa->origx || !soa->origy || !soa->origz || !soa->area || !soa->area1 ||
+        !soa->area2 || !soa->orig_area || !soa->orig_area1 || !soa->orig_area2 || !soa->invalid)
+      ErrorExit(ERROR_NOMEMORY, "GCAMloadSoa: could not allocate planes for %zu nodes", nnodes);
+    gcam->soa = soa;
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (x = 0; x < gcam->width; x++) {
+    ROMP_PFLB_begin
+    int y, z;
+    for (y = 0; y < gcam->height; y++) {
+      const GCA_MORPH_NODE *gcamn = gcam->nodes[x][y];
+      size_t i = GCAM_SOA_INDEX(soa, x, y, 0);
+      for (z = 0; z < gcam->depth; z++, i++, gcamn++) {
+        soa->x[i] = gcamn->x;
+        soa->y[i] = gcamn->y;
+        soa->z[i] = gcamn->z;
+        soa->origx[i] = gcamn->origx;
+        soa->origy[i] = gcamn->origy;
+        soa->origz[i] = gcamn->origz;
+        soa->area[i] = gcamn->area;
+        soa->area1[i] = gcamn->area1;
+        soa->area2[i] = gcamn->area2;
+        soa->orig_area[i] = gcamn->orig_area;
+        soa->orig_area1[i] = gcamn->orig_area1;
+        soa->orig_area2[i] = gcamn->orig_area2;
+        soa->invalid[i] = gcamn->invalid;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  soa->valid = 1;
+
+  return (soa);
+}
+
+/* the planes if they are current, so a writer can keep them that way */
+static GCAM_SOA *gcamCurrentSoa(GCA_MORPH *gcam)
+{
+  return (gcam->soa && gcam->soa->valid) ? gcam->soa : NULL;
+}
+
 
 // different_neighbor_labels is very hot.
 //
@@ -2610,7 +2741,195 @@ double gcamDistanceEnergy(GCA_MORPH *gcam, MRI *mri)
 
 #define AREA_NEIGHBORS 8
 const float jac_scale = 10;
-int gcamJacobianTerm(GCA_MORPH *gcam, const MRI *mri, double l_jacobian, double ratio_thresh)
+
+/*
+  gcamJacobianTermAtNode() reading positions and areas from the planes of
+  gcam->soa instead of the nodes. The arithmetic is the same operation for
+  operation - including the single precision of the VECTOR temporaries in
+  the original - so the gradient is identical.
+*/
+static void gcamJacobianTermAtNodeSoa(
+    const GCA_MORPH *gcam, const GCAM_SOA *soa, double l_jacobian, int i, int j, int k, double *pdx, double *pdy, double *pdz)
+{
+  float delta, ratio, vi[3], vj[3], vk[3], j_x_k[3], k_x_i[3], i_x_j[3], tmp[3], grad[3] = {0, 0, 0};
+  int n, invert, width, height, depth;
+  size_t c, ci, cj, ck;
+  double exponent, orig_area, area;
+
+  *pdx = *pdy = *pdz = 0;
+  if (DZERO(l_jacobian)) return;
+
+  width = gcam->width;
+  height = gcam->height;
+  depth = gcam->depth;
+
+  for (n = 0; n < AREA_NEIGHBORS; n++) {
+    /* the same 8 tetrahedra as gcamJacobianTermAtNode */
+    invert = 1;
+    switch (n) {
+      default:
+      case 0:
+        if ((i + 1 >= width) || (j + 1 >= height) || (k + 1 >= depth)) continue;
+        c = GCAM_SOA_INDEX(soa, i, j, k);
+        ci = GCAM_SOA_INDEX(soa, i + 1, j, k);
+        cj = GCAM_SOA_INDEX(soa, i, j + 1, k);
+        ck = GCAM_SOA_INDEX(soa, i, j, k + 1);
+        break;
+      case 1:
+        if ((i == 0) || (j + 1 >= height) || (k + 1 >= depth)) continue;
+        c = GCAM_SOA_INDEX(soa, i - 1, j, k);
+        ci = GCAM_SOA_INDEX(soa, i, j, k);
+        cj = GCAM_SOA_INDEX(soa, i - 1, j + 1, k);
+        ck = GCAM_SOA_INDEX(soa, i - 1, j, k + 1);
+        break;
+      case 2:
+        if ((i + 1 >= width) || (j == 0) || (k + 1 >= depth)) continue;
+        c = GCAM_SOA_INDEX(soa, i, j - 1, k);
+        ci = GCAM_SOA_INDEX(soa, i + 1, j - 1, k);
+        cj = GCAM_SOA_INDEX(soa, i, j, k);
+        ck = GCAM_SOA_INDEX(soa, i, j - 1, k + 1);
+        break;
+      case 3:
+        if ((i + 1 >= width) || (j + 1 >= height) || (k == 0)) continue;
+        c = GCAM_SOA_INDEX(soa, i, j, k - 1);
+        ci = GCAM_SOA_INDEX(soa, i + 1, j, k - 1);
+        cj = GCAM_SOA_INDEX(soa, i, j + 1, k - 1);
+        ck = GCAM_SOA_INDEX(soa, i, j, k);
+        break;
+      case 4:
+        if ((i == 0) || (j == 0) || (k == 0)) continue;
+        invert = -1;
+        c = GCAM_SOA_INDEX(soa, i, j, k);
+        ci = GCAM_SOA_INDEX(soa, i - 1, j, k);
+        cj = GCAM_SOA_INDEX(soa, i, j - 1, k);
+        ck = GCAM_SOA_INDEX(soa, i, j, k - 1);
+        break;
+      case 5:
+        if ((i + 1 >= width) || (j == 0) || (k == 0)) continue;
+        invert = -1;
+        c = GCAM_SOA_INDEX(soa, i + 1, j, k);
+        ci = GCAM_SOA_INDEX(soa, i, j, k);
+        cj = GCAM_SOA_INDEX(soa, i + 1, j - 1, k);
+        ck = GCAM_SOA_INDEX(soa, i + 1, j, k - 1);
+        break;
+      case 6:
+        if ((i == 0) || (j + 1 >= height) || (k == 0)) continue;
+        invert = -1;
+        c = GCAM_SOA_INDEX(soa, i, j + 1, k);
+        ci = GCAM_SOA_INDEX(soa, i - 1, j + 1, k);
+        cj = GCAM_SOA_INDEX(soa, i, j, k);
+        ck = GCAM_SOA_INDEX(soa, i, j + 1, k - 1);
+        break;
+      case 7:
+        if ((i == 0) || (j == 0) || (k + 1 >= depth)) continue;
+        invert = -1;
+        c = GCAM_SOA_INDEX(soa, i, j, k + 1);
+        ci = GCAM_SOA_INDEX(soa, i - 1, j, k + 1);
+        cj = GCAM_SOA_INDEX(soa, i, j - 1, k + 1);
+        ck = GCAM_SOA_INDEX(soa, i, j, k);
+        break;
+    }
+    if (invert > 0) {
+      orig_area = soa->orig_area1[c];
+      area = soa->area1[c];
+    }
+    else {
+      orig_area = soa->orig_area2[c];
+      area = soa->area2[c];
+    }
+    if (FZERO(orig_area)) continue;
+
+    if (soa->invalid[c] == GCAM_POSITION_INVALID || soa->invalid[ci] == GCAM_POSITION_INVALID ||
+        soa->invalid[cj] == GCAM_POSITION_INVALID || soa->invalid[ck] == GCAM_POSITION_INVALID) {
+      continue;
+    }
+
+    vi[0] = soa->x[ci] - soa->x[c];
+    vi[1] = soa->y[ci] - soa->y[c];
+    vi[2] = soa->z[ci] - soa->z[c];
+    vj[0] = soa->x[cj] - soa->x[c];
+    vj[1] = soa->y[cj] - soa->y[c];
+    vj[2] = soa->z[cj] - soa->z[c];
+    vk[0] = soa->x[ck] - soa->x[c];
+    vk[1] = soa->y[ck] - soa->y[c];
+    vk[2] = soa->z[ck] - soa->z[c];
+
+    ratio = area / orig_area;
+    exponent = gcam->exp_k * ratio;
+    if (exponent > MAX_EXP) {
+      exponent = MAX_EXP;
+    }
+    delta = (invert * gcam->exp_k / orig_area) * (1.0 / (1.0 + exp(exponent)));
+
+#define SOA_CROSS(a, b, r)           \
+  r[0] = a[1] * b[2] - a[2] * b[1], \
+  r[1] = a[2] * b[0] - a[0] * b[2], \
+  r[2] = a[0] * b[1] - a[1] * b[0]
+    switch (n) {
+      default:
+      case 4:
+      case 0:
+        SOA_CROSS(vj, vk, j_x_k);
+        SOA_CROSS(vk, vi, k_x_i);
+        SOA_CROSS(vi, vj, i_x_j);
+        tmp[0] = i_x_j[0] + j_x_k[0];
+        tmp[1] = i_x_j[1] + j_x_k[1];
+        tmp[2] = i_x_j[2] + j_x_k[2];
+        tmp[0] = k_x_i[0] + tmp[0];
+        tmp[1] = k_x_i[1] + tmp[1];
+        tmp[2] = k_x_i[2] + tmp[2];
+        tmp[0] = tmp[0] * -delta;
+        tmp[1] = tmp[1] * -delta;
+        tmp[2] = tmp[2] * -delta;
+        break;
+      case 5:
+      case 1:
+        SOA_CROSS(vj, vk, j_x_k);
+        tmp[0] = j_x_k[0] * delta;
+        tmp[1] = j_x_k[1] * delta;
+        tmp[2] = j_x_k[2] * delta;
+        break;
+      case 6:
+      case 2:
+        SOA_CROSS(vk, vi, k_x_i);
+        tmp[0] = k_x_i[0] * delta;
+        tmp[1] = k_x_i[1] * delta;
+        tmp[2] = k_x_i[2] * delta;
+        break;
+      case 7:
+      case 3:
+        SOA_CROSS(vi, vj, i_x_j);
+        tmp[0] = i_x_j[0] * delta;
+        tmp[1] = i_x_j[1] * delta;
+        tmp[2] = i_x_j[2] * delta;
+        break;
+    }
+#undef SOA_CROSS
+    grad[0] = tmp[0] + grad[0];
+    grad[1] = tmp[1] + grad[1];
+    grad[2] = tmp[2] + grad[2];
+  }
+
+  *pdx = l_jacobian * grad[0];
+  *pdy = l_jacobian * grad[1];
+  *pdz = l_jacobian * grad[2];
+
+  if (i == Gx && j == Gy && k == Gz) {
+    const GCA_MORPH_NODE *gcamn = &gcam->nodes[i][j][k];
+    printf(
+        "l_jaco: node(%d,%d,%d): area=%2.4f, orig_area=%2.4f, "
+        "grad=(%2.3f,%2.3f,%2.3f)\n",
+        i,
+        j,
+        k,
+        gcamn->area,
+        gcamn->orig_area,
+        *pdx,
+        *pdy,
+        *pdz);
+  }
+}
+int gcamJacobianTerm(GCA_MORPH *gcam, double l_jacobian, double ratio_thresh)
 {
   int i = 0, j = 0, k = 0, num /*, xi, yi, zi, xk, yk, zk = 0*/;
   int n_omp_threads = 1;
@@ -2618,6 +2937,8 @@ int gcamJacobianTerm(GCA_MORPH *gcam, const MRI *mri, double l_jacobian, double
   double orig_area = 0.0, ratio = 0.0, max_norm;
   double mn[_MAX_FS_THREADS]; /* _MAX_FS_THREADS is in utils.h */
   GCA_MORPH_NODE *gcamn = NULL;
+  const GCAM_SOA *soa;
+  size_t c = 0;
   extern int gcamJacobianTerm_nCalls;
   extern double gcamJacobianTerm_tsec;
   Timer timer;
@@ -2626,28 +2947,29 @@ int gcamJacobianTerm(GCA_MORPH *gcam, const MRI *mri, double l_jacobian, double
     return (NO_ERROR);
   }
 
+  soa = GCAMloadSoa(gcam);
   num = 0;
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for if_ROMP(assume_reproducible) reduction (+:num) firstprivate (j,k,gcamn,ratio,orig_area,ratio_thresh) shared(gcam) schedule(static,1)
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction (+:num) firstprivate (j,k,c,ratio,orig_area,ratio_thresh) shared(gcam,soa) schedule(static,1)
 #endif
   for (i = 0; i < gcam->width; i++) {
     ROMP_PFLB_begin
     
     for (j = 0; j < gcam->height; j++) {
       for (k = 0; k < gcam->depth; k++) {
-        gcamn = &gcam->nodes[i][j][k];
+        c = GCAM_SOA_INDEX(soa, i, j, k);
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+        if (soa->invalid[c] == GCAM_POSITION_INVALID) {
           continue;
         }
 
-        orig_area = gcamn->orig_area;
+        orig_area = soa->orig_area[c];
         if (FZERO(orig_area)) {
           continue;
         }
 
-        ratio = gcamn->area / orig_area;
+        ratio = soa->area[c] / orig_area;
         if (ratio < ratio_thresh) {
           num++;
         }
@@ -2721,24 +3043,23 @@ int gcamJacobianTerm(GCA_MORPH *gcam, const MRI *mri, double l_jacobian, double
 
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(j, k, gcamn, dx, dy, dz, norm) \
-    shared(gcam, mri, l_jacobian, Gx, Gy, Gz, max_norm) schedule(static, 1)
+  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(j, k, dx, dy, dz, norm) \
+    shared(gcam, soa, l_jacobian, Gx, Gy, Gz, max_norm) schedule(static, 1)
 #endif
   for (i = 0; i < gcam->width; i++) {
     ROMP_PFLB_begin
     
     for (j = 0; j < gcam->height; j++) {
       for (k = 0; k < gcam->depth; k++) {
-        gcamn = &gcam->nodes[i][j][k];
         if (i == Gx && j == Gy && k == Gz) {
           DiagBreak();
         }
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+        if (soa->invalid[GCAM_SOA_INDEX(soa, i, j, k)] == GCAM_POSITION_INVALID) {
           continue;
         }
 
-        gcamJacobianTermAtNode(gcam, mri, l_jacobian, i, j, k, &dx, &dy, &dz);
+        gcamJacobianTermAtNodeSoa(gcam, soa, l_jacobian, i, j, k, &dx, &dy, &dz);
         norm = sqrt(dx * dx + dy * dy + dz * dz);
         if (norm > max_norm * jac_scale && max_norm > 0 && norm > 1)
         /* don't let it get too big, otherwise it's the
@@ -3534,6 +3855,7 @@ int gcamComputeMetricProperties(GCA_MORPH *gcam)
   int gcam_neg_counter[_MAX_FS_THREADS], Ginvalid_counter[_MAX_FS_THREADS];
   GCA_MORPH_NODE *gcamn = NULL, *gcamni = NULL, *gcamnj = NULL, *gcamnk = NULL;
   VECTOR *v_i[_MAX_FS_THREADS], *v_j[_MAX_FS_THREADS], *v_k[_MAX_FS_THREADS];
+  GCAM_SOA *const soa = gcamCurrentSoa(gcam);
 
   // Ginvalid has file scope and static storage.....
   Ginvalid = 0;
@@ -3595,7 +3917,7 @@ int gcamComputeMetricProperties(GCA_MORPH *gcam)
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
   #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(tid, j, k, gcamn, neg, num, gcamni, gcamnj, gcamnk, area1, area2) \
-    shared(gcam, Gx, Gy, Gz, v_i, v_j, v_k, gcam_neg_counter, Ginvalid_counter) schedule(static, 1)
+    shared(gcam, soa, Gx, Gy, Gz, v_i, v_j, v_k, gcam_neg_counter, Ginvalid_counter) schedule(static, 1)
 #endif
   for (i = 0; i < width; i++) {
     ROMP_PFLB_begin
@@ -3703,6 +4025,14 @@ int gcamComputeMetricProperties(GCA_MORPH *gcam)
           gcamn->area = 0;
         }
 
+        if (soa) {
+          size_t const c = GCAM_SOA_INDEX(soa, i, j, k);
+          soa->area[c] = gcamn->area;
+          soa->area1[c] = gcamn->area1;
+          soa->area2[c] = gcamn->area2;
+          soa->invalid[c] = gcamn->invalid;
+        }
+
         // Keep track of determinants which have become negative
         if ((gcamn->invalid == GCAM_VALID) && neg && (gcamn->orig_area > 0)) {
           if (i > 0 && j > 0 && k > 0 && i < gcam->width - 1 && j < gcam->height - 1 && k < gcam->depth - 1) {
@@ -4704,6 +5034,7 @@ int GCAMregisterLevel(GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth, GCA_MORPH_PARM
   double tFOTS, tGradient;
   long int tnow;
 
+  GCAMinvalidateSoa(gcam);
   if (parms->integration_type == GCAM_INTEGRATE_FIXED) {
     which = GCAM_INTEGRATE_FIXED;
   }
@@ -5803,7 +6134,7 @@ int gcamComputeGradient(GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth, GCA_MORPH_PA
   gcamSpringTerm(gcam, parms->l_spring, parms->ratio_thresh);
   //  gcamInvalidSpringTerm(gcam, 1.0)  ;
   //
-  gcamJacobianTerm(gcam, mri, parms->l_jacobian, parms->ratio_thresh);
+  gcamJacobianTerm(gcam, parms->l_jacobian, parms->ratio_thresh);
   // The following appears to be a null operation, based on current #ifdefs
   gcamLimitGradientMagnitude(gcam, parms, mri);
 
@@ -6031,7 +6362,9 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
   double dx = 0.0, dy = 0.0, dz = 0.0;
   int x = 0, y = 0, z = 0, xk = 0, yk = 0, zk = 0, xn = 0, yn = 0, zn = 0;
   int width, height, depth, num = 0;
-  GCA_MORPH_NODE *gcamn = NULL, *gcamn_nbr = NULL;
+  size_t i = 0, in = 0;
+  GCA_MORPH_NODE *gcamn = NULL;
+  const GCAM_SOA *soa;
   extern int gcamSmoothnessTerm_nCalls;
   extern double gcamSmoothnessTerm_tsec;
   Timer timer;
@@ -6042,14 +6375,16 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
 
   gcamSmoothnessTerm_nCalls ++;
 
+  // the 26-neighborhood is read from the dense planes, only the gradient goes back to the nodes
+  soa = GCAMloadSoa(gcam);
   width = gcam->width;
   height = gcam->height;
   depth = gcam->depth;
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
   #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(                                                          \
-    y, z, gcamn, vx, vy, vz, dx, dy, dz, num, xk, xn, yk, yn, zk, zn, gcamn_nbr, vnx, vny, vnz) \
-    shared(gcam, Gx, Gy, Gz) schedule(static, 1)
+    y, z, i, in, gcamn, vx, vy, vz, dx, dy, dz, num, xk, xn, yk, yn, zk, zn, vnx, vny, vnz) \
+    shared(gcam, soa, Gx, Gy, Gz) schedule(static, 1)
 #endif
   for (x = 0; x < gcam->width; x++) {
     ROMP_PFLB_begin
@@ -6059,15 +6394,15 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
         if (x == Gx && y == Gy && z == Gz) {
           DiagBreak();
         }
-        gcamn = &gcam->nodes[x][y][z];
+        i = GCAM_SOA_INDEX(soa, x, y, z);
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+        if (soa->invalid[i] == GCAM_POSITION_INVALID) {
           continue;
         }
 
-        vx = gcamn->x - gcamn->origx;
-        vy = gcamn->y - gcamn->origy;
-        vz = gcamn->z - gcamn->origz;
+        vx = soa->x[i] - soa->origx[i];
+        vy = soa->y[i] - soa->origy[i];
+        vz = soa->z[i] - soa->origz[i];
         dx = dy = dz = 0.0f;
         if (x == Gx && y == Gy && z == Gz)
           printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n", x, y, z, vx, vy, vz);
@@ -6092,15 +6427,15 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
               zn = MAX(0, zn);
               zn = MIN(depth - 1, zn);
 
-              gcamn_nbr = &gcam->nodes[xn][yn][zn];
+              in = GCAM_SOA_INDEX(soa, xn, yn, zn);
 
-              if (gcamn_nbr->invalid == GCAM_POSITION_INVALID) {
+              if (soa->invalid[in] == GCAM_POSITION_INVALID) {
                 continue;
               }
 
-              vnx = gcamn_nbr->x - gcamn_nbr->origx;
-              vny = gcamn_nbr->y - gcamn_nbr->origy;
-              vnz = gcamn_nbr->z - gcamn_nbr->origz;
+              vnx = soa->x[in] - soa->origx[in];
+              vny = soa->y[in] - soa->origy[in];
+              vnz = soa->z[in] - soa->origz[in];
 
               dx += (vnx - vx);
               dy += (vny - vy);
@@ -6126,6 +6461,7 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
           printf("l_smoo: node(%d,%d,%d): DX=(%2.2f,%2.2f,%2.2f)\n", x, y, z, dx, dy, dz);
         }
 
+        gcamn = &gcam->nodes[x][y][z];
         gcamn->dx += dx;
         gcamn->dy += dy;
         gcamn->dz += dz;
@@ -7056,6 +7392,8 @@ int gcamApplyGradient(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms)
   float dx, dy, dz, dt, momentum;
   GCA_MORPH_NODE *gcamn;
 
+  GCAM_SOA *const soa = gcamCurrentSoa(gcam);
+
   dt = parms->dt;
   momentum = parms->momentum;
   for (x = 0; x < gcam->width; x++)
@@ -7093,6 +7431,12 @@ int gcamApplyGradient(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms)
         gcamn->x += dx;
         gcamn->y += dy;
         gcamn->z += dz;
+        if (soa) {
+          size_t const c = GCAM_SOA_INDEX(soa, x, y, z);
+          soa->x[c] = gcamn->x;
+          soa->y[c] = gcamn->y;
+          soa->z[c] = gcamn->z;
+        }
         if (x == Gx && y == Gy && z == Gz) {
           printf("(%2.2f,%2.2f,%2.2f)\n", gcamn->x, gcamn->y, gcamn->z);
         }
@@ -7680,6 +8024,7 @@ int gcamUndoGradient(GCA_MORPH *gcam)
   int x, y, z;
   float dx, dy, dz;
   GCA_MORPH_NODE *gcamn;
+  GCAM_SOA *const soa = gcamCurrentSoa(gcam);
 
   for (x = 0; x < gcam->width; x++)
     for (y = 0; y < gcam->height; y++)
@@ -7715,6 +8060,12 @@ int gcamUndoGradient(GCA_MORPH *gcam)
         gcamn->x -= dx;
         gcamn->y -= dy;
         gcamn->z -= dz;
+        if (soa) {
+          size_t const c = GCAM_SOA_INDEX(soa, x, y, z);
+          soa->x[c] = gcamn->x;
+          soa->y[c] = gcamn->y;
+          soa->z[c] = gcamn->z;
+        }
         if (x == Gx && y == Gy && z == Gz) {
           printf("(%2.1f,%2.1f,%2.1f)\n", gcamn->x, gcamn->y, gcamn->z);
         }
@@ -7728,6 +8079,7 @@ int gcamReadMRI(GCA_MORPH *gcam, MRI *mri, int which)
   float d;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   if (Gdiag & DIAG_WRITE && DIAG_VERBOSE_ON) {
     MRIwrite(mri, "m.mgz");
   }
@@ -9349,6 +9701,7 @@ int GCAMstoreMetricProperties(GCA_MORPH *gcam)
 {
   int x, y, z;
 
+  GCAMinvalidateSoa(gcam);
   gcamComputeMetricProperties(gcam);
   for (x = 0; x < gcam->width; x++)
     for (y = 0; y < gcam->height; y++)
@@ -9384,6 +9737,7 @@ int GCAMcopyNodePositions(GCA_MORPH *gcam, int from, int to)
   int x, y, z;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   for (x = 0; x < gcam->width; x++)
     for (y = 0; y < gcam->height; y++)
       for (z = 0; z < gcam->depth; z++) {
@@ -9782,6 +10136,7 @@ int GCAMapplyTransform(GCA_MORPH *gcam, TRANSFORM *transform)
   float xf, yf, zf;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   for (x = 0; x < gcam->width; x++) {
     for (y = 0; y < gcam->height; y++) {
       for (z = 0; z < gcam->depth; z++) {
@@ -9822,6 +10177,7 @@ int GCAMapplyInverseTransform(GCA_MORPH *gcam, const TRANSFORM *transform)
   float xf, yf, zf;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   for (x = 0; x < gcam->width; x++) {
     for (y = 0; y < gcam->height; y++) {
       for (z = 0; z < gcam->depth; z++) {
@@ -9866,6 +10222,7 @@ int GCAMmarkNegativeNodesInvalid(GCA_MORPH *gcam)
   int x, y, z;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   for (z = 0; z < gcam->depth; z++) {
     for (y = 0; y < gcam->height; y++) {
       for (x = 0; x < gcam->width; x++) {
@@ -9884,6 +10241,7 @@ int GCAMmarkNegativeBorderNodesInvalid(GCA_MORPH *gcam)
   int x, y, z;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   for (z = 0; z < gcam->depth; z++) {
     for (y = 0; y < gcam->height; y++) {
       for (x = 0; x < gcam->width; x++) {
@@ -10615,6 +10973,7 @@ int GCAMexpand(GCA_MORPH *gcam, float distance)
   double cx, cy, cz, dx, dy, dz, norm;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   cx = cy = cz = 0;
   for (num = i = 0; i < gcam->width; i++) {
     for (j = 0; j < gcam->height; j++) {
@@ -11193,6 +11552,7 @@ GCA_MORPH *GCAMlinearTransform(GCA_MORPH *gcam_src, MATRIX *m_vox2vox, GCA_MORPH
 
   VectorFree(&v1);
   VectorFree(&v2);
+  GCAMinvalidateSoa(gcam_dst);
   return (gcam_dst);
 }
 
@@ -11205,6 +11565,7 @@ int GCAMrasToVox(GCA_MORPH *gcam, MRI *mri)
   GCA_MORPH_NODE *gcamn;
   VECTOR *v1, *v2;
 
+  GCAMinvalidateSoa(gcam);
 #if 0  // commented out unnecessary conversion 06/29/2023
   if (gcam->type == GCAM_VOX) {
     GCAMvoxToRas(gcam); /* convert it to RAS coords so that it can be converted back(?)*/
@@ -11286,6 +11647,7 @@ int GCAMvoxToRas(GCA_MORPH *gcam)
   GCA_MORPH_NODE *gcamn;
   VECTOR *v1, *v2;
 
+  GCAMinvalidateSoa(gcam);
   if (gcam->type == GCAM_RAS) {
     return (NO_ERROR);
   }
@@ -11708,6 +12070,7 @@ int GCAMaddIntensitiesFromImage(GCA_MORPH *gcam, MRI *mri_target)
   double val, mean;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   if (gcam->ninputs == 0) {
     gcam->ninputs = 1;
   }
@@ -11991,6 +12354,7 @@ int gcamSetTotalMovement(GCA_MORPH *gcam, float alpha)
   double dx, dy, dz;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   for (i = 0; i < gcam->width; i++) {
     for (j = 0; j < gcam->height; j++) {
       for (k = 0; k < gcam->depth; k++) {
@@ -12019,6 +12383,7 @@ int GCAMreinitWithLTA(GCA_MORPH *gcam, LTA *lta, MRI *mri, GCA_MORPH_PARMS *parm
   MATRIX *m_avg, *m_L;
   GCA_MORPH_PARMS lp, *lin_parms = &lp;
 
+  GCAMinvalidateSoa(gcam);
   if (Gdiag & DIAG_WRITE) {
     std::string fname(parms->base_name);
     fname += ".log";
@@ -12223,7 +12588,7 @@ int GCAMreinitWithLTA(GCA_MORPH *gcam, LTA *lta, MRI *mri, GCA_MORPH_PARMS *parm
       last_rms = GCAMcomputeRMS(gcam, mri, parms);
       gcamComputeTargetGradient(gcam);
       gcamSmoothnessTerm(gcam, mri, parms->l_smoothness);
-      gcamJacobianTerm(gcam, mri, parms->l_jacobian, parms->ratio_thresh);
+      gcamJacobianTerm(gcam, parms->l_jacobian, parms->ratio_thresh);
       gcamLimitGradientMagnitude(gcam, parms, mri);
 
       gcamSmoothGradient(gcam, navgs);
@@ -12441,6 +12806,7 @@ int gcamApplyLinearTransform(GCA_MORPH *gcam, MATRIX *m_L)
   int x, y, z;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   v_src = VectorAlloc(4, MATRIX_REAL);
   v_dst = VectorAlloc(4, MATRIX_REAL);
   VECTOR_ELT(v_src, 4) = 1.0;
@@ -13262,6 +13628,7 @@ int GCAMdeformVentricles(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
   double rms, last_rms, orig_dt, min_dt, pct_change;
   int navgs, level;
 
+  GCAMinvalidateSoa(gcam);
   parms->mri = mri;
   if (Gdiag & DIAG_WRITE) {
     std::string fname(parms->base_name);
@@ -13292,7 +13659,7 @@ int GCAMdeformVentricles(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
       last_rms = GCAMcomputeRMS(gcam, mri, parms);
       gcamComputePeriventricularWMDeformation(gcam, mri);
       gcamSmoothnessTerm(gcam, mri, parms->l_smoothness);
-      gcamJacobianTerm(gcam, mri, parms->l_jacobian, parms->ratio_thresh);
+      gcamJacobianTerm(gcam, parms->l_jacobian, parms->ratio_thresh);
       gcamLimitGradientMagnitude(gcam, parms, mri);
       gcamSmoothGradient(gcam, navgs);
       parms->dt = orig_dt;
@@ -15100,6 +15467,7 @@ int GCAMcompose(GCA_MORPH *gcam, MRI *mri_warp)
   double dx, dy, dz;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   for (xp = 0; xp < gcam->width; xp++) {
     for (yp = 0; yp < gcam->height; yp++) {
       for (zp = 0; zp < gcam->depth; zp++) {
@@ -15131,6 +15499,7 @@ int GCAMreadWarpFromMRI(GCA_MORPH *gcam, const MRI *mri_warp, int DeformationFla
   double dx, dy, dz;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   if (gcam->width == mri_warp->width && gcam->height == mri_warp->height && gcam->depth == mri_warp->depth) {
     printf("GCAMreadWarpFromMRI(): warp and gcam have the same dims\n");
     for (xp = 0; xp < gcam->width; xp++){
@@ -15195,6 +15564,7 @@ int GCAMreadPositionsFromMRI(GCA_MORPH *gcam, const MRI *mri_pos)
   double x, y, z;
   GCA_MORPH_NODE *gcamn;
 
+  GCAMinvalidateSoa(gcam);
   if (gcam->width == mri_pos->width && gcam->height == mri_pos->height && gcam->depth == mri_pos->depth) {
     for (xp = 0; xp < gcam->width; xp++)
       for (yp = 0; yp < gcam->height; yp++)
@@ -16344,6 +16714,7 @@ GCA_MORPH *GCAMconcat2(GCAM *gcam1, GCAM *gcam2, GCAM *out)
       }
     }
   }
+  GCAMinvalidateSoa(out);
   return (out);
 }
 
@@ -16458,6 +16829,7 @@ GCA_MORPH *GCAMconcat3(LTA *lta1, GCAM *gcam, LTA *lta2, GCAM *out)
   VectorFree(&orig);
   VectorFree(&v);
   VectorFree(&w);
+  GCAMinvalidateSoa(out);
   return (out);
 }
 
@@ -16828,6 +17200,7 @@ int GCAMregisterVentricles(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
   TRANSFORM transform;
   float cmeans_lh[MAX_GCA_INPUTS], cmeans_rh[MAX_GCA_INPUTS];
 
+  GCAMinvalidateSoa(gcam);
   transform.type = MORPH_3D_TYPE;
   transform.xform = (void *)gcam;
 
@@ -17139,7 +17512,7 @@ int GCAMregisterVentricles(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
         gcamSmoothnessTerm(gcam, mri, parms->l_smoothness);
         gcamLSmoothnessTerm(gcam, mri, parms->l_lsmoothness);
         gcamSpringTerm(gcam, parms->l_spring, parms->ratio_thresh);
-        gcamJacobianTerm(gcam, mri, parms->l_jacobian, parms->ratio_thresh);
+        gcamJacobianTerm(gcam, parms->l_jacobian, parms->ratio_thresh);
         // The following appears to be a null operation, based on current #ifdefs
         gcamLimitGradientMagnitude(gcam, parms, mri);
         gcamSmoothGradient(gcam, parms->navgs);
@@ -17383,6 +17756,7 @@ GCA_MORPH *GCAMcopy(const GCA_MORPH *gcamsrc, GCA_MORPH *gcamdst)
       }
     }
   }
+  GCAMinvalidateSoa(gcamdst);
   gcamdst->vgcam_ms = gcamsrc->vgcam_ms; // Not saved.
   return (gcamdst);
 }
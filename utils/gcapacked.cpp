@@ -0,0 +1,644 @@
+/**
+ * @brief flat, structure-of-arrays storage for GCA atlases
+ *
+ * Reader and writer for the packed (.gcap) atlas format. See gcapacked.h.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "colortab.h"
+#include "diag.h"
+#include "error.h"
+#include "gca.h"
+#include "gcapacked.h"
+#include "macros.h"
+
+#define GCAP_BYTE_ORDER 0x01020304
+
+/* the blocks of a .gcap file, in the order they are written */
+enum
+{
+  GCAP_NODE_OFFSETS = 0,
+  GCAP_NODE_TOTAL_TRAINING,
+  GCAP_GC_LABELS,
+  GCAP_MEANS,
+  GCAP_COVARS,
+  GCAP_GC_NTRAINING,
+  GCAP_GIBBS_NLABELS,
+  GCAP_GIBBS_OFFSETS,
+  GCAP_GIBBS_LABELS,
+  GCAP_GIBBS_PRIORS,
+  GCAP_PRIOR_OFFSETS,
+  GCAP_PRIOR_TOTAL_TRAINING,
+  GCAP_PRIOR_LABELS,
+  GCAP_PRIOR_PRIORS,
+  GCAP_TISSUE_PARMS,
+  GCAP_NBLOCKS
+};
+
+typedef struct
+{
+  char    magic[8];
+  int32_t version;
+  int32_t byte_order;
+  int32_t ninputs;
+  int32_t flags;
+  int32_t type;
+  int32_t max_label;
+  int32_t total_training;
+  float   prior_spacing;
+  float   node_spacing;
+  int32_t node_width, node_height, node_depth;
+  int32_t prior_width, prior_height, prior_depth;
+  int32_t width, height, depth;
+  float   xsize, ysize, zsize;
+  float   x_r, x_a, x_s;
+  float   y_r, y_a, y_s;
+  float   z_r, z_a, z_s;
+  float   c_r, c_a, c_s;
+  double  TRs[MAX_GCA_INPUTS];
+  double  FAs[MAX_GCA_INPUTS];
+  double  TEs[MAX_GCA_INPUTS];
+  int64_t ngcs;
+  int64_t ngibbs;
+  int64_t nprior_labels;
+  int64_t blocks[GCAP_NBLOCKS];  // byte offset of each block
+  int64_t ct_offset;             // byte offset of the colortable, 0 if none
+  int64_t file_size;
+} GCAP_FILE_HEADER;
+
+static int gcapPad(FILE *fp)
+{
+  static const char zeros[GCA_PACKED_ALIGN] = {0};
+  long pos = ftell(fp);
+  long pad = (GCA_PACKED_ALIGN - (pos % GCA_PACKED_ALIGN)) % GCA_PACKED_ALIGN;
+  if (pad && fwrite(zeros, 1, pad, fp) != (size_t)pad) return (ERROR_BADFILE);
+  return (NO_ERROR);
+}
+
+static int gcapBeginBlock(FILE *fp, GCAP_FILE_HEADER *hdr, int block)
+{
+  if (gcapPad(fp) != NO_ERROR) return (ERROR_BADFILE);
+  hdr->blocks[block] = ftell(fp);
+  return (NO_ERROR);
+}
+
+#define GCAP_WRITE(ptr, n, fp)                                   \
+  if (fwrite((ptr), sizeof(*(ptr)), (n), (fp)) != (size_t)(n)) { \
+    error = ERROR_BADFILE;                                       \
+  }
+
+/*!
+  \fn int GCApackedWrite(GCA *gca, const char *fname)
+  \brief Writes any GCA (packed or not) in the packed .gcap format. The
+  node and prior data are streamed block by block so no packed copy of
+  the atlas is built in memory.
+*/
+int GCApackedWrite(GCA *gca, const char *fname)
+{
+  GCAP_FILE_HEADER hdr;
+  FILE *fp;
+  int x, y, z, n, i, error = NO_ERROR, ncovars, gibbs;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  int64_t offset;
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCApackedWrite(%s): could not open file", fname));
+  }
+
+  ncovars = gca->ninputs * (gca->ninputs + 1) / 2;
+  gibbs = (gca->flags & GCA_NO_MRF) == 0;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, GCA_PACKED_MAGIC, sizeof(hdr.magic));
+  hdr.version = GCA_PACKED_VERSION;
+  hdr.byte_order = GCAP_BYTE_ORDER;
+  hdr.ninputs = gca->ninputs;
+  hdr.flags = gca->flags;
+  hdr.type = gca->type;
+  hdr.max_label = gca->max_label;
+  hdr.total_training = gca->total_training;
+  hdr.prior_spacing = gca->prior_spacing;
+  hdr.node_spacing = gca->node_spacing;
+  hdr.node_width = gca->node_width;
+  hdr.node_height = gca->node_height;
+  hdr.node_depth = gca->node_depth;
+  hdr.prior_width = gca->prior_width;
+  hdr.prior_height = gca->prior_height;
+  hdr.prior_depth = gca->prior_depth;
+  hdr.width = gca->width;
+  hdr.height = gca->height;
+  hdr.depth = gca->depth;
+  hdr.xsize = gca->xsize;
+  hdr.ysize = gca->ysize;
+  hdr.zsize = gca->zsize;
+  hdr.x_r = gca->x_r;
+  hdr.x_a = gca->x_a;
+  hdr.x_s = gca->x_s;
+  hdr.y_r = gca->y_r;
+  hdr.y_a = gca->y_a;
+  hdr.y_s = gca->y_s;
+  hdr.z_r = gca->z_r;
+  hdr.z_a = gca->z_a;
+  hdr.z_s = gca->z_s;
+  hdr.c_r = gca->c_r;
+  hdr.c_a = gca->c_a;
+  hdr.c_s = gca->c_s;
+  memmove(hdr.TRs, gca->TRs, sizeof(hdr.TRs));
+  memmove(hdr.FAs, gca->FAs, sizeof(hdr.FAs));
+  memmove(hdr.TEs, gca->TEs, sizeof(hdr.TEs));
+
+  /* count everything up front so the header is complete */
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        hdr.ngcs += gcan->nlabels;
+        if (!gibbs) continue;
+        for (n = 0; n < gcan->nlabels; n++)
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) hdr.ngibbs += gcan->gcs[n].nlabels[i];
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) hdr.nprior_labels += gca->priors[x][y][z].nlabels;
+
+  // placeholder, rewritten once the block offsets are known
+  GCAP_WRITE(&hdr, 1, fp);
+
+  gcapBeginBlock(fp, &hdr, GCAP_NODE_OFFSETS);
+  offset = 0;
+  GCAP_WRITE(&offset, 1, fp);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        offset += gca->nodes[x][y][z].nlabels;
+        GCAP_WRITE(&offset, 1, fp);
+      }
+
+  gcapBeginBlock(fp, &hdr, GCAP_NODE_TOTAL_TRAINING);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) GCAP_WRITE(&gca->nodes[x][y][z].total_training, 1, fp);
+
+  gcapBeginBlock(fp, &hdr, GCAP_GC_LABELS);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        if (gcan->nlabels) GCAP_WRITE(gcan->labels, gcan->nlabels, fp);
+      }
+
+  gcapBeginBlock(fp, &hdr, GCAP_MEANS);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        for (n = 0; n < gcan->nlabels; n++) GCAP_WRITE(gcan->gcs[n].means, gca->ninputs, fp);
+      }
+
+  gcapBeginBlock(fp, &hdr, GCAP_COVARS);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        for (n = 0; n < gcan->nlabels; n++) GCAP_WRITE(gcan->gcs[n].covars, ncovars, fp);
+      }
+
+  gcapBeginBlock(fp, &hdr, GCAP_GC_NTRAINING);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        for (n = 0; n < gcan->nlabels; n++) GCAP_WRITE(&gcan->gcs[n].ntraining, 1, fp);
+      }
+
+  if (gibbs) {
+    gcapBeginBlock(fp, &hdr, GCAP_GIBBS_NLABELS);
+    for (x = 0; x < gca->node_width; x++)
+      for (y = 0; y < gca->node_height; y++)
+        for (z = 0; z < gca->node_depth; z++) {
+          gcan = &gca->nodes[x][y][z];
+          for (n = 0; n < gcan->nlabels; n++) GCAP_WRITE(gcan->gcs[n].nlabels, GIBBS_NEIGHBORS, fp);
+        }
+
+    gcapBeginBlock(fp, &hdr, GCAP_GIBBS_OFFSETS);
+    offset = 0;
+    GCAP_WRITE(&offset, 1, fp);
+    for (x = 0; x < gca->node_width; x++)
+      for (y = 0; y < gca->node_height; y++)
+        for (z = 0; z < gca->node_depth; z++) {
+          gcan = &gca->nodes[x][y][z];
+          for (n = 0; n < gcan->nlabels; n++)
+            for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+              offset += gcan->gcs[n].nlabels[i];
+              GCAP_WRITE(&offset, 1, fp);
+            }
+        }
+
+    gcapBeginBlock(fp, &hdr, GCAP_GIBBS_LABELS);
+    for (x = 0; x < gca->node_width; x++)
+      for (y = 0; y < gca->node_height; y++)
+        for (z = 0; z < gca->node_depth; z++) {
+          gcan = &gca->nodes[x][y][z];
+          for (n = 0; n < gcan->nlabels; n++)
+            for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+              gc = &gcan->gcs[n];
+              if (gc->nlabels[i]) GCAP_WRITE(gc->labels[i], gc->nlabels[i], fp);
+            }
+        }
+
+    gcapBeginBlock(fp, &hdr, GCAP_GIBBS_PRIORS);
+    for (x = 0; x < gca->node_width; x++)
+      for (y = 0; y < gca->node_height; y++)
+        for (z = 0; z < gca->node_depth; z++) {
+          gcan = &gca->nodes[x][y][z];
+          for (n = 0; n < gcan->nlabels; n++)
+            for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+              gc = &gcan->gcs[n];
+              if (gc->nlabels[i]) GCAP_WRITE(gc->label_priors[i], gc->nlabels[i], fp);
+            }
+        }
+  }
+
+  gcapBeginBlock(fp, &hdr, GCAP_PRIOR_OFFSETS);
+  offset = 0;
+  GCAP_WRITE(&offset, 1, fp);
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        offset += gca->priors[x][y][z].nlabels;
+        GCAP_WRITE(&offset, 1, fp);
+      }
+
+  gcapBeginBlock(fp, &hdr, GCAP_PRIOR_TOTAL_TRAINING);
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) GCAP_WRITE(&gca->priors[x][y][z].total_training, 1, fp);
+
+  gcapBeginBlock(fp, &hdr, GCAP_PRIOR_LABELS);
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        if (gcap->nlabels) GCAP_WRITE(gcap->labels, gcap->nlabels, fp);
+      }
+
+  gcapBeginBlock(fp, &hdr, GCAP_PRIOR_PRIORS);
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        if (gcap->nlabels) GCAP_WRITE(gcap->priors, gcap->nlabels, fp);
+      }
+
+  gcapBeginBlock(fp, &hdr, GCAP_TISSUE_PARMS);
+  GCAP_WRITE(gca->tissue_parms, MAX_GCA_LABELS, fp);
+
+  if (gca->ct) {
+    gcapPad(fp);
+    hdr.ct_offset = ftell(fp);
+    if (CTABwriteIntoBinary(gca->ct, fp) != NO_ERROR) error = ERROR_BADFILE;
+  }
+
+  // the mapping covers whole pages, so pad the file out to a block boundary
+  gcapPad(fp);
+  hdr.file_size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  GCAP_WRITE(&hdr, 1, fp);
+  if (fclose(fp) != 0) error = ERROR_BADFILE;
+
+  if (error != NO_ERROR) {
+    ErrorReturn(error, (error, "GCApackedWrite(%s): write failed", fname));
+  }
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int GCApackedIsFile(const char *fname)
+  \brief Returns 1 if fname starts with the packed GCA magic number
+*/
+int GCApackedIsFile(const char *fname)
+{
+  char magic[8];
+  FILE *fp;
+  int is_packed = 0;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) return (0);
+  if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic))
+    is_packed = (memcmp(magic, GCA_PACKED_MAGIC, sizeof(magic)) == 0);
+  fclose(fp);
+  return (is_packed);
+}
+
+/* builds the GCA_NODE/GCA_PRIOR/GC1D views that point into the blocks */
+static int gcapBuildViews(GCA *gca, GCA_PACKED *gcap)
+{
+  int64_t node, prior, g, off;
+  int x, y, i;
+
+  gcap->node_arena = (GCA_NODE *)calloc(gcap->nnodes, sizeof(GCA_NODE));
+  gcap->node_rows = (GCA_NODE **)calloc((size_t)gca->node_width * gca->node_height, sizeof(GCA_NODE *));
+  gca->nodes = (GCA_NODE ***)calloc(gca->node_width, sizeof(GCA_NODE **));
+  gcap->prior_arena = (GCA_PRIOR *)calloc(gcap->npriors, sizeof(GCA_PRIOR));
+  gcap->prior_rows = (GCA_PRIOR **)calloc((size_t)gca->prior_width * gca->prior_height, sizeof(GCA_PRIOR *));
+  gca->priors = (GCA_PRIOR ***)calloc(gca->prior_width, sizeof(GCA_PRIOR **));
+  gcap->gc_arena = (GC1D *)calloc(gcap->ngcs > 0 ? gcap->ngcs : 1, sizeof(GC1D));
+  if (!gcap->node_arena || !gcap->node_rows || !gca->nodes || !gcap->prior_arena || !gcap->prior_rows ||
+      !gca->priors || !gcap->gc_arena)
+    ErrorExit(ERROR_NOMEMORY, "GCApackedRead: could not allocate node and prior views");
+
+  if (gcap->gibbs) {
+    gcap->gibbs_label_ptrs = (unsigned short **)calloc(gcap->ngcs * GIBBS_NEIGHBORS + 1, sizeof(unsigned short *));
+    gcap->gibbs_prior_ptrs = (float **)calloc(gcap->ngcs * GIBBS_NEIGHBORS + 1, sizeof(float *));
+    if (!gcap->gibbs_label_ptrs || !gcap->gibbs_prior_ptrs)
+      ErrorExit(ERROR_NOMEMORY, "GCApackedRead: could not allocate gibbs views");
+  }
+
+  for (x = 0; x < gca->node_width; x++) {
+    gca->nodes[x] = gcap->node_rows + (size_t)x * gca->node_height;
+    for (y = 0; y < gca->node_height; y++)
+      gca->nodes[x][y] = gcap->node_arena + ((size_t)x * gca->node_height + y) * gca->node_depth;
+  }
+  for (x = 0; x < gca->prior_width; x++) {
+    gca->priors[x] = gcap->prior_rows + (size_t)x * gca->prior_height;
+    for (y = 0; y < gca->prior_height; y++)
+      gca->priors[x][y] = gcap->prior_arena + ((size_t)x * gca->prior_height + y) * gca->prior_depth;
+  }
+
+  for (node = 0; node < gcap->nnodes; node++) {
+    GCA_NODE *gcan = &gcap->node_arena[node];
+    off = gcap->node_offsets[node];
+    gcan->nlabels = gcan->max_labels = GCApackedNodeNlabels(gcap, node);
+    gcan->total_training = gcap->node_total_training[node];
+    if (gcan->nlabels) {
+      gcan->labels = gcap->gc_labels + off;
+      gcan->gcs = gcap->gc_arena + off;
+    }
+  }
+
+  for (g = 0; g < gcap->ngcs; g++) {
+    GC1D *gc = &gcap->gc_arena[g];
+    gc->means = gcap->means + g * gcap->ninputs;
+    gc->covars = gcap->covars + g * gcap->ncovars;
+    gc->ntraining = gcap->gc_ntraining[g];
+    if (!gcap->gibbs) continue;
+    gc->nlabels = gcap->gibbs_nlabels + g * GIBBS_NEIGHBORS;
+    gc->labels = gcap->gibbs_label_ptrs + g * GIBBS_NEIGHBORS;
+    gc->label_priors = gcap->gibbs_prior_ptrs + g * GIBBS_NEIGHBORS;
+    for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+      off = gcap->gibbs_offsets[g * GIBBS_NEIGHBORS + i];
+      gc->labels[i] = gcap->gibbs_labels + off;
+      gc->label_priors[i] = gcap->gibbs_priors + off;
+    }
+  }
+
+  for (prior = 0; prior < gcap->npriors; prior++) {
+    GCA_PRIOR *gcapr = &gcap->prior_arena[prior];
+    off = gcap->prior_offsets[prior];
+    gcapr->nlabels = gcapr->max_labels = GCApackedPriorNlabels(gcap, prior);
+    gcapr->total_training = gcap->prior_total_training[prior];
+    if (gcapr->nlabels) {
+      gcapr->labels = gcap->prior_labels + off;
+      gcapr->priors = gcap->prior_priors + off;
+    }
+  }
+  return (NO_ERROR);
+}
+
+/*!
+  \fn GCA *GCApackedRead(const char *fname)
+  \brief Maps a .gcap file copy-on-write and builds a GCA whose nodes and
+  priors point into the mapping. Pages that are never written (everything,
+  for mri_ca_label and mri_em_register) stay shared between processes.
+*/
+GCA *GCApackedRead(const char *fname)
+{
+  GCAP_FILE_HEADER hdr;
+  GCA_PACKED *gcap;
+  GCA *gca;
+  struct stat st;
+  char *base;
+  void *map;
+  int fd, b;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    ErrorReturn(NULL, (ERROR_BADPARM, "GCApackedRead(%s): could not open file", fname));
+  }
+  if (fstat(fd, &st) != 0 || read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+    close(fd);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCApackedRead(%s): could not read header", fname));
+  }
+  if (memcmp(hdr.magic, GCA_PACKED_MAGIC, sizeof(hdr.magic)) || hdr.version != GCA_PACKED_VERSION) {
+    close(fd);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCApackedRead(%s): not a version %d packed GCA", fname, GCA_PACKED_VERSION));
+  }
+  if (hdr.byte_order != GCAP_BYTE_ORDER) {
+    close(fd);
+    ErrorReturn(NULL,
+                (ERROR_BADFILE, "GCApackedRead(%s): written on a machine with different byte order, "
+                 "regenerate it from the .gca", fname));
+  }
+  if (hdr.file_size != (int64_t)st.st_size) {
+    close(fd);
+    ErrorReturn(NULL,
+                (ERROR_BADFILE, "GCApackedRead(%s): truncated file (%lld bytes, %lld expected)",
+                 fname, (long long)st.st_size, (long long)hdr.file_size));
+  }
+
+  map = mmap(NULL, hdr.file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    ErrorReturn(NULL, (ERROR_NOMEMORY, "GCApackedRead(%s): mmap failed (%s)", fname, strerror(errno)));
+  }
+  base = (char *)map;
+
+  gcap = (GCA_PACKED *)calloc(1, sizeof(GCA_PACKED));
+  if (!gcap) ErrorExit(ERROR_NOMEMORY, "GCApackedRead: could not allocate packed GCA");
+  gcap->map = map;
+  gcap->map_size = hdr.file_size;
+  gcap->ninputs = hdr.ninputs;
+  gcap->ncovars = hdr.ninputs * (hdr.ninputs + 1) / 2;
+  gcap->gibbs = (hdr.flags & GCA_NO_MRF) == 0;
+  gcap->nnodes = (int64_t)hdr.node_width * hdr.node_height * hdr.node_depth;
+  gcap->npriors = (int64_t)hdr.prior_width * hdr.prior_height * hdr.prior_depth;
+  gcap->ngcs = hdr.ngcs;
+  gcap->ngibbs = hdr.ngibbs;
+  gcap->nprior_labels = hdr.nprior_labels;
+
+  for (b = 0; b < GCAP_NBLOCKS; b++) {
+    if (b >= GCAP_GIBBS_NLABELS && b <= GCAP_GIBBS_PRIORS && !gcap->gibbs) continue;
+    if (hdr.blocks[b] <= 0 || hdr.blocks[b] >= hdr.file_size || hdr.blocks[b] % GCA_PACKED_ALIGN ||
+        (b == GCAP_TISSUE_PARMS && hdr.blocks[b] + (int64_t)sizeof(GCA_TISSUE_PARMS) * MAX_GCA_LABELS > hdr.file_size)) {
+      munmap(map, hdr.file_size);
+      free(gcap);
+      ErrorReturn(NULL, (ERROR_BADFILE, "GCApackedRead(%s): corrupt block table", fname));
+    }
+  }
+  gcap->node_offsets = (int64_t *)(base + hdr.blocks[GCAP_NODE_OFFSETS]);
+  gcap->node_total_training = (int *)(base + hdr.blocks[GCAP_NODE_TOTAL_TRAINING]);
+  gcap->gc_labels = (unsigned short *)(base + hdr.blocks[GCAP_GC_LABELS]);
+  gcap->means = (float *)(base + hdr.blocks[GCAP_MEANS]);
+  gcap->covars = (float *)(base + hdr.blocks[GCAP_COVARS]);
+  gcap->gc_ntraining = (int *)(base + hdr.blocks[GCAP_GC_NTRAINING]);
+  if (gcap->gibbs) {
+    gcap->gibbs_nlabels = (short *)(base + hdr.blocks[GCAP_GIBBS_NLABELS]);
+    gcap->gibbs_offsets = (int64_t *)(base + hdr.blocks[GCAP_GIBBS_OFFSETS]);
+    gcap->gibbs_labels = (unsigned short *)(base + hdr.blocks[GCAP_GIBBS_LABELS]);
+    gcap->gibbs_priors = (float *)(base + hdr.blocks[GCAP_GIBBS_PRIORS]);
+  }
+  gcap->prior_offsets = (int64_t *)(base + hdr.blocks[GCAP_PRIOR_OFFSETS]);
+  gcap->prior_total_training = (int *)(base + hdr.blocks[GCAP_PRIOR_TOTAL_TRAINING]);
+  gcap->prior_labels = (unsigned short *)(base + hdr.blocks[GCAP_PRIOR_LABELS]);
+  gcap->prior_priors = (float *)(base + hdr.blocks[GCAP_PRIOR_PRIORS]);
+
+  if (gcap->node_offsets[gcap->nnodes] != gcap->ngcs || gcap->prior_offsets[gcap->npriors] != gcap->nprior_labels ||
+      (gcap->gibbs && gcap->gibbs_offsets[gcap->ngcs * GIBBS_NEIGHBORS] != gcap->ngibbs)) {
+    munmap(map, hdr.file_size);
+    free(gcap);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCApackedRead(%s): inconsistent offset tables", fname));
+  }
+
+  // no per-node allocation - the views are built over the mapping below, and
+  // every field gcaAllocMax() would default comes from the header, so the
+  // struct is set up (GCAsetup) exactly once at the end
+  gca = (GCA *)calloc(1, sizeof(GCA));
+  if (!gca) {
+    munmap(map, hdr.file_size);
+    free(gcap);
+    ErrorReturn(NULL, (ERROR_NOMEMORY, "GCApackedRead(%s): could not allocate struct", fname));
+  }
+  gca->ninputs = hdr.ninputs;
+  gca->prior_spacing = hdr.prior_spacing;
+  gca->node_spacing = hdr.node_spacing;
+  gca->flags = hdr.flags;
+  gca->total_training = hdr.total_training;
+  memmove(gca->tissue_parms, base + hdr.blocks[GCAP_TISSUE_PARMS], sizeof(gca->tissue_parms));
+  gca->node_width = hdr.node_width;
+  gca->node_height = hdr.node_height;
+  gca->node_depth = hdr.node_depth;
+  gca->prior_width = hdr.prior_width;
+  gca->prior_height = hdr.prior_height;
+  gca->prior_depth = hdr.prior_depth;
+  gca->type = hdr.type;
+  gca->max_label = hdr.max_label;
+  memmove(gca->TRs, hdr.TRs, sizeof(gca->TRs));
+  memmove(gca->FAs, hdr.FAs, sizeof(gca->FAs));
+  memmove(gca->TEs, hdr.TEs, sizeof(gca->TEs));
+  gca->x_r = hdr.x_r;
+  gca->x_a = hdr.x_a;
+  gca->x_s = hdr.x_s;
+  gca->y_r = hdr.y_r;
+  gca->y_a = hdr.y_a;
+  gca->y_s = hdr.y_s;
+  gca->z_r = hdr.z_r;
+  gca->z_a = hdr.z_a;
+  gca->z_s = hdr.z_s;
+  gca->c_r = hdr.c_r;
+  gca->c_a = hdr.c_a;
+  gca->c_s = hdr.c_s;
+  gca->width = hdr.width;
+  gca->height = hdr.height;
+  gca->depth = hdr.depth;
+  gca->xsize = hdr.xsize;
+  gca->ysize = hdr.ysize;
+  gca->zsize = hdr.zsize;
+  gca->packed = gcap;
+
+  gcapBuildViews(gca, gcap);
+
+  if (hdr.ct_offset > 0) {
+    FILE *fp = fopen(fname, "rb");
+    if (fp && fseek(fp, hdr.ct_offset, SEEK_SET) == 0) {
+      fprintf(stdout, "reading colortable from GCA file...\n");
+      gca->ct = CTABreadFromBinary(fp);
+      if (NULL != gca->ct)
+        fprintf(stdout, "colortable with %d entries read (originally %s)\n", gca->ct->nentries, gca->ct->fname);
+    }
+    if (fp) fclose(fp);
+  }
+
+  GCAsetup(gca);
+
+  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+    printf("GCApackedRead(%s): %lld nodes, %lld gcs, %lld priors mapped (%2.1f MB)\n",
+           fname, (long long)gcap->nnodes, (long long)gcap->ngcs, (long long)gcap->npriors,
+           gcap->map_size / (1024.0 * 1024.0));
+
+  return (gca);
+}
+
+/*!
+  \fn int GCApackedReleaseGibbs(GCA *gca)
+  \brief Drops the gibbs views of a packed GCA (the mapped blocks are left
+  alone and simply never touched again).
+*/
+int GCApackedReleaseGibbs(GCA *gca)
+{
+  GCA_PACKED *gcap = gca->packed;
+  int64_t g;
+
+  if (gcap == NULL || !gcap->gibbs) return (NO_ERROR);
+  for (g = 0; g < gcap->ngcs; g++) {
+    gcap->gc_arena[g].nlabels = NULL;
+    gcap->gc_arena[g].labels = NULL;
+    gcap->gc_arena[g].label_priors = NULL;
+  }
+  free(gcap->gibbs_label_ptrs);
+  free(gcap->gibbs_prior_ptrs);
+  gcap->gibbs_label_ptrs = NULL;
+  gcap->gibbs_prior_ptrs = NULL;
+  gcap->gibbs = 0;
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int GCApackedFree(GCA *gca)
+  \brief Releases the views and the mapping of a packed GCA. Called by
+  GCAfree(), which still owns the GCA struct itself.
+*/
+int GCApackedFree(GCA *gca)
+{
+  GCA_PACKED *gcap = gca->packed;
+
+  if (gcap == NULL) return (NO_ERROR);
+  free(gca->nodes);
+  free(gca->priors);
+  gca->nodes = NULL;
+  gca->priors = NULL;
+  free(gcap->node_arena);
+  free(gcap->node_rows);
+  free(gcap->prior_arena);
+  free(gcap->prior_rows);
+  free(gcap->gc_arena);
+  free(gcap->gibbs_label_ptrs);
+  free(gcap->gibbs_prior_ptrs);
+  if (gcap->map) munmap(gcap->map, gcap->map_size);
+  free(gcap);
+  gca->packed = NULL;
+  return (NO_ERROR);
+}
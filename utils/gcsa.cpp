@@ -38,6 +38,7 @@
 #include "macros.h"
 #include "mrishash.h"
 #include "proto.h"
+#include "romp_support.h"
 #include "tags.h"
 #include "transform.h"
 #include "utils.h"
@@ -58,6 +59,9 @@ static double gcsaNbhdGibbsLogLikelihood(
     GCSA *gcsa, MRI_SURFACE *mris, double *v_inputs, int vno, double gibbs_coef, int label);
 static double gcsaVertexGibbsLogLikelihood(GCSA *gcsa, MRI_SURFACE *mris, double const *v_inputs, int vno, double gibbs_coef);
 static int add_gc_to_gcsan(GCSA_NODE *gcsan_src, int nsrc, GCSA_NODE *gcsan_dst);
+static bool gcsaUseReference();
+static MRI *gcsaEngineLabel(GCSA *gcsa, MRI_SURFACE *mris);
+static int gcsaEngineReclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris);
 
 GCSA *GCSAalloc(int ninputs, int icno_priors, int icno_classifiers)
 {
@@ -956,6 +960,8 @@ MRI *GCSAlabel(GCSA *gcsa, MRI_SURFACE *mris)
   CP_NODE *cpn;
   double v_inputs[100], p[3];
 
+  if (!gcsaUseReference()) return gcsaEngineLabel(gcsa, mris);
+
   MRI *probabilities = MRIallocSequence(mris->nvertices,1,1,MRI_FLOAT,3);
 
   for (vno = 0; vno < mris->nvertices; vno++) {
@@ -1305,6 +1311,8 @@ int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
   CP_NODE *cpn;
   double v_inputs[100];
 
+  if (!gcsaUseReference()) return gcsaEngineReclassifyUsingGibbsPriors(gcsa, mris);
+
   indices = (int *)calloc(mris->nvertices, sizeof(int));
 
   niter = 0;
@@ -1527,6 +1535,564 @@ static double gcsaVertexGibbsLogLikelihood(
   return (ll);
 }
 
+/*-----------------------------------------------------------------------
+  GCSAlabel and GCSAreclassifyUsingGibbsPriors visit every vertex, and for
+  each one look up its prior and classifier nodes in the hash tables and
+  invert the covariance matrix of every label it might get, one vertex at
+  a time through static matrices.
+
+  GCSA_ENGINE does the lookups and the inversions once per call, so the
+  vertices can be labeled in parallel, with the same float operations in
+  the same order as GCSANclassify and gcsaVertexGibbsLogLikelihood, so
+  GCSAlabel gives the same labels and probabilities.
+
+  The Gibbs relabeling visits the vertices in the same random order as
+  the serial version, so it gives the same labeling. With
+  FS_GCSA_GIBBS_COLORED set, it instead visits them one color at a time,
+  with the surface colored so no two vertices within 2 hops of each other
+  share a color. The log likelihood of a vertex's neighborhood only reads
+  the labels of vertices within 2 hops, so the vertices of a color are
+  relabeled concurrently, and the result does not depend on the number of
+  threads, but it converges to a slightly different labeling than the
+  random order. Set FS_GCSA_REFERENCE to use the serial versions.
+  -----------------------------------------------------------------------*/
+typedef struct
+{
+  GCSA   *gcsa;
+  MRIS   *mris;
+  int     ninputs;
+  int    *vno_prior;       // per vertex of the surface being labeled
+  int    *vno_classifier;
+  double *inputs;          // ninputs per vertex
+  int    *gcs_first;       // per classifier node, index of its first GCS in the arrays below
+  float  *inv;             // ninputs*ninputs per GCS, row major
+  float  *det;             // of the covariance matrix, as MatrixDeterminant gives it
+  char   *singular;        // one of the GCSA_ENGINE_* states below
+} GCSA_ENGINE;
+
+// inv and det are only computed for the classifier nodes the surface maps to.
+// A singular covariance is only reported, or fatal, when a vertex uses it.
+#define GCSA_ENGINE_INVERTED      0
+#define GCSA_ENGINE_REGULARIZED   1   // inv is of the covariance regularized as GCSANclassify does
+#define GCSA_ENGINE_REPORTED      2   // same, and the singular matrix has been printed
+#define GCSA_ENGINE_NOT_INVERTIBLE 3  // even the regularized covariance could not be inverted
+
+static bool gcsaUseReference()
+{
+  return getenv("FS_GCSA_REFERENCE") != NULL;
+}
+
+static void gcsaEngineFree(GCSA_ENGINE *engine)
+{
+  free(engine->vno_prior);
+  free(engine->vno_classifier);
+  free(engine->inputs);
+  free(engine->gcs_first);
+  free(engine->inv);
+  free(engine->det);
+  free(engine->singular);
+  memset(engine, 0, sizeof(*engine));
+}
+
+static void gcsaEngineInit(GCSA_ENGINE *engine, GCSA *gcsa, MRIS *mris)
+{
+  int const ninputs = gcsa->ninputs;
+  int vno, j, n, r, c;
+
+  memset(engine, 0, sizeof(*engine));
+  engine->gcsa    = gcsa;
+  engine->mris    = mris;
+  engine->ninputs = ninputs;
+
+  // the nodes and inputs of the vertices
+  MRIS * const mris_classifiers = gcsa->mris_classifiers;
+  engine->vno_prior      = (int    *)calloc(mris->nvertices, sizeof(int));
+  engine->vno_classifier = (int    *)calloc(mris->nvertices, sizeof(int));
+  engine->inputs         = (double *)calloc((size_t)mris->nvertices * ninputs, sizeof(double));
+  if (!engine->vno_prior || !engine->vno_classifier || !engine->inputs)
+    ErrorExit(ERROR_NOMEMORY, "gcsaEngineInit: could not allocate %d vertices", mris->nvertices);
+
+  int const nframes = MIN(ninputs, gcsa->inputvals->nframes);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(experimental)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, &mris->vertices[vno]);
+    engine->vno_prior[vno] = v_prior - gcsa->mris_priors->vertices;
+    engine->vno_classifier[vno] = GCSAsourceToClassifierVertex(gcsa, v_prior) - mris_classifiers->vertices;
+    int i;
+    for (i = 0; i < nframes; i++) engine->inputs[(size_t)vno * ninputs + i] = MRIgetVoxVal(gcsa->inputvals, vno, 0, 0, i);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // the inverse covariances of the classifier nodes the vertices use,
+  // serially since MatrixInverse is not known to be thread safe
+  char *used = (char *)calloc(mris_classifiers->nvertices, sizeof(char));
+  if (!used) ErrorExit(ERROR_NOMEMORY, "gcsaEngineInit: could not allocate %d nodes", mris_classifiers->nvertices);
+  for (vno = 0; vno < mris->nvertices; vno++) used[engine->vno_classifier[vno]] = 1;
+
+  engine->gcs_first = (int *)calloc(mris_classifiers->nvertices + 1, sizeof(int));
+  if (!engine->gcs_first) ErrorExit(ERROR_NOMEMORY, "gcsaEngineInit: could not allocate %d nodes", mris_classifiers->nvertices);
+  for (j = 0; j < mris_classifiers->nvertices; j++)
+    engine->gcs_first[j + 1] = engine->gcs_first[j] + gcsa->gc_nodes[j].nlabels;
+
+  int const ngcs = engine->gcs_first[mris_classifiers->nvertices];
+  engine->inv      = (float *)calloc((size_t)ngcs * ninputs * ninputs, sizeof(float));
+  engine->det      = (float *)calloc(ngcs, sizeof(float));
+  engine->singular = (char  *)calloc(ngcs, sizeof(char));
+  if (!engine->inv || !engine->det || !engine->singular)
+    ErrorExit(ERROR_NOMEMORY, "gcsaEngineInit: could not allocate %d classifiers", ngcs);
+
+  MATRIX *m_cov_inv = NULL;
+  for (j = 0; j < mris_classifiers->nvertices; j++) {
+    if (!used[j]) continue;
+    GCSA_NODE * const gcsan = &gcsa->gc_nodes[j];
+    for (n = 0; n < gcsan->nlabels; n++) {
+      GCS * const gcs = &gcsan->gcs[n];
+      int   const k   = engine->gcs_first[j] + n;
+
+      m_cov_inv = MatrixInverse(gcs->m_cov, m_cov_inv);
+      if (!m_cov_inv) {
+        MATRIX *m_tmp = MatrixIdentity(ninputs, NULL);
+        MatrixScalarMul(m_tmp, 0.1, m_tmp);
+        MatrixAdd(m_tmp, gcs->m_cov, m_tmp);
+        m_cov_inv = MatrixInverse(m_tmp, NULL);
+        MatrixFree(&m_tmp);
+        if (!m_cov_inv) {
+          engine->singular[k] = GCSA_ENGINE_NOT_INVERTIBLE;
+          continue;
+        }
+        engine->singular[k] = GCSA_ENGINE_REGULARIZED;
+      }
+      for (r = 0; r < ninputs; r++)
+        for (c = 0; c < ninputs; c++) engine->inv[(size_t)k * ninputs * ninputs + r * ninputs + c] = m_cov_inv->rptr[r + 1][c + 1];
+      engine->det[k] = MatrixDeterminant(gcs->m_cov);
+    }
+  }
+  if (m_cov_inv) MatrixFree(&m_cov_inv);
+  free(used);
+}
+
+// -0.5 * the Mahalanobis distance of the inputs from the means of GCS k, as
+// GCSANclassify and gcsaVertexGibbsLogLikelihood compute it with MATRIX floats
+//
+static float gcsaEngineMahalanobis(GCSA_ENGINE const *engine, GCS const *gcs, int k, double const *v_inputs)
+{
+  int const ninputs = engine->ninputs;
+  float const * const inv = &engine->inv[(size_t)k * ninputs * ninputs];
+  float x[GCSA_MAX_INPUTS], tmp[GCSA_MAX_INPUTS];
+  int r, c;
+
+  for (r = 0; r < ninputs; r++) {
+    x[r] = gcs->v_means->rptr[r + 1][1];
+    x[r] -= v_inputs[r];
+  }
+  for (r = 0; r < ninputs; r++) {
+    float val = 0.0;
+    for (c = 0; c < ninputs; c++) val += inv[r * ninputs + c] * x[c];
+    tmp[r] = val;
+  }
+  float dot = 0.0f;
+  for (r = 0; r < ninputs; r++) dot += x[r] * tmp[r];
+  return dot;
+}
+
+// What GCSANclassify prints or exits with when the covariance of GCS nc of
+// classifier node j is singular, once per GCS rather than once per vertex
+//
+static void gcsaEngineReportSingular(GCSA_ENGINE const *engine, int j, int nc, int k)
+{
+  if (engine->singular[k] == GCSA_ENGINE_NOT_INVERTIBLE)
+    ErrorExit(ERROR_BADPARM, "GCSANclassify: could not regularize matrix");
+#ifdef HAVE_OPENMP
+  #pragma omp critical(gcsaEngineReportSingular)
+#endif
+  if (engine->singular[k] == GCSA_ENGINE_REGULARIZED) {
+    engine->singular[k] = GCSA_ENGINE_REPORTED;
+    fprintf(stderr, "Singular matrix in GCSAclassify, node=%d, n=%d:\n", j, nc);
+    MatrixPrint(stderr, engine->gcsa->gc_nodes[j].gcs[nc].m_cov);
+  }
+}
+
+// GCSANclassify
+//
+static int gcsaEngineClassify(GCSA_ENGINE const *engine, int vno, double *pprob)
+{
+  GCSA      * const gcsa  = engine->gcsa;
+  GCSA_NODE * const gcsan = &gcsa->gc_nodes[engine->vno_classifier[vno]];
+  CP_NODE   * const cpn   = &gcsa->cp_nodes[engine->vno_prior[vno]];
+  double const * const v_inputs = &engine->inputs[(size_t)vno * engine->ninputs];
+
+  double ptotal = 0.0, max_p = -10000, sumpl = 0;
+  double best_prior = 0, best_plike = 0;
+  int best_label = -1, n;
+
+  for (n = 0; n < cpn->nlabels; n++) {
+    int nc;
+    GCS const * const gcs = GCSAgetGC(gcsan, cpn->labels[n], &nc);
+    if (!gcs) {
+      ErrorPrintf(ERROR_BADPARM, "GCSANclassify: could not find GCS for node %d!", n);
+      continue;
+    }
+    int const k = engine->gcs_first[engine->vno_classifier[vno]] + nc;
+    if (engine->singular[k] != GCSA_ENGINE_INVERTED) gcsaEngineReportSingular(engine, engine->vno_classifier[vno], nc, k);
+    double proj = gcsaEngineMahalanobis(engine, gcs, k, v_inputs);
+    double det  = engine->det[k];
+    double plikelihood = exp(-0.5*proj)/(sqrt(det));
+    double p = cpn->cps[n].prior*plikelihood;
+    ptotal += p;
+    sumpl += plikelihood;
+    if (p > max_p) {
+      max_p = p;
+      best_label = cpn->labels[n];
+      best_prior = cpn->cps[n].prior;
+      best_plike = plikelihood;
+    }
+  }
+
+  if (ptotal == 0) ptotal = 10e10;
+  if (sumpl == 0) sumpl = 10e10;
+  if (max_p < 0) max_p = 0;
+  pprob[0] = max_p / ptotal;
+  pprob[1] = best_plike/sumpl;
+  pprob[2] = best_prior;
+
+  return (best_label);
+}
+
+static MRI *gcsaEngineLabel(GCSA *gcsa, MRI_SURFACE *mris)
+{
+  GCSA_ENGINE engine;
+  gcsaEngineInit(&engine, gcsa, mris);
+
+  MRI *probabilities = MRIallocSequence(mris->nvertices,1,1,MRI_FLOAT,3);
+
+  int vno;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1024)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX * const v = &mris->vertices[vno];
+    if (v->ripflag) ROMP_PF_continue;
+
+    double p[3];
+    int label;
+    if (vno == Gdiag_no) {
+      // GCSANclassify prints the details, and gives the same label
+      double v_inputs[100];
+      GCSAload_inputs(v_inputs, gcsa->inputvals, vno);
+      label = GCSANclassify(&gcsa->gc_nodes[engine.vno_classifier[vno]], &gcsa->cp_nodes[engine.vno_prior[vno]],
+                            v_inputs, gcsa->ninputs, p, NULL, 0, vno);
+    }
+    else {
+      label = gcsaEngineClassify(&engine, vno, p);
+    }
+    v->annotation = label;
+    for(int k=0; k < 3; k++) MRIsetVoxVal(probabilities,vno,0,0,k,p[k]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (Gdiag_no >= 0 && Gdiag_no < mris->nvertices && !mris->vertices[Gdiag_no].ripflag) {
+    VERTEX const * const v = &mris->vertices[Gdiag_no];
+    GCSA_NODE * const gcsan = &gcsa->gc_nodes[engine.vno_classifier[Gdiag_no]];
+    CP_NODE   * const cpn   = &gcsa->cp_nodes[engine.vno_prior[Gdiag_no]];
+    int n;
+    if (gcsa->ninputs == 2)
+      printf("v %d: inputs (%2.2f, %2.2f), label=%s (%d, %d)\n",Gdiag_no,v->val,v->val2,
+             annotation_to_name(v->annotation, NULL), annotation_to_index(v->annotation),v->annotation);
+    for (n = 0; n < cpn->nlabels; n++) {
+      GCS *gcs = GCSAgetGC(gcsan, cpn->labels[n], NULL);
+      printf("label %s (%d) [%d], p=%2.4f, means:\n",annotation_to_name(cpn->labels[n], NULL),
+             n,cpn->labels[n],cpn->cps[n].prior);
+      MatrixPrint(stdout, gcs->v_means);
+    }
+  }
+
+  gcsaEngineFree(&engine);
+  return(probabilities);
+}
+
+// gcsaVertexGibbsLogLikelihood of vertex vno with the label of vno_label replaced by label.
+// Like it, uses the v_inputs it is given, which for the neighbors of the vertex being
+// relabeled are the inputs of that vertex.
+//
+static double gcsaEngineVertexGibbsLogLikelihood(
+    GCSA_ENGINE const * const engine, 
+    int const * const annotations,
+    double const * const v_inputs, 
+    int const vno, 
+    int const vno_label, 
+    int const label,
+    double const gibbs_coef)
+{
+  GCSA * const gcsa = engine->gcsa;
+  MRIS * const mris = engine->mris;
+  VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+  VERTEX          const * const v  = &mris->vertices         [vno];
+
+  CP_NODE   * const cpn   = &gcsa->cp_nodes[engine->vno_prior[vno]];
+  GCSA_NODE * const gcsan = &gcsa->gc_nodes[engine->vno_classifier[vno]];
+
+  int const vlabel = vno == vno_label ? label : annotations[vno];
+  int np;
+  for (np = 0; np < cpn->nlabels; np++) {
+    if (cpn->labels[np] == vlabel) break;
+  }
+  if (np >= cpn->nlabels) /* never occured here */
+    return (BIG_AND_NEGATIVE);
+
+  int nc;  
+  for (nc = 0; nc < gcsan->nlabels; nc++) {
+    if (gcsan->labels[nc] == vlabel) break;
+  }
+  if (nc >= gcsan->nlabels) /* never occured here */
+    return (BIG_AND_NEGATIVE);
+
+  int const k = engine->gcs_first[engine->vno_classifier[vno]] + nc;
+  if (engine->singular[k] != GCSA_ENGINE_INVERTED) ErrorExit(ERROR_BADPARM, "GCSAvertexLogLikelihood: could not invert matrix");
+  CP * const cp = &cpn->cps[np];
+
+  double const det = engine->det[k];
+  double ll = -0.5 * gcsaEngineMahalanobis(engine, &gcsan->gcs[nc], k, v_inputs) - 0.5 * log(det);
+  double nbr_prior = 0.0;
+
+  int n;
+  for (n = 0; n < vt->vnum; n++) {
+    int const vnb = vt->v[n];
+    int const nbr_label = vnb == vno_label ? label : annotations[vnb];
+    int const i = edge_to_index(v, &mris->vertices[vnb]);
+    int j;
+    for (j = 0; j < cp->nlabels[i]; j++) {
+      if (nbr_label == cp->labels[i][j]) break;
+    }
+    if (j < cp->nlabels[i]) {
+      if (!FZERO(cp->label_priors[i][j]))
+        nbr_prior += log(cp->label_priors[i][j]);
+      else
+        nbr_prior += BIG_AND_NEGATIVE;
+    }
+    else /* never occurred - make it unlikely */
+    {
+      nbr_prior += BIG_AND_NEGATIVE;
+    }
+  }
+  ll += (gibbs_coef * nbr_prior + log(cp->prior));
+
+  return (ll);
+}
+
+// gcsaNbhdGibbsLogLikelihood
+//
+static double gcsaEngineNbhdGibbsLogLikelihood(
+    GCSA_ENGINE const *engine, int const *annotations, int vno, double gibbs_coef, int label)
+{
+  VERTEX_TOPOLOGY const * const vt = &engine->mris->vertices_topology[vno];
+  double const * const v_inputs = &engine->inputs[(size_t)vno * engine->ninputs];
+
+  double total_ll = gcsaEngineVertexGibbsLogLikelihood(engine, annotations, v_inputs, vno, vno, label, gibbs_coef);
+
+  int n;
+  for (n = 0; n < vt->vnum; n++) {
+    double ll = gcsaEngineVertexGibbsLogLikelihood(engine, annotations, v_inputs, vt->v[n], vno, label, gibbs_coef);
+    total_ll += ll;
+  }
+
+  return (total_ll);
+}
+
+// Greedy coloring, in vertex order, of the vertices so no two within 2 hops share a color.
+// Returns the number of colors, and the vertices of color c in
+// vnos[color_first[c] .. color_first[c+1]).
+//
+static int gcsaColorDistance2(MRIS *mris, int **pcolor_first, int **pvnos)
+{
+  int *colors = (int *)malloc(mris->nvertices * sizeof(int));
+  int  max_colors = 64;
+  int *used = (int *)malloc(max_colors * sizeof(int));
+  int  ncolors = 0, vno, n, m, c;
+
+  for (c = 0; c < max_colors; c++) used[c] = -1;
+  for (vno = 0; vno < mris->nvertices; vno++) colors[vno] = -1;
+
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    for (n = 0; n < vt->vnum; n++) {
+      int const vnb = vt->v[n];
+      if (colors[vnb] >= 0) used[colors[vnb]] = vno;
+      VERTEX_TOPOLOGY const * const vnt = &mris->vertices_topology[vnb];
+      for (m = 0; m < vnt->vnum; m++) {
+        int const vnb2 = vnt->v[m];
+        if (colors[vnb2] >= 0) used[colors[vnb2]] = vno;
+      }
+    }
+    for (c = 0; c < max_colors && used[c] == vno; c++)
+      ;
+    if (c == max_colors) {
+      used = (int *)realloc(used, 2 * max_colors * sizeof(int));
+      for (m = max_colors; m < 2 * max_colors; m++) used[m] = -1;
+      max_colors *= 2;
+    }
+    colors[vno] = c;
+    ncolors = MAX(ncolors, c + 1);
+  }
+
+  int *color_first = (int *)calloc(ncolors + 1, sizeof(int));
+  int *vnos = (int *)malloc(mris->nvertices * sizeof(int));
+  for (vno = 0; vno < mris->nvertices; vno++) color_first[colors[vno] + 1]++;
+  for (c = 0; c < ncolors; c++) color_first[c + 1] += color_first[c];
+  for (c = 0; c < ncolors; c++) used[c] = color_first[c];
+  for (vno = 0; vno < mris->nvertices; vno++) vnos[used[colors[vno]]++] = vno;
+
+  free(used);
+  free(colors);
+  *pcolor_first = color_first;
+  *pvnos = vnos;
+  return (ncolors);
+}
+
+// Relabels vno with the label that maximizes the Gibbs log likelihood of its neighborhood,
+// as GCSAreclassifyUsingGibbsPriors does. Returns -1 if vno is not marked, 1 if its label
+// changed, else 0.
+//
+static int gcsaEngineRelabelVertex(GCSA_ENGINE const *engine, int *annotations, char *marked, int vno)
+{
+  if (marked[vno] == 0) return (-1);
+  marked[vno] = 0;
+
+  CP_NODE const * const cpn = &engine->gcsa->cp_nodes[engine->vno_prior[vno]];
+  if (cpn->nlabels <= 1) return (0);
+
+  int const old_label = annotations[vno];
+  int best_label = old_label;
+  if (vno == Gdiag_no) printf("reclassifying vertex %d...\n", vno);
+  double max_ll = gcsaEngineNbhdGibbsLogLikelihood(engine, annotations, vno, 1.0, old_label);
+  int n;
+  for (n = 0; n < cpn->nlabels; n++) {
+    int const label = cpn->labels[n];
+    double const ll = gcsaEngineNbhdGibbsLogLikelihood(engine, annotations, vno, 1.0, label);
+    if (vno == Gdiag_no)
+      printf("\tlabel %s (%d, %d): ll=%2.3f\n",
+             annotation_to_name(label, NULL),
+             label,
+             annotation_to_index(label),
+             ll);
+    if (ll > max_ll) {
+      max_ll = ll;
+      best_label = label;
+      if (vno == Gdiag_no) printf("\tlabel %s NEW MAX\n", annotation_to_name(label, NULL));
+    }
+  }
+  if (best_label == old_label) return (0);
+
+  if (vno == Gdiag_no)
+    printf("v %d: label changed from %s (%d) to %s (%d)\n",
+           vno,
+           annotation_to_name(old_label, NULL),
+           old_label,
+           annotation_to_name(best_label, NULL),
+           best_label);
+  marked[vno] = 1;
+  annotations[vno] = best_label;
+  return (1);
+}
+
+static int gcsaEngineReclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
+{
+  GCSA_ENGINE engine;
+  gcsaEngineInit(&engine, gcsa, mris);
+
+  bool const colored = getenv("FS_GCSA_GIBBS_COLORED") != NULL;
+  int *color_first = NULL, *vnos = NULL, *indices = NULL, ncolors = 0;
+  if (colored) {
+    ncolors = gcsaColorDistance2(mris, &color_first, &vnos);
+    printf("relabeling %d colors of vertices in parallel\n", ncolors);
+  }
+  else {
+    indices = (int *)calloc(mris->nvertices, sizeof(int));
+  }
+
+  int  *annotations = (int  *)malloc(mris->nvertices * sizeof(int));
+  char *marked      = (char *)malloc(mris->nvertices * sizeof(char));
+  if (!annotations || !marked) ErrorExit(ERROR_NOMEMORY, "GCSAreclassifyUsingGibbsPriors: could not allocate %d vertices", mris->nvertices);
+
+  int vno, i, n, c, niter = 0, nchanged;
+  for (vno = 0; vno < mris->nvertices; vno++) annotations[vno] = mris->vertices[vno].annotation;
+
+  if (gcsa_write_iterations != 0) {
+    char fname[STRLEN];
+    sprintf(fname, "%s%03d.annot", gcsa_write_fname, niter);
+    printf("writing snapshot to %s...\n", fname);
+    MRISwriteAnnotation(mris, fname);
+  }
+
+  /* mark all vertices, so they will all be considered the first time through*/
+  for (vno = 0; vno < mris->nvertices; vno++) marked[vno] = 1;
+  do {
+    nchanged = 0;
+    int examined = 0;
+    if (colored) {
+      for (c = 0; c < ncolors; c++) {
+        ROMP_PF_begin
+#ifdef HAVE_OPENMP
+        #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 256) reduction(+ : nchanged, examined)
+#endif
+        for (i = color_first[c]; i < color_first[c + 1]; i++) {
+          ROMP_PFLB_begin
+          int const result = gcsaEngineRelabelVertex(&engine, annotations, marked, vnos[i]);
+          if (result >= 0) examined++;
+          if (result > 0) nchanged++;
+          ROMP_PFLB_end
+        }
+        ROMP_PF_end
+      }
+    }
+    else {
+      MRIScomputeVertexPermutation(mris, indices);
+      for (i = 0; i < mris->nvertices; i++) {
+        int const result = gcsaEngineRelabelVertex(&engine, annotations, marked, indices[i]);
+        if (result >= 0) examined++;
+        if (result > 0) nchanged++;
+      }
+    }
+    printf("%03d: %6d changed, %d examined...\n", niter, nchanged, examined);
+    niter++;
+    if (gcsa_write_iterations && (niter % gcsa_write_iterations) == 0) {
+      for (vno = 0; vno < mris->nvertices; vno++) mris->vertices[vno].annotation = annotations[vno];
+      char fname[STRLEN];
+      sprintf(fname, "%s%03d.annot", gcsa_write_fname, niter);
+      printf("writing snapshot to %s...\n", fname);
+      MRISwriteAnnotation(mris, fname);
+    }
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+      if (marked[vno] != 1) continue;
+      for (n = 0; n < vt->vnum; n++) {
+        if (marked[vt->v[n]] == 1) continue;
+        marked[vt->v[n]] = 2;
+      }
+    }
+  } while (nchanged > MIN_CHANGED);
+
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    mris->vertices[vno].annotation = annotations[vno];
+    mris->vertices[vno].marked     = marked[vno];
+  }
+
+  free(annotations);
+  free(marked);
+  free(indices);
+  free(color_first);
+  free(vnos);
+  gcsaEngineFree(&engine);
+  return (NO_ERROR);
+}
+
 #if 0
 static CP *
 getCP(CP_NODE *cpn, int label)
@@ -27,6 +27,7 @@ extern const char *Progname;
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -363,6 +364,7 @@ MRI::~MRI()
     }
   } else {
     if (owndata) free(chunk);
+    if (chunk_map) munmap(chunk_map, chunk_map_size);
     if (slices) {
       for (int slice = 0; slice < depth * nframes; slice++)
         if (slices[slice]) free(slices[slice]);
@@ -41,6 +41,7 @@
 #include "mrimorph.h"
 #include "mri_identify.h"
 #include "mri2.h"
+#include "mrivol2vol.h"
 
 //#define MRI2_TIMERS
 
@@ -844,6 +845,19 @@ int MRIvol2Vol(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param)
   Timer tSample;
 #endif
 
+  // Row-wise, type-specialized engine for nearest and trilinear; gives the
+  // same values as the loop below, which handles everything else.
+  if (!MRIvol2VolUseReference() &&
+      MRIvol2VolSample(src, targ, Vt2s, InterpCode, nintfunc == &nint2) == NO_ERROR) {
+    if (FreeMats) {
+      MatrixFree(&V2Rsrc);
+      MatrixFree(&invV2Rsrc);
+      MatrixFree(&V2Rtarg);
+      MatrixFree(&Vt2s);
+    }
+    return (0);
+  }
+
   if (InterpCode == SAMPLE_CUBIC_BSPLINE) bspline = MRItoBSpline(src, NULL, 3);
 
 #ifdef HAVE_OPENMP
@@ -35,6 +35,7 @@
 #include "minc.h"
 #include "mri.h"
 #include "mrinorm.h"
+#include "mriwindow.h"
 #include "proto.h"
 #include "region.h"
 #include "talairachex.h"
@@ -1921,6 +1922,11 @@ MRI *MRImeanInMask(MRI *mri_src, MRI *mri_dst, MRI *mri_mask, int wsize)
     MRIcopyHeader(mri_src, mri_dst);
   }
 
+  // running sums give the same means for integer-valued volumes
+  if (!MRIwindowUseReference() && MRIwindowMeanInMask(mri_src, mri_dst, mri_mask, whalf)) {
+    return (mri_dst);
+  }
+
   for (z = 0; z < depth; z++) {
     for (y = 0; y < height; y++) {
       for (x = 0; x < width; x++) {
@@ -1975,6 +1981,10 @@ MRI *MRIstdInMask(MRI *mri_src, MRI *mri_dst, MRI *mri_mean, MRI *mri_mask, int
 
   whalf = wsize / 2;
 
+  if (!MRIwindowUseReference()) {
+    return (MRIwindowStd(mri_src, mri_dst, mri_mean, mri_mask, whalf));
+  }
+
   for (z = 0; z < depth; z++) {
     for (y = 0; y < height; y++) {
       for (x = 0; x < width; x++) {
@@ -2047,6 +2057,11 @@ MRI *MRImean(MRI *mri_src, MRI *mri_dst, int wsize)
     MRIcopyHeader(mri_src, mri_dst);
   }
 
+  // running sums give the same means for integer-valued volumes
+  if (!MRIwindowUseReference() && MRIwindowMean(mri_src, mri_dst, whalf)) {
+    return (mri_dst);
+  }
+
   {
     int frame, z;
 
@@ -2188,6 +2203,18 @@ MRI *MRImedian(MRI *mri_src, MRI *mri_dst, int wsize, MRI_REGION *box)
     median_index = wsquared / 2;
     whalf = wsize / 2;
 
+    if (!MRIwindowUseReference()) {
+      MRI_REGION plane;
+      if (box) {
+        plane = *box;
+        plane.z = 0;
+        plane.dz = 1;
+      }
+      if (MRIwindowOrder(mri_src, mri_dst, whalf, whalf, 0, median_index, 0, mri_src->nframes, box ? &plane : NULL)) {
+        return (mri_dst);
+      }
+    }
+
     if (sort_array && (wsquared != sort_size)) {
       free(sort_array);
       sort_array = NULL;
@@ -2235,6 +2262,13 @@ MRI *MRImedian(MRI *mri_src, MRI *mri_dst, int wsize, MRI_REGION *box)
   whalf = wsize / 2;
   printf("wsize %d wcubed %d  whalf %d\n",wsize,wcubed,whalf);
 
+  // a running histogram (or a selection, for float volumes) gives the
+  // same medians without sorting every window
+  if (!MRIwindowUseReference() &&
+      MRIwindowOrder(mri_src, mri_dst, whalf, whalf, whalf, median_index, 0, mri_src->nframes, box)) {
+    return (mri_dst);
+  }
+
   if (sort_array && (wcubed != sort_size)) {
     free(sort_array);
     sort_array = NULL;
@@ -2311,6 +2345,10 @@ MRI *MRIorder(MRI *mri_src, MRI *mri_dst, int wsize, float pct)
   order_index = pct * wcubed;
   whalf = wsize / 2;
 
+  if (!MRIwindowUseReference() && MRIwindowOrder(mri_src, mri_dst, whalf, whalf, whalf, order_index, 0, 1, NULL)) {
+    return (mri_dst);
+  }
+
   if (sort_array && (wcubed != sort_size)) {
     free(sort_array);
     sort_array = NULL;
@@ -2443,6 +2481,10 @@ MRI *MRIstd(MRI *mri_src, MRI *mri_dst, MRI *mri_mean, int wsize)
 
   whalf = wsize / 2;
 
+  if (!MRIwindowUseReference()) {
+    return (MRIwindowStd(mri_src, mri_dst, mri_mean, NULL, whalf));
+  }
+
   for (z = 0; z < depth; z++) {
     for (y = 0; y < height; y++) {
       for (x = 0; x < width; x++) {
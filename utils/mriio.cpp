@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -644,7 +645,14 @@ MRI *mri_read(const char *fname, int type, int volume_flag, int start_frame, int
     mri = sdtRead(fname_copy, volume_flag);
   }
   else if (type == MRI_MGH_FILE) {
-    mri = mghRead(fname_copy, volume_flag, -1);
+    if (volume_flag && start_frame >= 0 && end_frame >= start_frame) {
+      // only read the selected frames rather than copying them out below
+      mri = mghReadEx(fname_copy, volume_flag, start_frame, end_frame, 0, -1);
+      if (mri == NULL) return (NULL);
+      start_frame = -1;
+    }
+    else
+      mri = mghRead(fname_copy, volume_flag, -1);
   }
   else if (type == MGH_MORPH) {
     int which = start_frame ;
@@ -1054,6 +1062,60 @@ MRI *MRIreadEx(const char *fname, int nthframe)
 
 } /* end MRIread() */
 
+/*---------------------------------------------------------------------
+  MRIreadFrameSlab() - reads frames start_frame..end_frame and slices
+  start_slice..end_slice of a volume (an end of -1 means the last
+  one). For .mgh/.mgz only the selected voxels are read and stored (see
+  mghReadEx()); other formats are read in full and then cut down.
+  ---------------------------------------------------------------------*/
+MRI *MRIreadFrameSlab(const char *fname, int start_frame, int end_frame, int start_slice, int end_slice)
+{
+  char buf[STRLEN];
+  MRI *mri = NULL, *mri_tmp;
+
+  chklc();
+
+  FileNameFromWildcard(fname, buf);
+  fname = buf;
+  if (mri_identify(fname) == MRI_MGH_FILE)
+    mri = mghReadEx(fname, TRUE, start_frame, end_frame, start_slice, end_slice);
+  else {
+    mri = mri_read(fname, MRI_VOLUME_TYPE_UNKNOWN, TRUE, -1, -1);
+    if (mri == NULL) return (NULL);
+    if (end_frame < 0) end_frame = mri->nframes - 1;
+    if (end_slice < 0) end_slice = mri->depth - 1;
+    if (start_frame < 0 || start_frame > end_frame || end_frame >= mri->nframes || start_slice < 0 ||
+        start_slice > end_slice || end_slice >= mri->depth) {
+      errno = 0;
+      ErrorPrintf(ERROR_BADPARM,
+                  "MRIreadFrameSlab(%s): frames %d-%d, slices %d-%d out of range (%d frames, %d slices in volume)",
+                  fname,
+                  start_frame,
+                  end_frame,
+                  start_slice,
+                  end_slice,
+                  mri->nframes,
+                  mri->depth);
+      MRIfree(&mri);
+      return (NULL);
+    }
+    if (start_frame > 0 || end_frame < mri->nframes - 1) {
+      mri_tmp = MRIcopyFrames(mri, NULL, start_frame, end_frame, 0);
+      MRIfree(&mri);
+      mri = mri_tmp;
+    }
+    if (start_slice > 0 || end_slice < mri->depth - 1) {
+      mri_tmp = MRIextract(mri, NULL, 0, 0, start_slice, mri->width, mri->height, end_slice - start_slice + 1);
+      MRIfree(&mri);
+      mri = mri_tmp;
+    }
+  }
+  if (mri == NULL) return (NULL);
+
+  MRIremoveNaNs(mri, mri);
+  return (mri);
+}
+
 MRI *MRIreadInfo(const char *fname)
 {
   MRI *mri = NULL;
@@ -10807,12 +10869,93 @@ int znzTAGreadMRIframes(znzFile fp, MRI *mri, long len)
 // declare function pointer
 // static int (*myclose)(FILE *stream);
 
+/*---------------------------------------------------------------------
+  mghMapVoxels() - maps nframes frames of voxels, starting at byte
+  offset in the (uncompressed) file fname, into a new MRI instead of
+  reading them. The pages are mapped copy-on-write, so the file is never
+  modified. On little-endian hosts multi-byte voxels still have to be
+  byte-swapped in place, which touches (and privately copies) every
+  page; only uchar volumes are truly zero-copy there. Returns NULL if
+  the file cannot be mapped, in which case the caller reads it instead.
+  ---------------------------------------------------------------------*/
+static MRI *mghMapVoxels(const char *fname, long offset, int width, int height, int depth, int type, int nframes)
+{
+  struct stat st;
+  size_t nbytes;
+  void *map;
+  MRI *mri;
+  int fd;
+
+  switch (type) {
+    case MRI_UCHAR:
+    case MRI_SHORT:
+    case MRI_USHRT:
+    case MRI_INT:
+    case MRI_FLOAT:
+      break;
+    default:
+      return (NULL);
+  }
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) return (NULL);
+  nbytes = (size_t)width * height * depth * nframes * MRIsizeof(type);
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < offset + nbytes) {
+    close(fd);
+    return (NULL);
+  }
+  map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return (NULL);
+
+  mri = new MRI({width, height, depth, nframes}, type, false);
+  mri->ras_good_flag = 1;
+  mri->chunk = (char *)map + offset;
+  mri->ischunked = 1;
+  mri->owndata = false;
+  mri->chunk_map = map;
+  mri->chunk_map_size = st.st_size;
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  if (MRIsizeof(type) == 2) byteswapbufshort(mri->chunk, nbytes);
+  if (MRIsizeof(type) == 4) byteswapbuffloat(mri->chunk, nbytes);
+#endif
+  mri->initSlices();
+  mri->initIndices();
+  return (mri);
+}
+
+/*---------------------------------------------------------------------
+  mghRead() - reads an .mgh/.mgz file. frame >= 0 reads only that
+  frame; frame < -1 is a hack that means to only read in the first
+  -frame frames (otherwise I would have had to change the whole MRIread
+  interface and that was too much of a pain. Sorry.)
+  ---------------------------------------------------------------------*/
 MRI *mghRead(const char *fname, int read_volume, int frame)
+{
+  if (frame >= 0) return (mghReadEx(fname, read_volume, frame, frame, 0, -1));
+  if (frame < -1) return (mghReadEx(fname, read_volume, 0, -frame - 1, 0, -1));
+  return (mghReadEx(fname, read_volume, 0, -1, 0, -1));
+}
+
+/*---------------------------------------------------------------------
+  mghReadEx() - reads frames start_frame..end_frame and slices
+  start_slice..end_slice (a slab) of an .mgh/.mgz file. An end of -1
+  means the last frame/slice. Only the selected voxels are stored; the
+  rest are skipped with znzseek(), which for .mgz inflates and discards
+  them on the fly (the tags come after the voxels, so the stream still
+  has to be read to its end). The vox2ras of a slab is adjusted so that
+  its voxels keep their scanner RAS.
+
+  If FS_MGH_MMAP is set, the voxels of an uncompressed .mgh are mapped
+  rather than read when all slices are selected (see mghMapVoxels()).
+  ---------------------------------------------------------------------*/
+MRI *mghReadEx(const char *fname, int read_volume, int start_frame, int end_frame, int start_slice, int end_slice)
 {
   MRI *mri;
   znzFile fp;
-  int start_frame, end_frame, width, height, depth, nframes, type, x, y, z, bpv, dof, bytes, version, ival,
-      unused_space_size, good_ras_flag, i;
+  int frame, width, height, depth, nframes, type, x, y, z, bpv, dof, bytes, version, ival,
+      unused_space_size, good_ras_flag, i, file_nframes, file_depth;
+  long frame_bytes;
   BUFTYPE *buf;
   char unused_buf[UNUSED_SPACE_SIZE + 1];
   float fval, xsize, ysize, zsize, x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s, xfov, yfov, zfov;
@@ -10841,7 +10984,7 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
     fp = znzopen(fname, "rb", gzipped);
     if (znz_isnull(fp)) {
       errno = 0;
-      ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): could not open file", fname, frame));
+      ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): could not open file", fname, start_frame));
     }
   }
   else {
@@ -10850,7 +10993,7 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
                  "mghRead(%s, %d): could not open file.\n"
                  "Filename extension must be .mgh, .mgh.gz or .mgz",
                  fname,
-                 frame));
+                 start_frame));
   }
 
   /* keep the compiler quiet */
@@ -10861,7 +11004,7 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
   c_r = c_a = c_s = 0;
 
   nread = znzreadIntEx(&version, fp);
-  if (!nread) ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): read error", fname, frame));
+  if (!nread) ErrorReturn(NULL, (ERROR_BADPARM, "mghRead(%s, %d): read error", fname, start_frame));
 
   width = znzreadInt(fp);
   height = znzreadInt(fp);
@@ -10919,51 +11062,38 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
       break;
   }
   bytes = width * height * bpv; /* bytes per slice */
+  frame_bytes = (long)bytes * depth;
+  file_nframes = nframes;
+  file_depth = depth;
+  if (end_frame < 0) end_frame = file_nframes - 1;
+  if (end_slice < 0) end_slice = file_depth - 1;
+  if (start_frame < 0 || start_frame > end_frame || end_frame >= file_nframes || start_slice < 0 ||
+      start_slice > end_slice || end_slice >= file_depth) {
+    znzclose(fp);
+    errno = 0;
+    ErrorReturn(NULL,
+                (ERROR_BADPARM,
+                 "mghRead(%s): frames %d-%d, slices %d-%d out of range (%d frames, %d slices in volume)",
+                 fname,
+                 start_frame,
+                 end_frame,
+                 start_slice,
+                 end_slice,
+                 file_nframes,
+                 file_depth));
+  }
+  nframes = end_frame - start_frame + 1;
+  depth = end_slice - start_slice + 1;
+
   if (!read_volume) {
     mri = MRIallocHeader(width, height, depth, type, nframes);
     mri->dof = dof;
     mri->nframes = nframes;
     mri->version = version;                // version saved in mgz
     mri->intent  = (version >> 8) & 0xff;  // content of the mgz file, annot, curv, warp, ...
-    if (gzipped) {  // pipe cannot seek
-      long count, total_bytes;
-      uchar buf[STRLEN];
-
-      total_bytes = (long)mri->nframes * width * height * depth * bpv;
-      for (count = 0; count < total_bytes - STRLEN; count += STRLEN) znzread(buf, STRLEN, 1, fp);
-      znzread(buf, total_bytes - count, 1, fp);
-    }
-    else
-      znzseek(fp, (long)mri->nframes * width * height * depth * bpv, SEEK_CUR);
+    znzseek(fp, frame_bytes * file_nframes, SEEK_CUR);
   }
   else {
-    if (frame >= 0) {
-      start_frame = end_frame = frame;
-      if (gzipped) {  // pipe cannot seek
-        long count;
-        for (count = 0; count < (long)frame * width * height * depth * bpv; count++) znzgetc(fp);
-      }
-      else
-        znzseek(fp, (long)frame * width * height * depth * bpv, SEEK_CUR);
-      nframes = 1;
-    }
-    else { /* hack - # of frames < -1 means to only read in that
-              many frames. Otherwise I would have had to change the whole
-              MRIread interface and that was too much of a pain. Sorry.
-           */
-      if (frame < -1) nframes = frame * -1;
-
-      start_frame = 0;
-      end_frame = nframes - 1;
-      if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "read %d frames\n", nframes);
-    }
-    buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
-    mri = MRIallocSequence(width, height, depth, type, nframes);
-    mri->dof = dof;
-
-    mri->version = version;                // version saved in mgz
-    mri->intent  = (version >> 8) & 0xff;  // content of the mgz file, annot, curv, warp, ...
-    
     struct timespec begin, end;
     if (getenv("FS_MGZIO_TIMING"))
     {
@@ -10972,24 +11102,34 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
     }
 
     int USEVOXELBUF = 0;
-    if (mri->ischunked && getenv("FS_MGZIO_USEVOXELBUFREAD"))
+    mri = NULL;
+    if (!gzipped && depth == file_depth && getenv("FS_MGH_MMAP")) {
+      mri = mghMapVoxels(fname, znztell(fp) + frame_bytes * start_frame, width, height, depth, type, nframes);
+      if (mri) znzseek(fp, frame_bytes * file_nframes, SEEK_CUR);
+    }
+
+    if (!mri) {
+      mri = MRIallocSequence(width, height, depth, type, nframes);
+      if (start_frame > 0) znzseek(fp, frame_bytes * start_frame, SEEK_CUR);
+    }
+
+    if (mri->chunk_map)
+      ;  // voxels are already mapped
+    else if (mri->ischunked && depth == file_depth && getenv("FS_MGZIO_USEVOXELBUFREAD"))
     {
       USEVOXELBUF = 1;
       printf("INFO: Environment variable FS_MGZIO_USEVOXELBUFREAD set\n");
       printf("mghRead(): read voxel buffer ...\n");
-      if (buf) free(buf);
 
-      size_t bytes_to_read = (size_t)bytes * depth * (end_frame-start_frame+1);
+      size_t bytes_to_read = (size_t)bytes * depth * nframes;
 
-#if 1  // handle volumes larger than 98455280, read one slice at a time until we read all the bytes
+      // handle volumes larger than 98455280, read one slice at a time until we read all the bytes
       size_t bytes_per_slice = bytes;
-      BUFTYPE *bufsrc = &MRIseq_vox(mri, 0, 0, 0, start_frame);   // user can select frames to output; MRIseq_vox(mri, 0, 0, 0, 0) = (BUFTYPE*)mri->chunk;
+      BUFTYPE *bufsrc = &MRIseq_vox(mri, 0, 0, 0, 0);  // first selected frame; = (BUFTYPE*)mri->chunk
 
       size_t bytes_left_toread = bytes_to_read;
       while (bytes_left_toread > 0)
       {
-        //printf("[DEBUG] FS_MGZIO_USEVOXELBUFREAD: bufsrc=%p\n", bufsrc);
- 
         // It seems that the maximum bytes znzread() can read in at a time is 98455280.
         size_t bytes_read = znzread(bufsrc, sizeof(BUFTYPE), bytes_per_slice, fp);
         if (bytes_read != bytes_per_slice)
@@ -11007,42 +11147,20 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
         // adjust buffer pointer, and left bytes to be read
         bytes_left_toread -= bytes_read;
         bufsrc += bytes_read;
-        //printf("[DEBUG] FS_MGZIO_USEVOXELBUFREAD: read %lu bytes, %lu bytes left to be read\n", bytes_read, bytes_left_toread);
-      }
-
-      if (bytes_left_toread != 0)
-      {
-        znzclose(fp);
-        ErrorReturn(NULL, (ERROR_BADFILE, "mghRead (FS_MGZIO_USEVOXELBUFREAD): could not read %lu bytes, read only %lu bytes\n", bytes_to_read, (bytes_to_read-bytes_left_toread)));
-      }        
-#else  // volume cannot be larger than 98455280
-      BUFTYPE *bufsrc = &MRIseq_vox(mri, 0, 0, 0, start_frame);
-      size_t bytes_read = znzread(bufsrc, sizeof(BUFTYPE), bytes_to_read, fp);
-      //printf("[DEBUG] FS_MGZIO_USEVOXELBUFREAD: read %lu bytes, (%lu to read)\n", bytes_read, bytes_to_read);
-      if (bytes_read != bytes_to_read)
-      {
-        // It seems that the maximum bytes znzread() can read in at a time is 98455280.
-        znzclose(fp);
-        //free(bufsrc);
-        ErrorReturn(NULL, (ERROR_BADFILE, "mghRead (read voxel buffer): could not read %lu bytes, read only %lu bytes\n", bytes_to_read, bytes_read));
       }
-
-#if (BYTE_ORDER == LITTLE_ENDIAN)
-      if (bpv == 2) byteswapbufshort(bufsrc, bytes_to_read);
-      if (bpv == 4) byteswapbuffloat(bufsrc, bytes_to_read);
-      if (bpv == 8) byteswapbuffloat(bufsrc, bytes_to_read);
-#endif
-#endif
+      if (end_frame < file_nframes - 1) znzseek(fp, frame_bytes * (file_nframes - 1 - end_frame), SEEK_CUR);
     }
     else  // copy voxel point by point
     {
+      buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
       for (frame = start_frame; frame <= end_frame; frame++) {
+        if (start_slice > 0) znzseek(fp, (long)bytes * start_slice, SEEK_CUR);
         for (z = 0; z < depth; z++) {
           if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
             // fclose(fp) ;
             znzclose(fp);
             free(buf);
-            ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
+            ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z + start_slice));
           }
           switch (type) {
             case MRI_INT:
@@ -11086,19 +11204,26 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
               ErrorReturn(NULL, (ERROR_UNSUPPORTED, "mghRead: unsupported type %d", mri->type));
               break;
           } // switch
-          exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
+          exec_progress_callback(z, depth, frame - start_frame, nframes);
         } // depth
+        if (end_slice < file_depth - 1) znzseek(fp, (long)bytes * (file_depth - 1 - end_slice), SEEK_CUR);
       } // frame
       if (buf) free(buf);
+      // skip the frames that were not selected to get to the tags
+      if (end_frame < file_nframes - 1) znzseek(fp, frame_bytes * (file_nframes - 1 - end_frame), SEEK_CUR);
     } // end of copying voxel point by point
 
+    mri->dof = dof;
+    mri->version = version;                // version saved in mgz
+    mri->intent  = (version >> 8) & 0xff;  // content of the mgz file, annot, curv, warp, ...
+
     if (getenv("FS_MGZIO_TIMING"))
     {
       clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
       printf("Total time (mghRead) = %ld.%09ld seconds%s\n", 
              (end.tv_nsec < begin.tv_nsec) ? (end.tv_sec - 1 - begin.tv_sec) : (end.tv_sec - begin.tv_sec), 
              (end.tv_nsec < begin.tv_nsec) ? (1000000000 + end.tv_nsec - begin.tv_nsec) : (end.tv_nsec - begin.tv_nsec),
-             (USEVOXELBUF) ? " (USEVOXELBUF)" : "");
+             (USEVOXELBUF) ? " (USEVOXELBUF)" : (mri->chunk_map ? " (MMAP)" : ""));
     }
   }
 
@@ -11126,6 +11251,13 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
     mri->c_a = c_a;
     mri->c_s = c_s;
     if (good_ras_flag > 0) mri->ras_good_flag = 1;
+    if (depth != file_depth) {
+      // c_ras is the center of the file volume, move it to the center of the slab
+      float dz = zsize * (start_slice + depth / 2.0 - file_depth / 2.0);
+      mri->c_r += z_r * dz;
+      mri->c_a += z_a * dz;
+      mri->c_s += z_s * dz;
+    }
   }
   else {
     if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
@@ -11165,8 +11297,23 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
       
       switch (tag) {
         case TAG_MRI_FRAME:
-          if (znzTAGreadMRIframes(fp, mri, len) != NO_ERROR)
-            fprintf(stderr, "couldn't read frame structure from file\n");
+          if (nframes == file_nframes) {
+            if (znzTAGreadMRIframes(fp, mri, len) != NO_ERROR)
+              fprintf(stderr, "couldn't read frame structure from file\n");
+          }
+          else {  // read all of them, keep the selected ones
+            MRI *mri_frames = MRIallocHeader(1, 1, 1, MRI_UCHAR, file_nframes);
+            if (znzTAGreadMRIframes(fp, mri_frames, len) != NO_ERROR)
+              fprintf(stderr, "couldn't read frame structure from file\n");
+            else {
+              for (i = 0; i < nframes; i++) {
+                MATRIX *m_ras2vox = mri->frames[i].m_ras2vox;
+                mri->frames[i] = mri_frames->frames[start_frame + i];
+                mri->frames[i].m_ras2vox = MatrixCopy(mri_frames->frames[start_frame + i].m_ras2vox, m_ras2vox);
+              }
+            }
+            MRIfree(&mri_frames);
+          }
           break;
 
         case TAG_OLD_COLORTABLE:
@@ -11263,6 +11410,10 @@ MRI *mghRead(const char *fname, int read_volume, int frame)
 	  }
 	  break;
         case TAG_GCAMORPH_LABELS:
+          if (depth != file_depth) {  // labels are stored for the whole volume
+            znzTAGskip(fp, tag, (long long)len);
+            break;
+          }
 	  // allocate memory for mri->gcamorphLabel
 	  mri->initGCAMorphLabel();
 
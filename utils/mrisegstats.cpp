@@ -0,0 +1,553 @@
+/**
+ * @brief one-pass segmentation statistics engine behind mri_segstats
+ *
+ * Per-id voxel lists built with one pass over the segmentation, and the
+ * MRIsegStats() family computed from them. See mrisegstats.h.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "mri.h"
+#include "mrisegstats.h"
+#include "utils.h"
+#include "romp_support.h"
+
+// Labels handled by MRIvoxelsInLabelWithPartialVolumeEffects(); its
+// neighborhood tables are this long.
+#define MRI_SEGINDEX_PV_MAXLABELS 20000
+
+int MRIsegStatsUseReference(void)
+{
+  static int use_reference = -1 ;
+
+  if (use_reference < 0)
+    use_reference = (getenv("FS_MRI_SEGSTATS_REFERENCE") != NULL) ;
+  return (use_reference) ;
+}
+
+MRI_SEGINDEX *MRIsegIndexAlloc(MRI *seg, const int *segids, int nsegids)
+{
+  MRI_SEGINDEX *si ;
+  int *kvox, *next, n, k, c ;
+  int const width = seg->width, height = seg->height, depth = seg->depth ;
+
+  if ((double)width * height * depth > INT_MAX)
+    return (NULL) ;
+  int const nvox = width * height * depth ;
+
+  si = (MRI_SEGINDEX *)calloc(1, sizeof(MRI_SEGINDEX)) ;
+  si->width = width ;
+  si->height = height ;
+  si->depth = depth ;
+
+  // distinct ids, in increasing order
+  si->segids = (int *)calloc(nsegids + 1, sizeof(int)) ;
+  memmove(si->segids, segids, nsegids * sizeof(int)) ;
+  qsort(si->segids, nsegids, sizeof(int), compare_ints) ;
+  for (n = 0; n < nsegids; n++)
+    if (si->nsegs == 0 || si->segids[si->nsegs - 1] != si->segids[n])
+      si->segids[si->nsegs++] = si->segids[n] ;
+
+  // id of each voxel, read like the reference loops read it
+  kvox = (int *)malloc(nvox * sizeof(int)) ;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (c = 0; c < width; c++) {
+    ROMP_PFLB_begin
+    int r, s, *pk ;
+
+    pk = kvox + (size_t)c * height * depth ;
+    for (r = 0; r < height; r++)
+      for (s = 0; s < depth; s++)
+        *pk++ = MRIsegIndexFind(si, (int)MRIgetVoxVal(seg, c, r, s, 0)) ;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // counting sort of the voxels by id, keeping their order within an id
+  si->offset = (int *)calloc(si->nsegs + 1, sizeof(int)) ;
+  for (n = 0; n < nvox; n++)
+    if (kvox[n] >= 0)
+      si->offset[kvox[n] + 1]++ ;
+  for (k = 0; k < si->nsegs; k++)
+    si->offset[k + 1] += si->offset[k] ;
+
+  si->voxels = (int *)malloc((si->offset[si->nsegs] + 1) * sizeof(int)) ;
+  next = (int *)calloc(si->nsegs + 1, sizeof(int)) ;
+  memmove(next, si->offset, si->nsegs * sizeof(int)) ;
+  for (n = 0; n < nvox; n++)
+    if (kvox[n] >= 0)
+      si->voxels[next[kvox[n]]++] = n ;
+
+  free(next) ;
+  free(kvox) ;
+  return (si) ;
+}
+
+int MRIsegIndexFree(MRI_SEGINDEX **psi)
+{
+  MRI_SEGINDEX *si = *psi ;
+
+  if (si == NULL)
+    return (NO_ERROR) ;
+  free(si->segids) ;
+  free(si->offset) ;
+  free(si->voxels) ;
+  free(si) ;
+  *psi = NULL ;
+  return (NO_ERROR) ;
+}
+
+int MRIsegIndexFind(const MRI_SEGINDEX *si, int segid)
+{
+  int lo = 0, hi = si->nsegs - 1, mid ;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2 ;
+    if (si->segids[mid] == segid)
+      return (mid) ;
+    if (si->segids[mid] < segid)
+      lo = mid + 1 ;
+    else
+      hi = mid - 1 ;
+  }
+  return (-1) ;
+}
+
+int MRIsegIndexCount(const MRI_SEGINDEX *si, int segid)
+{
+  int k = MRIsegIndexFind(si, segid) ;
+
+  if (k < 0)
+    return (0) ;
+  return (si->offset[k + 1] - si->offset[k]) ;
+}
+
+// column, row and slice of an indexed voxel
+static inline void mriSegIndexVoxel(const MRI_SEGINDEX *si, int lin, int *c, int *r, int *s)
+{
+  *s = lin % si->depth ;
+  lin /= si->depth ;
+  *r = lin % si->height ;
+  *c = lin / si->height ;
+}
+
+/*---------------------------------------------------------
+  MRIsegIndexStats() - MRIsegStats() over the voxels of segid.
+  Same accumulation, in the same order.
+  ---------------------------------------------------------*/
+int MRIsegIndexStats(const MRI_SEGINDEX *si, int segid, MRI *mri, int frame,
+                     float *min, float *max, float *range, float *mean, float *std)
+{
+  int k, n, nvoxels, r, c, s ;
+  double val, sum, sum2 ;
+
+  *min = 0 ;
+  *max = 0 ;
+  sum = 0 ;
+  sum2 = 0 ;
+  nvoxels = 0 ;
+  k = MRIsegIndexFind(si, segid) ;
+  if (k >= 0) {
+    for (n = si->offset[k]; n < si->offset[k + 1]; n++) {
+      mriSegIndexVoxel(si, si->voxels[n], &c, &r, &s) ;
+      val = MRIgetVoxVal(mri, c, r, s, frame) ;
+      nvoxels++ ;
+      if (nvoxels == 1) {
+        *min = val ;
+        *max = val ;
+      }
+      if (*min > val)
+        *min = val ;
+      if (*max < val)
+        *max = val ;
+      sum += val ;
+      sum2 += (val * val) ;
+    }
+  }
+
+  *range = *max - *min ;
+
+  if (nvoxels != 0)
+    *mean = sum / nvoxels ;
+  else
+    *mean = 0.0 ;
+
+  if (nvoxels > 1)
+    *std = sqrt(((nvoxels) * (*mean) * (*mean) - 2 * (*mean) * sum + sum2) / (nvoxels - 1)) ;
+  else
+    *std = 0.0 ;
+
+  return (nvoxels) ;
+}
+
+/*---------------------------------------------------------
+  MRIsegIndexStatsRobust() - MRIsegStatsRobust() over the voxels of
+  segid: the same list of values, sorted the same way.
+  ---------------------------------------------------------*/
+int MRIsegIndexStatsRobust(const MRI_SEGINDEX *si, int segid, MRI *mri, int frame,
+                           float *min, float *max, float *range, float *mean, float *std,
+                           float Pct)
+{
+  int k, n, nvoxels, r, c, s, m ;
+  double val, sum, sum2 ;
+  float *vlist ;
+
+  *min = 0 ;
+  *max = 0 ;
+  *range = 0 ;
+  *mean = 0 ;
+  *std = 0 ;
+
+  k = MRIsegIndexFind(si, segid) ;
+  if (k < 0)
+    return (0) ;
+  nvoxels = si->offset[k + 1] - si->offset[k] ;
+  if (nvoxels == 0)
+    return (nvoxels) ;
+
+  vlist = (float *)calloc(sizeof(float), nvoxels) ;
+  for (n = 0; n < nvoxels; n++) {
+    mriSegIndexVoxel(si, si->voxels[si->offset[k] + n], &c, &r, &s) ;
+    vlist[n] = MRIgetVoxVal(mri, c, r, s, frame) ;
+  }
+  qsort((void *)vlist, nvoxels, sizeof(float), compare_floats) ;
+
+  // Compute stats excluding Pct of the values from each end
+  sum = 0 ;
+  sum2 = 0 ;
+  m = 0 ;
+  for (k = 0; k < nvoxels; k++) {
+    if (k < Pct * nvoxels / 100.0) continue ;
+    if (k > (100 - Pct) * nvoxels / 100.0) continue ;
+    val = vlist[k] ;
+    if (m == 0) {
+      *min = val ;
+      *max = val ;
+    }
+    if (*min > val) *min = val ;
+    if (*max < val) *max = val ;
+    sum += val ;
+    sum2 += (val * val) ;
+    m = m + 1 ;
+  }
+
+  *range = *max - *min ;
+  *mean = sum / m ;
+  if (m > 1)
+    *std = sqrt(((m) * (*mean) * (*mean) - 2 * (*mean) * sum + sum2) / (m - 1)) ;
+  else
+    *std = 0.0 ;
+
+  free(vlist) ;
+  return (m) ;
+}
+
+/*---------------------------------------------------------
+  MRIsegIndexFrameAvg() - MRIsegFrameAvg() over the voxels of segid.
+  favg must be preallocated to the number of frames.
+  ---------------------------------------------------------*/
+int MRIsegIndexFrameAvg(const MRI_SEGINDEX *si, int segid, MRI *mri, double *favg)
+{
+  int k, n, nvoxels, r, c, s, f ;
+
+  for (f = 0; f < mri->nframes; f++)
+    favg[f] = 0 ;
+
+  nvoxels = 0 ;
+  k = MRIsegIndexFind(si, segid) ;
+  if (k >= 0) {
+    for (n = si->offset[k]; n < si->offset[k + 1]; n++) {
+      mriSegIndexVoxel(si, si->voxels[n], &c, &r, &s) ;
+      for (f = 0; f < mri->nframes; f++)
+        favg[f] += MRIgetVoxVal(mri, c, r, s, f) ;
+      nvoxels++ ;
+    }
+  }
+
+  if (nvoxels != 0)
+    for (f = 0; f < mri->nframes; f++)
+      favg[f] /= nvoxels ;
+
+  return (nvoxels) ;
+}
+
+/*
+  Labels of the (2*whalf+1)^3 neighborhood of (x,y,z), clamped to the
+  volume, as MRIcomputeLabelNbhd() counts them: counts[] and sums[]
+  are only touched at the labels listed in nbrs[], which is returned
+  in increasing order.  sums[] may be NULL.
+*/
+static int mriSegIndexNbhd(const int *labels, const float *vals, int width, int height, int depth,
+                           int x, int y, int z, int whalf, int *counts, float *sums, int *nbrs)
+{
+  int xk, yk, zk, xi, yi, zi, label, nnbrs ;
+  size_t lin ;
+
+  nnbrs = 0 ;
+  for (xk = -whalf; xk <= whalf; xk++) {
+    xi = MIN(MAX(x + xk, 0), width - 1) ;
+    for (yk = -whalf; yk <= whalf; yk++) {
+      yi = MIN(MAX(y + yk, 0), height - 1) ;
+      for (zk = -whalf; zk <= whalf; zk++) {
+        zi = MIN(MAX(z + zk, 0), depth - 1) ;
+        lin = ((size_t)xi * height + yi) * depth + zi ;
+        label = labels[lin] ;
+        if (counts[label] == 0) {
+          nbrs[nnbrs++] = label ;
+          if (sums)
+            sums[label] = 0 ;
+        }
+        counts[label]++ ;
+        if (sums)
+          sums[label] += vals[lin] ;
+      }
+    }
+  }
+  qsort(nbrs, nnbrs, sizeof(int), compare_ints) ;
+  return (nnbrs) ;
+}
+
+/* what a border voxel adds to the volumes of (at most) two labels */
+typedef struct
+{
+  int lin ;
+  int k[2] ;   // indexed label, -1 for none
+  float pv[2] ;
+} MRI_SEGINDEX_PV ;
+
+/*---------------------------------------------------------
+  MRIsegIndexPVVolumes() - MRIvoxelsInLabelWithPartialVolumeEffects()
+  for all the indexed labels at once. A voxel that is not on the
+  border of its label counts fully for it, and for no other label. A
+  border voxel (6-connected) only counts for its own label and for
+  the neighbor label it mixes with, if that label is one of its
+  6-connected neighbors, and the mixing does not depend on which of
+  the two is asked about; so its contribution is computed once. The
+  volumes are then summed in the order of the reference loop.
+  ---------------------------------------------------------*/
+int MRIsegIndexPVVolumes(const MRI_SEGINDEX *si, MRI *seg, MRI *mri_vals, float *vols)
+{
+  int const width = seg->width, height = seg->height, depth = seg->depth ;
+  int const nvox = width * height * depth ;
+  int *labels, *kmap, *nrecs, k, x, bad ;
+  float *vals ;
+  MRI_SEGINDEX_PV **recs ;
+
+  if (width != si->width || height != si->height || depth != si->depth)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRIsegIndexPVVolumes: seg does not match the index")) ;
+
+  labels = (int *)malloc(nvox * sizeof(int)) ;
+  vals = (float *)malloc(nvox * sizeof(float)) ;
+  bad = 0 ;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+:bad)
+#endif
+  for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    int y, z ;
+    size_t lin ;
+
+    for (y = 0; y < height; y++)
+      for (z = 0; z < depth; z++) {
+        lin = ((size_t)x * height + y) * depth + z ;
+        labels[lin] = MRIgetVoxVal(seg, x, y, z, 0) ;
+        vals[lin] = MRIgetVoxVal(mri_vals, x, y, z, 0) ;
+        if (labels[lin] < 0 || labels[lin] >= MRI_SEGINDEX_PV_MAXLABELS)
+          bad++ ;
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  if (bad) {
+    free(labels) ;
+    free(vals) ;
+    return (ERROR_UNSUPPORTED) ;
+  }
+
+  kmap = (int *)malloc(MRI_SEGINDEX_PV_MAXLABELS * sizeof(int)) ;
+  for (k = 0; k < MRI_SEGINDEX_PV_MAXLABELS; k++)
+    kmap[k] = -1 ;
+  for (k = 0; k < si->nsegs; k++)
+    if (si->segids[k] >= 0 && si->segids[k] < MRI_SEGINDEX_PV_MAXLABELS)
+      kmap[si->segids[k]] = k ;
+
+  const float vox_vol = seg->xsize * seg->ysize * seg->zsize ;
+
+  // contributions of the border voxels, one list per x, in y/z order
+  recs = (MRI_SEGINDEX_PV **)calloc(width, sizeof(MRI_SEGINDEX_PV *)) ;
+  nrecs = (int *)calloc(width, sizeof(int)) ;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    int y, z, xk, yk, zk, n, nrec, maxrec, border, this_label, vox_label, nbr_label, max_count ;
+    int n1, n7, *counts1, *counts7, *nbrs1, *nbrs7, nbr6[6], nnbr6, nbr_is_6 ;
+    float *sums7, val, mean_label, mean_nbr, pv ;
+    size_t lin ;
+    MRI_SEGINDEX_PV *rec ;
+
+    counts1 = (int *)calloc(MRI_SEGINDEX_PV_MAXLABELS, sizeof(int)) ;
+    counts7 = (int *)calloc(MRI_SEGINDEX_PV_MAXLABELS, sizeof(int)) ;
+    sums7 = (float *)calloc(MRI_SEGINDEX_PV_MAXLABELS, sizeof(float)) ;
+    nbrs1 = (int *)calloc(27, sizeof(int)) ;
+    nbrs7 = (int *)calloc(15 * 15 * 15, sizeof(int)) ;
+    nrec = maxrec = 0 ;
+    rec = NULL ;
+
+    for (y = 0; y < height; y++)
+      for (z = 0; z < depth; z++) {
+        lin = ((size_t)x * height + y) * depth + z ;
+        vox_label = labels[lin] ;
+
+        // 6-connected neighbor labels, as MRImarkLabelBorderVoxels() sees them
+        nnbr6 = 0 ;
+        border = 0 ;
+        for (xk = -1; xk <= 1; xk++)
+          for (yk = -1; yk <= 1; yk++)
+            for (zk = -1; zk <= 1; zk++) {
+              if (abs(xk) + abs(yk) + abs(zk) != 1) continue ;
+              this_label = labels[((size_t)MIN(MAX(x + xk, 0), width - 1) * height + MIN(MAX(y + yk, 0), height - 1)) *
+                                      depth +
+                                  MIN(MAX(z + zk, 0), depth - 1)] ;
+              nbr6[nnbr6++] = this_label ;
+              if (this_label != vox_label) border = 1 ;
+            }
+        if (!border) continue ;
+
+        // nothing to do unless an indexed label is involved
+        for (n = 0; n < nnbr6; n++)
+          if (kmap[nbr6[n]] >= 0) break ;
+        if (kmap[vox_label] < 0 && n == nnbr6) continue ;
+
+        /* compute partial volume, as in
+           MRIvoxelsInLabelWithPartialVolumeEffects() */
+        n1 = mriSegIndexNbhd(labels, vals, width, height, depth, x, y, z, 1, counts1, NULL, nbrs1) ;
+        n7 = mriSegIndexNbhd(labels, vals, width, height, depth, x, y, z, 7, counts7, sums7, nbrs7) ;
+        for (n = 0; n < n7; n++)
+          sums7[nbrs7[n]] /= counts7[nbrs7[n]] ;
+
+        val = vals[lin] ;
+        mean_label = sums7[vox_label] ;
+        nbr_label = -1 ;
+        max_count = 0 ;
+        for (n = 0; n < n1; n++) {
+          this_label = nbrs1[n] ;
+          if (this_label == vox_label) continue ;
+          if ((counts7[this_label] > max_count) && ((sums7[this_label] - val) * (mean_label - val) < 0)) {
+            max_count = counts7[this_label] ;
+            nbr_label = this_label ;
+          }
+        }
+
+        if (nrec == maxrec) {
+          maxrec = MAX(2 * maxrec, 64) ;
+          rec = (MRI_SEGINDEX_PV *)realloc(rec, maxrec * sizeof(MRI_SEGINDEX_PV)) ;
+        }
+        rec[nrec].lin = (int)lin ;
+        rec[nrec].k[0] = rec[nrec].k[1] = -1 ;
+        rec[nrec].pv[0] = rec[nrec].pv[1] = 0 ;
+
+        if (max_count == 0) {
+          // couldn't find an appropriate label
+          rec[nrec].k[0] = kmap[vox_label] ;
+          rec[nrec].pv[0] = 1 ;
+        }
+        else {
+          mean_nbr = sums7[nbr_label] ;
+          pv = (val - mean_nbr) / (mean_label - mean_nbr) ;
+          if (pv > 1) pv = 1 ;
+          if (!(pv < 0)) {
+            rec[nrec].k[0] = kmap[vox_label] ;
+            rec[nrec].pv[0] = pv ;
+            // the voxel is only on the border of nbr_label if they touch
+            nbr_is_6 = 0 ;
+            for (n = 0; n < nnbr6; n++)
+              if (nbr6[n] == nbr_label) nbr_is_6 = 1 ;
+            if (nbr_is_6) {
+              rec[nrec].k[1] = kmap[nbr_label] ;
+              rec[nrec].pv[1] = 1 - pv ;
+            }
+          }
+        }
+        nrec++ ;
+
+        for (n = 0; n < n1; n++) counts1[nbrs1[n]] = 0 ;
+        for (n = 0; n < n7; n++) counts7[nbrs7[n]] = 0 ;
+      }
+
+    recs[x] = rec ;
+    nrecs[x] = nrec ;
+    free(counts1) ;
+    free(counts7) ;
+    free(sums7) ;
+    free(nbrs1) ;
+    free(nbrs7) ;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // sum in the order of the reference loop, each label on its own
+  for (k = 0; k < si->nsegs; k++)
+    vols[k] = 0 ;
+  for (x = 0; x < width; x++) {
+    int y, z, n, i ;
+    size_t lin ;
+    MRI_SEGINDEX_PV *rec = recs[x] ;
+
+    n = 0 ;
+    for (y = 0; y < height; y++)
+      for (z = 0; z < depth; z++) {
+        lin = ((size_t)x * height + y) * depth + z ;
+        if (n < nrecs[x] && rec[n].lin == (int)lin) {
+          for (i = 0; i < 2; i++)
+            if (rec[n].k[i] >= 0) vols[rec[n].k[i]] += vox_vol * rec[n].pv[i] ;
+          n++ ;
+        }
+        else if (kmap[labels[lin]] >= 0) {
+          // inside its label (border voxels of indexed labels all have a record)
+          vols[kmap[labels[lin]]] += vox_vol ;
+        }
+      }
+    free(rec) ;
+  }
+
+  // labels MRIvoxelsInLabelWithPartialVolumeEffects() refuses
+  for (k = 0; k < si->nsegs; k++)
+    if (si->segids[k] >= MRI_SEGINDEX_PV_MAXLABELS) {
+      printf("ERROR: MRIvoxelsInLabelWithPartialVolumeEffects()\n") ;
+      printf(" label %d exceeds maximum label number %d\n", si->segids[k], MRI_SEGINDEX_PV_MAXLABELS) ;
+      vols[k] = -100000 ;
+    }
+
+  free(recs) ;
+  free(nrecs) ;
+  free(kmap) ;
+  free(labels) ;
+  free(vals) ;
+  return (NO_ERROR) ;
+}
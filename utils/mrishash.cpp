@@ -21,8 +21,12 @@
  */
 
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <vector>
+
 //----------------------------------------------------
 // Includes that differ for linux vs GW BC compile
 //----------------------------------------------------
@@ -419,12 +423,14 @@ static void mhtVoxelList_SampleTriangle(
 static void lockBucket(const MHBT *bucketc) {
 #ifdef HAVE_OPENMP
     MHBT *bucket = (MHBT *)bucketc;
+    if (bucket->frozen) return;
     if (parallelLevel) omp_set_lock(&bucket->bucket_lock); else checkThread0();
 #endif
 }
 static void unlockBucket(const MHBT *bucketc) {
 #ifdef HAVE_OPENMP
     MHBT *bucket = (MHBT *)bucketc;
+    if (bucket->frozen) return;
     if (parallelLevel) omp_unset_lock(&bucket->bucket_lock); else checkThread0();
 #endif
 }
@@ -486,12 +492,18 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
     int                nfaces;
     MHT_FACE*          f;
 
+    // The immutable snapshot made by MHTfreeze, and the buckets changed since it was made
+    //
+    struct Frozen;
+    Frozen*              frozen;
+    std::vector<int64_t> dirty;
+
 
     virtual MRIS_HASH_TABLE_NoSurface       * toMRIS_HASH_TABLE_NoSurface_Wkr()       { return this; }
     virtual MRIS_HASH_TABLE_NoSurface const * toMRIS_HASH_TABLE_NoSurface_Wkr() const { return this; }
 
     MRIS_HASH_TABLE_NoSurface(MHTFNO_t fno_usage, float vres, int which, int nfaces) 
-      : MRIS_HASH_TABLE(fno_usage, vres, which), nbuckets(0), nfaces(0), f(nullptr) 
+      : MRIS_HASH_TABLE(fno_usage, vres, which), nbuckets(0), nfaces(0), f(nullptr), frozen(nullptr)
     {  
         bzero(&buckets_mustUseAcqRel, sizeof(buckets_mustUseAcqRel));
 #ifdef HAVE_OPENMP
@@ -518,6 +530,7 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
     }
       
     virtual void computeFaceCentroid(int which, int fno, float *x, float *y, float *z) = 0;
+    virtual bool vertexCoords(int vno, float *x, float *y, float *z) const = 0;   // false if ripped
 
     double WORLD_TO_VOLUME(double x) const { return (x / vres()) + TABLE_CENTER; }
     int    WORLD_TO_VOXEL (double x) const { return int(WORLD_TO_VOLUME(x));  }
@@ -533,9 +546,18 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
     MHBT* acqBucket       (float x, float y, float z) const;
     MHBT* acqBucket       (int xv, int yv, int zv) const;
     MHBT* acqBucketAtVoxIx(int xv, int yv, int zv) const;
+    MHBT* acqMutableBucket(int xv, int yv, int zv) const;
     MHBT* makeAndAcqBucket(int xv, int yv, int zv);
     bool  existsBuckets2  (int xv, int yv) const;
 
+    static int64_t bucketKey(int xv, int yv, int zv) { return ((int64_t)xv * TABLE_SIZE + yv) * TABLE_SIZE + zv; }
+    MHBT* frozenBucket    (int xv, int yv, int zv) const;
+    void  noteDirty       (int xv, int yv, int zv);
+    void  freeze          ();
+    void  refreeze        ();
+    void  refreezeVertices(int const *vnos, int nvnos);
+    void  thaw            ();
+
     int mhtAddFaceOrVertexAtCoords   (float x, float y, float z, int forvnum);
     int mhtAddFaceOrVertexAtVoxIx    (int xv, int yv, int zv, int forvnum);
     int mhtRemoveFaceOrVertexAtVoxIx (int xv, int yv, int zv, int forvnum);
@@ -548,6 +570,7 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
 
 MRIS_HASH_TABLE_NoSurface::~MRIS_HASH_TABLE_NoSurface() 
 {
+    thaw();
     for (int xv = 0; xv < TABLE_SIZE; xv++) {
         for (int yv = 0; yv < TABLE_SIZE; yv++) {
             if (!buckets_mustUseAcqRel[xv][yv]) continue;
@@ -666,6 +689,13 @@ MHBT * MRIS_HASH_TABLE_NoSurface::acqBucketAtVoxIx(int xv, int yv, int zv) const
 
 
 MHBT* MRIS_HASH_TABLE_NoSurface::acqBucket(int xv, int yv, int zv) const
+{
+  if (frozen) return frozenBucket(xv, yv, zv);   // immutable, no locks needed
+  return acqMutableBucket(xv, yv, zv);
+}
+
+
+MHBT* MRIS_HASH_TABLE_NoSurface::acqMutableBucket(int xv, int yv, int zv) const
 {
   if (xv >= TABLE_SIZE || yv >= TABLE_SIZE || zv >= TABLE_SIZE || xv < 0 || yv < 0 || zv < 0) return (NULL);
 
@@ -725,6 +755,201 @@ Done:
     return result;
 }
 
+
+//==================================================================
+// The frozen snapshot
+//
+// keys[i] is the i'th occupied bucket in (xv,yv,zv) order, its face or vertex numbers are
+// ids[offsets[i] .. offsets[i+1]), and shells[i] is an MHBT whose bins point there so that
+// the existing query code works on it unchanged.  slots is an open-addressing hash from a
+// key to its i.
+//==================================================================
+
+struct MRIS_HASH_TABLE_NoSurface::Frozen {
+    std::vector<int64_t> keys;
+    std::vector<int>     offsets;
+    std::vector<MHB>     ids;
+    std::vector<int>     slots;
+    size_t               mask;
+    MHBT*                shells;
+    std::vector<int64_t> vertexKey;     // vertex tables: the key of the bucket each vertex is in, or -1
+
+    Frozen() : mask(0), shells(nullptr) {}
+    ~Frozen() { ::free(shells); }
+
+    void addBucket(int64_t key, MHB const* bins, int nbins) {
+        keys.push_back(key);
+        offsets.push_back(ids.size());
+        ids.insert(ids.end(), bins, bins + nbins);
+    }
+
+    static size_t hash(int64_t key) {
+        uint64_t h = (uint64_t)key * 0x9E3779B97F4A7C15ull;
+        return (size_t)(h ^ (h >> 29));
+    }
+
+    void finish(bool forVertices) {
+        int const n = keys.size();
+        offsets.push_back(ids.size());
+
+        shells = (MHBT*)calloc(std::max(n,1), sizeof(MHBT));
+        if (!shells) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate %d buckets.\n", __MYFUNCTION__, n);
+        for (int i = 0; i < n; i++) {
+            MHBT* bucket = &shells[i];
+            *(MHB**)&bucket->bins     = ids.data() + offsets[i];
+            *(int *)&bucket->max_bins = offsets[i+1] - offsets[i];
+            bucket->nused  = offsets[i+1] - offsets[i];
+            bucket->frozen = true;
+        }
+
+        size_t nslots = 16;
+        while (nslots < 2*(size_t)n) nslots *= 2;
+        mask = nslots - 1;
+        slots.assign(nslots, -1);
+        for (int i = 0; i < n; i++) {
+            size_t h = hash(keys[i]) & mask;
+            while (slots[h] >= 0) h = (h + 1) & mask;
+            slots[h] = i;
+        }
+
+        if (forVertices) {
+            for (int i = 0; i < n; i++) {
+                for (int j = offsets[i]; j < offsets[i+1]; j++) {
+                    int const vno = ids[j].fno;
+                    if (vno >= (int)vertexKey.size()) vertexKey.resize(vno+1, -1);
+                    vertexKey[vno] = keys[i];
+                }
+            }
+        }
+    }
+};
+
+
+MHBT* MRIS_HASH_TABLE_NoSurface::frozenBucket(int xv, int yv, int zv) const
+{
+    if (xv >= TABLE_SIZE || yv >= TABLE_SIZE || zv >= TABLE_SIZE || xv < 0 || yv < 0 || zv < 0) return NULL;
+
+    int64_t const key = bucketKey(xv, yv, zv);
+    for (size_t h = Frozen::hash(key) & frozen->mask; ; h = (h + 1) & frozen->mask) {
+        int const i = frozen->slots[h];
+        if (i < 0) return NULL;
+        if (frozen->keys[i] == key) return &frozen->shells[i];
+    }
+}
+
+
+void MRIS_HASH_TABLE_NoSurface::noteDirty(int xv, int yv, int zv)
+{
+    if (!frozen) return;
+    lockBuckets();
+    dirty.push_back(bucketKey(xv, yv, zv));
+    unlockBuckets();
+}
+
+
+void MRIS_HASH_TABLE_NoSurface::freeze()
+{
+    Frozen* fr = new Frozen;
+    for (int xv = 0; xv < TABLE_SIZE; xv++) {
+        for (int yv = 0; yv < TABLE_SIZE; yv++) {
+            MHBT** column = buckets_mustUseAcqRel[xv][yv];
+            if (!column) continue;
+            for (int zv = 0; zv < TABLE_SIZE; zv++) {
+                MHBT const* bucket = column[zv];
+                if (bucket && bucket->nused) fr->addBucket(bucketKey(xv, yv, zv), bucket->bins, bucket->nused);
+            }
+        }
+    }
+    fr->finish(fno_usage() == MHTFNO_VERTEX);
+
+    delete frozen;
+    frozen = fr;
+    dirty.clear();
+}
+
+
+// Merge the dirty buckets, taken from the underlying table, into the snapshot.
+// Untouched buckets are copied over as they are.
+//
+void MRIS_HASH_TABLE_NoSurface::refreeze()
+{
+    if (!frozen) { freeze(); return; }
+    if (dirty.empty()) return;
+
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    Frozen const* old = frozen;
+    Frozen*       fr  = new Frozen;
+    fr->keys.reserve(old->keys.size() + dirty.size());
+    fr->offsets.reserve(old->keys.size() + dirty.size() + 1);
+    fr->ids.reserve(old->ids.size() + dirty.size());
+
+    size_t i = 0, j = 0;
+    while (i < old->keys.size() || j < dirty.size()) {
+        if (j == dirty.size() || (i < old->keys.size() && old->keys[i] < dirty[j])) {
+            fr->addBucket(old->keys[i], old->ids.data() + old->offsets[i], old->offsets[i+1] - old->offsets[i]);
+            i++;
+            continue;
+        }
+        if (i < old->keys.size() && old->keys[i] == dirty[j]) i++;
+
+        int64_t const key = dirty[j++];
+        int const zv = key % TABLE_SIZE;
+        int const yv = (key / TABLE_SIZE) % TABLE_SIZE;
+        int const xv = key / ((int64_t)TABLE_SIZE * TABLE_SIZE);
+        MHBT* bucket = acqMutableBucket(xv, yv, zv);
+        if (!bucket) continue;
+        if (bucket->nused) fr->addBucket(key, bucket->bins, bucket->nused);
+        relBucket(&bucket);
+    }
+    fr->finish(fno_usage() == MHTFNO_VERTEX);
+
+    delete frozen;
+    frozen = fr;
+    dirty.clear();
+}
+
+
+void MRIS_HASH_TABLE_NoSurface::refreezeVertices(int const *vnos, int nvnos)
+{
+    checkConstructedWithVertices();
+    if (!frozen) freeze();      // the table still has the vertices where they were
+
+    for (int i = 0; i < nvnos; i++) {
+        int const vno = vnos[i];
+        int64_t const oldKey = (vno < (int)frozen->vertexKey.size()) ? frozen->vertexKey[vno] : -1;
+
+        float x, y, z;
+        bool const present = vertexCoords(vno, &x, &y, &z);
+        int xv = 0, yv = 0, zv = 0;
+        int64_t newKey = -1;
+        if (present) {
+            xv = std::min(std::max(WORLD_TO_VOXEL(x), 0), TABLE_SIZE - 1);
+            yv = std::min(std::max(WORLD_TO_VOXEL(y), 0), TABLE_SIZE - 1);
+            zv = std::min(std::max(WORLD_TO_VOXEL(z), 0), TABLE_SIZE - 1);
+            newKey = bucketKey(xv, yv, zv);
+        }
+        if (oldKey == newKey) continue;
+
+        if (oldKey >= 0)
+            mhtRemoveFaceOrVertexAtVoxIx(oldKey / ((int64_t)TABLE_SIZE * TABLE_SIZE),
+                                         (oldKey / TABLE_SIZE) % TABLE_SIZE,
+                                         oldKey % TABLE_SIZE, vno);
+        if (newKey >= 0) mhtAddFaceOrVertexAtVoxIx(xv, yv, zv, vno);
+    }
+
+    refreeze();
+}
+
+
+void MRIS_HASH_TABLE_NoSurface::thaw()
+{
+    delete frozen;
+    frozen = nullptr;
+    dirty.clear();
+}
+
 #define buckets_mustUseAcqRel SHOULD_NOT_ACCESS_BUCKETS_DIRECTLY
 
 
@@ -752,6 +977,8 @@ int MRIS_HASH_TABLE_NoSurface::mhtAddFaceOrVertexAtVoxIx(int xv, int yv, int zv,
   if (zv < 0) zv = 0;
   if (zv >= TABLE_SIZE) zv = TABLE_SIZE - 1;
 
+  noteDirty(xv, yv, zv);
+
   {
     MHBT *bucket = makeAndAcqBucket(xv, yv, zv);
 
@@ -809,9 +1036,11 @@ int MRIS_HASH_TABLE_NoSurface::mhtRemoveFaceOrVertexAtVoxIx(int xv, int yv, int
 
   if (!existsBuckets2(xv,yv)) return (NO_ERROR);  // no bucket at such coordinates
   
-  MHBT *bucket = acqBucket(xv,yv,zv);
+  MHBT *bucket = acqMutableBucket(xv,yv,zv);
   if (!bucket) return (NO_ERROR);  // no bucket at such coordinates
 
+  noteDirty(xv, yv, zv);
+
   MHB *bin = bucket->bins;
   for (i = 0; i < bucket->nused; i++, bin++) {
     if (bin->fno == forvnum) /* found face */
@@ -921,6 +1150,13 @@ struct MRIS_HASH_TABLE_IMPL : public MRIS_HASH_TABLE_NoSurface {
         mhtComputeFaceCentroid(surface, which, fno, x, y, z);
     }
 
+    virtual bool vertexCoords(int vno, float *x, float *y, float *z) const {
+        auto v = surface.vertices(vno);
+        if (v.ripflag()) return false;
+        mhtVertex2xyz(v, which(), x, y, z);
+        return true;
+    }
+
     void checkConstructedWithFacesAndSurface   (Surface surface) const;
     void checkConstructedWithVerticesAndSurface(Surface surface) const;
 
@@ -2394,6 +2630,18 @@ int MHTtestIsMRISselfIntersecting(MRIS* mris,  float res)
 int  MHTwhich(MRIS_HASH_TABLE const * mht) { return mht->which(); }
 
 
+// Lock-free snapshot
+//
+void MHTfreeze(MRIS_HASH_TABLE *mht)   { mht->toMRIS_HASH_TABLE_NoSurface()->freeze();   }
+void MHTrefreeze(MRIS_HASH_TABLE *mht) { mht->toMRIS_HASH_TABLE_NoSurface()->refreeze(); }
+void MHTthaw(MRIS_HASH_TABLE *mht)     { mht->toMRIS_HASH_TABLE_NoSurface()->thaw();     }
+
+void MHTrefreezeVertices(MRIS_HASH_TABLE *mht, int const *vnos, int nvnos)
+{ mht->toMRIS_HASH_TABLE_NoSurface()->refreezeVertices(vnos, nvnos); }
+
+int  MHTisFrozen(MRIS_HASH_TABLE const *mht) { return mht->toMRIS_HASH_TABLE_NoSurface()->frozen != nullptr; }
+
+
 // Add/remove the faces of which vertex vno is a part
 //
 int  MHTaddAllFaces   (MRIS_HASH_TABLE* mht, MRIS* mris, int vno) 
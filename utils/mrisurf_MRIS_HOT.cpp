@@ -0,0 +1,344 @@
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#include "mrisurf.h"
+#include "mrisurf_MRIS_HOT.h"
+#include "mrisurf_base.h"
+#include "romp_support.h"
+
+
+bool MRISHOT_useReference()
+{
+  static int use_reference = -1;
+  if (use_reference < 0) use_reference = (getenv("FS_MRIS_HOT_REFERENCE") != NULL);
+  return use_reference;
+}
+
+
+void MRISHOT_ctr(MRIS_HOT* hot) {
+  bzero(hot, sizeof(*hot));
+}
+
+void MRISHOT_dtr(MRIS_HOT* hot) {
+#define SEP
+#define ELTX(C,T,N) ELT(C,T,N)
+#define ELT(C,T,N) freeAndNULL(hot->v_##N);
+  MRIS_HOT__LIST_V_IN SEP MRIS_HOT__LIST_V_IN_OUT SEP MRIS_HOT__LIST_V_TMP
+#undef ELT
+#undef ELTX
+#undef SEP
+  bzero(hot, sizeof(*hot));
+}
+
+
+void MRISHOT_load(MRIS_HOT* hot, MRIS* mris) {
+
+  if (hot->nvertices != mris->nvertices) {
+    MRISHOT_dtr(hot);
+#define SEP
+#define ELTX(C,T,N) ELT(C,T,N)
+#define ELT(C,T,N) hot->v_##N = (T*)malloc(mris->nvertices*sizeof(T));
+    MRIS_HOT__LIST_V_IN SEP MRIS_HOT__LIST_V_IN_OUT SEP MRIS_HOT__LIST_V_TMP
+#undef ELT
+#undef ELTX
+#undef SEP
+    hot->nvertices = mris->nvertices;
+  }
+  hot->underlyingMRIS    = mris;
+  hot->vertices_topology = mris->vertices_topology;
+  hot->averaged          = false;
+
+  int vno;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 4096)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX const * const v = &mris->vertices[vno];
+#define SEP
+#define ELTX(C,T,N) ELT(C,T,N)
+#define ELT(C,T,N) hot->v_##N[vno] = v->N;
+    MRIS_HOT__LIST_V_IN SEP MRIS_HOT__LIST_V_IN_OUT
+#undef ELT
+#undef ELTX
+#undef SEP
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+
+void MRISHOT_unloadGradient(MRIS* mris, MRIS_HOT* hot) {
+  cheapAssert(hot->nvertices == mris->nvertices);
+
+  int vno;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 4096)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX * const v = &mris->vertices[vno];
+#define SEP
+#define ELTX(C,T,N) ELT(C,T,N)
+#define ELT(C,T,N) v->N = hot->v_##N[vno];
+    MRIS_HOT__LIST_V_IN_OUT
+    if (hot->averaged && !hot->v_ripflag[vno]) { MRIS_HOT__LIST_V_TMP }
+#undef ELT
+#undef ELTX
+#undef SEP
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+
+// mrisAverageSignedGradients
+//
+int MRISHOT_averageSignedGradients(MRIS_HOT* hot, int num_avgs)
+{
+  if (num_avgs <= 0) {
+    return (NO_ERROR);
+  }
+
+  float * const dx = hot->v_dx;
+  float * const dy = hot->v_dy;
+  float * const dz = hot->v_dz;
+  float * const tdx = hot->v_tdx;
+  float * const tdy = hot->v_tdy;
+  float * const tdz = hot->v_tdz;
+  char const * const ripflag = hot->v_ripflag;
+
+  if (Gdiag_no >= 0) {
+    fprintf(stdout, "before averaging dot = %2.2f ",
+            dx[Gdiag_no] * hot->v_nx[Gdiag_no] + dy[Gdiag_no] * hot->v_ny[Gdiag_no] + dz[Gdiag_no] * hot->v_nz[Gdiag_no]);
+  }
+
+  int i, vno;
+  for (i = 0; i < num_avgs; i++) {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(experimental)
+#endif
+    for (vno = 0; vno < hot->nvertices; vno++) {
+      ROMP_PFLB_begin
+
+      double sx, sy, sz, dot;
+      int vnum, num, vnb;
+
+      if (ripflag[vno]) {
+        continue;
+      }
+      VERTEX_TOPOLOGY const * const vt = &hot->vertices_topology[vno];
+      sx = dx[vno];
+      sy = dy[vno];
+      sz = dz[vno];
+      int const * pnb = vt->v;
+      vnum = vt->vnum;
+      for (num = 0, vnb = 0; vnb < vnum; vnb++) {
+        int const n = *pnb++;
+        if (ripflag[n]) {
+          continue;
+        }
+        dot = dx[n] * dx[vno] + dy[n] * dy[vno] + dz[n] * dz[vno];
+        if (dot < 0) {
+          continue; /* pointing in opposite directions */
+        }
+
+        num++;
+        sx += dx[n];
+        sy += dy[n];
+        sz += dz[n];
+      }
+      num++;
+      tdx[vno] = sx / (float)num;
+      tdy[vno] = sy / (float)num;
+      tdz[vno] = sz / (float)num;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(experimental)
+#endif
+    for (vno = 0; vno < hot->nvertices; vno++) {
+      ROMP_PFLB_begin
+      if (ripflag[vno]) ROMP_PF_continue;
+
+      dx[vno] = tdx[vno];
+      dy[vno] = tdy[vno];
+      dz[vno] = tdz[vno];
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+  hot->averaged = true;
+
+  if (Gdiag_no >= 0) {
+    float dot = hot->v_nx[Gdiag_no] * dx[Gdiag_no] + hot->v_ny[Gdiag_no] * dy[Gdiag_no] + hot->v_nz[Gdiag_no] * dz[Gdiag_no];
+    fprintf(stdout, " after dot = %2.2f (%2.3f, %2.3f, %2.3f)\n", dot, dx[Gdiag_no], dy[Gdiag_no], dz[Gdiag_no]);
+  }
+  return (NO_ERROR);
+}
+
+
+// average of the edges to the unripped neighbors, as the spring terms compute it
+//
+static inline int hotNeighborMean(MRIS_HOT const * hot, int vno, float* psx, float* psy, float* psz)
+{
+  VERTEX_TOPOLOGY const * const vt = &hot->vertices_topology[vno];
+  float const x = hot->v_x[vno];
+  float const y = hot->v_y[vno];
+  float const z = hot->v_z[vno];
+
+  float sx = 0, sy = 0, sz = 0;
+  int n = 0;
+  for (int m = 0; m < vt->vnum; m++) {
+    int const vnb = vt->v[m];
+    if (!hot->v_ripflag[vnb]) {
+      sx += hot->v_x[vnb] - x;
+      sy += hot->v_y[vnb] - y;
+      sz += hot->v_z[vnb] - z;
+      n++;
+    }
+  }
+  *psx = sx; *psy = sy; *psz = sz;
+  return n;
+}
+
+
+// mrisComputeSpringTerm
+//
+int MRISHOT_computeSpringTerm(MRIS_HOT* hot, double l_spring)
+{
+  int vno, n;
+  float sx, sy, sz, dist_scale;
+
+  if (FZERO(l_spring)) {
+    return (NO_ERROR);
+  }
+
+#if METRIC_SCALE
+  MRIS const * const mris = hot->underlyingMRIS;
+  if (mris->patch) {
+    dist_scale = 1.0;
+  }
+  else {
+    dist_scale = sqrt(mris->orig_area / mris->total_area);
+  }
+#else
+  dist_scale = 1.0;
+#endif
+  for (vno = 0; vno < hot->nvertices; vno++) {
+    if (hot->v_ripflag[vno]) {
+      continue;
+    }
+    if (hot->v_border[vno] && !hot->v_neg[vno]) {
+      continue;
+    }
+
+    n = hotNeighborMean(hot, vno, &sx, &sy, &sz);
+    if (n > 0) {
+      sx = dist_scale * sx / n;
+      sy = dist_scale * sy / n;
+      sz = dist_scale * sz / n;
+    }
+
+    sx *= l_spring;
+    sy *= l_spring;
+    sz *= l_spring;
+    hot->v_dx[vno] += sx;
+    hot->v_dy[vno] += sy;
+    hot->v_dz[vno] += sz;
+    if (vno == Gdiag_no) fprintf(stdout, "v %d spring term:         (%2.3f, %2.3f, %2.3f)\n", vno, sx, sy, sz);
+  }
+
+  return (NO_ERROR);
+}
+
+
+// mrisComputeNormalSpringTerm
+//
+void MRISHOT_computeNormalSpringTerm(MRIS_HOT* hot, double l_spring)
+{
+  if (FZERO(l_spring)) return;
+
+  for (int vno = 0; vno < hot->nvertices; vno++) {
+    float dx = 0, dy = 0, dz = 0;
+
+    if (!hot->v_ripflag[vno]) {
+      float sx, sy, sz;
+      int const n = hotNeighborMean(hot, vno, &sx, &sy, &sz);
+      if (n > 0) {
+        sx /= n;
+        sy /= n;
+        sz /= n;
+      }
+
+      float nx = hot->v_nx[vno];
+      float ny = hot->v_ny[vno];
+      float nz = hot->v_nz[vno];
+
+      // project onto normal
+      float nc = sx * nx + sy * ny + sz * nz;
+
+      // move in normal direction
+      dx = l_spring * nc * nx;
+      dy = l_spring * nc * ny;
+      dz = l_spring * nc * nz;
+    }
+
+    hot->v_dx[vno] += dx;
+    hot->v_dy[vno] += dy;
+    hot->v_dz[vno] += dz;
+  }
+}
+
+
+// mrisComputeTangentialSpringTerm
+//
+void MRISHOT_computeTangentialSpringTerm(MRIS_HOT* hot, double l_spring)
+{
+  if (FZERO(l_spring)) return;
+
+  for (int vno = 0; vno < hot->nvertices; vno++) {
+    float dx = 0, dy = 0, dz = 0;
+
+    if (!hot->v_ripflag[vno] && !(hot->v_border[vno] && !hot->v_neg[vno])) {
+      float sx, sy, sz;
+      int const n = hotNeighborMean(hot, vno, &sx, &sy, &sz);
+      if (n > 0) {
+        sx /= n;
+        sy /= n;
+        sz /= n;
+      }
+
+      float nx = hot->v_nx[vno];
+      float ny = hot->v_ny[vno];
+      float nz = hot->v_nz[vno];
+
+      // project onto normal
+      float nc = sx * nx + sy * ny + sz * nz;
+
+      // remove normal component and scale
+      dx = l_spring * (sx - nc * nx);
+      dy = l_spring * (sy - nc * ny);
+      dz = l_spring * (sz - nc * nz);
+    }
+
+    hot->v_dx[vno] += dx;
+    hot->v_dy[vno] += dy;
+    hot->v_dz[vno] += dz;
+  }
+}
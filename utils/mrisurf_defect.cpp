@@ -420,7 +420,27 @@ static double MUTATION_PCT_INIT = (MUTATION_PCT * 1.0);
   0.1 /* replace this many with \
 mutated versions of best */
 #define MAX_UNCHANGED 3
-static int max_unchanged = MAX_UNCHANGED;
+
+/* Random numbers for the retessellation searches. Normally these come from
+   randomNumber(), but when defects are retessellated in groups each defect
+   is given its own splitmix64 stream, so that the result does not depend on
+   the order the groups are handled in. */
+static double defectRandomNumber(DEFECT *defect, double low, double hi)
+{
+  if (!defect->random_state) {
+    return randomNumber(low, hi);
+  }
+  if (low > hi) {
+    double tmp = low;
+    low = hi;
+    hi = tmp;
+  }
+  unsigned long long z = (defect->random_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return low + (hi - low) * ((double)(z >> 11) / 9007199254740992.0);
+}
 
 #define AREA_THRESHOLD 35.0f
 
@@ -4813,7 +4833,7 @@ static void generateOrdering(DP *dp, SEGMENTATION *segmentation, int i)
       fflush(stdout);  // nicknote: prevents segfault on Linux PowerPC
       // when -O2 optimization is used w/gcc 3.3.3
 
-      r = nint(randomNumber(0.0, (double)nseg - 1));
+      r = nint(defectRandomNumber(dp->defect, 0.0, (double)nseg - 1));
 
       val = seg_order[n];
       seg_order[n] = seg_order[r];
@@ -7801,6 +7821,588 @@ static int defectIdentifyDefectiveVertices(MRI_SURFACE *mris,
 
   return counting;
 }
+//==================================================================
+// Retessellation of independent defect groups
+//
+// With FS_TOPOLOGY_PARALLEL_DEFECTS set, the defect list is split into
+// groups whose vertices, borders and convex hulls are further apart than
+// a margin, in both the original and the spherical coordinates. A group
+// can then be retessellated without seeing any other group, so each group
+// is retessellated on a private copy of the corrected surface starting
+// from the same state, and the results are merged back in group order.
+// The groups themselves are run one after the other; the threads go to
+// the parallel loops inside the search. Every defect draws its random
+// numbers from its own stream (see defectRandomNumber), so the corrected
+// surface does not depend on the number of threads, though it is not the
+// same as the one produced by the default loop.
+//
+#define DEFECT_GROUP_MARGIN 5.0f /* mm, FS_TOPOLOGY_DEFECT_MARGIN overrides */
+
+typedef struct
+{
+  int ndefects;
+  int *defects;  /* indices into the defect list, ascending */
+  int nvertices;
+  int *vertices; /* defect, border and convex hull vertices, in mris_corrected */
+  double cost;
+
+  /* the retessellated state, copied out of the private surface */
+  VERTEX *v;
+  VERTEX_TOPOLOGY *vt;
+  int nnew;   /* # of faces added, numbered from base_nfaces */
+  int nfaces; /* # of faces (old and new) attached to the group */
+  int *fnos;
+  FACE *faces;
+  FaceNormCacheEntry *fnorms;
+  FaceNormDeferredEntry *fdeferred;
+} DEFECT_GROUP;
+
+static int mrisUseParallelDefectRetessellation(TOPOLOGY_PARMS const *parms)
+{
+  char const *cp = getenv("FS_TOPOLOGY_PARALLEL_DEFECTS");
+  if (!cp || !atoi(cp)) {
+    return 0;
+  }
+
+  /* only the genetic search without any of its diagnostic outputs */
+  if (parms->search_mode != GENETIC_SEARCH || parms->optimal_mapping || parms->correct_defect >= 0 ||
+      parms->save_fname || parms->movie || parms->check_surface_intersection) {
+    return 0;
+  }
+  if (getenv("FS_DEBUG_PATCH") || getenv("USE_RANDOM_TOPOLOGY_CORRECTION")) {
+    return 0;
+  }
+  if (DIAG_VERBOSE_ON || (Gdiag & 0x1000000)) {
+    return 0;
+  }
+  return 1;
+}
+
+static int compare_int(const void *p1, const void *p2)
+{
+  int const i1 = *(int const *)p1, i2 = *(int const *)p2;
+  return i1 < i2 ? -1 : i1 > i2 ? 1 : 0;
+}
+
+static int mrisDefectEulerNumber(MRIS const *mris, int *pnv, int *pne, int *pnf)
+{
+  int vno, nv, ne;
+
+  for (nv = ne = vno = 0; vno < mris->nvertices; vno++) {
+    if (mris->vertices[vno].ripflag || mris->vertices_topology[vno].vnum == 0) {
+      continue;
+    }
+    ne += mris->vertices_topology[vno].vnum;
+    nv++;
+  }
+  ne /= 2;
+  *pnv = nv;
+  *pne = ne;
+  *pnf = mris->nfaces;
+  return nv + mris->nfaces - ne;
+}
+
+/* copy a vertex and its topology into mris, keeping the distance arrays
+   of the destination. Face numbers >= fno_base are shifted by fno_shift. */
+static void mrisLoadDefectVertex(
+    MRIS *mris, int vno, VERTEX const *v, VERTEX_TOPOLOGY const *vt, int fno_base, int fno_shift)
+{
+  VERTEX *const vdst = &mris->vertices[vno];
+  VERTEX_TOPOLOGY *const vdstt = &mris->vertices_topology[vno];
+  int n, vsize;
+
+  float *const dist = vdst->dist, *const dist_orig = vdst->dist_orig;
+  int const dist_capacity = vdst->dist_capacity, dist_orig_capacity = vdst->dist_orig_capacity;
+  void *const vp = vdst->vp;
+  *vdst = *v;
+  vdst->dist = dist;
+  vdst->dist_orig = dist_orig;
+  vdst->dist_capacity = dist_capacity;
+  vdst->dist_orig_capacity = dist_orig_capacity;
+  vdst->vp = vp;
+
+  vdstt->nsizeMax = vt->nsizeMax;
+  modVnum(mris, vno, vt->vnum, true);
+  vdstt->v2num = vt->v2num;
+  vdstt->v3num = vt->v3num;
+  MRIS_setNsizeCur(mris, vno, vt->nsizeCur);
+  vsize = mrisVertexVSize(mris, vno);
+  if (vsize > 0) {
+    vdstt->v = (int *)realloc(vdstt->v, vsize * sizeof(int));
+    if (!vdstt->v) ErrorExit(ERROR_NOMEMORY, "mrisLoadDefectVertex: could not allocate %d nbrs", vsize);
+    memcpy(vdstt->v, vt->v, vsize * sizeof(int));
+  }
+
+  vdstt->num = vt->num;
+  if (vt->num > 0) {
+    vdstt->f = (int *)realloc(vdstt->f, vt->num * sizeof(int));
+    vdstt->n = (uchar *)realloc(vdstt->n, vt->num * sizeof(uchar));
+    if (!vdstt->f || !vdstt->n) ErrorExit(ERROR_NOMEMORY, "mrisLoadDefectVertex: could not allocate %d faces", vt->num);
+    for (n = 0; n < vt->num; n++) {
+      vdstt->f[n] = vt->f[n] < fno_base ? vt->f[n] : vt->f[n] + fno_shift;
+      vdstt->n[n] = vt->n[n];
+    }
+  }
+}
+
+static void mrisLoadDefectFace(
+    MRIS *mris, int fno, FACE const *f, FaceNormCacheEntry const *fnorm, FaceNormDeferredEntry const *fdeferred)
+{
+  FACE *const fdst = &mris->faces[fno];
+  PDMATRIX const norm = fdst->norm;
+  A3PDMATRIX const gradNorm = fdst->gradNorm;
+
+  *fdst = *f;
+  fdst->norm = norm;
+  fdst->gradNorm = gradNorm;
+  mris->faceNormCacheEntries[fno] = *fnorm;
+  mris->faceNormDeferredEntries[fno] = *fdeferred;
+}
+
+/* a private copy of the corrected surface. Unlike MRISclone, it keeps the
+   over-allocation, so the copy can grow by as many faces as the original */
+static MRIS *mrisCopyCorrectedSurface(MRIS const *mris)
+{
+  int vno, fno;
+
+  MRIS *mris_copy = MRISoverAlloc(mris->max_vertices, mris->max_faces, mris->nvertices, mris->nfaces);
+  mris_copy->type = mris->type;
+  mris_copy->status = mris->status;
+  mris_copy->origxyz_status = mris->origxyz_status;
+  mris_copy->hemisphere = mris->hemisphere;
+  mris_copy->useRealRAS = mris->useRealRAS;
+  mris_copy->vg = mris->vg;
+  mris_copy->nsize = mris->nsize;
+  mris_copy->max_nsize = mris->max_nsize;
+  mris_copy->vtotalsMightBeTooBig = mris->vtotalsMightBeTooBig;
+
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    mrisLoadDefectVertex(mris_copy, vno, &mris->vertices[vno], &mris->vertices_topology[vno], mris->nfaces, 0);
+  }
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    mrisLoadDefectFace(
+        mris_copy, fno, &mris->faces[fno], &mris->faceNormCacheEntries[fno], &mris->faceNormDeferredEntries[fno]);
+  }
+  return mris_copy;
+}
+
+/* split the defects into groups that are more than margin apart */
+static DEFECT_GROUP *mrisGroupDefects(MRIS const *mris, DEFECT_LIST *dl, int const *vertex_trans, float margin, int *pngroups)
+{
+  int i, j, n, k, ngroups, *parent, *group_of;
+  float *box;
+  DEFECT_GROUP *groups;
+
+  /* bounding boxes of each defect in the original and the spherical coordinates */
+  box = (float *)calloc(12 * dl->ndefects, sizeof(float));
+  parent = (int *)calloc(dl->ndefects, sizeof(int));
+  group_of = (int *)calloc(dl->ndefects, sizeof(int));
+  if (!box || !parent || !group_of) ErrorExit(ERROR_NOMEMORY, "mrisGroupDefects: could not allocate %d defects", dl->ndefects);
+
+  for (i = 0; i < dl->ndefects; i++) {
+    DEFECT const *const defect = &dl->defects[i];
+    float *const b = &box[12 * i];
+    for (k = 0; k < 6; k++) {
+      b[2 * k] = 1e10;
+      b[2 * k + 1] = -1e10;
+    }
+    for (n = 0; n < defect->nvertices + defect->nborder + defect->nchull; n++) {
+      int const vno = n < defect->nvertices ? vertex_trans[defect->vertices[n]] :
+                      n < defect->nvertices + defect->nborder ? vertex_trans[defect->border[n - defect->nvertices]] :
+                      vertex_trans[defect->chull[n - defect->nvertices - defect->nborder]];
+      if (vno < 0) {
+        continue;
+      }
+      VERTEX const *const v = &mris->vertices[vno];
+      float const c[6] = {v->origx, v->origy, v->origz, v->cx, v->cy, v->cz};
+      for (k = 0; k < 6; k++) {
+        b[2 * k] = MIN(b[2 * k], c[k] - margin / 2);
+        b[2 * k + 1] = MAX(b[2 * k + 1], c[k] + margin / 2);
+      }
+    }
+    parent[i] = i;
+  }
+
+  /* union-find over the defects whose boxes overlap in either space */
+  for (i = 0; i < dl->ndefects; i++) {
+    for (j = i + 1; j < dl->ndefects; j++) {
+      float const *const bi = &box[12 * i], *const bj = &box[12 * j];
+      int overlap_orig = 1, overlap_sphere = 1;
+      for (k = 0; k < 3; k++) {
+        if (bi[2 * k] > bj[2 * k + 1] || bj[2 * k] > bi[2 * k + 1]) {
+          overlap_orig = 0;
+        }
+        if (bi[2 * k + 6] > bj[2 * k + 7] || bj[2 * k + 6] > bi[2 * k + 7]) {
+          overlap_sphere = 0;
+        }
+      }
+      if (overlap_orig || overlap_sphere) {
+        int ri = i, rj = j;
+        while (parent[ri] != ri) ri = parent[ri];
+        while (parent[rj] != rj) rj = parent[rj];
+        if (ri != rj) {
+          parent[MAX(ri, rj)] = MIN(ri, rj); /* the root is the lowest defect */
+        }
+      }
+    }
+  }
+
+  /* number the groups in the order of their lowest defect */
+  for (ngroups = i = 0; i < dl->ndefects; i++) {
+    int r = i;
+    while (parent[r] != r) r = parent[r];
+    group_of[i] = r == i ? ngroups++ : group_of[r];
+  }
+  groups = (DEFECT_GROUP *)calloc(ngroups, sizeof(DEFECT_GROUP));
+  if (!groups) ErrorExit(ERROR_NOMEMORY, "mrisGroupDefects: could not allocate %d groups", ngroups);
+  for (i = 0; i < dl->ndefects; i++) {
+    DEFECT const *const defect = &dl->defects[i];
+    DEFECT_GROUP *const group = &groups[group_of[i]];
+    group->ndefects++;
+    group->nvertices += defect->nvertices + defect->nborder + defect->nchull;
+    n = defect->nvertices + defect->nborder;
+    group->cost += (double)n * n;   // the GA is dominated by the n^2 candidate edges
+  }
+  for (k = 0; k < ngroups; k++) {
+    groups[k].defects = (int *)calloc(groups[k].ndefects, sizeof(int));
+    groups[k].vertices = (int *)calloc(groups[k].nvertices, sizeof(int));
+    if (!groups[k].defects || !groups[k].vertices)
+      ErrorExit(ERROR_NOMEMORY, "mrisGroupDefects: could not allocate group %d", k);
+    groups[k].ndefects = groups[k].nvertices = 0;
+  }
+  for (i = 0; i < dl->ndefects; i++) {
+    DEFECT const *const defect = &dl->defects[i];
+    DEFECT_GROUP *const group = &groups[group_of[i]];
+    group->defects[group->ndefects++] = i;
+    for (n = 0; n < defect->nvertices; n++) {
+      if (vertex_trans[defect->vertices[n]] >= 0) group->vertices[group->nvertices++] = vertex_trans[defect->vertices[n]];
+    }
+    for (n = 0; n < defect->nborder; n++) {
+      if (vertex_trans[defect->border[n]] >= 0) group->vertices[group->nvertices++] = vertex_trans[defect->border[n]];
+    }
+    for (n = 0; n < defect->nchull; n++) {
+      if (vertex_trans[defect->chull[n]] >= 0) group->vertices[group->nvertices++] = vertex_trans[defect->chull[n]];
+    }
+  }
+  for (k = 0; k < ngroups; k++) {
+    DEFECT_GROUP *const group = &groups[k];
+    qsort(group->vertices, group->nvertices, sizeof(int), compare_int);
+    for (n = i = 0; i < group->nvertices; i++) {
+      if (i == 0 || group->vertices[i] != group->vertices[i - 1]) group->vertices[n++] = group->vertices[i];
+    }
+    group->nvertices = n;
+  }
+
+  free(box);
+  free(parent);
+  free(group_of);
+  *pngroups = ngroups;
+  return groups;
+}
+
+/* copy the retessellated group out of its private surface, then put the
+   private surface back into the state of mris_corrected */
+static void mrisSaveDefectGroup(DEFECT_GROUP *group, MRIS *mris_copy, MRIS const *mris_corrected, int base_nfaces)
+{
+  int i, n, nfnos;
+
+  group->v = (VERTEX *)calloc(group->nvertices, sizeof(VERTEX));
+  group->vt = (VERTEX_TOPOLOGY *)calloc(group->nvertices, sizeof(VERTEX_TOPOLOGY));
+  if (!group->v || !group->vt)
+    ErrorExit(ERROR_NOMEMORY, "mrisSaveDefectGroup: could not allocate %d vertices", group->nvertices);
+
+  group->nnew = mris_copy->nfaces - base_nfaces;
+  for (nfnos = group->nnew, i = 0; i < group->nvertices; i++) {
+    nfnos += mris_copy->vertices_topology[group->vertices[i]].num;
+  }
+  group->fnos = (int *)calloc(nfnos + 1, sizeof(int));
+  if (!group->fnos) ErrorExit(ERROR_NOMEMORY, "mrisSaveDefectGroup: could not allocate %d faces", nfnos);
+
+  for (nfnos = 0; nfnos < group->nnew; nfnos++) {
+    group->fnos[nfnos] = base_nfaces + nfnos;
+  }
+  for (i = 0; i < group->nvertices; i++) {
+    int const vno = group->vertices[i];
+    VERTEX_TOPOLOGY const *const vt = &mris_copy->vertices_topology[vno];
+    VERTEX_TOPOLOGY *const vdstt = &group->vt[i];
+    int const vsize = mrisVertexVSize(mris_copy, vno);
+
+    group->v[i] = mris_copy->vertices[vno];
+    *vdstt = *vt;
+    vdstt->e = NULL;
+    vdstt->v = vsize > 0 ? (int *)malloc(vsize * sizeof(int)) : NULL;
+    vdstt->f = vt->num > 0 ? (int *)malloc(vt->num * sizeof(int)) : NULL;
+    vdstt->n = vt->num > 0 ? (uchar *)malloc(vt->num * sizeof(uchar)) : NULL;
+    if ((vsize > 0 && !vdstt->v) || (vt->num > 0 && (!vdstt->f || !vdstt->n)))
+      ErrorExit(ERROR_NOMEMORY, "mrisSaveDefectGroup: could not allocate topology of vertex %d", vno);
+    if (vsize > 0) memcpy(vdstt->v, vt->v, vsize * sizeof(int));
+    if (vt->num > 0) {
+      memcpy(vdstt->f, vt->f, vt->num * sizeof(int));
+      memcpy(vdstt->n, vt->n, vt->num * sizeof(uchar));
+    }
+    for (n = 0; n < vt->num; n++) {
+      if (vt->f[n] < base_nfaces) group->fnos[nfnos++] = vt->f[n];
+    }
+  }
+
+  /* the faces touching the group, old ones first */
+  qsort(group->fnos, nfnos, sizeof(int), compare_int);
+  for (n = i = 0; i < nfnos; i++) {
+    if (i == 0 || group->fnos[i] != group->fnos[i - 1]) group->fnos[n++] = group->fnos[i];
+  }
+  group->nfaces = n;
+  group->faces = (FACE *)calloc(group->nfaces + 1, sizeof(FACE));
+  group->fnorms = (FaceNormCacheEntry *)calloc(group->nfaces + 1, sizeof(FaceNormCacheEntry));
+  group->fdeferred = (FaceNormDeferredEntry *)calloc(group->nfaces + 1, sizeof(FaceNormDeferredEntry));
+  if (!group->faces || !group->fnorms || !group->fdeferred)
+    ErrorExit(ERROR_NOMEMORY, "mrisSaveDefectGroup: could not allocate %d faces", group->nfaces);
+  for (i = 0; i < group->nfaces; i++) {
+    int const fno = group->fnos[i];
+    group->faces[i] = mris_copy->faces[fno];
+    group->faces[i].norm = NULL;
+    group->faces[i].gradNorm[0] = group->faces[i].gradNorm[1] = group->faces[i].gradNorm[2] = NULL;
+    group->fnorms[i] = mris_copy->faceNormCacheEntries[fno];
+    group->fdeferred[i] = mris_copy->faceNormDeferredEntries[fno];
+  }
+
+  /* reset the private copy */
+  for (i = 0; i < group->nvertices; i++) {
+    int const vno = group->vertices[i];
+    mrisLoadDefectVertex(
+        mris_copy, vno, &mris_corrected->vertices[vno], &mris_corrected->vertices_topology[vno], base_nfaces, 0);
+  }
+  for (i = 0; i < group->nfaces && group->fnos[i] < base_nfaces; i++) {
+    int const fno = group->fnos[i];
+    mrisLoadDefectFace(mris_copy,
+                       fno,
+                       &mris_corrected->faces[fno],
+                       &mris_corrected->faceNormCacheEntries[fno],
+                       &mris_corrected->faceNormDeferredEntries[fno]);
+  }
+  MRIStruncateNFaces(mris_copy, base_nfaces);
+}
+
+/* append the new faces of the group to mris_corrected and copy its vertices in */
+static void mrisMergeDefectGroup(DEFECT_GROUP *group, MRIS *mris_corrected, int base_nfaces)
+{
+  int i;
+  int const fno_start = mris_corrected->nfaces;
+
+  if (fno_start + group->nnew > mris_corrected->max_faces)
+    ErrorExit(ERROR_NOMEMORY,
+              "mrisMergeDefectGroup: too many faces (%d, max %d)",
+              fno_start + group->nnew,
+              mris_corrected->max_faces);
+  MRISgrowNFaces(mris_corrected, fno_start + group->nnew);
+
+  for (i = 0; i < group->nfaces; i++) {
+    int const fno = group->fnos[i] < base_nfaces ? group->fnos[i] : group->fnos[i] - base_nfaces + fno_start;
+    mrisLoadDefectFace(mris_corrected, fno, &group->faces[i], &group->fnorms[i], &group->fdeferred[i]);
+  }
+  for (i = 0; i < group->nvertices; i++) {
+    mrisLoadDefectVertex(
+        mris_corrected, group->vertices[i], &group->v[i], &group->vt[i], base_nfaces, fno_start - base_nfaces);
+  }
+}
+
+static void mrisFreeDefectGroups(DEFECT_GROUP *groups, int ngroups)
+{
+  int g, i;
+
+  for (g = 0; g < ngroups; g++) {
+    DEFECT_GROUP *const group = &groups[g];
+    if (group->vt) {
+      for (i = 0; i < group->nvertices; i++) {
+        free(group->vt[i].v);
+        free(group->vt[i].f);
+        free(group->vt[i].n);
+      }
+    }
+    free(group->defects);
+    free(group->vertices);
+    free(group->v);
+    free(group->vt);
+    free(group->fnos);
+    free(group->faces);
+    free(group->fnorms);
+    free(group->fdeferred);
+  }
+  free(groups);
+}
+
+static int compare_group_cost(const void *p1, const void *p2)
+{
+  DEFECT_GROUP const *const g1 = *(DEFECT_GROUP const *const *)p1;
+  DEFECT_GROUP const *const g2 = *(DEFECT_GROUP const *const *)p2;
+  if (g1->cost != g2->cost) {
+    return g1->cost > g2->cost ? -1 : 1;
+  }
+  return g1->defects[0] < g2->defects[0] ? -1 : 1;
+}
+
+static int mrisRetessellateDefectGroups(MRI_SURFACE *mris,
+                                        MRI_SURFACE *mris_corrected,
+                                             DEFECT_LIST *dl,
+                                             int *vertex_trans,
+                                        MRI *mri,
+                                        HISTOGRAM *h_k1,
+                                        HISTOGRAM *h_k2,
+                                        MRI *mri_k1_k2,
+                                        HISTOGRAM *h_white,
+                                        HISTOGRAM *h_gray,
+                                        HISTOGRAM *h_border,
+                                        HISTOGRAM *h_grad,
+                                        MRI *mri_gray_white,
+                                        HISTOGRAM *h_dot,
+                                        TOPOLOGY_PARMS *parms)
+{
+  int g, i, n, k, ngroups, ncorrected, base_nfaces, nv, ne, nf, euler_nb, theoric_euler;
+  float margin = DEFECT_GROUP_MARGIN;
+  char *cp;
+  unsigned long long seed;
+  DEFECT_GROUP *groups, **order;
+  HISTOGRAM **h_defect;
+  MRIS *mris_copy;
+
+  if ((cp = getenv("FS_TOPOLOGY_DEFECT_MARGIN")) != NULL) {
+    margin = atof(cp);
+  }
+  groups = mrisGroupDefects(mris_corrected, dl, vertex_trans, margin, &ngroups);
+
+  /* one random stream per defect, all derived from the usual generator */
+  seed = (unsigned long long)(randomNumber(0.0, 1.0) * 9007199254740992.0);
+  for (i = 0; i < dl->ndefects; i++) {
+    dl->defects[i].random_state = seed ^ (0xD1B54A32D192ED03ULL * (unsigned long long)(i + 1));
+    if (!dl->defects[i].random_state) dl->defects[i].random_state = 1;
+  }
+
+  fprintf(WHICH_OUTPUT,
+          "retessellating %d defects in %d independent groups (margin %2.1f mm)\n",
+          dl->ndefects,
+          ngroups,
+          margin);
+
+  /* the gray/white distributions around each defect, which need the marks on mris */
+  h_defect = (HISTOGRAM **)calloc(4 * dl->ndefects, sizeof(HISTOGRAM *));
+  if (!h_defect) ErrorExit(ERROR_NOMEMORY, "mrisRetessellateDefectGroups: could not allocate histograms");
+  for (i = 0; i < dl->ndefects; i++) {
+    for (n = 0; n < 4; n++) {
+      h_defect[4 * i + n] = HISTOalloc(h_white->nbins);
+    }
+    mrisMarkAllDefects(mris, dl, 1);
+    mrisComputeGrayWhiteBorderDistributions(
+        mris, mri, &dl->defects[i], h_defect[4 * i], h_defect[4 * i + 1], h_defect[4 * i + 2], h_defect[4 * i + 3]);
+    mrisMarkAllDefects(mris, dl, 0);
+  }
+
+  /* the first group is retessellated in place. This also sets up the
+     state that the search initializes on its first call */
+  for (n = 0; n < groups[0].ndefects; n++) {
+    i = groups[0].defects[n];
+    mrisTessellateDefect(mris,
+                         mris_corrected,
+                         &dl->defects[i],
+                         vertex_trans,
+                         mri,
+                         h_k1,
+                         h_k2,
+                         mri_k1_k2,
+                         h_defect[4 * i],
+                         h_defect[4 * i + 1],
+                         h_defect[4 * i + 2],
+                         h_defect[4 * i + 3],
+                         mri_gray_white,
+                         h_dot,
+                         parms);
+  }
+  ncorrected = groups[0].ndefects;
+  euler_nb = mrisDefectEulerNumber(mris_corrected, &nv, &ne, &nf);
+  theoric_euler = 2 + ncorrected - dl->ndefects;
+  fprintf(WHICH_OUTPUT,
+          "After retessellation of defect group 0 (%d defects), "
+          "euler #=%d (%d,%d,%d) : difference with theory (%d) = %d \n",
+          groups[0].ndefects,
+          euler_nb,
+          nv,
+          ne,
+          nf,
+          theoric_euler,
+          theoric_euler - euler_nb);
+
+  /* the other groups are retessellated on a private copy, largest first.
+     The groups are not run concurrently: the search keeps static state
+     (the RAS to voxel cache, the defect counters, the per-thread scratch
+     of its own parallel loops) that is not safe to share between two
+     defects, so the threads are spent inside each defect instead */
+  base_nfaces = mris_corrected->nfaces;
+  order = (DEFECT_GROUP **)calloc(ngroups, sizeof(DEFECT_GROUP *));
+  if (!order) ErrorExit(ERROR_NOMEMORY, "mrisRetessellateDefectGroups: could not allocate");
+  for (g = 1; g < ngroups; g++) {
+    order[g - 1] = &groups[g];
+  }
+  qsort(order, ngroups - 1, sizeof(DEFECT_GROUP *), compare_group_cost);
+  mris_copy = ngroups > 1 ? mrisCopyCorrectedSurface(mris_corrected) : NULL;
+
+  for (g = 0; g < ngroups - 1; g++) {
+    DEFECT_GROUP *const group = order[g];
+    TOPOLOGY_PARMS group_parms = *parms;
+    for (k = 0; k < group->ndefects; k++) {
+      int const d = group->defects[k];
+      mrisTessellateDefect(mris,
+                           mris_copy,
+                           &dl->defects[d],
+                           vertex_trans,
+                           mri,
+                           h_k1,
+                           h_k2,
+                           mri_k1_k2,
+                           h_defect[4 * d],
+                           h_defect[4 * d + 1],
+                           h_defect[4 * d + 2],
+                           h_defect[4 * d + 3],
+                           mri_gray_white,
+                           h_dot,
+                           &group_parms);
+    }
+    mrisSaveDefectGroup(group, mris_copy, mris_corrected, base_nfaces);
+  }
+
+  /* merge in group order, so the face numbering follows the defect numbering */
+  for (g = 1; g < ngroups; g++) {
+    mrisMergeDefectGroup(&groups[g], mris_corrected, base_nfaces);
+    ncorrected += groups[g].ndefects;
+    euler_nb = mrisDefectEulerNumber(mris_corrected, &nv, &ne, &nf);
+    theoric_euler = 2 + ncorrected - dl->ndefects;
+    fprintf(WHICH_OUTPUT,
+            "After retessellation of defect group %d (%d defects, first %d), "
+            "euler #=%d (%d,%d,%d) : difference with theory (%d) = %d \n",
+            g,
+            groups[g].ndefects,
+            groups[g].defects[0],
+            euler_nb,
+            nv,
+            ne,
+            nf,
+            theoric_euler,
+            theoric_euler - euler_nb);
+  }
+  mrisCheckVertexFaceTopology(mris_corrected);
+
+  if (mris_copy) MRISfree(&mris_copy);
+  for (i = 0; i < 4 * dl->ndefects; i++) {
+    HISTOfree(&h_defect[i]);
+  }
+  for (i = 0; i < dl->ndefects; i++) {
+    dl->defects[i].random_state = 0;
+  }
+  free(h_defect);
+  free(order);
+  mrisFreeDefectGroups(groups, ngroups);
+
+  return (NO_ERROR);
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 //
 //
@@ -8434,7 +9036,27 @@ MRI_SURFACE *MRIScorrectTopology(
     mrisComputeSurfaceStatistics(mris, mri, h_k1, h_k2, mri_k1_k2, mri_gray_white, h_dot);
 
   mrisMarkAllDefects(mris, dl, 0);
-  for (i = 0; i < dl->ndefects; i++) {
+
+  int const parallel_defects = mrisUseParallelDefectRetessellation(parms);
+  if (parallel_defects) {
+    mrisRetessellateDefectGroups(mris,
+                                 mris_corrected,
+                                 dl,
+                                 vertex_trans,
+                                 mri,
+                                 h_k1,
+                                 h_k2,
+                                 mri_k1_k2,
+                                 h_white,
+                                 h_gray,
+                                 h_border,
+                                 h_grad,
+                                 mri_gray_white,
+                                 h_dot,
+                                 parms);
+  }
+
+  for (i = 0; i < dl->ndefects && !parallel_defects; i++) {
     if (parms->correct_defect >= 0 && i != parms->correct_defect) {
       continue;
     }
@@ -11623,7 +12245,7 @@ static int mrisCrossoverDefectPatches(DEFECT_PATCH *dp1, DEFECT_PATCH *dp2, DEFE
   DEFECT_PATCH *dp_src;
 
   added = (int *)calloc(dp1->nedges, sizeof(int));
-  p = randomNumber(0.0, 1.0);
+  p = defectRandomNumber(dp1->defect, 0.0, 1.0);
   if (p < 0.5) /* add from first defect */
   {
     dp_src = dp1;
@@ -11729,7 +12351,7 @@ static int mrisMutateDefectPatch(DEFECT_PATCH *dp, EDGE_TABLE *etable, double pm
   }
 
   for (i = 0; i < dp->nedges; i++) {
-    p = randomNumber(0.0, 1.0);
+    p = defectRandomNumber(dp->defect, 0.0, 1.0);
     eti = dp->ordering[i];
 
     if (p < pmutation) {
@@ -11739,7 +12361,7 @@ static int mrisMutateDefectPatch(DEFECT_PATCH *dp, EDGE_TABLE *etable, double pm
                                                                 two */
         {
           ntry = 0;
-          j = (int)randomNumber(0.0, dp->nedges - .1);
+          j = (int)defectRandomNumber(dp->defect, 0.0, dp->nedges - .1);
           while (ntry < NTRY) {
             e = &etable->edges[dp->ordering[j]]; /*potential new edge */
             if (e->used != USED_IN_ORIGINAL_TESSELLATION) {
@@ -11748,7 +12370,7 @@ static int mrisMutateDefectPatch(DEFECT_PATCH *dp, EDGE_TABLE *etable, double pm
             else {
               break;
             }
-            j = (int)randomNumber(0.0, dp->nedges - .1);
+            j = (int)defectRandomNumber(dp->defect, 0.0, dp->nedges - .1);
           }
           tmp = dp->ordering[i];
           dp->ordering[i] = dp->ordering[j];
@@ -11757,7 +12379,7 @@ static int mrisMutateDefectPatch(DEFECT_PATCH *dp, EDGE_TABLE *etable, double pm
         else /* swap two edges that intersect */
         {
           ntry = 0;
-          j = (int)randomNumber(0.0, etable->noverlap[eti] - 0.0001);
+          j = (int)defectRandomNumber(dp->defect, 0.0, etable->noverlap[eti] - 0.0001);
           etj = etable->overlapping_edges[eti][j]; /* index of jth
                                                       overlapping edge */
           j = dp_indices[etj];                     /* find where it is in this
@@ -11770,7 +12392,7 @@ static int mrisMutateDefectPatch(DEFECT_PATCH *dp, EDGE_TABLE *etable, double pm
             else {
               break;
             }
-            j = (int)randomNumber(0.0, etable->noverlap[eti] - 0.0001);
+            j = (int)defectRandomNumber(dp->defect, 0.0, etable->noverlap[eti] - 0.0001);
             etj = etable->overlapping_edges[eti][j]; /* index of
                                                         jth overlapping
                                                         edge */
@@ -11787,7 +12409,7 @@ static int mrisMutateDefectPatch(DEFECT_PATCH *dp, EDGE_TABLE *etable, double pm
       else {
         /* swap any two */
         ntry = 0;
-        j = (int)randomNumber(0.0, dp->nedges - .1);
+        j = (int)defectRandomNumber(dp->defect, 0.0, dp->nedges - .1);
         while (ntry < NTRY) {
           e = &etable->edges[dp->ordering[j]]; /*potential new edge */
           if (e->used != USED_IN_ORIGINAL_TESSELLATION) {
@@ -11796,7 +12418,7 @@ static int mrisMutateDefectPatch(DEFECT_PATCH *dp, EDGE_TABLE *etable, double pm
           else {
             break;
           }
-          j = (int)randomNumber(0.0, dp->nedges - .1);
+          j = (int)defectRandomNumber(dp->defect, 0.0, dp->nedges - .1);
         }
         tmp = dp->ordering[i];
         dp->ordering[i] = dp->ordering[j];
@@ -12160,7 +12782,7 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
                                  0 is left for the original surface*/
   EDGE_TABLE etable;
   int max_patches = MAX_PATCHES, ranks[MAX_PATCHES], next_gen_index, selected[MAX_PATCHES], nzero, sno = 0, max_edges,
-      debug_patch_n = -1, nbest = 0;
+      debug_patch_n = -1, nbest = 0, max_unchanged = MAX_UNCHANGED;
   MRI *mri_defect, *mri_defect_white, *mri_defect_gray, *mri_defect_sign;
   char fname[500];
   SEGMENTATION *segmentation;
@@ -12904,6 +13526,9 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
             savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
           }
         }
+#ifdef HAVE_OPENMP
+        #pragma omp atomic
+#endif
         nmut++;
         if (++nbest == debug_patch_n) {
           dps = dps_next_generation;
@@ -12987,7 +13612,7 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
     for (; l < ncrossovers; l++) /* fill out rest of list */
     {
       double p;
-      p = randomNumber(0.0, 1.0);
+      p = defectRandomNumber(defect, 0.0, 1.0);
       for (fitness = 0.0, j = 0; j < nselected; j++) {
         i = ranks[j];
         dp = &dps[i];
@@ -13010,7 +13635,7 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
       p1 = selected[i];
       do /* select second parent at random */
       {
-        p2 = selected[(int)randomNumber(0, ncrossovers - .001)];
+        p2 = selected[(int)defectRandomNumber(defect, 0, ncrossovers - .001)];
       } while (p2 == p1);
 
       ROMP_SCOPE_begin
@@ -13110,6 +13735,9 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
 
         ROMP_SCOPE_end
 
+#ifdef HAVE_OPENMP
+        #pragma omp atomic
+#endif
         ncross++;
         if (++nbest == debug_patch_n) {
           dps = dps_next_generation;
@@ -13213,7 +13841,13 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
             dps = dps_next_generation;
             goto debug_use_this_patch;
           }
+#ifdef HAVE_OPENMP
+          #pragma omp atomic
+#endif
           nmut++;
+#ifdef HAVE_OPENMP
+          #pragma omp atomic
+#endif
           ncross++;
         }
 
@@ -13360,6 +13994,9 @@ debug_use_this_patch:
     MRISwriteCurvature(mris, fname);
   }
 
+#ifdef HAVE_OPENMP
+  #pragma omp atomic
+#endif
   nkilled += nfinalvertices;
 
   /* use the best ordering to retessellate the defected patch */
@@ -13766,7 +14403,7 @@ static int mrisComputeRandomRetessellation(MRI_SURFACE *mris,
          original edge table -random ordering otherwise */
       for (m = 0; m < 11; m++)
         for (j = 0; j < nedges; j++) {
-          k = nint(randomNumber(0.0, (double)nedges - 1));
+          k = nint(defectRandomNumber(defect, 0.0, (double)nedges - 1));
 
           tmp = dp.ordering[j];
           dp.ordering[j] = dp.ordering[k];
@@ -13865,6 +14502,9 @@ static int mrisComputeRandomRetessellation(MRI_SURFACE *mris,
           nfinalvertices,
           defect->nvertices);
   fprintf(WHICH_OUTPUT, "best patch # is %d - total number of generated patches %d\n", nbestpatch, niters - 1);
+#ifdef HAVE_OPENMP
+  #pragma omp atomic
+#endif
   nkilled += nfinalvertices;
 
   /* use the best ordering to retessellate the defected patch */
@@ -4768,6 +4768,18 @@ int MRISrigidBodyAlignVectorLocal(MRI_SURFACE *mris, INTEGRATION_PARMS *old_parm
 #define ENDING_ANGLE RADIANS(4.0f)
 #define NANGLES 8
 
+// Bandwidth of the spherical harmonic rotation search, 0 for the grid search.
+// Also set by FREESURFER_MRISrigidBodyAlignGlobal_useSO3 (=bandwidth, or any other value for the default).
+//
+#define SO3_DEFAULT_BANDWIDTH 32
+static int so3_bandwidth;
+
+int MRISsetRigidBodyAlignSO3(int bandwidth)
+{
+  so3_bandwidth = bandwidth;
+  return (NO_ERROR);
+}
+
 int MRISrigidBodyAlignGlobal(
     MRI_SURFACE *mris, INTEGRATION_PARMS *parms, float min_degrees, float max_degrees, int nangles)
 {
@@ -4802,11 +4814,15 @@ int MRISrigidBodyAlignGlobal(
   static bool 
     once,
     use_old,
-    use_new;
+    use_new,
+    use_so3;
 
   if (!once) { once = true;
+    char const * const so3 = getenv("FREESURFER_MRISrigidBodyAlignGlobal_useSO3");
+    if (so3 && !so3_bandwidth) so3_bandwidth = (atoi(so3) > 0) ? atoi(so3) : SO3_DEFAULT_BANDWIDTH;
+    use_so3 = (so3_bandwidth > 0);
     use_old = !!getenv("FREESURFER_MRISrigidBodyAlignGlobal_useOld");
-    use_new = !!getenv("FREESURFER_MRISrigidBodyAlignGlobal_useNew") || !use_old ;
+    use_new = !!getenv("FREESURFER_MRISrigidBodyAlignGlobal_useNew") || (!use_old && !use_so3) ;
   }
 
   double new_mina = 666.0, new_minb = 666.0, new_ming = 666.0, new_sse = 666.0;
@@ -4841,6 +4857,33 @@ int MRISrigidBodyAlignGlobal(
       msec / (1000 * 60.0));
   }
   
+  double so3_mina = 666.0, so3_minb = 666.0, so3_ming = 666.0, so3_sse = 666.0;
+  if (use_so3) {
+
+    printf("Starting SO(3) MRISrigidBodyAlignGlobal_findMinSSE_SO3()\n");
+    Timer so3_timer;
+
+    double ext_sse = 0.0;
+    MRISrigidBodyAlignGlobal_findMinSSE_SO3(
+        &so3_mina, &so3_minb, &so3_ming, &so3_sse,
+        mris,
+        parms,
+        min_radians,
+        max_radians,
+        ext_sse,
+        nangles,
+        so3_bandwidth);
+
+    parms->start_t += 1.0f;
+    parms->t       += 1.0f;
+
+    int msec = so3_timer.milliseconds();
+    printf("  SO(3) MRISrigidBodyAlignGlobal_findMinSSE_SO3"
+      " min @ (%2.2f, %2.2f, %2.2f) sse = %2.1f, elapsed since starting=%6.4f min\n",
+      (float)DEGREES(so3_mina), (float)DEGREES(so3_minb), (float)DEGREES(so3_ming), so3_sse,
+      msec / (1000 * 60.0));
+  }
+
   double old_mina = 666.0, old_minb = 666.0, old_ming = 666.0, old_sse = 666.0;
   if (use_old) {
 
@@ -4985,6 +5028,11 @@ int MRISrigidBodyAlignGlobal(
     
     // TODO compare with new once the new is implemented
   }
+  if (use_so3) {
+    new_mina = so3_mina; new_minb = so3_minb; new_ming = so3_ming; new_sse = so3_sse;
+
+    // any grid search above only ran alongside, to compare with
+  }
 
   if (tracing) {
     fprintf(stdout,
@@ -3716,7 +3716,7 @@ static int mrisReadGeoFilePositions(MRI_SURFACE *mris, const char *fname)
 
 /*-----------------------------------------------------
   ------------------------------------------------------*/
-static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier);
+static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier, MRIS_CACHE const *cache = NULL);
 static MRIS* MRISreadOverAlloc_old(const char *fname, double nVFMultiplier);
 
 MRIS* MRISreadOverAlloc(const char *fname, double nVFMultiplier)
@@ -3738,7 +3738,7 @@ MRIS* MRISreadOverAlloc(const char *fname, double nVFMultiplier)
     : MRISreadOverAlloc_new(fname, nVFMultiplier);
 }
 
-static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier)
+static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier, MRIS_CACHE const *cache)
 {
   int const type = MRISfileNameType(fname);  /* using extension to get type */
   
@@ -3828,7 +3828,9 @@ static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier)
       }
       else if (magic == TRIANGLE_FILE_MAGIC_NUMBER) {
         fclose(fp);
-        mris = mrisReadTriangleFile(fname, nVFMultiplier);
+        mris = cache
+          ? mrisReadTriangleFileFromCache(cache, fname, nVFMultiplier)
+          : mrisReadTriangleFile(fname, nVFMultiplier);
         if (!mris) {
           ErrorReturn(NULL, (Gerror, "mrisReadTriangleFile failed.\n"));
         }
@@ -4105,9 +4107,14 @@ static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier)
     }
   }
   
-  mrisCompleteTopology(mris);
+  if (cache && version == -3) {
+    mrisCacheCompleteTopology(mris, cache);
+  }
+  else {
+    mrisCompleteTopology(mris);
   
-  mrisCheckVertexFaceTopology(mris);
+    mrisCheckVertexFaceTopology(mris);
+  }
 
   mrisComputeSurfaceDimensions(mris);
   mrisComputeVertexDistances(mris);
@@ -4614,8 +4621,15 @@ MRIS * MRISread(const char *fname, bool dotkrRasConvert)
       type != MRI_MGH_FILE)
     __MRISapplyFSGIIread(surf_to_read, fname, &type);
 
-  MRIS *mris = MRISreadOverAlloc(surf_to_read, 1.0);
-  if (mris == NULL) return (NULL);
+  // with FS_MRIS_CACHE set, the topology of a triangle file is read from its .fscache sidecar when it has an
+  // up to date one, and the sidecar is written when it does not
+  MRIS_CACHE *cache = mrisCacheEnabled() ? mrisCacheRead(surf_to_read) : NULL;
+
+  MRIS *mris = cache ? MRISreadOverAlloc_new(surf_to_read, 1.0, cache) : MRISreadOverAlloc(surf_to_read, 1.0);
+  if (mris == NULL) {
+    mrisCacheFree(&cache);
+    return (NULL);
+  }
 
   // save xyz coordinates space because mris->useRealRAS is changed after conversion
   mris->orig_xyzspace = mris->useRealRAS;
@@ -4628,14 +4642,24 @@ MRIS * MRISread(const char *fname, bool dotkrRasConvert)
     {
       printf("ERROR: Surface %s doesn't have valid volume geometry!\n", surf_to_read);
       MRISfree(&mris);
+      mrisCacheFree(&cache);
       return NULL;
     }
 
     MRISscanner2Tkr(mris);
   }
 
+  if (cache) {
+    mrisCacheAddRings(mris, cache);
+    mrisCacheFree(&cache);
+    MRISsetNeighborhoodSizeAndDist(mris, 3);  // nbhds are cached, compute the distances
+    MRISresetNeighborhoodSize(mris, 1);       // reset current size to 1-nbrs
+    return (mris);
+  }
+
   MRISsetNeighborhoodSizeAndDist(mris, 3);  // find nbhds out to 3-nbrs
   MRISresetNeighborhoodSize(mris, 1);       // reset current size to 1-nbrs
+  if (mrisCacheEnabled() && mris->type == MRIS_TRIANGULAR_SURFACE) mrisCacheWrite(mris, surf_to_read);
   return (mris);
 }
 
@@ -6142,88 +6166,13 @@ static int mrisReadTriangleFilePositions(MRI_SURFACE *mris, const char *fname)
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
-  Parameters:
-
-  Returns value:
-
-  Description
+  Reads the tags that follow the faces of a triangle file
+  (volume geometry, useRealRAS, command lines, ...) into mris.
   ------------------------------------------------------*/
-static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double nVFMultiplier)
+void mrisReadTriangleFileTags(MRIS *mris, FILE *fp, const char *fname)
 {
-  FACE *f;
-  int nvertices, nfaces, magic, vno, fno, n;
-  char line[STRLEN];
-  FILE *fp;
   int tag;
 
-  fp = fopen(fname, "rb");
-  if (!fp) ErrorReturn(NULL, (ERROR_NOFILE, "mrisReadTriangleFile(%s): could not open file", fname));
-
-  fread3(&magic, fp);
-
-  const char *noextra = getenv("TRIANGULARSURFACE_NOEXTRA_READ");
-  if (noextra == NULL)
-  {
-    fgets(line, 200, fp);
-    fscanf(fp, "\n");
-  }
-  /*  fscanf(fp, "\ncreated by %s on %s\n", user, time_str) ;*/
-  nvertices = freadInt(fp);
-  nfaces    = freadInt(fp);
-  
-  if (nvertices < 0 || nfaces < 0) {
-    fflush(stdout);
-    fflush(stderr);
-    fprintf(stderr, "%s:%d %s freadInt returned nvertices:%d \n", __FILE__,__LINE__,fname,nvertices);
-    fprintf(stderr, "%s:%d %s freadInt returned nfaces:%d \n", __FILE__,__LINE__,fname,nfaces);
-    exit(1);
-  }
-
-  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
-    fprintf(stdout, "surface %s: %d vertices and %d faces.\n", fname, nvertices, nfaces);
-
-  MRIS * mris = MRISoverAlloc(nVFMultiplier * nvertices, nVFMultiplier * nfaces, nvertices, nfaces);
-  mris->type = MRIS_TRIANGULAR_SURFACE;
-
-  for (vno = 0; vno < nvertices; vno++) {
-    if (vno % 100 == 0) exec_progress_callback(vno, nvertices, 0, 1);
-    VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
-    VERTEX          * const v  = &mris->vertices         [vno];
-    if (vno == Gdiag_no) {
-      DiagBreak();
-    }
-
-    float x = freadFloat(fp);
-    float y = freadFloat(fp);
-    float z = freadFloat(fp);
-    
-    MRISsetXYZ(mris,vno, x, y, z);
-
-    vt->num = 0; /* will figure it out */
-    if (fabs(v->x) > 10000 || !std::isfinite(v->x))
-      ErrorExit(ERROR_BADFILE, "%s: vertex %d x coordinate %f!", Progname, vno, v->x);
-    if (fabs(v->y) > 10000 || !std::isfinite(v->y))
-      ErrorExit(ERROR_BADFILE, "%s: vertex %d y coordinate %f!", Progname, vno, v->y);
-    if (fabs(v->z) > 10000 || !std::isfinite(v->z))
-      ErrorExit(ERROR_BADFILE, "%s: vertex %d z coordinate %f!", Progname, vno, v->z);
-  }
-
-  for (fno = 0; fno < mris->nfaces; fno++) {
-    f = &mris->faces[fno];
-    for (n = 0; n < VERTICES_PER_FACE; n++) {
-      f->v[n] = freadInt(fp);
-      if (f->v[n] >= mris->nvertices || f->v[n] < 0)
-        ErrorExit(ERROR_BADFILE, "f[%d]->v[%d] = %d - out of range!\n", fno, n, f->v[n]);
-    }
-
-    for (n = 0; n < VERTICES_PER_FACE; n++) {
-      mris->vertices_topology[mris->faces[fno].v[n]].num++;
-    }
-  }
-  // new addition
-  mris->useRealRAS = 0;
-
-  // read tags
   if (getenv("FS_SKIP_TAGS") == NULL)
   {
     long long len;
@@ -6295,6 +6244,104 @@ static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double nVFMultiplier
       }
     }
   }
+}
+
+/*-----------------------------------------------------
+  Reads the magic number, the "created by" line and the vertex and
+  face counts of a triangle file, leaving fp at the first vertex.
+  Returns the magic number.
+  ------------------------------------------------------*/
+int mrisReadTriangleFileHeader(FILE *fp, int *pnvertices, int *pnfaces)
+{
+  int magic;
+  char line[STRLEN];
+
+  fread3(&magic, fp);
+
+  const char *noextra = getenv("TRIANGULARSURFACE_NOEXTRA_READ");
+  if (noextra == NULL)
+  {
+    fgets(line, 200, fp);
+    fscanf(fp, "\n");
+  }
+  /*  fscanf(fp, "\ncreated by %s on %s\n", user, time_str) ;*/
+  *pnvertices = freadInt(fp);
+  *pnfaces    = freadInt(fp);
+
+  return (magic);
+}
+
+/*-----------------------------------------------------
+  Parameters:
+
+  Returns value:
+
+  Description
+  ------------------------------------------------------*/
+static MRI_SURFACE *mrisReadTriangleFile(const char *fname, double nVFMultiplier)
+{
+  FACE *f;
+  int nvertices, nfaces, vno, fno, n;
+  FILE *fp;
+
+  fp = fopen(fname, "rb");
+  if (!fp) ErrorReturn(NULL, (ERROR_NOFILE, "mrisReadTriangleFile(%s): could not open file", fname));
+
+  mrisReadTriangleFileHeader(fp, &nvertices, &nfaces);
+  
+  if (nvertices < 0 || nfaces < 0) {
+    fflush(stdout);
+    fflush(stderr);
+    fprintf(stderr, "%s:%d %s freadInt returned nvertices:%d \n", __FILE__,__LINE__,fname,nvertices);
+    fprintf(stderr, "%s:%d %s freadInt returned nfaces:%d \n", __FILE__,__LINE__,fname,nfaces);
+    exit(1);
+  }
+
+  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+    fprintf(stdout, "surface %s: %d vertices and %d faces.\n", fname, nvertices, nfaces);
+
+  MRIS * mris = MRISoverAlloc(nVFMultiplier * nvertices, nVFMultiplier * nfaces, nvertices, nfaces);
+  mris->type = MRIS_TRIANGULAR_SURFACE;
+
+  for (vno = 0; vno < nvertices; vno++) {
+    if (vno % 100 == 0) exec_progress_callback(vno, nvertices, 0, 1);
+    VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
+    VERTEX          * const v  = &mris->vertices         [vno];
+    if (vno == Gdiag_no) {
+      DiagBreak();
+    }
+
+    float x = freadFloat(fp);
+    float y = freadFloat(fp);
+    float z = freadFloat(fp);
+    
+    MRISsetXYZ(mris,vno, x, y, z);
+
+    vt->num = 0; /* will figure it out */
+    if (fabs(v->x) > 10000 || !std::isfinite(v->x))
+      ErrorExit(ERROR_BADFILE, "%s: vertex %d x coordinate %f!", Progname, vno, v->x);
+    if (fabs(v->y) > 10000 || !std::isfinite(v->y))
+      ErrorExit(ERROR_BADFILE, "%s: vertex %d y coordinate %f!", Progname, vno, v->y);
+    if (fabs(v->z) > 10000 || !std::isfinite(v->z))
+      ErrorExit(ERROR_BADFILE, "%s: vertex %d z coordinate %f!", Progname, vno, v->z);
+  }
+
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    f = &mris->faces[fno];
+    for (n = 0; n < VERTICES_PER_FACE; n++) {
+      f->v[n] = freadInt(fp);
+      if (f->v[n] >= mris->nvertices || f->v[n] < 0)
+        ErrorExit(ERROR_BADFILE, "f[%d]->v[%d] = %d - out of range!\n", fno, n, f->v[n]);
+    }
+
+    for (n = 0; n < VERTICES_PER_FACE; n++) {
+      mris->vertices_topology[mris->faces[fno].v[n]].num++;
+    }
+  }
+  // new addition
+  mris->useRealRAS = 0;
+
+  mrisReadTriangleFileTags(mris, fp, fname);
 
   fclose(fp);
 
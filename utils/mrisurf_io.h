@@ -7,3 +7,18 @@ int mrisReadTransform(MRIS *mris, const char *mris_fname);
 // STL
 MRIS* mrisReadSTL(const std::string &filename);
 bool mrisWriteSTL(const MRIS* mris, const std::string &filename);
+
+// triangle files, split so the surface cache can read the parts it does not hold
+int  mrisReadTriangleFileHeader(FILE *fp, int *pnvertices, int *pnfaces);
+void mrisReadTriangleFileTags(MRIS *mris, FILE *fp, const char *fname);
+
+// surface cache (mrisurf_io_cache.cpp), the topology MRISread builds kept in <surface>.fscache
+typedef struct MRIS_CACHE MRIS_CACHE;
+
+bool        mrisCacheEnabled();
+MRIS_CACHE* mrisCacheRead(const char *surf_fname);
+void        mrisCacheFree(MRIS_CACHE **pcache);
+MRIS*       mrisReadTriangleFileFromCache(MRIS_CACHE const *cache, const char *fname, double nVFMultiplier);
+void        mrisCacheCompleteTopology(MRIS *mris, MRIS_CACHE const *cache);     // the immediate neighbors
+void        mrisCacheAddRings(MRIS *mris, MRIS_CACHE const *cache);             // the 2 and 3-hop neighbors
+int         mrisCacheWrite(MRIS *mris, const char *surf_fname);
@@ -0,0 +1,497 @@
+#define COMPILING_MRISURF_TOPOLOGY_FRIEND_CHECKED
+/*
+ * $ Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "mrisurf_io.h"
+#include "mrisurf_base.h"
+
+// A triangle file only holds the vertices and the faces, so every MRISread of it
+// rebuilds the face lists and neighbors of the vertices and then searches out the 2-
+// and 3-hop rings, all of which only depend on the faces.
+//
+// With FS_MRIS_CACHE set, MRISread keeps what it built in a sidecar file next to the
+// surface (lh.white -> lh.white.fscache): the vertex coordinates and faces as they are
+// in the file, and the neighbors of each vertex, in the order MRISread finds them, as
+// one CSR list.  The blocks are cache line aligned and the file is mmap'd, so a later
+// MRISread of the same surface copies them in instead of rebuilding them, and ends up
+// with the same MRIS.
+//
+// The sidecar records the size and the hash of the whole surface file, and is only used
+// if both still match, so a surface that has been rewritten is never read with a stale
+// topology; MRISread then rebuilds it and rewrites the sidecar.  Sidecars that can not
+// be written (e.g. read-only subjects) are silently skipped.
+//
+#define MRIS_CACHE_MAGIC      "FSSURFC1"
+#define MRIS_CACHE_VERSION    1
+#define MRIS_CACHE_ALIGN      64      // every block starts on a cache line
+#define MRIS_CACHE_SUFFIX     ".fscache"
+#define MRIS_CACHE_BYTE_ORDER 0x01020304
+
+#define TRIANGLE_FILE_MAGIC_NUMBER (-2 & 0x00ffffff)
+
+// the blocks of a .fscache file, in the order they are written
+enum
+{
+  MRISC_XYZ = 0,          // float[3*nvertices]  as in the surface file
+  MRISC_FACES,            // int[3*nfaces]
+  MRISC_RING_OFFSETS,     // int64[nvertices+1]  vertex vno owns ring[ring_offsets[vno] .. ring_offsets[vno+1])
+  MRISC_VNUM,             // short[nvertices]
+  MRISC_V2NUM,            // short[nvertices]    v3num is the length of the vertex's ring
+  MRISC_NSIZE_MAX,        // uchar[nvertices]
+  MRISC_RING,             // int[nring]          the 1, 2 and 3-hop neighbors of each vertex
+  MRISC_NBLOCKS
+};
+
+typedef struct
+{
+  char     magic[8];
+  int32_t  version;
+  int32_t  byte_order;
+  int32_t  nvertices;
+  int32_t  nfaces;
+  int64_t  nring;
+  int64_t  source_size;       // the surface file this was built from
+  uint64_t source_hash;
+  int64_t  tag_offset;        // where the tags start in the surface file
+  int64_t  blocks[MRISC_NBLOCKS];
+  int64_t  file_size;
+} MRISC_FILE_HEADER;
+
+struct MRIS_CACHE {
+  MRISC_FILE_HEADER const * hdr;
+  float   const * xyz;
+  int     const * faces;
+  int64_t const * ring_offsets;
+  short   const * vnum;
+  short   const * v2num;
+  uchar   const * nsizeMax;
+  int     const * ring;
+
+  void*   map;
+  size_t  map_size;
+};
+
+
+bool mrisCacheEnabled()
+{
+  // the cached neighbors are the ones found by the default topology code
+  return getenv("FS_MRIS_CACHE") != NULL
+      && getenv("mrisCompleteTopology_new") == NULL
+      && getenv("MRISfindNeighborsAtVertex_old") == NULL
+      && getenv("FS_SKIP_TAGS") == NULL;
+}
+
+
+static void mrisCacheName(const char *surf_fname, char *cache_fname)
+{
+  snprintf(cache_fname, STRLEN, "%s%s", surf_fname, MRIS_CACHE_SUFFIX);
+}
+
+
+// size and hash of the whole surface file
+//
+static bool mrisCacheHashSource(const char *surf_fname, int64_t *psize, uint64_t *phash)
+{
+  FILE *fp = fopen(surf_fname, "rb");
+  if (!fp) return false;
+
+  unsigned long hash = fnv_init();
+  int64_t size = 0;
+  size_t const bufsize = 1 << 20;
+  unsigned char *buf = (unsigned char *)malloc(bufsize);
+  size_t n;
+  while ((n = fread(buf, 1, bufsize, fp)) > 0) {
+    hash = fnv_add(hash, buf, n);
+    size += n;
+  }
+  bool const ok = !ferror(fp);
+  free(buf);
+  fclose(fp);
+
+  *psize = size;
+  *phash = hash;
+  return ok;
+}
+
+
+/*-----------------------------------------------------
+  Checks that every block fits in the file, and that the indices
+  and neighbor counts in them describe a surface of nvertices, so
+  nothing built from the cache can index outside its arrays.
+  ------------------------------------------------------*/
+static bool mrisCacheValidBlocks(MRISC_FILE_HEADER const *hdr)
+{
+  int64_t const nv = hdr->nvertices;
+  if (nv <= 0 || hdr->nfaces < 0 || hdr->nring < 0 || hdr->nring > hdr->file_size) return false;
+
+  int64_t size[MRISC_NBLOCKS];
+  size[MRISC_XYZ]          = 3 * nv * (int64_t)sizeof(float);
+  size[MRISC_FACES]        = 3 * (int64_t)hdr->nfaces * (int64_t)sizeof(int);
+  size[MRISC_RING_OFFSETS] = (nv + 1) * (int64_t)sizeof(int64_t);
+  size[MRISC_VNUM]         = nv * (int64_t)sizeof(short);
+  size[MRISC_V2NUM]        = nv * (int64_t)sizeof(short);
+  size[MRISC_NSIZE_MAX]    = nv * (int64_t)sizeof(uchar);
+  size[MRISC_RING]         = hdr->nring * (int64_t)sizeof(int);
+
+  int b;
+  for (b = 0; b < MRISC_NBLOCKS; b++) {
+    if (hdr->blocks[b] < (int64_t)sizeof(*hdr) || hdr->blocks[b] % MRIS_CACHE_ALIGN
+        || size[b] > hdr->file_size - hdr->blocks[b])
+      return false;
+  }
+  return true;
+}
+
+static bool mrisCacheValidTopology(MRIS_CACHE const *cache)
+{
+  int const nvertices = cache->hdr->nvertices;
+  int64_t const nfaces = cache->hdr->nfaces;
+  int64_t const nring  = cache->hdr->nring;
+
+  int64_t i;
+  for (i = 0; i < 3 * nfaces; i++)
+    if (cache->faces[i] < 0 || cache->faces[i] >= nvertices) return false;
+
+  if (cache->ring_offsets[0] != 0 || cache->ring_offsets[nvertices] != nring) return false;
+  int vno;
+  for (vno = 0; vno < nvertices; vno++) {
+    int64_t const len = cache->ring_offsets[vno+1] - cache->ring_offsets[vno];
+    if (len < 0 || cache->vnum[vno] < 0 || cache->vnum[vno] > cache->v2num[vno] || cache->v2num[vno] > len
+        || cache->nsizeMax[vno] != 3)
+      return false;
+  }
+
+  for (i = 0; i < nring; i++)
+    if (cache->ring[i] < 0 || cache->ring[i] >= nvertices) return false;
+
+  return true;
+}
+
+
+/*-----------------------------------------------------
+  Maps the sidecar of surf_fname. NULL if there is none, if it
+  was built from a different version of the surface file, or if it
+  is damaged; the surface is then read the normal way.
+  ------------------------------------------------------*/
+MRIS_CACHE* mrisCacheRead(const char *surf_fname)
+{
+  char fname[STRLEN];
+  mrisCacheName(surf_fname, fname);
+
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  MRISC_FILE_HEADER hdr;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)
+      || memcmp(hdr.magic, MRIS_CACHE_MAGIC, sizeof(hdr.magic)) || hdr.version != MRIS_CACHE_VERSION
+      || hdr.byte_order != MRIS_CACHE_BYTE_ORDER || hdr.file_size != (int64_t)st.st_size) {
+    close(fd);
+    if (Gdiag & DIAG_SHOW) fprintf(stdout, "mrisCacheRead: ignoring %s, not a version %d surface cache\n", fname, MRIS_CACHE_VERSION);
+    return NULL;
+  }
+
+  int64_t  source_size;
+  uint64_t source_hash;
+  if (!mrisCacheHashSource(surf_fname, &source_size, &source_hash)
+      || source_size != hdr.source_size || source_hash != hdr.source_hash) {
+    close(fd);
+    if (Gdiag & DIAG_SHOW) fprintf(stdout, "mrisCacheRead: ignoring %s, %s has changed\n", fname, surf_fname);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, hdr.file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    ErrorReturn(NULL, (ERROR_NOMEMORY, "mrisCacheRead(%s): mmap failed (%s)", fname, strerror(errno)));
+  }
+
+  if (!mrisCacheValidBlocks(&hdr)) {
+    munmap(map, hdr.file_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "mrisCacheRead(%s): blocks do not fit in the file", fname));
+  }
+
+  char const * const base = (char const *)map;
+  MRIS_CACHE *cache = (MRIS_CACHE *)calloc(1, sizeof(MRIS_CACHE));
+  cache->map          = map;
+  cache->map_size     = hdr.file_size;
+  cache->hdr          = (MRISC_FILE_HEADER const *)map;
+  cache->xyz          = (float   const *)(base + hdr.blocks[MRISC_XYZ]);
+  cache->faces        = (int     const *)(base + hdr.blocks[MRISC_FACES]);
+  cache->ring_offsets = (int64_t const *)(base + hdr.blocks[MRISC_RING_OFFSETS]);
+  cache->vnum         = (short   const *)(base + hdr.blocks[MRISC_VNUM]);
+  cache->v2num        = (short   const *)(base + hdr.blocks[MRISC_V2NUM]);
+  cache->nsizeMax     = (uchar   const *)(base + hdr.blocks[MRISC_NSIZE_MAX]);
+  cache->ring         = (int     const *)(base + hdr.blocks[MRISC_RING]);
+
+  if (!mrisCacheValidTopology(cache)) {
+    mrisCacheFree(&cache);
+    ErrorReturn(NULL, (ERROR_BADFILE, "mrisCacheRead(%s): inconsistent faces or neighbor lists", fname));
+  }
+
+  return cache;
+}
+
+
+void mrisCacheFree(MRIS_CACHE **pcache)
+{
+  MRIS_CACHE *cache = *pcache;
+  if (!cache) return;
+  *pcache = NULL;
+  if (cache->map) munmap(cache->map, cache->map_size);
+  free(cache);
+}
+
+
+/*-----------------------------------------------------
+  What mrisReadTriangleFile reads, but with the vertices and faces
+  taken from the cache. Only the tags are read from the surface file.
+  ------------------------------------------------------*/
+MRIS* mrisReadTriangleFileFromCache(MRIS_CACHE const *cache, const char *fname, double nVFMultiplier)
+{
+  int const nvertices = cache->hdr->nvertices;
+  int const nfaces    = cache->hdr->nfaces;
+
+  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+    fprintf(stdout, "surface %s: %d vertices and %d faces (cached).\n", fname, nvertices, nfaces);
+
+  MRIS * mris = MRISoverAlloc(nVFMultiplier * nvertices, nVFMultiplier * nfaces, nvertices, nfaces);
+  mris->type = MRIS_TRIANGULAR_SURFACE;
+
+  int vno;
+  for (vno = 0; vno < nvertices; vno++) {
+    float const * xyz = &cache->xyz[3*vno];
+    MRISsetXYZ(mris, vno, xyz[0], xyz[1], xyz[2]);
+    mris->vertices_topology[vno].num = 0; /* will figure it out */
+  }
+
+  int fno;
+  for (fno = 0; fno < nfaces; fno++) {
+    FACE * const f = &mris->faces[fno];
+    int n;
+    for (n = 0; n < VERTICES_PER_FACE; n++) {
+      f->v[n] = cache->faces[3*fno + n];
+      mris->vertices_topology[f->v[n]].num++;
+    }
+  }
+  mris->useRealRAS = 0;
+
+  FILE *fp = fopen(fname, "rb");
+  if (!fp || fseek(fp, cache->hdr->tag_offset, SEEK_SET) != 0) {
+    if (fp) fclose(fp);
+    MRISfree(&mris);
+    ErrorReturn(NULL, (ERROR_NOFILE, "mrisReadTriangleFileFromCache(%s): could not read tags", fname));
+  }
+  mrisReadTriangleFileTags(mris, fp, fname);
+  fclose(fp);
+
+  return (mris);
+}
+
+
+/*-----------------------------------------------------
+  Does what mrisCompleteTopology does to a surface read from a
+  triangle file: the immediate neighbors of each vertex, in the order
+  it finds them.
+  ------------------------------------------------------*/
+void mrisCacheCompleteTopology(MRIS *mris, MRIS_CACHE const *cache)
+{
+  cheapAssert(mris->nvertices == cache->hdr->nvertices);
+
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
+    int const * const ring = &cache->ring[cache->ring_offsets[vno]];
+
+    setVnum(mris, vno, cache->vnum[vno]);
+    if (vt->v) free(vt->v);
+    vt->v = (int *)calloc(vt->vnum, sizeof(int));
+    if (!vt->v) ErrorExit(ERROR_NOMEMORY, "mrisCacheCompleteTopology: could not allocate nbr array");
+    memmove(vt->v, ring, vt->vnum * sizeof(int));
+
+    vt->vtotal = vt->vnum;
+    vt->nsizeMax = vt->nsizeCur = 1;
+    vt->v3num = vt->vtotal;
+  }
+
+  mrisCheckVertexFaceTopology(mris);
+}
+
+
+/*-----------------------------------------------------
+  Adds the 2 and 3-hop rings that MRISsetNeighborhoodSizeAndDist(mris, 3)
+  would find, so it only has to compute the distances.
+  ------------------------------------------------------*/
+void mrisCacheAddRings(MRIS *mris, MRIS_CACHE const *cache)
+{
+  cheapAssert(mris->nvertices == cache->hdr->nvertices);
+
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
+    VERTEX          * const v  = &mris->vertices         [vno];
+    if (v->ripflag || vt->nsizeMax != 1) continue;
+
+    int const * const ring = &cache->ring[cache->ring_offsets[vno]];
+    int const oldSize = vt->vnum;
+    int const newSize = cache->ring_offsets[vno+1] - cache->ring_offsets[vno];
+    if (newSize > oldSize) {
+      vt->v = (int *)realloc(vt->v, newSize * sizeof(int));
+      if (!vt->v) ErrorExit(ERROR_NOMEMORY, "mrisCacheAddRings: could not allocate nbr array");
+      memmove(vt->v + oldSize, ring + oldSize, (newSize - oldSize) * sizeof(int));
+      if (v->dist) MRISgrowDist(mris, vno, newSize);
+    }
+
+    vt->v2num = cache->v2num[vno];
+    vt->v3num = newSize;
+    vt->nsizeMax = cache->nsizeMax[vno]; vt->nsizeMaxClock = mris->nsizeMaxClock;
+    vt->vtotal = vt->vnum;
+  }
+}
+
+
+static int mrisCachePad(FILE *fp)
+{
+  static const char zeros[MRIS_CACHE_ALIGN] = {0};
+  long pos = ftell(fp);
+  long pad = (MRIS_CACHE_ALIGN - (pos % MRIS_CACHE_ALIGN)) % MRIS_CACHE_ALIGN;
+  if (pad && fwrite(zeros, 1, pad, fp) != (size_t)pad) return (ERROR_BADFILE);
+  return (NO_ERROR);
+}
+
+static int mrisCacheBeginBlock(FILE *fp, MRISC_FILE_HEADER *hdr, int block)
+{
+  if (mrisCachePad(fp) != NO_ERROR) return (ERROR_BADFILE);
+  hdr->blocks[block] = ftell(fp);
+  return (NO_ERROR);
+}
+
+#define MRISC_WRITE(ptr, n, fp)                                   \
+  if (fwrite((ptr), sizeof(*(ptr)), (n), (fp)) != (size_t)(n)) {  \
+    error = ERROR_BADFILE;                                        \
+  }
+
+/*-----------------------------------------------------
+  Writes the sidecar of surf_fname, from mris as MRISread leaves it
+  (neighborhoods found out to 3 hops). The vertex coordinates are read
+  from the surface file, since MRISread may have converted them. The
+  sidecar is written under a temporary name and renamed, so concurrent
+  readers see either the old or the new one.
+  ------------------------------------------------------*/
+int mrisCacheWrite(MRIS *mris, const char *surf_fname)
+{
+  int vno, fno, error = NO_ERROR;
+
+  if (mris->max_nsize != 3) return (ERROR_BADPARM);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    if (mris->vertices[vno].ripflag || vt->nsizeMax != 3 || vt->nsizeCur != 1) return (ERROR_BADPARM);
+  }
+
+  MRISC_FILE_HEADER hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, MRIS_CACHE_MAGIC, sizeof(hdr.magic));
+  hdr.version    = MRIS_CACHE_VERSION;
+  hdr.byte_order = MRIS_CACHE_BYTE_ORDER;
+  hdr.nvertices  = mris->nvertices;
+  hdr.nfaces     = mris->nfaces;
+
+  // the coordinates as they are in the file, and where the tags start
+  float *xyz = (float *)malloc(3 * sizeof(float) * mris->nvertices);
+  {
+    FILE *fp = fopen(surf_fname, "rb");
+    if (!fp) {
+      free(xyz);
+      return (ERROR_NOFILE);
+    }
+    int nvertices, nfaces;
+    int const magic = mrisReadTriangleFileHeader(fp, &nvertices, &nfaces);
+    if (magic != TRIANGLE_FILE_MAGIC_NUMBER || nvertices != mris->nvertices || nfaces != mris->nfaces) {
+      fclose(fp);
+      free(xyz);
+      return (ERROR_BADFILE);
+    }
+    for (vno = 0; vno < 3 * nvertices; vno++) xyz[vno] = freadFloat(fp);
+    hdr.tag_offset = ftell(fp) + (int64_t)nfaces * VERTICES_PER_FACE * sizeof(int);
+    fclose(fp);
+  }
+  if (!mrisCacheHashSource(surf_fname, &hdr.source_size, &hdr.source_hash)) {
+    free(xyz);
+    return (ERROR_NOFILE);
+  }
+
+  char fname[STRLEN], tmpname[STRLEN];
+  mrisCacheName(surf_fname, fname);
+  snprintf(tmpname, STRLEN, "%s.%d", fname, (int)getpid());
+  FILE *fp = fopen(tmpname, "wb");
+  if (!fp) {
+    free(xyz);
+    return (ERROR_NOFILE);
+  }
+
+  MRISC_WRITE(&hdr, 1, fp);
+
+  mrisCacheBeginBlock(fp, &hdr, MRISC_XYZ);
+  MRISC_WRITE(xyz, 3 * mris->nvertices, fp);
+  free(xyz);
+
+  mrisCacheBeginBlock(fp, &hdr, MRISC_FACES);
+  for (fno = 0; fno < mris->nfaces; fno++) MRISC_WRITE(mris->faces[fno].v, VERTICES_PER_FACE, fp);
+
+  mrisCacheBeginBlock(fp, &hdr, MRISC_RING_OFFSETS);
+  int64_t offset = 0;
+  MRISC_WRITE(&offset, 1, fp);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    offset += mris->vertices_topology[vno].v3num;
+    MRISC_WRITE(&offset, 1, fp);
+  }
+  hdr.nring = offset;
+
+  mrisCacheBeginBlock(fp, &hdr, MRISC_VNUM);
+  for (vno = 0; vno < mris->nvertices; vno++) MRISC_WRITE(&mris->vertices_topology[vno].vnum, 1, fp);
+
+  mrisCacheBeginBlock(fp, &hdr, MRISC_V2NUM);
+  for (vno = 0; vno < mris->nvertices; vno++) MRISC_WRITE(&mris->vertices_topology[vno].v2num, 1, fp);
+
+  mrisCacheBeginBlock(fp, &hdr, MRISC_NSIZE_MAX);
+  for (vno = 0; vno < mris->nvertices; vno++) MRISC_WRITE(&mris->vertices_topology[vno].nsizeMax, 1, fp);
+
+  mrisCacheBeginBlock(fp, &hdr, MRISC_RING);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    MRISC_WRITE(vt->v, vt->v3num, fp);
+  }
+
+  // the mapping covers whole pages, so pad the file out to a block boundary
+  mrisCachePad(fp);
+  hdr.file_size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  MRISC_WRITE(&hdr, 1, fp);
+  if (fclose(fp) != 0) error = ERROR_BADFILE;
+
+  if (error == NO_ERROR && rename(tmpname, fname) != 0) error = ERROR_BADFILE;
+  if (error != NO_ERROR) {
+    unlink(tmpname);
+    return (error);
+  }
+
+  if (Gdiag & DIAG_SHOW) fprintf(stdout, "wrote surface cache %s\n", fname);
+  return (NO_ERROR);
+}
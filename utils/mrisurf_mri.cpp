@@ -23,6 +23,7 @@
 #include "mrisurf_timeStep.h"
 #include "mrisurf_sseTerms.h"
 #include "mrisurf_compute_dxyz.h"
+#include "mrisurf_MRIS_HOT.h"
 #include "region.h"
 #include "surfgrad.h"
 
@@ -579,6 +580,12 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
   // are allowed after which it will break from the iteration loop.
   // This can make the number of iterations parameter much less
   // important than it first appears.
+  // The averaging and the spring terms run on the hot properties of
+  // the vertices (see mrisurf_MRIS_HOT.h), the other terms on the MRIS.
+  bool const use_hot = !MRISHOT_useReference();
+  MRIS_HOT hot;
+  MRISHOT_ctr(&hot);
+
   dt = parms->dt;
   l_intensity = parms->l_intensity;
   for (n = parms->start_t; n < parms->start_t + niterations; n++) {
@@ -613,10 +620,21 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
     }
     /*mrisMarkSulcalVertices(mris, parms) ;*/
     mrisComputeLaplacianTerm(mris, parms->l_lap);
-    mrisAverageSignedGradients(mris, avgs);
-    /*mrisUpdateSulcalGradients(mris, parms) ;*/
-    /* smoothness terms */
-    mrisComputeSpringTerm(mris, parms->l_spring);
+    if (use_hot) {
+      MRISHOT_load(&hot, mris);
+      MRISHOT_averageSignedGradients(&hot, avgs);
+      MRISHOT_computeSpringTerm(&hot, parms->l_spring);
+    } else {
+      mrisAverageSignedGradients(mris, avgs);
+      /*mrisUpdateSulcalGradients(mris, parms) ;*/
+      /* smoothness terms */
+      mrisComputeSpringTerm(mris, parms->l_spring);
+    }
+    // terms that only have an MRIS version get the gradient back from hot
+    bool const mris_terms_a = parms->l_hinge > 0 || parms->l_spring_nzr > 0 ||
+      !FZERO(parms->l_spring_norm) || !FZERO(parms->l_repulse) || !FZERO(parms->l_tsmooth) ||
+      !FZERO(parms->l_thick_min) || !FZERO(parms->l_thick_parallel);
+    if (use_hot && mris_terms_a) MRISHOT_unloadGradient(mris, &hot);
     if(parms->l_hinge > 0 || parms->l_spring_nzr > 0){
       if(mris->edges == NULL){
 	printf("First pass, creating edges\n");
@@ -643,12 +661,26 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
     mrisComputeThicknessSmoothnessTerm(mris, parms->l_tsmooth, parms);
     mrisComputeThicknessMinimizationTerm(mris, parms->l_thick_min, parms);
     mrisComputeThicknessParallelTerm(mris, parms->l_thick_parallel, parms);
-    mrisComputeNormalSpringTerm(mris, parms->l_nspring);
-    mrisComputeQuadraticCurvatureTerm(mris, parms->l_curv);
-    /*mrisComputeAverageNormalTerm(mris, avgs, parms->l_nspring) ;*/
-    /*mrisComputeCurvatureTerm(mris, parms->l_curv) ;*/
-    mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
-    mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+    if (use_hot) {
+      if (mris_terms_a) MRISHOT_load(&hot, mris);
+      MRISHOT_computeNormalSpringTerm(&hot, parms->l_nspring);
+      bool const mris_terms_b = !FZERO(parms->l_curv) || !FZERO(parms->l_nlspring);
+      if (mris_terms_b) {
+        MRISHOT_unloadGradient(mris, &hot);
+        mrisComputeQuadraticCurvatureTerm(mris, parms->l_curv);
+        mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
+        MRISHOT_load(&hot, mris);
+      }
+      MRISHOT_computeTangentialSpringTerm(&hot, parms->l_tspring);
+      MRISHOT_unloadGradient(mris, &hot);
+    } else {
+      mrisComputeNormalSpringTerm(mris, parms->l_nspring);
+      mrisComputeQuadraticCurvatureTerm(mris, parms->l_curv);
+      /*mrisComputeAverageNormalTerm(mris, avgs, parms->l_nspring) ;*/
+      /*mrisComputeCurvatureTerm(mris, parms->l_curv) ;*/
+      mrisComputeNonlinearSpringTerm(mris, parms->l_nlspring, parms);
+      mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
+    }
     mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
     mrisComputeMaxSpringTerm(mris, parms->l_max_spring);
     mrisComputeAngleAreaTerms(mris, parms);
@@ -871,6 +903,7 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
   if (mht_v_orig) {
     MHTfree(&mht_v_orig);
   }
+  MRISHOT_dtr(&hot);
 
   return (NO_ERROR);
 }
@@ -5384,15 +5417,15 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   other way). Same for mask. The mask is inclusive, so voxels with
   mask=1 are included. If mask is NULL, it is ignored. Gives identical
   results as MRISsmoothMRI(); see MRISsmoothMRIFastCheck().
+  The neighbourhoods are resolved once into an MRIS_SMOOTH_OP, which
+  is then applied to blocks of frames at a time; callers that smooth
+  many volumes over the same surface and mask can keep the operator
+  themselves, see MRISsmoothOpAlloc().
   -------------------------------------------------------------------*/
 MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI *Targ)
 {
-  int nnbrs, nthstep, frame, vno, nthnbr, num, nvox, nbrvno, reshape;
-  MRI *SrcTmp, *mritmp, *IncMaskTmp = NULL;
-  int msecTime;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-  float **pF, **pF0, *tF, *tF0, sumF;
-  VERTEX *v, *vn;
+  int nvox, msecTime;
+  MRIS_SMOOTH_OP *op;
 
   if (Gdiag_no > 0) printf("MRISsmoothMRIFast()\n");
 
@@ -5401,25 +5434,9 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
     printf("ERROR: MRISsmoothMRIFast(): Surf/Src dimension mismatch\n");
     return (NULL);
   }
-  if (IncMask) {
-    if (IncMask->width * IncMask->height * IncMask->depth != nvox) {
-      printf("ERROR: MRISsmoothMRIFast(): Surf/Mask dimension mismatch\n");
-      return (NULL);
-    }
-    if (IncMask->width != nvox)
-      IncMaskTmp = mri_reshape(IncMask, nvox, 1, 1, IncMask->nframes);
-    else
-      IncMaskTmp = MRIcopy(IncMask, NULL);
-  }
-  // Reshape the source if needed
-  if (Src->width != nvox) {
-    if (Gdiag_no > 0) printf("MRISsmoothMRIFast(): reshaping\n");
-    SrcTmp = mri_reshape(Src, nvox, 1, 1, Src->nframes);
-    reshape = 1;
-  }
-  else {
-    reshape = 0;
-    SrcTmp = MRIcopy(Src, NULL);
+  if (IncMask && IncMask->width * IncMask->height * IncMask->depth != nvox) {
+    printf("ERROR: MRISsmoothMRIFast(): Surf/Mask dimension mismatch\n");
+    return (NULL);
   }
   if (Targ != NULL) {
     if (MRIdimMismatch(Src, Targ, 1)) {
@@ -5432,109 +5449,217 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
     }
   }
 
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-  pF = (float **)calloc(Surf->nvertices * nNbrsMax, sizeof(float *));
-  tF = (float *)calloc(Surf->nvertices, sizeof(float));
-  nNbrs = (int *)calloc(Surf->nvertices, sizeof(int));
-  rip = (int *)calloc(Surf->nvertices, sizeof(int));
+  Timer mytimer;
 
-  pF0 = pF;
-  tF0 = tF;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
+  op = MRISsmoothOpAlloc(Surf, IncMask);
+  if (op == NULL) return (NULL);
+  Targ = MRISsmoothOpApply(op, Src, nSmoothSteps, Targ);
+  MRISsmoothOpFree(&op);
 
-  Timer mytimer;
+  msecTime = mytimer.milliseconds();
+  if (Gdiag_no > 0) {
+    printf("MRISsmoothFast() nsteps = %d, tsec = %g\n", nSmoothSteps, msecTime / 1000.0);
+    fflush(stdout);
+  }
 
-  // Loop through frames
-  for (frame = 0; frame < Src->nframes; frame++) {
-    // Set up pointers for this frame
-    pF = pF0;
-    rip = rip0;
-    nNbrs = nNbrs0;
-    for (vno = 0; vno < Surf->nvertices; vno++) {
-      v = &Surf->vertices[vno];
-      if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0) < 0.5) {
-        // Mask is inclusive, so look for out of mask
-        // should exclude rips here too? Original does not.
-        rip[vno] = 1;
-        MRIFseq_vox(SrcTmp, vno, 0, 0, frame) = 0;
-        continue;
-      }
-      rip[vno] = 0;
-      *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, vno, 0, 0, frame)));
-      nnbrs = Surf->vertices_topology[vno].vnum;
+  return (Targ);
+}
+
+/*-------------------------------------------------------------------
+  MRISsmoothOpAlloc() - builds the nearest-neighbour averaging step
+  used by MRISsmoothMRIFast() as a CSR matrix. Row vno lists vno
+  itself followed by its unripped, in-mask neighbours; the step
+  replaces each value with the mean of its row. Rows of vertices
+  outside of IncMask (which may be NULL) are empty, and those
+  vertices are set to 0. The operator only depends on the topology,
+  the ripflags and the mask, so it can be reused for any number of
+  volumes and any number of steps as long as those do not change.
+  -------------------------------------------------------------------*/
+MRIS_SMOOTH_OP *MRISsmoothOpAlloc(MRIS *Surf, MRI *IncMask)
+{
+  int vno, nvertices = Surf->nvertices;
+  char *inmask;
+  MRIS_SMOOTH_OP *op;
+
+  if (IncMask && IncMask->width * IncMask->height * IncMask->depth != nvertices) {
+    printf("ERROR: MRISsmoothOpAlloc(): Surf/Mask dimension mismatch\n");
+    return (NULL);
+  }
+
+  // Mask is inclusive; like MRISsmoothMRIFast() always was, only frame
+  // 0 is looked at and a vertex's own ripflag does not exclude it
+  inmask = (char *)malloc(nvertices * sizeof(char));
+  for (vno = 0; vno < nvertices; vno++) {
+    inmask[vno] = 1;
+    if (IncMask) {
+      int const c = vno % IncMask->width;
+      int const r = (vno / IncMask->width) % IncMask->height;
+      int const s = vno / (IncMask->width * IncMask->height);
+      if (MRIgetVoxVal(IncMask, c, r, s, 0) < 0.5) inmask[vno] = 0;
+    }
+  }
+
+  op = (MRIS_SMOOTH_OP *)calloc(1, sizeof(MRIS_SMOOTH_OP));
+  op->nvertices = nvertices;
+  op->rowptr = (int *)malloc((nvertices + 1) * sizeof(int));
+
+  op->rowptr[0] = 0;
+  for (vno = 0; vno < nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &Surf->vertices_topology[vno];
+    int n, num = 0;
+    if (inmask[vno]) {
       num = 1;
-      for (nthnbr = 0; nthnbr < nnbrs; nthnbr++) {
-        nbrvno = Surf->vertices_topology[vno].v[nthnbr];
-        vn = &Surf->vertices[nbrvno];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, nbrvno, 0, 0, 0) < 0.5) {
-          continue;
-        }
-        *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, nbrvno, 0, 0, frame)));
-        num++;
+      for (n = 0; n < vt->vnum; n++) {
+        int const nbrvno = vt->v[n];
+        if (!Surf->vertices[nbrvno].ripflag && inmask[nbrvno]) num++;
       }
-      *nNbrs++ = num;  // num takes into account all rips/masks
     }
+    op->rowptr[vno + 1] = op->rowptr[vno] + num;
+  }
+  op->nnz = op->rowptr[nvertices];
+  op->col = (int *)malloc(MAX(op->nnz, 1) * sizeof(int));
 
-    // Step through the iterations
-    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
-      // Init pointers for this iteration
-      pF = pF0;
-      rip = rip0;
-      tF = tF0;
-      nNbrs = nNbrs0;
-      // Loop through vertices, average nearest neighbors
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        sumF = *(*pF++);
-        for (nthnbr = 0; nthnbr < (*nNbrs) - 1; nthnbr++) {
-          sumF += *(*pF++);
-        }
-        *tF++ = sumF / (*nNbrs);
-        nNbrs++;
-      }
-      // Load up for the next step
-      rip = rip0;
-      tF = tF0;
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        MRIsetVoxVal(SrcTmp, vno, 0, 0, frame, *tF++);
-      }
+  for (vno = 0; vno < nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &Surf->vertices_topology[vno];
+    int n, k = op->rowptr[vno];
+    if (!inmask[vno]) continue;
+    op->col[k++] = vno;
+    for (n = 0; n < vt->vnum; n++) {
+      int const nbrvno = vt->v[n];
+      if (!Surf->vertices[nbrvno].ripflag && inmask[nbrvno]) op->col[k++] = nbrvno;
     }
+  }
 
-  } /* end loop over frame */
+  free(inmask);
+  return (op);
+}
+
+void MRISsmoothOpFree(MRIS_SMOOTH_OP **pop)
+{
+  MRIS_SMOOTH_OP *op = *pop;
+  *pop = NULL;
+  if (!op) return;
+  free(op->rowptr);
+  free(op->col);
+  free(op);
+}
+
+// One step for nf interleaved frames: X and Y hold nf values per vertex.
+// The sums are made in the same order, and in float, as the per-frame
+// loop MRISsmoothMRIFast() used to have, so the results are identical.
+static void mrisSmoothOpStep(MRIS_SMOOTH_OP const *op, float const *X, float *Y, int nf)
+{
+  int vno;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+  for (vno = 0; vno < op->nvertices; vno++) {
+    ROMP_PFLB_begin
+    int f, k;
+    int const k0 = op->rowptr[vno], k1 = op->rowptr[vno + 1];
+    float *y = &Y[(size_t)vno * nf];
+
+    if (k0 == k1) {
+      for (f = 0; f < nf; f++) y[f] = 0;
+      ROMP_PF_continue;
+    }
 
-  // Copy to the output
-  if (reshape) {
-    if (Gdiag_no > 0) printf("MRISsmoothFast() reshaping again\n");
-    mritmp = mri_reshape(SrcTmp, Src->width, Src->height, Src->depth, Src->nframes);
-    Targ = MRIcopy(mritmp, Targ);
-    MRIfree(&mritmp);
+    float const *x = &X[(size_t)op->col[k0] * nf];
+    for (f = 0; f < nf; f++) y[f] = x[f];
+    for (k = k0 + 1; k < k1; k++) {
+      x = &X[(size_t)op->col[k] * nf];
+      for (f = 0; f < nf; f++) y[f] += x[f];
+    }
+    float const num = k1 - k0;
+    for (f = 0; f < nf; f++) y[f] /= num;
+    ROMP_PFLB_end
   }
-  else
-    Targ = MRIcopy(SrcTmp, Targ);
+  ROMP_PF_end
+}
 
-  msecTime = mytimer.milliseconds();
-  if (Gdiag_no > 0) {
-    printf("MRISsmoothFast() nsteps = %d, tsec = %g\n", nSmoothSteps, msecTime / 1000.0);
-    fflush(stdout);
+/*-------------------------------------------------------------------
+  MRISsmoothOpApply() - applies nSmoothSteps steps of op to every frame
+  of Src. Frames are processed MRIS_SMOOTH_OP_FRAME_BLOCK at a time,
+  interleaved so that one pass over the operator serves the whole
+  block. Src does not need to be reshaped to nvertices x 1 x 1. Targ
+  may be NULL or Src.
+  -------------------------------------------------------------------*/
+#define MRIS_SMOOTH_OP_FRAME_BLOCK 32
+
+MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *Src, int nSmoothSteps, MRI *Targ)
+{
+  int f0, nthstep, nvox = Src->width * Src->height * Src->depth;
+  int const nblock = MIN(Src->nframes, MRIS_SMOOTH_OP_FRAME_BLOCK);
+  float *X, *Y;
+
+  if (op->nvertices != nvox) {
+    printf("ERROR: MRISsmoothOpApply(): op/Src dimension mismatch\n");
+    return (NULL);
+  }
+  if (Targ != NULL && MRIdimMismatch(Src, Targ, 1)) {
+    printf("ERROR: MRISsmoothOpApply(): output dimension mismatch\n");
+    return (NULL);
   }
 
-  MRIfree(&SrcTmp);
-  if (IncMaskTmp) MRIfree(&IncMaskTmp);
-  free(pF0);
-  free(tF0);
-  free(rip0);
-  free(nNbrs0);
+  if (Targ == NULL)
+    Targ = MRIcopy(Src, NULL);
+  else if (Targ != Src)
+    MRIcopy(Src, Targ);
+
+  X = (float *)malloc((size_t)nvox * nblock * sizeof(float));
+  Y = (float *)malloc((size_t)nvox * nblock * sizeof(float));
+
+  // a block is read from Src before it is written to Targ, so this
+  // also works in-place
+  for (f0 = 0; f0 < Src->nframes; f0 += nblock) {
+    int const nf = MIN(nblock, Src->nframes - f0);
+    int vno;
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+    for (vno = 0; vno < nvox; vno++) {
+      ROMP_PFLB_begin
+      int f;
+      int const c = vno % Src->width;
+      int const r = (vno / Src->width) % Src->height;
+      int const s = vno / (Src->width * Src->height);
+      bool const masked = (op->rowptr[vno] == op->rowptr[vno + 1]);
+      for (f = 0; f < nf; f++)
+        X[(size_t)vno * nf + f] = masked ? 0 : MRIgetVoxVal(Src, c, r, s, f0 + f);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
+      float *tmp;
+      mrisSmoothOpStep(op, X, Y, nf);
+      tmp = X;
+      X = Y;
+      Y = tmp;
+    }
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+    for (vno = 0; vno < nvox; vno++) {
+      ROMP_PFLB_begin
+      int f;
+      int const c = vno % Targ->width;
+      int const r = (vno / Targ->width) % Targ->height;
+      int const s = vno / (Targ->width * Targ->height);
+      for (f = 0; f < nf; f++) MRIsetVoxVal(Targ, c, r, s, f0 + f, X[(size_t)vno * nf + f]);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+
+  free(X);
+  free(Y);
 
   return (Targ);
 }
@@ -0,0 +1,304 @@
+/**
+ * @brief resampling engine behind MRIvol2Vol
+ *
+ * Row-wise, type-specialized nearest-neighbor and trilinear resampling
+ * through a vox2vox matrix, giving the same values as the reference loop
+ * in MRIvol2Vol(). See mrivol2vol.h.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "mri.h"
+#include "mrivol2vol.h"
+#include "utils.h"
+#include "romp_support.h"
+
+// Number of target voxels whose source coordinates are computed together
+#define MRI_VOL2VOL_BLOCK 16
+
+int MRIvol2VolUseReference(void)
+{
+  static int use_reference = -1 ;
+
+  if (use_reference < 0)
+    use_reference = (getenv("FS_MRI_VOL2VOL_REFERENCE") != NULL) ;
+  return (use_reference) ;
+}
+
+// MRI_LONG is left out: MRIgetVoxVal() and MRIsampleSeqVolume() do not
+// agree on its width.
+static int mriVol2VolTypeSupported(int type)
+{
+  switch (type) {
+    case MRI_UCHAR:
+    case MRI_SHORT:
+    case MRI_USHRT:
+    case MRI_INT:
+    case MRI_FLOAT:
+      return (1) ;
+  }
+  return (0) ;
+}
+
+// nint() and nint2() from utils.cpp
+template <bool Nint2>
+static inline int mriVol2VolRound(double f)
+{
+  if (Nint2)
+    return (f < 0 ? ((int)(f - 0.5)) : ((int)(f + 0.49999999))) ;
+  return (f < 0 ? ((int)(f - 0.5)) : ((int)(f + 0.5))) ;
+}
+
+// The products of each matrix column with the target indices along its
+// axis, so that each source coordinate is
+//   ((col[ct] + row[rt]) + slice[st]) + offset
+// which is the reference's expression, evaluated in the same order.
+typedef struct
+{
+  std::vector<float> col[3], row[3], slice[3] ;
+  float offset[3] ;
+} MRI_VOL2VOL_TERMS ;
+
+static void mriVol2VolTerms(MRI_VOL2VOL_TERMS *terms, MATRIX *Vt2s, MRI *targ)
+{
+  for (int i = 0; i < 3; i++) {
+    terms->col[i].resize(targ->width) ;
+    terms->row[i].resize(targ->height) ;
+    terms->slice[i].resize(targ->depth) ;
+    for (int ct = 0; ct < targ->width; ct++) terms->col[i][ct] = Vt2s->rptr[i + 1][1] * ct ;
+    for (int rt = 0; rt < targ->height; rt++) terms->row[i][rt] = Vt2s->rptr[i + 1][2] * rt ;
+    for (int st = 0; st < targ->depth; st++) terms->slice[i][st] = Vt2s->rptr[i + 1][3] * st ;
+    terms->offset[i] = Vt2s->rptr[i + 1][4] ;
+  }
+}
+
+/*
+  Samples all frames of target row (rt, st) into vals[ct*nframes + f].
+  valid[ct] is cleared where the reference loop leaves the target voxel
+  alone (the nearest source voxel is outside the source).
+*/
+template <typename S, int InterpCode, bool Nint2>
+static void mriVol2VolSampleRow(MRI *src, MRI_VOL2VOL_TERMS const *terms, int width, int rt, int st,
+                                float *vals, unsigned char *valid)
+{
+  int const nframes = src->nframes ;
+  int const depth = src->depth ;
+  float const rc = terms->row[0][rt], rr = terms->row[1][rt], rs = terms->row[2][rt] ;
+  float const sc = terms->slice[0][st], sr = terms->slice[1][st], ss = terms->slice[2][st] ;
+  float const *colc = &terms->col[0][0], *colr = &terms->col[1][0], *cols = &terms->col[2][0] ;
+
+  for (int c0 = 0; c0 < width; c0 += MRI_VOL2VOL_BLOCK) {
+    int const n = std::min(MRI_VOL2VOL_BLOCK, width - c0) ;
+    float fcs[MRI_VOL2VOL_BLOCK], frs[MRI_VOL2VOL_BLOCK], fss[MRI_VOL2VOL_BLOCK] ;
+    int ics[MRI_VOL2VOL_BLOCK], irs[MRI_VOL2VOL_BLOCK], iss[MRI_VOL2VOL_BLOCK] ;
+
+    for (int i = 0; i < n; i++) {
+      fcs[i] = ((colc[c0 + i] + rc) + sc) + terms->offset[0] ;
+      frs[i] = ((colr[c0 + i] + rr) + sr) + terms->offset[1] ;
+      fss[i] = ((cols[c0 + i] + rs) + ss) + terms->offset[2] ;
+    }
+    for (int i = 0; i < n; i++) {
+      ics[i] = mriVol2VolRound<Nint2>(fcs[i]) ;
+      irs[i] = mriVol2VolRound<Nint2>(frs[i]) ;
+      iss[i] = mriVol2VolRound<Nint2>(fss[i]) ;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int const ct = c0 + i ;
+      if (ics[i] < 0 || ics[i] >= src->width || irs[i] < 0 || irs[i] >= src->height || iss[i] < 0 ||
+          iss[i] >= src->depth) {
+        valid[ct] = 0 ;
+        continue ;
+      }
+      valid[ct] = 1 ;
+      float *valvect = &vals[ct * nframes] ;
+
+      if (InterpCode == SAMPLE_NEAREST) {
+        for (int f = 0; f < nframes; f++)
+          valvect[f] = (float)((S *)src->slices[iss[i] + f * depth][irs[i]])[ics[i]] ;
+        continue ;
+      }
+
+      // MRIsampleSeqVolume()
+      double x = fcs[i], y = frs[i], z = fss[i] ;
+      if (!(x >= 0 && x <= src->width - 1 && y >= 0 && y <= src->height - 1 && z >= 0 && z <= src->depth - 1)) {
+        float const nicol = rint(x), nirow = rint(y), nislice = rint(z) ;
+        if (!(nicol >= 0 && nicol < src->width && nirow >= 0 && nirow < src->height && nislice >= 0 &&
+              nislice < src->depth)) {
+          for (int f = 0; f < nframes; f++) valvect[f] = src->outside_val ;
+          continue ;
+        }
+      }
+
+      if (x >= src->width) x = src->width - 1.0 ;
+      if (y >= src->height) y = src->height - 1.0 ;
+      if (z >= src->depth) z = src->depth - 1.0 ;
+      if (x < 0.0) x = 0.0 ;
+      if (y < 0.0) y = 0.0 ;
+      if (z < 0.0) z = 0.0 ;
+
+      int const xm = MAX((int)x, 0) ;
+      int const xp = MIN(src->width - 1, xm + 1) ;
+      int const ym = MAX((int)y, 0) ;
+      int const yp = MIN(src->height - 1, ym + 1) ;
+      int const zm = MAX((int)z, 0) ;
+      int const zp = MIN(src->depth - 1, zm + 1) ;
+
+      double const xmd = x - (float)xm ;
+      double const ymd = y - (float)ym ;
+      double const zmd = z - (float)zm ;
+      double const xpd = (1.0f - xmd) ;
+      double const ypd = (1.0f - ymd) ;
+      double const zpd = (1.0f - zmd) ;
+
+      for (int f = 0; f < nframes; f++) {
+        S const *mm = (S const *)src->slices[zm + f * depth][ym] ;
+        S const *pm = (S const *)src->slices[zp + f * depth][ym] ;
+        S const *mp = (S const *)src->slices[zm + f * depth][yp] ;
+        S const *pp = (S const *)src->slices[zp + f * depth][yp] ;
+        valvect[f] = xpd * ypd * zpd * (double)mm[xm] + xpd * ypd * zmd * (double)pm[xm] +
+                     xpd * ymd * zpd * (double)mp[xm] + xpd * ymd * zmd * (double)pp[xm] +
+                     xmd * ypd * zpd * (double)mm[xp] + xmd * ypd * zmd * (double)pm[xp] +
+                     xmd * ymd * zpd * (double)mp[xp] + xmd * ymd * zmd * (double)pp[xp] ;
+      }
+    }
+  }
+}
+
+// MRIsetVoxVal(): clip, then round for the integer types
+template <typename T>
+static void mriVol2VolStoreRow(T *p, float const *vals, unsigned char const *valid, int width, int nframes, int f,
+                               float lo, float hi)
+{
+  for (int ct = 0; ct < width; ct++) {
+    if (!valid[ct]) continue ;
+    float v = vals[ct * nframes + f] ;
+    if (v < lo) v = lo ;
+    if (v > hi) v = hi ;
+    p[ct] = mriVol2VolRound<false>(v) ;
+  }
+}
+
+static void mriVol2VolStore(MRI *targ, int rt, int st, float const *vals, unsigned char const *valid)
+{
+  int const width = targ->width, nframes = targ->nframes ;
+
+  for (int f = 0; f < nframes; f++) {
+    void *row = targ->slices[st + f * targ->depth][rt] ;
+    switch (targ->type) {
+      case MRI_UCHAR:
+        mriVol2VolStoreRow((unsigned char *)row, vals, valid, width, nframes, f, 0, UCHAR_MAX) ;
+        break ;
+      case MRI_SHORT:
+        mriVol2VolStoreRow((short *)row, vals, valid, width, nframes, f, -32768, 32767) ;
+        break ;
+      case MRI_USHRT:
+        mriVol2VolStoreRow((unsigned short *)row, vals, valid, width, nframes, f, 0, USHRT_MAX) ;
+        break ;
+      case MRI_INT:
+        mriVol2VolStoreRow((int *)row, vals, valid, width, nframes, f, (float)INT_MIN, (float)INT_MAX) ;
+        break ;
+      case MRI_FLOAT: {
+        float *p = (float *)row ;
+        for (int ct = 0; ct < width; ct++)
+          if (valid[ct]) p[ct] = vals[ct * nframes + f] ;
+        break ;
+      }
+    }
+  }
+}
+
+typedef void (*MRI_VOL2VOL_ROW_FUNC)(MRI *, MRI_VOL2VOL_TERMS const *, int, int, int, float *, unsigned char *) ;
+
+template <typename S>
+static MRI_VOL2VOL_ROW_FUNC mriVol2VolRowFunc(int InterpCode, int use_nint2)
+{
+  if (InterpCode == SAMPLE_NEAREST)
+    return use_nint2 ? mriVol2VolSampleRow<S, SAMPLE_NEAREST, true> : mriVol2VolSampleRow<S, SAMPLE_NEAREST, false> ;
+  return use_nint2 ? mriVol2VolSampleRow<S, SAMPLE_TRILINEAR, true> : mriVol2VolSampleRow<S, SAMPLE_TRILINEAR, false> ;
+}
+
+int MRIvol2VolSample(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, int use_nint2)
+{
+  MRI_VOL2VOL_ROW_FUNC sampleRow ;
+  MRI_VOL2VOL_TERMS terms ;
+  int show_progress_thread, nthreads, nrows, row ;
+
+  if (InterpCode != SAMPLE_NEAREST && InterpCode != SAMPLE_TRILINEAR) return (ERROR_UNSUPPORTED) ;
+  if (!mriVol2VolTypeSupported(src->type) || !mriVol2VolTypeSupported(targ->type)) return (ERROR_UNSUPPORTED) ;
+  if (src->nframes != targ->nframes) return (ERROR_UNSUPPORTED) ;
+
+  switch (src->type) {
+    case MRI_UCHAR:
+      sampleRow = mriVol2VolRowFunc<unsigned char>(InterpCode, use_nint2) ;
+      break ;
+    case MRI_SHORT:
+      sampleRow = mriVol2VolRowFunc<short>(InterpCode, use_nint2) ;
+      break ;
+    case MRI_USHRT:
+      sampleRow = mriVol2VolRowFunc<unsigned short>(InterpCode, use_nint2) ;
+      break ;
+    case MRI_INT:
+      sampleRow = mriVol2VolRowFunc<int>(InterpCode, use_nint2) ;
+      break ;
+    default:
+      sampleRow = mriVol2VolRowFunc<float>(InterpCode, use_nint2) ;
+      break ;
+  }
+
+  mriVol2VolTerms(&terms, Vt2s, targ) ;
+
+  nthreads = omp_get_max_threads() ;
+  show_progress_thread = (nthreads == 1) ? 0 : nthreads - 1;  // avoid master thread
+  std::vector<std::vector<float> > vals(nthreads) ;
+  std::vector<std::vector<unsigned char> > valid(nthreads) ;
+
+  // rows of the target, slice-major, so the writes go through memory in order
+  nrows = targ->height * targ->depth ;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 4)
+#endif
+  for (row = 0; row < nrows; row++) {
+    ROMP_PFLB_begin
+    int const tid = omp_get_thread_num() ;
+    int const st = row / targ->height, rt = row % targ->height ;
+
+    std::vector<float> &v = vals[tid] ;
+    std::vector<unsigned char> &ok = valid[tid] ;
+    if (v.empty()) {
+      v.resize((size_t)targ->width * targ->nframes) ;
+      ok.resize(targ->width) ;
+    }
+
+    sampleRow(src, &terms, targ->width, rt, st, &v[0], &ok[0]) ;
+    mriVol2VolStore(targ, rt, st, &v[0], &ok[0]) ;
+
+    if (tid == show_progress_thread && rt == 0) exec_progress_callback(st, targ->depth, 0, 1) ;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR) ;
+}
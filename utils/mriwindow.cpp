@@ -0,0 +1,649 @@
+/**
+ * @brief sliding-window engine behind the mrifilter window filters
+ *
+ * Running-sum window means and incremental-histogram order statistics for
+ * MRImean(), MRImeanInMask(), MRImedian() and MRIorder(), and a threaded
+ * MRIstd()/MRIstdInMask(). See mriwindow.h.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "mri.h"
+#include "mriwindow.h"
+#include "utils.h"
+#include "romp_support.h"
+
+// Integer window sums are only guaranteed to come out like the reference
+// float accumulation while every partial sum is exactly representable.
+#define MRI_WINDOW_MAX_EXACT_SUM 16777216.0  // 2^24
+
+// Largest range of values (max-min+1) tracked with a histogram; wider
+// ranges use a partial selection instead.
+#define MRI_WINDOW_MAX_HISTO_BINS 65536
+
+int MRIwindowUseReference(void)
+{
+  static int use_reference = -1 ;
+
+  if (use_reference < 0)
+    use_reference = (getenv("FS_MRI_WINDOW_REFERENCE") != NULL) ;
+  return (use_reference) ;
+}
+
+static int mriWindowIsIntegral(const MRI *mri)
+{
+  switch (mri->type) {
+    case MRI_UCHAR:
+    case MRI_SHORT:
+    case MRI_USHRT:
+    case MRI_INT:
+    case MRI_LONG:
+      return (1) ;
+    default:
+      return (0) ;
+  }
+}
+
+static inline int mriWindowClamp(int i, int n)
+{
+  return (i < 0 ? 0 : i >= n ? n - 1 : i) ;
+}
+
+/*
+  Reads a frame of an integer-valued volume into an int array, through
+  MRIgetVoxVal() like the reference loops do.  Returns NULL if the type is
+  not integral or a value is too large to be held exactly by a float.
+*/
+static int *mriWindowLoadIntegral(MRI *mri, int frame, int *pmin, int *pmax)
+{
+  int const width = mri->width, height = mri->height, depth = mri->depth ;
+  int *vals, z, nbad = 0, vmin = 0, vmax = 0 ;
+
+  if (!mriWindowIsIntegral(mri)) return (NULL) ;
+
+  vals = (int *)malloc((size_t)width * height * depth * sizeof(int)) ;
+  if (!vals) ErrorExit(ERROR_NOMEMORY, "mriWindowLoadIntegral: could not allocate %dx%dx%d", width, height, depth) ;
+
+  vmin = INT_MAX ;
+  vmax = INT_MIN ;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+:nbad) reduction(min:vmin) reduction(max:vmax)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y ;
+    int *v = &vals[(size_t)z * width * height] ;
+    for (y = 0; y < height; y++) {
+      for (x = 0; x < width; x++, v++) {
+        float const f = MRIgetVoxVal(mri, x, y, z, frame) ;
+        if (!(fabs(f) < MRI_WINDOW_MAX_EXACT_SUM)) {
+          nbad++ ;
+          *v = 0 ;
+          continue ;
+        }
+        *v = (int)f ;
+        if (*v < vmin) vmin = *v ;
+        if (*v > vmax) vmax = *v ;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (nbad) {
+    free(vals) ;
+    return (NULL) ;
+  }
+  *pmin = vmin ;
+  *pmax = vmax ;
+  return (vals) ;
+}
+
+/*
+  Replaces a with its sums over a (2h+1)^3 box clipped to the volume, using
+  one running sum per axis.  tmp must have the size of a.  Returns the array
+  holding the result (tmp).
+*/
+static int *mriWindowBoxSums(int *a, int *tmp, int width, int height, int depth, int h)
+{
+  size_t const plane = (size_t)width * height ;
+  int y, z ;
+
+  // x: a -> tmp
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y ;
+    for (y = 0; y < height; y++) {
+      int const *in = &a[z * plane + (size_t)y * width] ;
+      int *out = &tmp[z * plane + (size_t)y * width] ;
+      int s = 0 ;
+      for (x = 0; x <= h && x < width; x++) s += in[x] ;
+      for (x = 0; x < width; x++) {
+        out[x] = s ;
+        if (x + h + 1 < width) s += in[x + h + 1] ;
+        if (x - h >= 0) s -= in[x - h] ;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // y: tmp -> a, each output row built from the previous one
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y ;
+    int const *in = &tmp[z * plane] ;
+    int *out = &a[z * plane] ;
+    for (x = 0; x < width; x++) out[x] = 0 ;
+    for (y = 0; y <= h && y < height; y++)
+      for (x = 0; x < width; x++) out[x] += in[(size_t)y * width + x] ;
+    for (y = 1; y < height; y++) {
+      int const *prev = &out[(size_t)(y - 1) * width] ;
+      int *row = &out[(size_t)y * width] ;
+      int const *add = (y + h < height) ? &in[(size_t)(y + h) * width] : NULL ;
+      int const *sub = (y - h - 1 >= 0) ? &in[(size_t)(y - h - 1) * width] : NULL ;
+      for (x = 0; x < width; x++) row[x] = prev[x] ;
+      if (add)
+        for (x = 0; x < width; x++) row[x] += add[x] ;
+      if (sub)
+        for (x = 0; x < width; x++) row[x] -= sub[x] ;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // z: a -> tmp, one row of every plane per iteration
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (y = 0; y < height; y++) {
+    ROMP_PFLB_begin
+    int x, z ;
+    size_t const row = (size_t)y * width ;
+    int *out = &tmp[row] ;
+    for (x = 0; x < width; x++) out[x] = 0 ;
+    for (z = 0; z <= h && z < depth; z++)
+      for (x = 0; x < width; x++) out[x] += a[z * plane + row + x] ;
+    for (z = 1; z < depth; z++) {
+      int const *prev = &tmp[(z - 1) * plane + row] ;
+      int *cur = &tmp[z * plane + row] ;
+      int const *add = (z + h < depth) ? &a[(z + h) * plane + row] : NULL ;
+      int const *sub = (z - h - 1 >= 0) ? &a[(z - h - 1) * plane + row] : NULL ;
+      for (x = 0; x < width; x++) cur[x] = prev[x] ;
+      if (add)
+        for (x = 0; x < width; x++) cur[x] += add[x] ;
+      if (sub)
+        for (x = 0; x < width; x++) cur[x] -= sub[x] ;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (tmp) ;
+}
+
+static inline int mriWindowExtent(int i, int h, int n)
+{
+  return (MIN(i + h, n - 1) - MAX(i - h, 0) + 1) ;
+}
+
+/*-----------------------------------------------------
+  MRIwindowMean() - MRImean() for integer-valued volumes. The reference
+  accumulates the window in a float; as long as the largest possible
+  window sum is below 2^24 that accumulation is exact, so the integer
+  running sums give the same quotients.
+------------------------------------------------------*/
+MRI *MRIwindowMean(MRI *mri_src, MRI *mri_dst, int whalf)
+{
+  int const width = mri_src->width, height = mri_src->height, depth = mri_src->depth ;
+  double const wcubed = (double)(2 * whalf + 1) * (2 * whalf + 1) * (2 * whalf + 1) ;
+  int frame, *tmp ;
+
+  if (whalf < 0 || !mriWindowIsIntegral(mri_src)) return (NULL) ;
+
+  tmp = (int *)malloc((size_t)width * height * depth * sizeof(int)) ;
+  if (!tmp) ErrorExit(ERROR_NOMEMORY, "MRIwindowMean: could not allocate %dx%dx%d", width, height, depth) ;
+
+  for (frame = 0; frame < mri_src->nframes; frame++) {
+    int vmin, vmax, z ;
+    int *vals = mriWindowLoadIntegral(mri_src, frame, &vmin, &vmax) ;
+    if (!vals || MAX(abs(vmin), abs(vmax)) * wcubed >= MRI_WINDOW_MAX_EXACT_SUM) {
+      // the frames done so far hold the reference values anyway
+      if (vals) free(vals) ;
+      free(tmp) ;
+      return (NULL) ;
+    }
+
+    int const *sums = mriWindowBoxSums(vals, tmp, width, height, depth, whalf) ;
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (z = 0; z < depth; z++) {
+      ROMP_PFLB_begin
+      int x, y ;
+      int const cz = mriWindowExtent(z, whalf, depth) ;
+      for (y = 0; y < height; y++) {
+        int const cy = mriWindowExtent(y, whalf, height) ;
+        int const *s = &sums[((size_t)z * height + y) * width] ;
+        for (x = 0; x < width; x++) {
+          float num = (float)(mriWindowExtent(x, whalf, width) * cy * cz) ;
+          float val = (float)s[x] ;
+          val /= num ;
+          MRIsetVoxVal(mri_dst, x, y, z, frame, val) ;
+        }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    free(vals) ;
+    exec_progress_callback(frame, mri_src->nframes, 0, 1) ;
+  }
+
+  free(tmp) ;
+  return (mri_dst) ;
+}
+
+/*-----------------------------------------------------
+  MRIwindowMeanInMask() - MRImeanInMask() for integer-valued volumes:
+  the masked values and the mask itself are summed separately.
+------------------------------------------------------*/
+MRI *MRIwindowMeanInMask(MRI *mri_src, MRI *mri_dst, MRI *mri_mask, int whalf)
+{
+  int const width = mri_src->width, height = mri_src->height, depth = mri_src->depth ;
+  size_t const nvox = (size_t)width * height * depth ;
+  double const wcubed = (double)(2 * whalf + 1) * (2 * whalf + 1) * (2 * whalf + 1) ;
+  int vmin, vmax, z, *vals, *mask, *tmp ;
+
+  if (whalf < 0 || !mriWindowIsIntegral(mri_src)) return (NULL) ;
+
+  vals = mriWindowLoadIntegral(mri_src, 0, &vmin, &vmax) ;
+  if (!vals) return (NULL) ;
+  if (MAX(abs(vmin), abs(vmax)) * wcubed >= MRI_WINDOW_MAX_EXACT_SUM) {
+    free(vals) ;
+    return (NULL) ;
+  }
+
+  mask = (int *)malloc(nvox * sizeof(int)) ;
+  tmp = (int *)malloc(nvox * sizeof(int)) ;
+  if (!mask || !tmp) ErrorExit(ERROR_NOMEMORY, "MRIwindowMeanInMask: could not allocate %dx%dx%d", width, height, depth) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y ;
+    size_t i = (size_t)z * width * height ;
+    for (y = 0; y < height; y++)
+      for (x = 0; x < width; x++, i++) {
+        mask[i] = (MRIgetVoxVal(mri_mask, x, y, z, 0) != 0) ;
+        if (!mask[i]) vals[i] = 0 ;
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // the mask is needed again below, so sum a copy of it
+  int *counts = (int *)malloc(nvox * sizeof(int)) ;
+  if (!counts) ErrorExit(ERROR_NOMEMORY, "MRIwindowMeanInMask: could not allocate %dx%dx%d", width, height, depth) ;
+  memcpy(counts, mask, nvox * sizeof(int)) ;
+
+  // the sums end up in tmp, after which vals is free to hold the counts
+  int const *sums = mriWindowBoxSums(vals, tmp, width, height, depth, whalf) ;
+  int const *nums = mriWindowBoxSums(counts, vals, width, height, depth, whalf) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y ;
+    size_t i = (size_t)z * width * height ;
+    for (y = 0; y < height; y++)
+      for (x = 0; x < width; x++, i++) {
+        if (!mask[i] || nums[i] == 0) continue ;
+        float val = (float)sums[i] ;
+        val /= nums[i] ;
+        MRIsetVoxVal(mri_dst, x, y, z, 0, val) ;
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(vals) ;
+  free(tmp) ;
+  free(counts) ;
+  free(mask) ;
+  return (mri_dst) ;
+}
+
+typedef struct
+{
+  int xmin, xmax, ymin, ymax, zmin, zmax ;
+  int xhalf, yhalf, zhalf ;
+  int order ;
+}
+MRI_WINDOW_ORDER ;
+
+/*
+  Huang's running-median histogram, extended to 3D: along each row of
+  voxels the window moves by one column of (2*yhalf+1)*(2*zhalf+1) values,
+  and the bin holding the order'th value is tracked incrementally
+  (lt = number of values in the bins below it).  bins[] holds value-min.
+*/
+static void mriWindowOrderRowHisto(MRI *mri_dst, int frame, const MRI_WINDOW_ORDER *wo, const unsigned short *bins,
+                                   int width, int height, int depth, int y, int z, int vmin, int *hist)
+{
+  size_t const plane = (size_t)width * height ;
+  int x, dx, dy, dz, mbin = 0, lt = 0 ;
+
+#define MRI_WINDOW_COLUMN(XC, OP)                                                         \
+  for (dz = -wo->zhalf; dz <= wo->zhalf; dz++) {                                          \
+    size_t const zoff = mriWindowClamp(z + dz, depth) * plane ;                          \
+    for (dy = -wo->yhalf; dy <= wo->yhalf; dy++) {                                        \
+      int const b = bins[zoff + (size_t)mriWindowClamp(y + dy, height) * width + (XC)] ; \
+      OP ;                                                                                \
+    }                                                                                     \
+  }
+
+  for (dx = -wo->xhalf; dx <= wo->xhalf; dx++) {
+    int const xc = mriWindowClamp(wo->xmin + dx, width) ;
+    MRI_WINDOW_COLUMN(xc, hist[b]++)
+  }
+
+  for (x = wo->xmin; x <= wo->xmax; x++) {
+    if (x > wo->xmin) {
+      int const xo = mriWindowClamp(x - 1 - wo->xhalf, width) ;
+      int const xn = mriWindowClamp(x + wo->xhalf, width) ;
+      MRI_WINDOW_COLUMN(xo, hist[b]--; if (b < mbin) lt--)
+      MRI_WINDOW_COLUMN(xn, hist[b]++; if (b < mbin) lt++)
+    }
+    while (lt > wo->order) {
+      mbin-- ;
+      lt -= hist[mbin] ;
+    }
+    while (lt + hist[mbin] <= wo->order) {
+      lt += hist[mbin] ;
+      mbin++ ;
+    }
+    MRIsetVoxVal(mri_dst, x, y, z, frame, (float)(vmin + mbin)) ;
+  }
+
+  // leave the histogram empty for the next row
+  for (dx = -wo->xhalf; dx <= wo->xhalf; dx++) {
+    int const xc = mriWindowClamp(wo->xmax + dx, width) ;
+    MRI_WINDOW_COLUMN(xc, hist[b]--)
+  }
+#undef MRI_WINDOW_COLUMN
+}
+
+/*
+  Any type: gather the window and select the order'th value.  Without NaNs
+  (and signed zeros, which compare equal to 0) the selected value is the one
+  the reference qsort puts there.
+*/
+static void mriWindowOrderRowSelect(MRI *mri_dst, int frame, const MRI_WINDOW_ORDER *wo, const float *vals,
+                                    int width, int height, int depth, int y, int z, float *buf)
+{
+  size_t const plane = (size_t)width * height ;
+  int x, dx, dy, dz ;
+
+  for (x = wo->xmin; x <= wo->xmax; x++) {
+    float *b = buf ;
+    for (dz = -wo->zhalf; dz <= wo->zhalf; dz++) {
+      size_t const zoff = mriWindowClamp(z + dz, depth) * plane ;
+      for (dy = -wo->yhalf; dy <= wo->yhalf; dy++) {
+        float const *row = &vals[zoff + (size_t)mriWindowClamp(y + dy, height) * width] ;
+        for (dx = -wo->xhalf; dx <= wo->xhalf; dx++) *b++ = row[mriWindowClamp(x + dx, width)] ;
+      }
+    }
+    std::nth_element(buf, buf + wo->order, b) ;
+    MRIsetVoxVal(mri_dst, x, y, z, frame, buf[wo->order]) ;
+  }
+}
+
+static float *mriWindowLoadFloat(MRI *mri, int frame)
+{
+  int const width = mri->width, height = mri->height, depth = mri->depth ;
+  int z, nbad = 0 ;
+  float *vals = (float *)malloc((size_t)width * height * depth * sizeof(float)) ;
+  if (!vals) ErrorExit(ERROR_NOMEMORY, "mriWindowLoadFloat: could not allocate %dx%dx%d", width, height, depth) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+:nbad)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y ;
+    float *v = &vals[(size_t)z * width * height] ;
+    for (y = 0; y < height; y++)
+      for (x = 0; x < width; x++, v++) {
+        *v = MRIgetVoxVal(mri, x, y, z, frame) ;
+        if (isnan(*v) || (*v == 0 && signbit(*v))) nbad++ ;
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (nbad) {
+    free(vals) ;
+    return (NULL) ;
+  }
+  return (vals) ;
+}
+
+/*-----------------------------------------------------
+  MRIwindowOrder() - order statistic of a clamped window, as computed by
+  MRImedian() and MRIorder().
+------------------------------------------------------*/
+MRI *MRIwindowOrder(MRI *mri_src, MRI *mri_dst, int xhalf, int yhalf, int zhalf,
+                    int order, int frame0, int nframes, MRI_REGION *box)
+{
+  int const width = mri_src->width, height = mri_src->height, depth = mri_src->depth ;
+  int const nwindow = (2 * xhalf + 1) * (2 * yhalf + 1) * (2 * zhalf + 1) ;
+  int const maxThreads = omp_get_max_threads() ;
+  MRI_WINDOW_ORDER wo ;
+  int frame, tid ;
+
+  if (xhalf < 0 || yhalf < 0 || zhalf < 0 || order < 0 || order >= nwindow) return (NULL) ;
+
+  wo.xhalf = xhalf ;
+  wo.yhalf = yhalf ;
+  wo.zhalf = zhalf ;
+  wo.order = order ;
+  if (box) {
+    wo.xmin = box->x ;
+    wo.ymin = box->y ;
+    wo.zmin = box->z ;
+    wo.xmax = box->x + box->dx - 1 ;
+    wo.ymax = box->y + box->dy - 1 ;
+    wo.zmax = box->z + box->dz - 1 ;
+    if (wo.xmin < 0 || wo.ymin < 0 || wo.zmin < 0 || wo.xmax >= width || wo.ymax >= height || wo.zmax >= depth)
+      return (NULL) ;  // the reference reads outside of the volume there
+  }
+  else {
+    wo.xmin = wo.ymin = wo.zmin = 0 ;
+    wo.xmax = width - 1 ;
+    wo.ymax = height - 1 ;
+    wo.zmax = depth - 1 ;
+  }
+  if (wo.xmax < wo.xmin || wo.ymax < wo.ymin || wo.zmax < wo.zmin) return (mri_dst) ;
+
+  int const ny = wo.ymax - wo.ymin + 1 ;
+  int const nrows = ny * (wo.zmax - wo.zmin + 1) ;
+
+  // per-thread scratch, allocated by the thread that uses it
+  void **scratch = (void **)calloc(maxThreads, sizeof(void *)) ;
+
+  for (frame = frame0; frame < frame0 + nframes; frame++) {
+    unsigned short *bins = NULL ;
+    float *vals = NULL ;
+    int vmin = 0, vmax = 0, row ;
+    int *ivals = mriWindowLoadIntegral(mri_src, frame, &vmin, &vmax) ;
+
+    if (ivals && (double)vmax - vmin + 1 <= MRI_WINDOW_MAX_HISTO_BINS) {
+      size_t i, nvox = (size_t)width * height * depth ;
+      bins = (unsigned short *)malloc(nvox * sizeof(unsigned short)) ;
+      if (!bins) ErrorExit(ERROR_NOMEMORY, "MRIwindowOrder: could not allocate %dx%dx%d", width, height, depth) ;
+      for (i = 0; i < nvox; i++) bins[i] = (unsigned short)(ivals[i] - vmin) ;
+    }
+    else if (!(vals = mriWindowLoadFloat(mri_src, frame))) {
+      if (ivals) free(ivals) ;
+      for (tid = 0; tid < maxThreads; tid++) free(scratch[tid]) ;
+      free(scratch) ;
+      return (NULL) ;  // NaNs - leave it all to the reference
+    }
+    if (ivals) free(ivals) ;
+
+    // a thread's scratch is either a histogram or a window buffer; drop
+    // the old kind when the path changes between frames
+    for (tid = 0; tid < maxThreads; tid++) {
+      free(scratch[tid]) ;
+      scratch[tid] = NULL ;
+    }
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+    for (row = 0; row < nrows; row++) {
+      ROMP_PFLB_begin
+      int const tid = omp_get_thread_num() ;
+      int const y = wo.ymin + row % ny ;
+      int const z = wo.zmin + row / ny ;
+      if (bins) {
+        if (!scratch[tid]) scratch[tid] = calloc(vmax - vmin + 1, sizeof(int)) ;
+        mriWindowOrderRowHisto(mri_dst, frame, &wo, bins, width, height, depth, y, z, vmin, (int *)scratch[tid]) ;
+      }
+      else {
+        if (!scratch[tid]) scratch[tid] = malloc(nwindow * sizeof(float)) ;
+        mriWindowOrderRowSelect(mri_dst, frame, &wo, vals, width, height, depth, y, z, (float *)scratch[tid]) ;
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    if (bins) free(bins) ;
+    if (vals) free(vals) ;
+    exec_progress_callback(frame - frame0, nframes, 0, 1) ;
+  }
+
+  for (tid = 0; tid < maxThreads; tid++) free(scratch[tid]) ;
+  free(scratch) ;
+  return (mri_dst) ;
+}
+
+/*-----------------------------------------------------
+  MRIwindowStd() - MRIstd()/MRIstdInMask(). The deviations are taken from
+  the caller's mean volume, so there is nothing to share between windows;
+  the reference order of summation is kept and only the volume access and
+  the threading are different.
+------------------------------------------------------*/
+MRI *MRIwindowStd(MRI *mri_src, MRI *mri_dst, MRI *mri_mean, MRI *mri_mask, int whalf)
+{
+  int const width = mri_src->width, height = mri_src->height, depth = mri_src->depth ;
+  size_t const plane = (size_t)width * height ;
+  char *mask = NULL ;
+  float *vals ;
+  int z ;
+
+  vals = (float *)malloc(plane * depth * sizeof(float)) ;
+  if (mri_mask) mask = (char *)malloc(plane * depth) ;
+  if (!vals || (mri_mask && !mask))
+    ErrorExit(ERROR_NOMEMORY, "MRIwindowStd: could not allocate %dx%dx%d", width, height, depth) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y ;
+    size_t i = z * plane ;
+    for (y = 0; y < height; y++)
+      for (x = 0; x < width; x++, i++) {
+        vals[i] = MRIgetVoxVal(mri_src, x, y, z, 0) ;
+        if (mask) mask[i] = (MRIgetVoxVal(mri_mask, x, y, z, 0) != 0) ;
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y, x0, y0, z0 ;
+    for (y = 0; y < height; y++) {
+      for (x = 0; x < width; x++) {
+        float wcubed, mean, variance, f ;
+        if (mask && !mask[z * plane + (size_t)y * width + x]) continue ;
+        mean = MRIgetVoxVal(mri_mean, x, y, z, 0) ;
+        wcubed = 0 ;
+        for (variance = 0.0f, z0 = MAX(z - whalf, 0); z0 <= MIN(z + whalf, depth - 1); z0++) {
+          for (y0 = MAX(y - whalf, 0); y0 <= MIN(y + whalf, height - 1); y0++) {
+            size_t const row = z0 * plane + (size_t)y0 * width ;
+            for (x0 = MAX(x - whalf, 0); x0 <= MIN(x + whalf, width - 1); x0++) {
+              if (mask && !mask[row + x0]) continue ;
+              wcubed++ ;
+              f = vals[row + x0] ;
+              f -= mean ;
+              variance += (f * f) ;
+            }
+          }
+        }
+        if (wcubed == 0) {
+          MRIsetVoxVal(mri_dst, x, y, z, 0, 0) ;
+        }
+        else {
+          MRIsetVoxVal(mri_dst, x, y, z, 0, sqrt(variance / wcubed)) ;
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(vals) ;
+  if (mask) free(mask) ;
+  return (mri_dst) ;
+}
@@ -26,10 +26,20 @@ static const int debug = 0;
 #endif
 
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
 #include <pthread.h>
 
+#include <algorithm>
+#include <vector>
+
+static void romp_prof_init();
+
 static void __attribute__((constructor)) before_main() 
 {
+    romp_prof_init();
     int n = omp_get_max_threads();
     if (n <= _MAX_FS_THREADS) return;
     omp_set_num_threads(_MAX_FS_THREADS);
@@ -114,9 +124,13 @@ static long cpuTimeUsed() {
 #endif
 }
 
+static void romp_prof_note_level(ROMP_level level, int went_parallel);
+
 int ROMP_if_parallel1(ROMP_level level)
 {
-    return (level >= romp_level);               // sadly this allows nested parallelism
+    int result = (level >= romp_level);         // sadly this allows nested parallelism
+    if (romp_prof_active) romp_prof_note_level(level, result);
+    return result;
 }                                               // sad only because it hasn't been analyzed
 
 static size_t countGoParallel;
@@ -456,6 +470,339 @@ void ROMP_show_stats(FILE* file)
 }
 
 
+// The always-compiled loop profiler, see romp_support.h
+//
+int          romp_prof_enabled;
+int volatile romp_prof_active;
+
+struct ROMP_prof_site {
+    ROMP_prof_site*        next;
+    ROMP_pf_static_struct* pf;
+    int  level;                 // from the last if_ROMP seen, -1 if none
+    int  max_threads;           // most threads seen running the body in one call
+    long calls;
+    long parallel_calls;        // if_ROMP decided to go parallel
+    long wall_ns, min_ns, max_ns;
+    long timed_calls;           // calls where the body was timed by ROMP_PFLB_begin/end
+    long iterations;
+    long thread_ns;             // sum over timed calls and threads of when the thread finished its share
+    long span_ns;               // sum over timed calls of when the last thread finished * #threads
+    long busy_ns[_MAX_FS_THREADS];
+};
+
+// Written by each thread as it runs the body of the current site, so kept a cache line apart
+//
+struct ROMP_prof_slot {
+    long iterations;
+    long last_ns;
+    char pad[64 - 2*sizeof(long)];
+};
+
+// The sites and slots may be updated by more than one thread entering sites from serial code,
+// for example threads started by ITK or std::thread, so the site statistics are updated under
+// prof_sites_lock, the slots atomically, and the site being run is per thread.
+//
+static ROMP_prof_slot   prof_slots[_MAX_FS_THREADS] __attribute__((aligned(64)));
+static int volatile     prof_slots_used;
+static ROMP_prof_site*  prof_sites;
+static pthread_mutex_t  prof_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_local ROMP_prof_site* prof_current;
+static thread_local long            prof_current_start_ns;
+static long             prof_process_start_ns;
+static const char*      prof_dir;
+static bool             prof_want_json, prof_want_csv;
+
+static long prof_now_ns() 
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int prof_tid()
+{
+#ifdef HAVE_OPENMP
+#undef omp_get_thread_num
+    return omp_get_thread_num();
+#define omp_get_thread_num romp_omp_get_thread_num
+#else
+    return 0;
+#endif
+}
+
+static bool prof_in_parallel()
+{
+#ifdef HAVE_OPENMP
+    return omp_in_parallel();
+#else
+    return false;
+#endif
+}
+
+static void romp_prof_exit_handler(void);
+
+static void romp_prof_init()
+{
+    prof_process_start_ns = prof_now_ns();
+
+    const char* dir = getenv("FS_ROMP_PROFILE");
+    if (!dir || !*dir) return;
+    prof_dir = dir;
+
+    const char* format = getenv("FS_ROMP_PROFILE_FORMAT");
+    prof_want_json = !format || !strcmp(format, "json") || !strcmp(format, "both");
+    prof_want_csv  = !format || !strcmp(format, "csv")  || !strcmp(format, "both");
+    if (!prof_want_json && !prof_want_csv) {
+        fprintf(stderr, "FS_ROMP_PROFILE_FORMAT=%s not json, csv or both, writing both\n", format);
+        prof_want_json = prof_want_csv = true;
+    }
+
+    romp_prof_enabled = 1;
+    atexit(romp_prof_exit_handler);
+}
+
+// Move what the threads recorded for the loop body into the site
+//
+// Called with prof_sites_lock held
+//
+static void prof_flush_slots(ROMP_prof_site* site, long start_ns)
+{
+    if (!__atomic_exchange_n(&prof_slots_used, 0, __ATOMIC_ACQ_REL)) return;
+
+    long iterations = 0, sum = 0, max = 0;
+    int  threads = 0;
+    for (int tid = 0; tid < _MAX_FS_THREADS; tid++) {
+        ROMP_prof_slot & slot = prof_slots[tid];
+        long const slot_iterations = __atomic_exchange_n(&slot.iterations, 0L, __ATOMIC_ACQ_REL);
+        if (!slot_iterations) continue;
+        long finished = std::max(0L, __atomic_load_n(&slot.last_ns, __ATOMIC_RELAXED) - start_ns);
+        site->busy_ns[tid] += finished;
+        iterations += slot_iterations;
+        sum += finished;
+        max = std::max(max, finished);
+        threads++;
+    }
+    if (!threads) return;
+
+    site->timed_calls++;
+    site->iterations += iterations;
+    site->thread_ns  += sum;
+    site->span_ns    += max * threads;
+    site->max_threads = std::max(site->max_threads, threads);
+}
+
+void ROMP_prof_begin(ROMP_pf_static_struct * pf_static, ROMP_prof_stack_struct * prof_stack)
+{
+    prof_stack->site = NULL;
+    if (prof_in_parallel()) return;     // charged to the enclosing site
+
+    ROMP_prof_site* site = (ROMP_prof_site*)__atomic_load_n(&pf_static->ptr, __ATOMIC_ACQUIRE);
+    if (!site) {
+        pthread_mutex_lock(&prof_sites_lock);
+        site = (ROMP_prof_site*)pf_static->ptr;
+        if (!site) {
+            site = (ROMP_prof_site*)calloc(1, sizeof(ROMP_prof_site));
+            site->pf    = pf_static;
+            site->level = -1;
+            site->next  = prof_sites;
+            prof_sites  = site;
+            __atomic_store_n(&pf_static->ptr, (void*)site, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&prof_sites_lock);
+    }
+
+    long now = prof_now_ns();
+    if (prof_current) {
+        pthread_mutex_lock(&prof_sites_lock);
+        prof_flush_slots(prof_current, prof_current_start_ns);
+        pthread_mutex_unlock(&prof_sites_lock);
+    }
+
+    prof_stack->site           = site;
+    prof_stack->outer          = prof_current;
+    prof_stack->outer_start_ns = prof_current_start_ns;
+    prof_stack->start_ns       = now;
+
+    // romp_prof_active counts the threads that are running a site
+    if (!prof_current) __atomic_add_fetch(&romp_prof_active, 1, __ATOMIC_RELAXED);
+    prof_current          = site;
+    prof_current_start_ns = now;
+}
+
+void ROMP_prof_end(ROMP_prof_stack_struct * prof_stack)
+{
+    ROMP_prof_site* site = prof_stack->site;
+    long wall = prof_now_ns() - prof_stack->start_ns;
+
+    pthread_mutex_lock(&prof_sites_lock);
+    prof_flush_slots(site, prof_stack->start_ns);
+    if (site->calls == 0 || wall < site->min_ns) site->min_ns = wall;
+    if (wall > site->max_ns) site->max_ns = wall;
+    site->wall_ns += wall;
+    site->calls++;
+    pthread_mutex_unlock(&prof_sites_lock);
+
+    prof_current          = prof_stack->outer;
+    prof_current_start_ns = prof_stack->outer_start_ns;
+    if (!prof_current) __atomic_sub_fetch(&romp_prof_active, 1, __ATOMIC_RELAXED);
+}
+
+void ROMP_prof_lb(int body_begin)
+{
+    int tid = prof_tid();
+    if (tid >= _MAX_FS_THREADS) return;
+    ROMP_prof_slot & slot = prof_slots[tid];
+    if (body_begin) __atomic_add_fetch(&slot.iterations, 1L, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot.last_ns, prof_now_ns(), __ATOMIC_RELAXED);
+    if (!prof_slots_used) __atomic_store_n(&prof_slots_used, 1, __ATOMIC_RELEASE);
+}
+
+static void romp_prof_note_level(ROMP_level level, int went_parallel)
+{
+    if (prof_in_parallel() || !prof_current) return;
+    pthread_mutex_lock(&prof_sites_lock);
+    prof_current->level = level;
+    if (went_parallel) prof_current->parallel_calls++;
+    pthread_mutex_unlock(&prof_sites_lock);
+}
+
+static std::vector<ROMP_prof_site*> prof_sorted_sites()
+{
+    std::vector<ROMP_prof_site*> sites;
+    pthread_mutex_lock(&prof_sites_lock);
+    for (ROMP_prof_site* site = prof_sites; site; site = site->next) 
+        if (site->calls) sites.push_back(site);
+    pthread_mutex_unlock(&prof_sites_lock);
+    std::sort(sites.begin(), sites.end(), 
+        [](ROMP_prof_site* a, ROMP_prof_site* b) { return a->wall_ns > b->wall_ns; });
+    return sites;
+}
+
+// Fraction of the threads' time spent waiting for the last one to finish, and max/mean of the finish times
+//
+static double prof_imbalance   (ROMP_prof_site* site) { return site->span_ns  ? 1.0 - (double)site->thread_ns / site->span_ns : 0.0; }
+static double prof_max_over_mean(ROMP_prof_site* site) { return site->thread_ns ? (double)site->span_ns / site->thread_ns : 1.0; }
+
+static const char* prof_program()
+{
+    const char* name = getMainFile();
+    return name ? name : "unknown";
+}
+
+void ROMP_prof_write_csv(FILE* file)
+{
+    fprintf(file, "program,pid,file,func,line,level,calls,parallel_calls,wall_ns,min_ns,max_ns,"
+                  "timed_calls,iterations,threads,thread_min_ns,thread_mean_ns,thread_max_ns,imbalance,max_over_mean\n");
+
+    std::vector<ROMP_prof_site*> sites = prof_sorted_sites();
+    for (ROMP_prof_site* site : sites) {
+        long tmin = 0, tmax = 0, tsum = 0; int n = 0;
+        for (int tid = 0; tid < _MAX_FS_THREADS; tid++) {
+            long busy = site->busy_ns[tid];
+            if (!busy) continue;
+            tmin = n ? std::min(tmin, busy) : busy;
+            tmax = std::max(tmax, busy);
+            tsum += busy;
+            n++;
+        }
+        fprintf(file, "\"%s\",%d,\"%s\",\"%s\",%u,%d,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%d,%ld,%ld,%ld,%.4f,%.4f\n",
+            prof_program(), (int)getpid(), site->pf->file, site->pf->func, site->pf->line, site->level,
+            site->calls, site->parallel_calls, site->wall_ns, site->min_ns, site->max_ns,
+            site->timed_calls, site->iterations, site->max_threads, tmin, n ? tsum / n : 0L, tmax,
+            prof_imbalance(site), prof_max_over_mean(site));
+    }
+}
+
+static void prof_json_string(FILE* file, const char* s)
+{
+    fputc('"', file);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(file, "\\%c", c);
+        else if (c < 0x20) fprintf(file, "\\u%04x", c);
+        else fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+void ROMP_prof_write_json(FILE* file)
+{
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0) strcpy(host, "unknown");
+    host[sizeof(host)-1] = 0;
+
+    fprintf(file, "{\n  \"program\": "); prof_json_string(file, prof_program());
+    fprintf(file, ",\n  \"host\": ");    prof_json_string(file, host);
+    fprintf(file, ",\n  \"pid\": %d", (int)getpid());
+    fprintf(file, ",\n  \"date\": ");    prof_json_string(file, currentDateTime(false).c_str());
+    fprintf(file, ",\n  \"wall_ns\": %ld", prof_now_ns() - prof_process_start_ns);
+    fprintf(file, ",\n  \"max_threads\": %d", omp_get_max_threads());
+    fprintf(file, ",\n  \"romp_level\": %d", (int)romp_level);
+
+    fprintf(file, ",\n  \"cmdline\": [");
+    FILE* cmdline = fopen("/proc/self/cmdline", "r");
+    if (cmdline) {
+        std::vector<char> arg;
+        int c, nargs = 0;
+        while ((c = fgetc(cmdline)) != EOF) {
+            if (c) { arg.push_back(c); continue; }
+            arg.push_back(0);
+            if (nargs++) fprintf(file, ", ");
+            prof_json_string(file, arg.data());
+            arg.clear();
+        }
+        fclose(cmdline);
+    }
+    fprintf(file, "]");
+
+    fprintf(file, ",\n  \"loops\": [");
+    std::vector<ROMP_prof_site*> sites = prof_sorted_sites();
+    for (size_t i = 0; i < sites.size(); i++) {
+        ROMP_prof_site* site = sites[i];
+        fprintf(file, "%s\n    {\"file\": ", i ? "," : "");  prof_json_string(file, site->pf->file);
+        fprintf(file, ", \"func\": ");                       prof_json_string(file, site->pf->func);
+        fprintf(file, ", \"line\": %u, \"level\": %d, \"calls\": %ld, \"parallel_calls\": %ld"
+                      ", \"wall_ns\": %ld, \"min_ns\": %ld, \"max_ns\": %ld"
+                      ", \"timed_calls\": %ld, \"iterations\": %ld, \"threads\": %d"
+                      ", \"imbalance\": %.4f, \"max_over_mean\": %.4f, \"thread_busy_ns\": [",
+            site->pf->line, site->level, site->calls, site->parallel_calls,
+            site->wall_ns, site->min_ns, site->max_ns,
+            site->timed_calls, site->iterations, site->max_threads,
+            prof_imbalance(site), prof_max_over_mean(site));
+        int last = _MAX_FS_THREADS - 1;
+        while (last >= 0 && !site->busy_ns[last]) last--;
+        for (int tid = 0; tid <= last; tid++) fprintf(file, "%s%ld", tid ? ", " : "", site->busy_ns[tid]);
+        fprintf(file, "]}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+static void romp_prof_exit_handler(void)
+{
+    if (!strcmp(prof_dir, "stderr")) {
+        ROMP_prof_write_csv(stderr);
+        return;
+    }
+
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0) strcpy(host, "unknown");
+    host[sizeof(host)-1] = 0;
+
+    for (int json = 0; json < 2; json++) {
+        if (json ? !prof_want_json : !prof_want_csv) continue;
+        char fname[4096];
+        snprintf(fname, sizeof(fname), "%s/%s.%s.%d.romp.%s", prof_dir, prof_program(), host, (int)getpid(), json ? "json" : "csv");
+        FILE* file = fopen(fname, "w");
+        if (!file) {
+            fprintf(stderr, "Could not create %s\n", fname);
+            continue;
+        }
+        if (json) ROMP_prof_write_json(file); else ROMP_prof_write_csv(file);
+        fclose(file);
+    }
+}
+
+
 void ROMP_Distributor_begin(ROMP_Distributor* distributor,
     int lo, int hi, 
     double* sumReducedDouble0, 
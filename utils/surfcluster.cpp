@@ -953,3 +953,236 @@ int sclustSaveAsPointSet(char *fname, SCS *scslist, int NClusters, MRIS *surf)
 
   return(0);
 }
+
+/*---------------------------------------------------------------
+  sclustUseReference() - returns 1 if FS_SURFCLUSTER_REFERENCE is
+  set in the environment, in which case callers should cluster once
+  per threshold with sclustMapSurfClusters() as before (eg, to
+  compare the two).
+  ---------------------------------------------------------------*/
+int sclustUseReference(void)
+{
+  static int UseReference = -1;
+  if (UseReference < 0) UseReference = (getenv("FS_SURFCLUSTER_REFERENCE") != NULL);
+  return (UseReference);
+}
+
+/*---------------------------------------------------------------
+  sclustTreeAlloc() - copies what the cluster tree needs from the
+  surface: the neighbors of each vertex and the vertex area that
+  SurfClusterSummary() would use (including the
+  FS_CLUSTER_USE_AVG_VERTEX_AREA option). The surface is not used
+  after this.
+  ---------------------------------------------------------------*/
+SURFCLUSTERTREE *sclustTreeAlloc(MRI_SURFACE *Surf)
+{
+  SURFCLUSTERTREE *sct;
+  int vtx, nbr, nnbrs, ClusterUseAvgVertexArea = 0;
+  double avgvertexarea;
+
+  if (Surf->group_avg_vtxarea_loaded)
+    avgvertexarea = Surf->group_avg_surface_area / Surf->nvertices;
+  else
+    avgvertexarea = Surf->total_area / Surf->nvertices;
+  if (getenv("FS_CLUSTER_USE_AVG_VERTEX_AREA") != NULL)
+    sscanf(getenv("FS_CLUSTER_USE_AVG_VERTEX_AREA"), "%d", &ClusterUseAvgVertexArea);
+
+  sct = (SURFCLUSTERTREE *)calloc(1, sizeof(SURFCLUSTERTREE));
+  sct->nvertices = Surf->nvertices;
+  sct->nbrstart = (int *)calloc(Surf->nvertices + 1, sizeof(int));
+  sct->area = (float *)calloc(Surf->nvertices, sizeof(float));
+
+  nnbrs = 0;
+  for (vtx = 0; vtx < Surf->nvertices; vtx++) nnbrs += Surf->vertices_topology[vtx].vnum;
+  sct->nbrs = (int *)calloc(nnbrs + 1, sizeof(int));
+
+  nnbrs = 0;
+  for (vtx = 0; vtx < Surf->nvertices; vtx++) {
+    sct->nbrstart[vtx] = nnbrs;
+    for (nbr = 0; nbr < Surf->vertices_topology[vtx].vnum; nbr++)
+      sct->nbrs[nnbrs++] = Surf->vertices_topology[vtx].v[nbr];
+    if (ClusterUseAvgVertexArea == 0) {
+      if (!Surf->group_avg_vtxarea_loaded)
+        sct->area[vtx] = Surf->vertices[vtx].area;
+      else
+        sct->area[vtx] = Surf->vertices[vtx].group_avg_area;
+    }
+    else
+      sct->area[vtx] = avgvertexarea;
+  }
+  sct->nbrstart[Surf->nvertices] = nnbrs;
+
+  return (sct);
+}
+
+/*---------------------------------------------------------------*/
+int sclustTreeFree(SURFCLUSTERTREE **psct)
+{
+  SURFCLUSTERTREE *sct = *psct;
+
+  if (sct == NULL) return (0);
+  free(sct->nbrstart);
+  free(sct->nbrs);
+  free(sct->area);
+  free(sct);
+  *psct = NULL;
+  return (0);
+}
+
+typedef struct
+{
+  float t;
+  int vtx;
+} SCLUST_SORTVAL;
+
+// decreasing value, then increasing vertex number
+static int sclustCompareSortVal(const void *a, const void *b)
+{
+  const SCLUST_SORTVAL *sa = (const SCLUST_SORTVAL *)a, *sb = (const SCLUST_SORTVAL *)b;
+  if (sa->t > sb->t) return (-1);
+  if (sa->t < sb->t) return (+1);
+  return (sa->vtx - sb->vtx);
+}
+
+static int sclustTreeFindRoot(int *parent, int vtx)
+{
+  while (parent[vtx] != vtx) {
+    parent[vtx] = parent[parent[vtx]];
+    vtx = parent[vtx];
+  }
+  return (vtx);
+}
+
+/*---------------------------------------------------------------
+  sclustTreeMaxClusters() - for each of the nthresh thresholds
+  thmin[k], gives what sclustMapSurfClusters(Surf, thmin[k], -1,
+  thsign, 0, ...) followed by sclustMaxClusterArea(),
+  sclustMaxClusterCount() and sclustMaxClusterWeightVtx() would
+  give when the vertex values are val (nvertices). Any of the outputs
+  can be NULL.
+
+  The values are sorted once, then the vertices are added to a
+  union-find forest in order of decreasing value, so the clusters
+  at a threshold are the trees of the forest once all the vertices
+  at or above it have been added. Lowering the threshold only merges
+  clusters, so all the thresholds are handled in one sweep without
+  regrowing anything. The areas and weights of the clusters at each
+  threshold are summed in vertex order, as SurfClusterSummary()
+  does, so the results are exactly those of the reference.
+
+  Nothing is stored in the surface, so this can be called from
+  several threads at once with the same tree.
+  ---------------------------------------------------------------*/
+int sclustTreeMaxClusters(const SURFCLUSTERTREE *sct, const float *val, int thsign,
+                          const double *thmin, int nthresh, int *nClusters,
+                          double *MaxArea, int *MaxCount, float *MaxWeightVtx)
+{
+  SCLUST_SORTVAL *sv;
+  int *parent, *order, *rank, *count, *roots;
+  float *area, t, th, maxw, w;
+  double *weight;
+  int nvtxs, nsorted, nadded, vtx, nbr, k, kk, n, r, u, nroots;
+
+  nvtxs = sct->nvertices;
+  sv = (SCLUST_SORTVAL *)calloc(nvtxs + 1, sizeof(SCLUST_SORTVAL));
+  rank = (int *)calloc(nvtxs, sizeof(int));
+  parent = (int *)calloc(nvtxs, sizeof(int));
+  count = (int *)calloc(nvtxs, sizeof(int));
+  roots = (int *)calloc(nvtxs + 1, sizeof(int));
+  area = (float *)calloc(nvtxs, sizeof(float));
+  weight = (double *)calloc(nvtxs, sizeof(double));
+  order = (int *)calloc(nthresh + 1, sizeof(int));
+
+  // value each vertex is compared to the threshold with, as in clustValueInRange()
+  nsorted = 0;
+  for (vtx = 0; vtx < nvtxs; vtx++) {
+    rank[vtx] = nvtxs;  // not added
+    t = val[vtx];
+    if (thsign == 0) t = fabs(t);
+    if (thsign == -1) t = -t;
+    if (isnan(t)) continue;
+    sv[nsorted].t = t;
+    sv[nsorted].vtx = vtx;
+    nsorted++;
+  }
+  qsort(sv, nsorted, sizeof(SCLUST_SORTVAL), sclustCompareSortVal);
+
+  // thresholds from highest to lowest
+  for (k = 0; k < nthresh; k++) order[k] = k;
+  for (k = 1; k < nthresh; k++) {
+    for (kk = k; kk > 0 && thmin[order[kk]] > thmin[order[kk - 1]]; kk--) {
+      n = order[kk];
+      order[kk] = order[kk - 1];
+      order[kk - 1] = n;
+    }
+  }
+
+  nadded = 0;
+  for (k = 0; k < nthresh; k++) {
+    th = thmin[order[k]];  // float, as passed to sclustMapSurfClusters()
+
+    // add the vertices at or above the threshold
+    while (nadded < nsorted && sv[nadded].t >= th) {
+      vtx = sv[nadded].vtx;
+      rank[vtx] = nadded;
+      parent[vtx] = vtx;
+      for (nbr = sct->nbrstart[vtx]; nbr < sct->nbrstart[vtx + 1]; nbr++) {
+        u = sct->nbrs[nbr];
+        if (rank[u] >= nadded) continue;  // not added yet
+        r = sclustTreeFindRoot(parent, u);
+        u = sclustTreeFindRoot(parent, vtx);
+        if (r < u)
+          parent[u] = r;
+        else if (u < r)
+          parent[r] = u;
+      }
+      nadded++;
+    }
+
+    // sum over the clusters in vertex order
+    nroots = 0;
+    for (vtx = 0; vtx < nvtxs; vtx++) {
+      if (rank[vtx] >= nadded) continue;
+      r = sclustTreeFindRoot(parent, vtx);
+      if (count[r] == 0) {
+        roots[nroots++] = r;
+        area[r] = 0;
+        weight[r] = 0;
+      }
+      count[r]++;
+      area[r] += sct->area[vtx];
+      weight[r] += val[vtx];
+    }
+
+    // same as sclustMaxClusterArea(), sclustMaxClusterCount() and
+    // sclustMaxClusterWeightVtx()
+    if (thsign == 0)
+      maxw = 0;
+    else
+      maxw = -thsign * 10e10;
+    if (nClusters) nClusters[order[k]] = nroots;
+    if (MaxArea) MaxArea[order[k]] = 0;
+    if (MaxCount) MaxCount[order[k]] = 0;
+    for (n = 0; n < nroots; n++) {
+      r = roots[n];
+      if (MaxArea && MaxArea[order[k]] < area[r]) MaxArea[order[k]] = area[r];
+      if (MaxCount && MaxCount[order[k]] < count[r]) MaxCount[order[k]] = count[r];
+      w = weight[r];
+      if (thsign == 0 && fabs(maxw) < fabs(w)) maxw = w;
+      if (thsign == +1 && maxw < w) maxw = w;
+      if (thsign == -1 && maxw > w) maxw = w;
+      count[r] = 0;
+    }
+    if (MaxWeightVtx) MaxWeightVtx[order[k]] = (nroots > 0) ? maxw : 0;
+  }
+
+  free(sv);
+  free(rank);
+  free(parent);
+  free(count);
+  free(roots);
+  free(area);
+  free(weight);
+  free(order);
+  return (0);
+}
@@ -0,0 +1,129 @@
+/*--------------------------------------------
+  MRISpositionSurface_bench_hot.cpp
+
+  Times the averaging and spring terms of an MRISpositionSurface
+  iteration (10 averages, spring, normal and tangential spring) on the
+  MRIS and on MRIS_HOT, including the loading and unloading of the hot
+  properties, and checks that both give the same gradient bit for bit.
+
+  Usage: MRISpositionSurface_bench_hot [surface [iterations]]
+
+  Without a surface, the bumpy sphere of ../bench_surface.h is used.
+  Exits non-zero if any vertex gets a different gradient.
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "diag.h"
+#include "mrisurf.h"
+#include "mrisurf_sseTerms.h"
+#include "mrisurf_compute_dxyz.h"
+#include "mrisurf_MRIS_HOT.h"
+#include "timer.h"
+#include "romp_support.h"
+#include "../bench_surface.h"
+
+// in utils/mrisurf_deform.h, which is not installed
+int mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring);
+
+const char *Progname;
+
+#define NAVGS     10
+#define L_SPRING  1.0
+#define L_NSPRING 0.5
+#define L_TSPRING 1.0
+
+static void setGradient(MRIS *mris, float const *g)
+{
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    v->dx = g[3*vno+0];
+    v->dy = g[3*vno+1];
+    v->dz = g[3*vno+2];
+  }
+}
+
+static void getGradient(MRIS *mris, float *g)
+{
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    g[3*vno+0] = v->dx;
+    g[3*vno+1] = v->dy;
+    g[3*vno+2] = v->dz;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  MRIS *mris;
+
+  Progname = argv[0];
+
+  if (argc > 1) {
+    mris = MRISread(argv[1]);
+    if (!mris) ErrorExit(ERROR_NOFILE, "%s: could not read surface %s", Progname, argv[1]);
+  }
+  else {
+    mris = benchBumpySphere();
+    MRIScomputeMetricProperties(mris);
+    mris->orig_area = 0.9 * mris->total_area;
+  }
+  int niters = argc > 2 ? atoi(argv[2]) : 20;
+
+  // a gradient that does not point the same way everywhere, and a few
+  // ripped and border vertices so every branch of the terms is taken
+  unsigned int seed = 1234;
+  float *g0   = (float *)malloc(3 * sizeof(float) * mris->nvertices);
+  float *gref = (float *)malloc(3 * sizeof(float) * mris->nvertices);
+  float *ghot = (float *)malloc(3 * sizeof(float) * mris->nvertices);
+  for (int i = 0; i < 3 * mris->nvertices; i++) g0[i] = (double)rand_r(&seed) / RAND_MAX - 0.5;
+  for (int vno = 0; vno < mris->nvertices; vno += 97) mris->vertices[vno].ripflag = 1;
+  for (int vno = 1; vno < mris->nvertices; vno += 89) mris->vertices[vno].border  = 1;
+  for (int vno = 2; vno < mris->nvertices; vno += 178) mris->vertices[vno].neg    = 1;
+
+  printf("%d vertices, %d iterations, %d threads\n", mris->nvertices, niters, omp_get_max_threads());
+
+  Timer timer;
+  for (int n = 0; n < niters; n++) {
+    setGradient(mris, g0);
+    mrisAverageSignedGradients(mris, NAVGS);
+    mrisComputeSpringTerm(mris, L_SPRING);
+    mrisComputeNormalSpringTerm(mris, L_NSPRING);
+    mrisComputeTangentialSpringTerm(mris, L_TSPRING);
+  }
+  double tref = timer.seconds();
+  getGradient(mris, gref);
+
+  MRIS_HOT hot;
+  MRISHOT_ctr(&hot);
+  timer.reset();
+  for (int n = 0; n < niters; n++) {
+    setGradient(mris, g0);
+    MRISHOT_load(&hot, mris);
+    MRISHOT_averageSignedGradients(&hot, NAVGS);
+    MRISHOT_computeSpringTerm(&hot, L_SPRING);
+    MRISHOT_computeNormalSpringTerm(&hot, L_NSPRING);
+    MRISHOT_computeTangentialSpringTerm(&hot, L_TSPRING);
+    MRISHOT_unloadGradient(mris, &hot);
+  }
+  double thot = timer.seconds();
+  getGradient(mris, ghot);
+  MRISHOT_dtr(&hot);
+
+  int ndiff = 0;
+  for (int vno = 0; vno < mris->nvertices; vno++)
+    if (memcmp(&gref[3*vno], &ghot[3*vno], 3 * sizeof(float))) ndiff++;
+
+  printf("per iteration: MRIS %.2fms, MRIS_HOT %.2fms (x%.1f), %d vertices differ\n",
+         1000.0 * tref / niters, 1000.0 * thot / niters, tref / thot, ndiff);
+
+  free(g0);
+  free(gref);
+  free(ghot);
+  MRISfree(&mris);
+
+  return ndiff ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+/*--------------------------------------------
+  MRISread_bench_cache.cpp
+
+  Times MRISread of a triangle file without the .fscache sidecar
+  (FS_MRIS_CACHE unset), when writing it, and when reading from it,
+  and checks that all three give the same surface.
+
+  Usage: MRISread_bench_cache [surface [reads]]
+
+  Without a surface, the bumpy sphere of ../bench_surface.h is written
+  to /tmp and used. The surface's sidecar is removed first and at the
+  end. Exits non-zero if the surfaces differ.
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "diag.h"
+#include "mrisurf.h"
+#include "timer.h"
+#include "../bench_surface.h"
+
+const char *Progname;
+
+static MRIS *timedRead(const char *fname, int nreads, double *pms)
+{
+  MRIS *mris = NULL;
+  Timer timer;
+  for (int n = 0; n < nreads; n++) {
+    if (mris) MRISfree(&mris);
+    mris = MRISread(fname);
+    if (!mris) ErrorExit(ERROR_NOFILE, "%s: could not read surface %s", Progname, fname);
+  }
+  *pms = 1000.0 * timer.seconds() / nreads;
+  return mris;
+}
+
+int main(int argc, char *argv[])
+{
+  char fname[STRLEN], cache_fname[STRLEN];
+
+  Progname = argv[0];
+
+  if (argc > 1) {
+    strcpy(fname, argv[1]);
+  }
+  else {
+    sprintf(fname, "/tmp/lh.MRISread_bench_cache.%d", (int)getpid());
+    MRIS *mris = benchBumpySphere();
+    MRISwrite(mris, fname);
+    MRISfree(&mris);
+  }
+  int nreads = argc > 2 ? atoi(argv[2]) : 5;
+
+  sprintf(cache_fname, "%s.fscache", fname);
+  unlink(cache_fname);
+
+  double tref, twrite, tread;
+
+  unsetenv("FS_MRIS_CACHE");
+  MRIS *mris_ref = timedRead(fname, nreads, &tref);
+
+  setenv("FS_MRIS_CACHE", "1", 1);
+  MRIS *mris_write = timedRead(fname, 1, &twrite);
+  if (access(cache_fname, R_OK)) ErrorExit(ERROR_BADFILE, "%s: %s was not written", Progname, cache_fname);
+  MRIS *mris_read = timedRead(fname, nreads, &tread);
+
+  printf("%d vertices: MRISread %.1fms, writing the cache %.1fms, from the cache %.1fms (x%.2f)\n",
+         mris_ref->nvertices, tref, twrite, tread, tref / tread);
+
+  // the hash covers the vertex and face fields, the neighbors and the distances
+  MRIS_HASH href, hwrite, hread;
+  mris_hash_init(&href,   mris_ref);
+  mris_hash_init(&hwrite, mris_write);
+  mris_hash_init(&hread,  mris_read);
+  int ndiff = 0;
+  if (hwrite.hash != href.hash) {
+    mris_print_diff(stdout, mris_ref, mris_write);
+    ndiff++;
+  }
+  if (hread.hash != href.hash) {
+    mris_print_diff(stdout, mris_ref, mris_read);
+    ndiff++;
+  }
+  printf("%s\n", ndiff ? "surfaces differ" : "surfaces are the same");
+
+  unlink(cache_fname);
+  if (argc <= 1) unlink(fname);
+  MRISfree(&mris_ref);
+  MRISfree(&mris_write);
+  MRISfree(&mris_read);
+
+  return ndiff ? 1 : 0;
+}
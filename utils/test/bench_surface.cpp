@@ -0,0 +1,29 @@
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+
+#include "icosahedron.h"
+#include "bench_surface.h"
+
+MRIS *benchBumpySphere(void)
+{
+  MRIS *mris = ic163842_make_surface(163842, 327680);
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    double r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    double s = (60.0 + 6.0 * sin(v->x / 7.0) * sin(v->y / 9.0) * cos(v->z / 8.0)) / r;
+    MRISsetXYZ(mris, vno, v->x * s, v->y * s, v->z * s);
+  }
+  return mris;
+}
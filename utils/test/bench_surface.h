@@ -0,0 +1,30 @@
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+/*--------------------------------------------
+  bench_surface.h
+
+  The surface the utils/test benches run on when they are not given one:
+  a bumpy ic7 sphere (163842 vertices, about the size of an lh.white).
+  The folding keeps hash buckets and neighborhoods from being uniformly
+  filled, and is the same on every run.
+  ----------------------------------------------*/
+
+#ifndef BENCH_SURFACE_H
+#define BENCH_SURFACE_H
+
+#include "mrisurf.h"
+
+MRIS *benchBumpySphere(void);
+
+#endif
@@ -0,0 +1,185 @@
+/*--------------------------------------------
+  mrishash_bench_300_frozen.cpp
+
+  Compares closest-vertex and closest-face queries, run from a parallel
+  loop, against the normal (locked) MHT and against the same table after
+  MHTfreeze(). Also times MHTrefreezeVertices() after moving a few
+  vertices, against building and freezing a new table.
+
+  Usage: mrishash_bench_300_frozen [surface]
+
+  Without a surface, the bumpy sphere of ../bench_surface.h is used.
+  Exits non-zero if the frozen table ever gives a different answer
+  from the locked one.
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "diag.h"
+#include "mrisurf.h"
+#include "mrishash.h"
+#include "timer.h"
+#include "romp_support.h"
+#include "../bench_surface.h"
+
+const char *Progname;
+
+#define NPROBES 2000000
+
+static void makeProbes(MRIS *mris, float *probes, int nprobes, unsigned int seed)
+{
+  for (int n = 0; n < nprobes; n++) {
+    VERTEX const *v = &mris->vertices[rand_r(&seed) % mris->nvertices];
+    probes[3*n+0] = v->x + 4.0 * ((double)rand_r(&seed) / RAND_MAX - 0.5);
+    probes[3*n+1] = v->y + 4.0 * ((double)rand_r(&seed) / RAND_MAX - 0.5);
+    probes[3*n+2] = v->z + 4.0 * ((double)rand_r(&seed) / RAND_MAX - 0.5);
+  }
+}
+
+static double findVertices(MRIS_HASH_TABLE *mht, MRIS *mris, float const *probes, int nprobes, int *vnos)
+{
+  Timer timer;
+  int n;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(experimental) schedule(static, 4096)
+#endif
+  for (n = 0; n < nprobes; n++) {
+    ROMP_PFLB_begin
+    float dist;
+    vnos[n] = MHTfindClosestVertexNoXYZ(mht, mris, probes[3*n], probes[3*n+1], probes[3*n+2], &dist);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  return timer.seconds();
+}
+
+static double findFaces(MRIS_HASH_TABLE *mht, MRIS *mris, float const *probes, int nprobes, int *fnos)
+{
+  Timer timer;
+  int n;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(experimental) schedule(static, 4096)
+#endif
+  for (n = 0; n < nprobes; n++) {
+    ROMP_PFLB_begin
+    double dist;
+    MHTfindClosestFaceNoGeneric(mht, mris, probes[3*n], probes[3*n+1], probes[3*n+2], 4.0, -1, -1, &fnos[n], &dist);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  return timer.seconds();
+}
+
+static int countDifferences(int const *a, int const *b, int n)
+{
+  int ndiff = 0;
+  for (int i = 0; i < n; i++) if (a[i] != b[i]) ndiff++;
+  return ndiff;
+}
+
+int main(int argc, char *argv[])
+{
+  MRIS *mris;
+  int nerrors = 0;
+
+  Progname = argv[0];
+
+  if (argc > 1) {
+    mris = MRISread(argv[1]);
+    if (!mris) ErrorExit(ERROR_NOFILE, "%s: could not read surface %s", Progname, argv[1]);
+  }
+  else {
+    mris = benchBumpySphere();
+  }
+  printf("%d vertices, %d faces, %d threads\n", mris->nvertices, mris->nfaces, omp_get_max_threads());
+
+  float *probes = (float *)malloc(3 * sizeof(float) * NPROBES);
+  int *locked = (int *)malloc(sizeof(int) * NPROBES);
+  int *frozen = (int *)malloc(sizeof(int) * NPROBES);
+  makeProbes(mris, probes, NPROBES, 1234);
+
+  // closest vertex
+  {
+    Timer timer;
+    MRIS_HASH_TABLE *mht = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, 2.0);
+    double build = timer.seconds();
+
+    MHT_maybeParallel_begin();
+    double tlocked = findVertices(mht, mris, probes, NPROBES, locked);
+    MHT_maybeParallel_end();
+
+    timer.reset();
+    MHTfreeze(mht);
+    double freeze = timer.seconds();
+    double tfrozen = findVertices(mht, mris, probes, NPROBES, frozen);
+
+    int ndiff = countDifferences(locked, frozen, NPROBES);
+    nerrors += ndiff;
+    printf("vertex table: build %.3fs freeze %.3fs, %d queries locked %.3fs frozen %.3fs (x%.1f), %d differ\n",
+           build, freeze, NPROBES, tlocked, tfrozen, tlocked / tfrozen, ndiff);
+
+    // move 1% of the vertices and refreeze just those
+    int nmoved = mris->nvertices / 100;
+    int *moved = (int *)malloc(sizeof(int) * nmoved);
+    for (int i = 0; i < nmoved; i++) {
+      int vno = moved[i] = (int)(((long)i * 7919) % mris->nvertices);
+      VERTEX const *v = &mris->vertices[vno];
+      MRISsetXYZ(mris, vno, v->x * 1.03, v->y * 1.03, v->z * 1.03);
+    }
+    timer.reset();
+    MHTrefreezeVertices(mht, moved, nmoved);
+    double refreeze = timer.seconds();
+
+    timer.reset();
+    MRIS_HASH_TABLE *mht2 = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, 2.0);
+    MHTfreeze(mht2);
+    double rebuild = timer.seconds();
+
+    findVertices(mht, mris, probes, NPROBES, frozen);
+    findVertices(mht2, mris, probes, NPROBES, locked);
+    ndiff = countDifferences(locked, frozen, NPROBES);
+    nerrors += ndiff;
+    printf("moved %d vertices: refreeze %.4fs, rebuild+freeze %.4fs, %d differ\n", nmoved, refreeze, rebuild, ndiff);
+
+    for (int i = 0; i < nmoved; i++) {
+      VERTEX const *v = &mris->vertices[moved[i]];
+      MRISsetXYZ(mris, moved[i], v->x / 1.03, v->y / 1.03, v->z / 1.03);
+    }
+    free(moved);
+    MHTfree(&mht2);
+    MHTfree(&mht);
+  }
+
+  // closest face
+  {
+    Timer timer;
+    MRIS_HASH_TABLE *mht = MHTcreateFaceTable_Resolution(mris, CURRENT_VERTICES, 2.0);
+    double build = timer.seconds();
+
+    MHT_maybeParallel_begin();
+    double tlocked = findFaces(mht, mris, probes, NPROBES, locked);
+    MHT_maybeParallel_end();
+
+    timer.reset();
+    MHTfreeze(mht);
+    double freeze = timer.seconds();
+    double tfrozen = findFaces(mht, mris, probes, NPROBES, frozen);
+
+    int ndiff = countDifferences(locked, frozen, NPROBES);
+    nerrors += ndiff;
+    printf("face table:   build %.3fs freeze %.3fs, %d queries locked %.3fs frozen %.3fs (x%.1f), %d differ\n",
+           build, freeze, NPROBES, tlocked, tfrozen, tlocked / tfrozen, ndiff);
+    MHTfree(&mht);
+  }
+
+  free(probes);
+  free(locked);
+  free(frozen);
+  MRISfree(&mris);
+
+  return nerrors ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/*--------------------------------------------
+  mrivol2vol_test_engine.cpp
+
+  Checks that MRIvol2VolSample() writes exactly the same target as the
+  FS_MRI_VOL2VOL_REFERENCE path of MRIvol2Vol(), ie the per-voxel loop
+  in mri2.cpp. Every source and target type the engine takes is run,
+  with nearest and trilinear interpolation, one and three frames, an
+  oblique vox2vox that maps part of the target outside the source, and
+  a single-slice source (where MRIvol2Vol() rounds with nint2()).
+
+  Usage: mrivol2vol_test_engine
+
+  Exits non-zero if any voxel differs.
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "error.h"
+#include "diag.h"
+#include "macros.h"
+#include "mri.h"
+#include "matrix.h"
+#include "mrivol2vol.h"
+
+const char *Progname;
+
+#define NTYPES 5
+static const int types[NTYPES] = {MRI_UCHAR, MRI_SHORT, MRI_USHRT, MRI_INT, MRI_FLOAT};
+
+static void fillSource(MRI *src, unsigned int *seed)
+{
+  for (int f = 0; f < src->nframes; f++)
+    for (int s = 0; s < src->depth; s++)
+      for (int r = 0; r < src->height; r++)
+        for (int c = 0; c < src->width; c++) {
+          double v = (double)rand_r(seed) / RAND_MAX;
+          switch (src->type) {
+            case MRI_UCHAR:
+              v = floor(255 * v);
+              break;
+            case MRI_SHORT:
+              v = floor(2000 * v) - 1000;
+              break;
+            case MRI_USHRT:
+              v = floor(4000 * v);
+              break;
+            case MRI_INT:
+              v = floor(200000 * v) - 100000;
+              break;
+            default:
+              v = 300 * v - 100;
+              break;
+          }
+          MRIsetVoxVal(src, c, r, s, f, v);
+        }
+}
+
+// target-to-source vox2vox: a rotation about z and x, a scaling and a shift
+static MATRIX *obliqueVox2Vox(MRI *src)
+{
+  MATRIX *m_rotz = MatrixReallocRotation(4, RADIANS(17.0), Z_ROTATION, NULL);
+  MATRIX *m_rotx = MatrixReallocRotation(4, RADIANS(-9.0), X_ROTATION, NULL);
+  MATRIX *m_scale = MatrixIdentity(4, NULL);
+  *MATRIX_RELT(m_scale, 1, 1) = 0.83;
+  *MATRIX_RELT(m_scale, 2, 2) = 0.91;
+  *MATRIX_RELT(m_scale, 3, 3) = 1.07;
+  MATRIX *m_tmp = MatrixMultiply(m_rotx, m_scale, NULL);
+  MATRIX *Vt2s = MatrixMultiply(m_rotz, m_tmp, NULL);
+  *MATRIX_RELT(Vt2s, 1, 4) = 0.3 * src->width + 0.37;
+  *MATRIX_RELT(Vt2s, 2, 4) = -0.1 * src->height + 0.21;
+  *MATRIX_RELT(Vt2s, 3, 4) = -1.6;
+  MatrixFree(&m_rotz);
+  MatrixFree(&m_rotx);
+  MatrixFree(&m_scale);
+  MatrixFree(&m_tmp);
+  return Vt2s;
+}
+
+// the slice half a voxel off, the case nint2() is there for, and every
+// other in-plane coordinate on a .5, where nint2() and nint() differ
+static MATRIX *sliceVox2Vox(void)
+{
+  MATRIX *Vt2s = MatrixIdentity(4, NULL);
+  *MATRIX_RELT(Vt2s, 1, 1) = 0.5;
+  *MATRIX_RELT(Vt2s, 2, 2) = 0.5;
+  *MATRIX_RELT(Vt2s, 3, 4) = 0.5;
+  return Vt2s;
+}
+
+static int compareEngine(MRI *src, int targ_type, MATRIX *Vt2s, int width, int height, int depth, int InterpCode)
+{
+  MRI *targ_ref = MRIallocSequence(width, height, depth, targ_type, src->nframes);
+  MRI *targ_eng = MRIallocSequence(width, height, depth, targ_type, src->nframes);
+  int ndiff = 0;
+
+  // voxels that map outside the source are left as they are
+  MRIvalueFill(targ_ref, 7);
+  MRIvalueFill(targ_eng, 7);
+
+  MRIvol2Vol(src, targ_ref, Vt2s, InterpCode, 0);
+  int use_nint2 = (src->width == 1 || src->height == 1 || src->depth == 1);
+  if (MRIvol2VolSample(src, targ_eng, Vt2s, InterpCode, use_nint2) != NO_ERROR) {
+    printf("src type %d targ type %d interp %d: the engine did not take it\n", src->type, targ_type, InterpCode);
+    ndiff++;
+  }
+  else {
+    for (int f = 0; f < src->nframes; f++)
+      for (int s = 0; s < depth; s++)
+        for (int r = 0; r < height; r++)
+          for (int c = 0; c < width; c++) {
+            float ref = MRIgetVoxVal(targ_ref, c, r, s, f);
+            float eng = MRIgetVoxVal(targ_eng, c, r, s, f);
+            if (ref != eng) {
+              if (ndiff < 5)
+                printf("src type %d targ type %d interp %d frames %d: (%d,%d,%d,%d) reference %.9g engine %.9g\n",
+                       src->type, targ_type, InterpCode, src->nframes, c, r, s, f, ref, eng);
+              ndiff++;
+            }
+          }
+  }
+
+  MRIfree(&targ_ref);
+  MRIfree(&targ_eng);
+  return ndiff;
+}
+
+int main(int argc, char *argv[])
+{
+  int ndiff = 0;
+  unsigned int seed = 1234;
+
+  Progname = argv[0];
+
+  // MRIvol2Vol() runs the reference loop with this set
+  setenv("FS_MRI_VOL2VOL_REFERENCE", "1", 1);
+  if (!MRIvol2VolUseReference()) {
+    printf("FS_MRI_VOL2VOL_REFERENCE is set but MRIvol2VolUseReference() is 0\n");
+    ndiff++;
+  }
+
+  for (int nframes = 1; nframes <= 3; nframes += 2)
+    for (int i = 0; i < NTYPES; i++) {
+      MRI *src = MRIallocSequence(37, 41, 23, types[i], nframes);
+      MRI *slice = MRIallocSequence(29, 31, 1, types[i], nframes);
+      fillSource(src, &seed);
+      fillSource(slice, &seed);
+      MATRIX *Vt2s = obliqueVox2Vox(src);
+      MATRIX *Vslice = sliceVox2Vox();
+
+      for (int j = 0; j < NTYPES; j++)
+        for (int interp = 0; interp < 2; interp++) {
+          int InterpCode = interp ? SAMPLE_TRILINEAR : SAMPLE_NEAREST;
+          ndiff += compareEngine(src, types[j], Vt2s, 45, 39, 31, InterpCode);
+          ndiff += compareEngine(slice, types[j], Vslice, 58, 62, 1, InterpCode);
+        }
+
+      MatrixFree(&Vt2s);
+      MatrixFree(&Vslice);
+      MRIfree(&src);
+      MRIfree(&slice);
+    }
+
+  printf("%s\n", ndiff ? "MRIvol2VolSample() differs from the reference" : "MRIvol2VolSample() matches the reference");
+  return ndiff ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+/*--------------------------------------------
+  surfcluster_test_tree.cpp
+
+  Checks that sclustTreeMaxClusters() gives, at every threshold, the
+  same number of clusters, largest area, largest count and largest
+  vertex weight as the FS_SURFCLUSTER_REFERENCE path of mri_mcsim,
+  ie sclustMapSurfClusters() once per threshold followed by
+  sclustMaxClusterArea(), sclustMaxClusterCount() and
+  sclustMaxClusterWeightVtx(). All three threshold signs are run,
+  with the vertex areas and with group average areas.
+
+  Usage: surfcluster_test_tree
+
+  Exits non-zero if any threshold differs.
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "error.h"
+#include "diag.h"
+#include "mrisurf.h"
+#include "surfcluster.h"
+#include "icosahedron.h"
+
+const char *Progname;
+
+#define NTHRESH 7
+static const double thresholds[NTHRESH] = {1.3, 2.0, 0.5, 4.0, 2.3, 3.0, 1.0};
+
+static int compareThresholds(MRIS *surf, float const *val, int thsign)
+{
+  int nClusters[NTHRESH], MaxCount[NTHRESH];
+  double MaxArea[NTHRESH];
+  float MaxWeightVtx[NTHRESH];
+  int ndiff = 0;
+
+  SURFCLUSTERTREE *sct = sclustTreeAlloc(surf);
+  sclustTreeMaxClusters(sct, val, thsign, thresholds, NTHRESH, nClusters, MaxArea, MaxCount, MaxWeightVtx);
+  sclustTreeFree(&sct);
+
+  for (int vno = 0; vno < surf->nvertices; vno++) surf->vertices[vno].val = val[vno];
+  for (int k = 0; k < NTHRESH; k++) {
+    int nref;
+    SCS *scs = sclustMapSurfClusters(surf, thresholds[k], -1, thsign, 0, &nref, NULL, NULL);
+    double area = sclustMaxClusterArea(scs, nref);
+    int count = sclustMaxClusterCount(scs, nref);
+    float weight = sclustMaxClusterWeightVtx(scs, nref, thsign);
+    if (scs) free(scs);
+
+    if (nref != nClusters[k] || area != MaxArea[k] || count != MaxCount[k] || weight != MaxWeightVtx[k]) {
+      printf("thsign %+d group %d thresh %g: reference %d clusters, area %.9g, count %d, weight %.9g; "
+             "tree %d clusters, area %.9g, count %d, weight %.9g\n",
+             thsign, surf->group_avg_vtxarea_loaded, thresholds[k],
+             nref, area, count, weight, nClusters[k], MaxArea[k], MaxCount[k], MaxWeightVtx[k]);
+      ndiff++;
+    }
+  }
+  return ndiff;
+}
+
+int main(int argc, char *argv[])
+{
+  int ndiff = 0;
+
+  Progname = argv[0];
+
+  // the reference path is what mri_mcsim runs with this set
+  setenv("FS_SURFCLUSTER_REFERENCE", "1", 1);
+  if (!sclustUseReference()) {
+    printf("FS_SURFCLUSTER_REFERENCE is set but sclustUseReference() is 0\n");
+    ndiff++;
+  }
+
+  MRIS *surf = ic163842_make_surface(163842, 327680);
+  MRIScomputeMetricProperties(surf);
+
+  // a smooth field of both signs with some noise, so there are many
+  // clusters at each threshold and they merge as it is lowered
+  unsigned int seed = 1234;
+  float *val = (float *)calloc(surf->nvertices, sizeof(float));
+  for (int vno = 0; vno < surf->nvertices; vno++) {
+    VERTEX const *v = &surf->vertices[vno];
+    val[vno] = 3.0 * sin(v->x / 13.0) * cos(v->y / 11.0) + 1.5 * sin(v->z / 7.0) +
+               ((double)rand_r(&seed) / RAND_MAX - 0.5);
+  }
+
+  double group_area = 0;
+  for (int vno = 0; vno < surf->nvertices; vno++) {
+    surf->vertices[vno].group_avg_area = surf->vertices[vno].area * (0.5 + (double)rand_r(&seed) / RAND_MAX);
+    group_area += surf->vertices[vno].group_avg_area;
+  }
+
+  for (int group = 0; group <= 1; group++) {
+    surf->group_avg_vtxarea_loaded = group;
+    surf->group_avg_surface_area = group_area;
+    for (int thsign = -1; thsign <= 1; thsign++) ndiff += compareThresholds(surf, val, thsign);
+  }
+
+  printf("%s\n", ndiff ? "cluster tree differs from the reference" : "cluster tree matches the reference");
+
+  free(val);
+  MRISfree(&surf);
+  return ndiff ? 1 : 0;
+}
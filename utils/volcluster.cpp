@@ -26,6 +26,7 @@
 #include "mri2.h"
 #include "randomfields.h"
 #include "resample.h"
+#include "romp_support.h"
 #include "transform.h"
 #include "utils.h"
 #define VOLCLUSTER_SRC
@@ -430,6 +431,436 @@ VOLCLUSTER *clustGrow(int col0, int row0, int slc0, MRI *HitMap, int AllowDiag,
   return (vc);
 }
 
+/*------------------------------------------------------------------------
+  clustUseReference() - returns 1 if FS_VOLCLUSTER_REFERENCE is set in
+  the environment, in which case the clusters are grown one voxel at a
+  time with clustGrow() as before (e.g. to compare the two).
+  ------------------------------------------------------------------------*/
+int clustUseReference(void)
+{
+  static int UseReference = -1;
+  if (UseReference < 0) UseReference = (getenv("FS_VOLCLUSTER_REFERENCE") != NULL);
+  return (UseReference);
+}
+
+/*------------------------------------------------------------------------
+  clustNbrOffsets() - neighbor offsets (col, row, slc) for 6-, 18- or
+  26-connectivity, in the order clustGrowOneVoxel() visits them. If
+  before is set, only the neighbors that come before the voxel in
+  col/row/slc order are returned. Returns the number of neighbors.
+  ------------------------------------------------------------------------*/
+static int clustNbrOffsets(int connectivity, int before, int dnbr[26][3])
+{
+  int dcol, drow, dslc, dsum, nnbrs;
+
+  nnbrs = 0;
+  for (dcol = -1; dcol <= +1; dcol++) {
+    for (drow = -1; drow <= +1; drow++) {
+      for (dslc = -1; dslc <= +1; dslc++) {
+        dsum = abs(dcol) + abs(drow) + abs(dslc);
+        if (dsum == 0) continue;
+        if (connectivity == 6 && dsum != 1) continue;
+        if (connectivity == 18 && dsum > 2) continue;
+        if (before && (dcol > 0 || (dcol == 0 && (drow > 0 || (drow == 0 && dslc > 0))))) continue;
+        dnbr[nnbrs][0] = dcol;
+        dnbr[nnbrs][1] = drow;
+        dnbr[nnbrs][2] = dslc;
+        nnbrs++;
+      }
+    }
+  }
+  return (nnbrs);
+}
+
+/* root of voxel v; every voxel points to a voxel that comes before it
+   (or to itself), so a root is the first voxel of its component */
+static inline int clustFindRoot(int *parent, int v)
+{
+  while (parent[v] != v) {
+    parent[v] = parent[parent[v]];
+    v = parent[v];
+  }
+  return (v);
+}
+
+static inline void clustUnion(int *parent, int a, int b)
+{
+  a = clustFindRoot(parent, a);
+  b = clustFindRoot(parent, b);
+  if (a < b)
+    parent[b] = a;
+  else if (b < a)
+    parent[a] = b;
+}
+
+/*------------------------------------------------------------------------
+  clustConnectedComponents() - labels the connected components of the
+  nonzero voxels of hit, a width x height x depth volume indexed by
+  slc + depth*(row + height*col), with 6-, 18- or 26-connectivity.
+
+  Two-pass union-find: the volume is cut into slabs of columns that
+  are scanned in parallel, each voxel being joined to the neighbors
+  already scanned; the slabs are then joined across their faces, and
+  a last pass numbers the components. Since each component is rooted
+  at its first voxel in col/row/slc order and the components are
+  numbered in that order, the result does not depend on the number of
+  threads: component n is the one clustGrow() would find n-th when
+  seeded from the hits in col/row/slc order.
+
+  label gets the component of each voxel (-1 outside). If not NULL,
+  nmembers and seed get the number of voxels in each component and
+  the index of its first voxel; they must be able to hold as many
+  components as there are hits. Returns the number of components.
+  ------------------------------------------------------------------------*/
+int clustConnectedComponents(
+    const unsigned char *hit, int width, int height, int depth, int connectivity, int *label, int *nmembers, int *seed)
+{
+  int dnbr[26][3], nnbrs, nslabs, nthslab, ncomp, v, nvox;
+
+  nvox = width * height * depth;
+  nnbrs = clustNbrOffsets(connectivity, 1, dnbr);
+
+  // label holds the union-find parents until the last pass
+  nslabs = 1;
+#ifdef HAVE_OPENMP
+  nslabs = omp_get_max_threads();
+#endif
+  if (nslabs > width) nslabs = width;
+  if (nslabs < 1) nslabs = 1;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (nthslab = 0; nthslab < nslabs; nthslab++) {
+    ROMP_PFLB_begin
+    int col0, col1, col, row, slc, n, c, r, s, v, w;
+
+    col0 = (int)(((long)width * nthslab) / nslabs);
+    col1 = (int)(((long)width * (nthslab + 1)) / nslabs);
+    for (col = col0; col < col1; col++) {
+      for (row = 0; row < height; row++) {
+        for (slc = 0; slc < depth; slc++) {
+          v = slc + depth * (row + height * col);
+          label[v] = v;
+          if (!hit[v]) continue;
+          for (n = 0; n < nnbrs; n++) {
+            c = col + dnbr[n][0];
+            if (c < col0) continue;  // joined across slabs below
+            r = row + dnbr[n][1];
+            if (r < 0 || r >= height) continue;
+            s = slc + dnbr[n][2];
+            if (s < 0 || s >= depth) continue;
+            w = s + depth * (r + height * c);
+            if (hit[w]) clustUnion(label, v, w);
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // join the first column of each slab to the last one of the previous
+  for (nthslab = 1; nthslab < nslabs; nthslab++) {
+    int col, row, slc, n, r, s, w;
+
+    col = (int)(((long)width * nthslab) / nslabs);
+    for (row = 0; row < height; row++) {
+      for (slc = 0; slc < depth; slc++) {
+        v = slc + depth * (row + height * col);
+        if (!hit[v]) continue;
+        for (n = 0; n < nnbrs; n++) {
+          if (dnbr[n][0] != -1) continue;
+          r = row + dnbr[n][1];
+          if (r < 0 || r >= height) continue;
+          s = slc + dnbr[n][2];
+          if (s < 0 || s >= depth) continue;
+          w = s + depth * (r + height * (col - 1));
+          if (hit[w]) clustUnion(label, v, w);
+        }
+      }
+    }
+  }
+
+  // parents come first, so they are already numbered
+  ncomp = 0;
+  for (v = 0; v < nvox; v++) {
+    if (!hit[v]) {
+      label[v] = -1;
+      continue;
+    }
+    if (label[v] == v) {
+      if (nmembers) nmembers[ncomp] = 0;
+      if (seed) seed[ncomp] = v;
+      label[v] = ncomp++;
+    }
+    else
+      label[v] = label[label[v]];
+    if (nmembers) nmembers[label[v]]++;
+  }
+
+  return (ncomp);
+}
+
+/*------------------------------------------------------------------------
+  clustGrowComponents() - builds the VOLCLUSTER of each connected
+  component of hit (see clustConnectedComponents()). The members are
+  listed in the order clustGrow() adds them when seeded at the first
+  voxel of the component. The components are grown in parallel; each
+  one only touches its own voxels.
+  ------------------------------------------------------------------------*/
+static VOLCLUSTER **clustGrowComponents(
+    const unsigned char *hit, int width, int height, int depth, int AllowDiag, float voxsize, int *nclusters)
+{
+  VOLCLUSTER **vclist;
+  int *label, *nmembers, *seed, nhits, ncomp, nthcomp, v, nvox, connectivity, dnbr[26][3], nnbrs;
+  unsigned char *added;
+
+  nvox = width * height * depth;
+  nhits = 0;
+  for (v = 0; v < nvox; v++)
+    if (hit[v]) nhits++;
+
+  connectivity = AllowDiag ? 26 : 6;
+  label = (int *)calloc(nvox, sizeof(int));
+  nmembers = (int *)calloc(nhits + 1, sizeof(int));
+  seed = (int *)calloc(nhits + 1, sizeof(int));
+  ncomp = clustConnectedComponents(hit, width, height, depth, connectivity, label, nmembers, seed);
+  free(label);
+
+  nnbrs = clustNbrOffsets(connectivity, 0, dnbr);
+  added = (unsigned char *)calloc(nvox, sizeof(unsigned char));
+  vclist = clustAllocClusterList(ncomp + 1);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (nthcomp = 0; nthcomp < ncomp; nthcomp++) {
+    ROMP_PFLB_begin
+    VOLCLUSTER *vc;
+    int nadded, nthmember, col0, row0, slc0, col, row, slc, n, w;
+
+    vc = clustAllocCluster(nmembers[nthcomp]);
+    vc->voxsize = voxsize;
+
+    // breadth-first, like clustGrow()
+    w = seed[nthcomp];
+    vc->col[0] = w / (height * depth);
+    vc->row[0] = (w / depth) % height;
+    vc->slc[0] = w % depth;
+    added[w] = 1;
+    nadded = 1;
+    for (nthmember = 0; nthmember < nadded; nthmember++) {
+      col0 = vc->col[nthmember];
+      row0 = vc->row[nthmember];
+      slc0 = vc->slc[nthmember];
+      for (n = 0; n < nnbrs; n++) {
+        col = col0 + dnbr[n][0];
+        if (col < 0 || col >= width) continue;
+        row = row0 + dnbr[n][1];
+        if (row < 0 || row >= height) continue;
+        slc = slc0 + dnbr[n][2];
+        if (slc < 0 || slc >= depth) continue;
+        w = slc + depth * (row + height * col);
+        if (!hit[w] || added[w]) continue;
+        added[w] = 1;
+        vc->col[nadded] = col;
+        vc->row[nadded] = row;
+        vc->slc[nadded] = slc;
+        nadded++;
+      }
+    }
+    vclist[nthcomp] = vc;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(added);
+  free(nmembers);
+  free(seed);
+
+  *nclusters = ncomp;
+  return (vclist);
+}
+
+/*------------------------------------------------------------------------
+  clustGrowAll() - same clusters as calling clustGrow() (with no limit
+  on the number of passes) on each voxel of HitMap still at 0, in
+  col/row/slc order, which is what mri_volcluster does with the hits
+  of clustInitHitMap(). Like clustGrow(), sets HitMap to 1 in the
+  clusters. Returns the list of clusters; the number of clusters is
+  returned in nclusters.
+  ------------------------------------------------------------------------*/
+VOLCLUSTER **clustGrowAll(MRI *HitMap, int AllowDiag, int *nclusters)
+{
+  VOLCLUSTER **vclist;
+  unsigned char *hit;
+  int col, nvox, n, m;
+
+  nvox = HitMap->width * HitMap->height * HitMap->depth;
+  hit = (unsigned char *)calloc(nvox, sizeof(unsigned char));
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (col = 0; col < HitMap->width; col++) {
+    ROMP_PFLB_begin
+    int row, slc;
+    for (row = 0; row < HitMap->height; row++)
+      for (slc = 0; slc < HitMap->depth; slc++)
+        hit[slc + HitMap->depth * (row + HitMap->height * col)] = (MRIgetVoxVal(HitMap, col, row, slc, 0) == 0);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  vclist = clustGrowComponents(hit, HitMap->width, HitMap->height, HitMap->depth, AllowDiag,
+                               HitMap->xsize * HitMap->ysize * HitMap->zsize, nclusters);
+  free(hit);
+
+  for (n = 0; n < *nclusters; n++)
+    for (m = 0; m < vclist[n]->nmembers; m++)
+      MRIsetVoxVal(HitMap, vclist[n]->col[m], vclist[n]->row[m], vclist[n]->slc[m], 0, 1);
+
+  return (vclist);
+}
+
+/*------------------------------------------------------------------------
+  clustThresholdHits() - sets hit to 1 where the voxel is in the mask
+  (if any) and in the threshold range, as clustInitHitMap() does.
+  hit is indexed by slc + depth*(row + height*col). Returns the number
+  of hits.
+  ------------------------------------------------------------------------*/
+static int clustThresholdHits(
+    MRI *vol, int frame, float thmin, float thmax, int thsign, MRI *binmask, int maskframe, unsigned char *hit)
+{
+  int col, nhits;
+
+  nhits = 0;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : nhits)
+#endif
+  for (col = 0; col < vol->width; col++) {
+    ROMP_PFLB_begin
+    int row, slc, v, maskval;
+    float val;
+    for (row = 0; row < vol->height; row++) {
+      for (slc = 0; slc < vol->depth; slc++) {
+        v = slc + vol->depth * (row + vol->height * col);
+        hit[v] = 0;
+        if (binmask != NULL) {
+          maskval = MRIgetVoxVal(binmask, col, row, slc, maskframe);
+          if (maskval == 0) continue;
+        }
+        val = MRIgetVoxVal(vol, col, row, slc, frame);
+        if (clustValueInRange(val, thmin, thmax, thsign)) {
+          hit[v] = 1;
+          nhits++;
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (nhits);
+}
+
+/*------------------------------------------------------------------------
+  clustGetClusterSummary() - clusters of the voxels of vol in the
+  threshold range (and in binmask, if not NULL), as clustGetClusters()
+  finds them before pruning and sorting, but without member lists:
+  only the size, the maximum and the centroid of each cluster. Meant
+  for simulations, which only need the size of the largest cluster.
+  ------------------------------------------------------------------------*/
+VOLCLUSTERSUMMARY *clustGetClusterSummary(
+    MRI *vol, int frame, float threshmin, float threshmax, int threshsign, MRI *binmask, int AllowDiag)
+{
+  VOLCLUSTERSUMMARY *vcs;
+  unsigned char *hit;
+  int *label, *seed, nvox, nhits, n, col, row, slc;
+  float val, val0;
+  double *csum;
+
+  nvox = vol->width * vol->height * vol->depth;
+  hit = (unsigned char *)calloc(nvox, sizeof(unsigned char));
+  nhits = clustThresholdHits(vol, frame, threshmin, threshmax, threshsign, binmask, 0, hit);
+
+  vcs = (VOLCLUSTERSUMMARY *)calloc(1, sizeof(VOLCLUSTERSUMMARY));
+  vcs->nmembers = (int *)calloc(nhits + 1, sizeof(int));
+  label = (int *)calloc(nvox, sizeof(int));
+  seed = (int *)calloc(nhits + 1, sizeof(int));
+  vcs->nclusters =
+      clustConnectedComponents(hit, vol->width, vol->height, vol->depth, AllowDiag ? 26 : 6, label, vcs->nmembers, seed);
+  free(seed);
+  free(hit);
+
+  n = vcs->nclusters + 1;
+  vcs->maxcol = (int *)calloc(n, sizeof(int));
+  vcs->maxrow = (int *)calloc(n, sizeof(int));
+  vcs->maxslc = (int *)calloc(n, sizeof(int));
+  vcs->maxval = (float *)calloc(n, sizeof(float));
+  vcs->ccol = (float *)calloc(n, sizeof(float));
+  vcs->crow = (float *)calloc(n, sizeof(float));
+  vcs->cslc = (float *)calloc(n, sizeof(float));
+  csum = (double *)calloc(3 * n, sizeof(double));
+
+  // one pass for the maxima (as in clustMaxMember()) and the centroids
+  vcs->maxnmembers = 0;
+  for (col = 0; col < vol->width; col++) {
+    for (row = 0; row < vol->height; row++) {
+      for (slc = 0; slc < vol->depth; slc++) {
+        n = label[slc + vol->depth * (row + vol->height * col)];
+        if (n < 0) continue;
+        val0 = MRIgetVoxVal(vol, col, row, slc, frame);
+        val = val0;
+        if (threshsign == 0) val = fabs(val0);
+        if (threshsign == -1) val = -val0;
+        if (fabs(vcs->maxval[n]) < val) {
+          vcs->maxval[n] = val0;
+          vcs->maxcol[n] = col;
+          vcs->maxrow[n] = row;
+          vcs->maxslc[n] = slc;
+        }
+        csum[3 * n] += col;
+        csum[3 * n + 1] += row;
+        csum[3 * n + 2] += slc;
+      }
+    }
+  }
+  for (n = 0; n < vcs->nclusters; n++) {
+    vcs->ccol[n] = csum[3 * n] / vcs->nmembers[n];
+    vcs->crow[n] = csum[3 * n + 1] / vcs->nmembers[n];
+    vcs->cslc[n] = csum[3 * n + 2] / vcs->nmembers[n];
+    if (vcs->nmembers[n] > vcs->maxnmembers) vcs->maxnmembers = vcs->nmembers[n];
+  }
+
+  free(csum);
+  free(label);
+  return (vcs);
+}
+
+/*------------------------------------------------------------------------*/
+int clustFreeClusterSummary(VOLCLUSTERSUMMARY **pvcs)
+{
+  VOLCLUSTERSUMMARY *vcs = *pvcs;
+
+  if (vcs == NULL) return (0);
+  free(vcs->nmembers);
+  free(vcs->maxcol);
+  free(vcs->maxrow);
+  free(vcs->maxslc);
+  free(vcs->maxval);
+  free(vcs->ccol);
+  free(vcs->crow);
+  free(vcs->cslc);
+  free(vcs);
+  *pvcs = NULL;
+  return (0);
+}
+
 /*-------------------------------------------------------------------*/
 int clustMaxMember(VOLCLUSTER *vc, MRI *vol, int frame, int thsign)
 {
@@ -790,50 +1221,73 @@ VOLCLUSTER **clustGetClusters(MRI *vol,
 
   voxsizemm3 = vol->xsize * vol->ysize * vol->zsize;
 
-  /* Initialize the hit map - this is a map of voxels that have been
-     accounted for as either outside of a the threshold range or
-     belonging to a cluster. The initialization is for thresholding */
-  HitMap = clustInitHitMap(vol, frame, threshmin, threshmax, threshsign, &nhits, &hitcol, &hitrow, &hitslc, binmask, 0);
-  if (HitMap == NULL) {
-    // Nothing survived the first thresholding
-    *nClusters = 0;
-    return (NULL);
+  if (!clustUseReference()) {
+    /* Threshold and label the connected components in one go; the
+       clusters are the same, in the same order, as those grown below */
+    unsigned char *hit;
+    hit = (unsigned char *)calloc(vol->width * vol->height * vol->depth, sizeof(unsigned char));
+    nhits = clustThresholdHits(vol, frame, threshmin, threshmax, threshsign, binmask, 0, hit);
+    if (nhits == 0) {
+      // Nothing survived the first thresholding
+      free(hit);
+      *nClusters = 0;
+      return (NULL);
+    }
+    if (Gdiag_no > 0) printf("INFO: Found %d voxels in threhold range\n", nhits);
+    ClusterList = clustGrowComponents(hit, vol->width, vol->height, vol->depth, allowdiag, voxsizemm3, &nclusters);
+    free(hit);
+    for (nthhit = 0; nthhit < nclusters; nthhit++) {
+      clustMaxMember(ClusterList[nthhit], vol, frame, threshsign);
+      if (XFM) clustComputeTal(ClusterList[nthhit], XFM);
+    }
+    HitMap = NULL;
   }
-  if (Gdiag_no > 0) printf("INFO: Found %d voxels in threhold range\n", nhits);
+  else {
+    /* Initialize the hit map - this is a map of voxels that have been
+       accounted for as either outside of a the threshold range or
+       belonging to a cluster. The initialization is for thresholding */
+    HitMap = clustInitHitMap(vol, frame, threshmin, threshmax, threshsign, &nhits, &hitcol, &hitrow, &hitslc, binmask, 0);
+    if (HitMap == NULL) {
+      // Nothing survived the first thresholding
+      *nClusters = 0;
+      return (NULL);
+    }
+    if (Gdiag_no > 0) printf("INFO: Found %d voxels in threhold range\n", nhits);
 
-  /* Allocate an array of clusters equal to the number of hits -- this
-     is the maximum number of clusters possible */
-  ClusterList = clustAllocClusterList(nhits);
-  if (ClusterList == NULL) {
-    printf("ERROR: could not alloc %d clusters\n", nhits);
-    return (NULL);
-  }
+    /* Allocate an array of clusters equal to the number of hits -- this
+       is the maximum number of clusters possible */
+    ClusterList = clustAllocClusterList(nhits);
+    if (ClusterList == NULL) {
+      printf("ERROR: could not alloc %d clusters\n", nhits);
+      return (NULL);
+    }
 
-  nclusters = 0;
-  for (nthhit = 0; nthhit < nhits; nthhit++) {
-    /* Determine whether this hit is still valid. It may
-       not be if it was assigned to the cluster of a
-       previous hit */
-    col = hitcol[nthhit];
-    row = hitrow[nthhit];
-    slc = hitslc[nthhit];
-    if (MRIgetVoxVal(HitMap, col, row, slc, 0)) continue;
+    nclusters = 0;
+    for (nthhit = 0; nthhit < nhits; nthhit++) {
+      /* Determine whether this hit is still valid. It may
+         not be if it was assigned to the cluster of a
+         previous hit */
+      col = hitcol[nthhit];
+      row = hitrow[nthhit];
+      slc = hitslc[nthhit];
+      if (MRIgetVoxVal(HitMap, col, row, slc, 0)) continue;
 
-    /* Grow cluster using this hit as a seed */
-    ClusterList[nclusters] = clustGrow(col, row, slc, HitMap, allowdiag, -1);
-    ClusterList[nclusters]->voxsize = voxsizemm3;
+      /* Grow cluster using this hit as a seed */
+      ClusterList[nclusters] = clustGrow(col, row, slc, HitMap, allowdiag, -1);
+      ClusterList[nclusters]->voxsize = voxsizemm3;
 
-    /* Determine the member with the maximum value */
-    clustMaxMember(ClusterList[nclusters], vol, frame, threshsign);
+      /* Determine the member with the maximum value */
+      clustMaxMember(ClusterList[nclusters], vol, frame, threshsign);
 
-    if (XFM) clustComputeTal(ClusterList[nclusters], XFM);
+      if (XFM) clustComputeTal(ClusterList[nclusters], XFM);
 
-    /* increment the number of clusters */
-    nclusters++;
+      /* increment the number of clusters */
+      nclusters++;
+    }
+    free(hitcol);
+    free(hitrow);
+    free(hitslc);
   }
-  free(hitcol);
-  free(hitrow);
-  free(hitslc);
 
   if (Gdiag_no > 0) printf("INFO: Found %d clusters that meet threshold criteria\n", nclusters);
 
@@ -859,7 +1313,7 @@ VOLCLUSTER **clustGetClusters(MRI *vol,
   clustFreeClusterList(&ClusterList, nclusters);
   ClusterList = ClusterList2;
 
-  MRIfree(&HitMap);
+  if (HitMap) MRIfree(&HitMap);
 
   if (Gdiag_no > 0) printf("INFO: Found %d final clusters\n", nclusters);
   *nClusters = nclusters;
@@ -1610,9 +2064,9 @@ CSD *CSDmerge(CSD *csd1, CSD *csd2)
   for (nthrep2 = 0; nthrep2 < csd2->nreps; nthrep2++) {
     csd->nClusters[nthrep] = csd2->nClusters[nthrep2];
     csd->MaxClusterSize[nthrep] = csd2->MaxClusterSize[nthrep2];
-    csd->MaxClusterSizeVtx[nthrep] = csd2->MaxClusterSizeVtx[nthrep1];
-    csd->MaxClusterWeightVtx[nthrep] = csd2->MaxClusterWeightVtx[nthrep1];
-    csd->MaxClusterWeightArea[nthrep] = csd2->MaxClusterWeightArea[nthrep1];
+    csd->MaxClusterSizeVtx[nthrep] = csd2->MaxClusterSizeVtx[nthrep2];
+    csd->MaxClusterWeightVtx[nthrep] = csd2->MaxClusterWeightVtx[nthrep2];
+    csd->MaxClusterWeightArea[nthrep] = csd2->MaxClusterWeightArea[nthrep2];
     csd->MaxSig[nthrep] = csd2->MaxSig[nthrep2];
     csd->MaxStat[nthrep] = csd2->MaxStat[nthrep2];
     nthrep++;
@@ -2039,6 +2493,7 @@ int CSDwrite(char *fname, CSD *csd)
     return (1);
   }
   CSDprint(fp, csd);
+  fclose(fp);
   return (0);
 }
 